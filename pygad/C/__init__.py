@@ -22,6 +22,13 @@ try:
 except:
     cpygad = cdll.LoadLibrary(glob(environment.module_dir + "../cpygad*.so")[0])
 
+# the OpenMP runtime the library is linked against (e.g. for checking that
+# results do not depend on the number of threads)
+cpygad.omp_get_max_threads.restype = c_int
+cpygad.omp_get_max_threads.argtypes = []
+cpygad.omp_set_num_threads.restype = None
+cpygad.omp_set_num_threads.argtypes = [c_int]
+
 cpygad.cubic.restype = c_double
 cpygad.cubic.argtypes = [c_double, c_double]
 cpygad.quartic.restype = c_double
@@ -37,3 +44,15 @@ cpygad.Wendland_C6.argtypes = [c_double, c_double]
 
 cpygad.Voigt.restype = c_double
 cpygad.Voigt.argtypes = [c_double, c_double, c_double]
+cpygad.Voigt_fast.restype = c_double
+cpygad.Voigt_fast.argtypes = [c_double, c_double, c_double]
+cpygad.Faddeeva_w_batch.restype = None
+cpygad.Faddeeva_w_batch.argtypes = [c_size_t, c_void_p, c_void_p]
+cpygad.Faddeeva_w_sweep.restype = None
+cpygad.Faddeeva_w_sweep.argtypes = [c_double, c_double, c_double, c_size_t, c_void_p]
+cpygad.Voigt_sweep.restype = None
+cpygad.Voigt_sweep.argtypes = [c_double, c_double, c_size_t, c_double, c_double,
+                               c_void_p]
+cpygad.line_profile_bins.restype = None
+cpygad.line_profile_bins.argtypes = [c_double, c_double, c_double, c_double,
+                                     c_double, c_void_p, c_size_t, c_void_p]
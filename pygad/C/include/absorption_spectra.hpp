@@ -2,6 +2,9 @@
 #include "general.hpp"
 #include "kernels.hpp"
 #include "looploop.hpp"
+#include "fft.hpp"
+#include "tree.hpp"
+#include "voigt.hpp"
 
 extern "C"
 void absorption_spectrum(bool particles,
@@ -32,3 +35,337 @@ void absorption_spectrum(bool particles,
                          const char *kernel_,
                          double periodic);
 
+// The same as `absorption_spectrum`, but with a generic set of l.o.s. fields:
+// `fields` is a (K x N) array of K quantities per particle / cell (e.g. density,
+// temperature, ion fraction, ...) and `los_fields` is the (K x Nbins) array of
+// their optical depth-weighted averages along the l.o.s.. All are accumulated
+// in a single pass over the particles. The Lorentz wings of the lines are
+// truncated at an optical depth of `wing_tau_tol`, if it is positive (see
+// `add_line_profile`), which the following functions take as well; the former
+// `absorption_spectrum` never truncates them. If `deterministic` is non-zero,
+// the particles are accumulated in a fixed order (over DETERMINISTIC_CHUNKS
+// chunks), such that the spectrum is reproducible bit by bit independent of the
+// number of threads; otherwise each thread bins into a private spectrum and
+// these are summed, which only agrees with the serial result up to rounding.
+extern "C"
+void absorption_spectrum_fields(bool particles,
+                                size_t N,
+                                double *pos,
+                                double *vel,
+                                double *hsml,
+                                double *n,
+                                double *temp,
+                                size_t K,
+                                double *fields,
+                                double *los_pos,
+                                double *vel_extent,
+                                size_t Nbins,
+                                double b_0,
+                                double *v_turb,
+                                double Xsec,
+                                double Gamma,
+                                double wing_tau_tol,
+                                int deterministic,
+                                double *taus,
+                                double *los_dens,
+                                double *los_fields,
+                                double *v_lims,
+                                double *column,
+                                const char *kernel_,
+                                double periodic);
+
+// The same as `absorption_spectrum_fields` with particles, but for `N_los`
+// lines of sight at once. The particles intersecting each l.o.s. are found with
+// a quadtree of the projected positions and the lines of sight are processed in
+// parallel. `taus` and `los_dens` are (N_los x Nbins) arrays, `los_fields` is
+// (N_los x K x Nbins), and `column` holds the column density within `v_lims`
+// for each l.o.s..
+extern "C"
+void absorption_spectra_batch(size_t N,
+                              double *pos,
+                              double *vel,
+                              double *hsml,
+                              double *n,
+                              double *temp,
+                              size_t K,
+                              double *fields,
+                              size_t N_los,
+                              double *los_pos,
+                              double *vel_extent,
+                              size_t Nbins,
+                              double b_0,
+                              double *v_turb,
+                              double Xsec,
+                              double Gamma,
+                              double wing_tau_tol,
+                              double *taus,
+                              double *los_dens,
+                              double *los_fields,
+                              double *v_lims,
+                              double *column,
+                              const char *kernel_,
+                              double periodic);
+
+// The spectrum of `N_lines` transitions along a single l.o.s. at once (particles
+// only). The projected kernel weight of each particle is computed once and all
+// lines are deposited onto a common grid of `Nbins` bins, which for line `k`
+// spans the velocities vel_extents[2*k] to vel_extents[2*k+1] (i.e. the same
+// wavelength range). `b_0`, `Xsec` and `Gamma` are given per line and `n` is
+// the (N_lines x N) array of the number of ions per particle for each line.
+extern "C"
+void absorption_spectrum_multiline(size_t N,
+                                   double *pos,
+                                   double *vel,
+                                   double *hsml,
+                                   double *temp,
+                                   double *los_pos,
+                                   size_t N_lines,
+                                   double *n,
+                                   double *vel_extents,
+                                   double *b_0,
+                                   double *Xsec,
+                                   double *Gamma,
+                                   double wing_tau_tol,
+                                   int deterministic,
+                                   double *v_turb,
+                                   size_t Nbins,
+                                   double *taus,
+                                   const char *kernel_,
+                                   double periodic);
+
+// Optical depths for a regular grid of (Npx[0] x Npx[1]) lines of sight along
+// the third axis ("forest" mode); `pos` are the projected particle positions
+// and the l.o.s. are located at the pixel centres of `extent`. With
+// `periodic_v` the spectra wrap around at the edges of `vel_extent`.
+// The particles are deposited in one sweep (per block of `block_rows` rows of
+// l.o.s.; all at once, if zero) and the spectra of each block are reduced to
+// the flux statistics on the fly:
+//   `mean_flux`: the mean transmitted flux <F>,
+//   `flux_pk`:   the 1D power spectrum of dF = F/<F>-1 (Nbins/2+1 values in
+//                units of velocity, averaged over all l.o.s.),
+//   `flux_pdf`:  the PDF of F in `Npdf` equal bins in [0,1].
+// Each of them (as well as the full optical depth cube `taus` of shape
+// (Npx[0] x Npx[1] x Nbins)) may be NULL, if not needed.
+extern "C"
+void absorption_forest(size_t N,
+                       double *pos,
+                       double *vel,
+                       double *hsml,
+                       double *n,
+                       double *temp,
+                       double *extent,
+                       size_t Npx[2],
+                       double *vel_extent,
+                       size_t Nbins,
+                       int periodic_v,
+                       double b_0,
+                       double *v_turb,
+                       double Xsec,
+                       double Gamma,
+                       double wing_tau_tol,
+                       double *taus,
+                       double *mean_flux,
+                       double *flux_pk,
+                       size_t Npdf,
+                       double *flux_pdf,
+                       size_t block_rows,
+                       const char *kernel_,
+                       double periodic);
+
+/*
+ * Optical depths along a long skewer, crossing many periodic replicas of the
+ * boxes of a stack of snapshots (e.g. for light-cone spectra of quasars).
+ *
+ * The ray starts at `origin` (comoving, within the box) and goes into direction
+ * `dir` for a comoving length of `length`; all lengths (positions, smoothing
+ * lengths, box sizes) are comoving and in the same units. Snapshot `s` (with
+ * `N[s]` gas particles and their positions `pos[s]`, peculiar velocities
+ * `vel[s]`, smoothing lengths `hsml[s]`, number of ions `n[s]`, temperatures
+ * `temp[s]`, and turbulent velocities `v_turb[s]`, which may be NULL) is used
+ * for the distances [d_lims[s],d_lims[s+1]) along the ray.
+ * `col_fac[s]` converts the number of ions per comoving area into physical
+ * column densities.
+ * The ray is split into segments of at most a quarter of the box size, for
+ * which the intersecting particles are found with an octree (in parallel).
+ * Each particle contributes at its point of closest approach with the
+ * cosmological redshift given by the table ln(1+z) = `lnz1_tab` at the
+ * distances `d_tab` and its peculiar velocity along the ray.
+ * The optical depths are binned on a grid of `Nbins` bins equidistant in
+ * ln(lambda/lambda_0), starting at `ln_l_min` with a width of `dlnl` (i.e. in
+ * velocity bins of c*dlnl); `c_light` and the velocities are in the same units.
+ */
+extern "C"
+void absorption_skewer(size_t N_snaps,
+                       const size_t *N,
+                       double *const *pos,
+                       double *const *vel,
+                       double *const *hsml,
+                       double *const *n,
+                       double *const *temp,
+                       double *const *v_turb,
+                       const double *boxsize,
+                       const double *col_fac,
+                       const double *d_lims,
+                       const double *origin,
+                       const double *dir,
+                       double length,
+                       size_t N_tab,
+                       const double *d_tab,
+                       const double *lnz1_tab,
+                       double ln_l_min,
+                       double dlnl,
+                       size_t Nbins,
+                       double b_0,
+                       double Xsec,
+                       double Gamma,
+                       double wing_tau_tol,
+                       double c_light,
+                       double *taus,
+                       const char *kernel_);
+
+// The line of a single particle / cell binned as in the spectra above (see
+// `add_line_profile`): `Dtb[i]` is the fraction of the line within velocity bin
+// `i` of the `Nbins` bins spanning `vel_extent` (zero, if not touched).
+extern "C"
+void line_profile_bins(double vj,
+                       double b,
+                       double Gamma,
+                       double tau_0,
+                       double wing_tau_tol,
+                       const double *vel_extent,
+                       size_t Nbins,
+                       double *Dtb);
+
+// the number of chunks of particles for the deterministic single l.o.s. spectra
+#define DETERMINISTIC_CHUNKS 64
+
+// the Doppler parameter of a particle
+inline double line_b_param(double T, double b_0, const double *v_turb, size_t j) {
+    if (v_turb==nullptr) {
+        return std::sqrt(T) * b_0;
+    } else {
+        double b_turb = v_turb[j];
+        return std::sqrt(b_0*b_0*T + b_turb*b_turb);
+    }
+}
+
+/*
+ * Distribute the line of a single particle / cell, centred at velocity `vj` and
+ * with Doppler parameter `b` and natural line width `Gamma`, over the velocity
+ * bins of a spectrum (starting at `vel_extent[0]` and with a bin width of `dv`).
+ * `tau_0` is the velocity integrated optical depth of the line (i.e. the column
+ * density times the cross section). If `wing_tau_tol` is positive, it is used
+ * to truncate the Lorentz wings, where they fall below an optical depth of
+ * `wing_tau_tol`, and the Voigt profile is evaluated by Humlicek's
+ * approximation; otherwise the lines span the entire spectrum and the profile
+ * is exact (by Weideman's expansion, to ~1e-10).
+ * For each bin `i` touched `add(i, Dtb, v)` is called, where `Dtb` is the
+ * fraction of the line within that bin and `v` the velocity it is attributed to
+ * (the latter for restricting column densities to a velocity window).
+ * Returns false, if the line is completely outside of the spectrum.
+ */
+template <typename F>
+bool add_line_profile(double vj, double b, double Gamma, double tau_0,
+                      double wing_tau_tol, const double *vel_extent,
+                      size_t Nbins, double dv, F add) {
+    // get the (middle) velocity bin index
+    double vi = (vj - vel_extent[0]) / dv;
+
+    // thermal broadening tb_b(v) = 1/(b*sqrt(pi)) * exp( -(v/b)^2 )
+    // natural line width L(v) = 1/pi * (Gamma / (v**2 + Gamma**2))
+    // convolution: the Voigt function
+    const double FWHM_L = 2 * Gamma;
+    double sigma = b / std::sqrt(2);
+    // FWHM are (FWHM for Voigt is approx., but with accuracy of ~0.02%):
+    double FWHM_b = 2 * std::sqrt(2 * std::log(2)) * sigma;
+    double FWHM_V = 0.5346*FWHM_L + std::sqrt(0.5346*FWHM_L*FWHM_L
+                            + FWHM_b*FWHM_b);
+
+    // how far to go away from the line centre
+    double v_width = 5.0 * b;
+    if ( Gamma > 0.0 ) {
+        // the Lorentz wings tau_0 * Gamma / (pi v^2) fall below the tolerance
+        // at |v| = sqrt(tau_0 * Gamma / (pi * tol))
+        if ( wing_tau_tol > 0.0 ) {
+            v_width = std::max(v_width,
+                    std::sqrt(tau_0 * Gamma / (M_PI * wing_tau_tol)));
+        } else {
+            v_width = INFINITY;
+        }
+    }
+    if ( vj+v_width < vel_extent[0] or vj-v_width > vel_extent[1] )
+        return false;   // out of bounds -- don't bin into bin #0 or #Nbins-1
+    size_t vi_min = std::max<double>(0.0,     std::floor((vj-v_width - vel_extent[0]) / dv));
+    size_t vi_max = std::min<double>(Nbins-1, std::ceil( (vj+v_width - vel_extent[0]) / dv));
+
+    if ( vi_min == vi_max ) {
+        assert( Gamma > 0.0 or std::abs(vi_min - vi) < 0.501 );
+        add(vi_min, 1.0, vj);
+        return true;
+    }
+
+    if ( Gamma > 0.0 ) {
+        // the Voigt profile evaluated in sweeps over equidistant points (by
+        // Humlicek's approximation, if the wings are truncated)
+        const bool fast = wing_tau_tol > 0.0;
+        auto Voigt_sweep_ = fast ? Voigt_fast_sweep : Voigt_sweep;
+        static thread_local std::vector<double> prof;
+        if ( FWHM_V < 10.*dv ) {
+            // FWHM gets comparable with the bin size, do proper integrals of
+            // the line-profile over the bins
+            // Antiderivative of the Voigt function requires the generalized
+            // hypergeometric function 2F2, which I do not have. Hence, the
+            // numeric integration by Simpson's method -- with less sampling
+            // points in the smooth wings for the fast profiles:
+            int K_core = std::min<int>( 10*dv/FWHM_V, 1000 );
+            K_core = std::max( 2*(K_core/2), 10 );
+            for ( size_t i=vi_min; i<=vi_max; i++ ) {
+                double v0 = (i-vi-0.5) * dv;
+                bool wing = std::abs((i-vi)*dv) > 0.5*dv + 5.0*FWHM_V;
+                int K = (fast and wing) ? 10 : K_core;
+                double h = dv/K;
+                prof.resize(K+1);
+                Voigt_sweep_(v0, h, K+1, sigma, Gamma, prof.data());
+                double Dtb = prof[0] + prof[K];
+                for ( int k=1; k<K; k+=2 )
+                    Dtb += 4. * prof[k] + 2. * prof[k+1];
+                Dtb -= 2. * prof[K];
+                Dtb *= h/3.;
+                add(i, Dtb, vj+(i-vi)*dv);
+            }
+        } else {
+            // approximate the line as constant over the bin
+            size_t n = vi_max - vi_min + 1;
+            prof.resize(n);
+            Voigt_sweep_((vi_min-vi)*dv, dv, n, sigma, Gamma, prof.data());
+            for ( size_t i=vi_min; i<=vi_max; i++ )
+                add(i, prof[i-vi_min] * dv, vj+(i-vi)*dv);
+        }
+        return true;
+    }
+
+    // the thermal broadening only (a Gaussian), evaluated in sweeps as well
+    static thread_local std::vector<double> prof;
+    size_t n = vi_max - vi_min + 1;
+    const double b_inv = 1.0 / b;
+    if ( FWHM_V < 10.*dv ) {
+        // FWHM gets comparable with the bin size, do proper integrals of the
+        // line-profile over the bins with the antiderivative of tb_b:
+        // int_0_v dv' tb_b(v') = 1/2 * erf(v/b)
+        // (where each bin edge is shared by two bins)
+        prof.resize(n+1);
+        erf_fast_sweep((vi_min-vi-0.5)*dv*b_inv, dv*b_inv, n+1, prof.data());
+        for ( size_t i=vi_min; i<=vi_max; i++ ) {
+            double Dtb = 0.5 * (prof[i-vi_min+1] - prof[i-vi_min]);
+            add(i, Dtb, vj+(i-vi)*dv);
+        }
+    } else {
+        // approximate the line as constant over the bin
+        prof.resize(n);
+        Gaussian_sweep((vi_min-vi)*dv*b_inv, dv*b_inv, n, prof.data());
+        const double norm = dv * b_inv / std::sqrt(M_PI);
+        for ( size_t i=vi_min; i<=vi_max; i++ )
+            add(i, prof[i-vi_min] * norm, vj+(i-vi)*dv);
+    }
+    return true;
+}
@@ -2,6 +2,7 @@
 #include "general.hpp"
 #include "kernels.hpp"
 #include "looploop.hpp"
+#include "tree.hpp"
 
 extern double H_lim_out_of_grid;
 
@@ -66,6 +67,22 @@ void bin_sph_along_line(size_t N,
                         const char *kernel_,
                         double periodic);
 
+// bin a SPH qty onto `N_los` lines along the z-axis at once, the particles
+// intersecting each line are found with a 2D tree of the projected positions
+extern "C"
+void bin_sph_along_lines(size_t N,
+                         double *pos,
+                         double *hsml,
+                         double *dV,
+                         double *qty,
+                         size_t N_los,
+                         double *los,
+                         double *extent,
+                         size_t Npx,
+                         double *lines,
+                         const char *kernel_,
+                         double periodic);
+
 
 // Mind the reversed indexing of i_min, i_max, and i due to performace at accessing
 // array elements in reversed loop order in nested_loops<2>::do_loops(...)!
@@ -291,3 +308,73 @@ void bin_sph_line(size_t N,
     */
 }
 
+// bin a SPH qty onto many lines along the z-axis at the (projected) positions
+// `los` (a (N_los x 2) array), each line filled by a single thread
+template <int d>
+void bin_sph_lines(size_t N,
+                   double *pos,
+                   double *hsml,
+                   double *dV,
+                   double *qty,
+                   size_t N_los,
+                   double *los,
+                   double *extent,
+                   size_t Npx,
+                   double *lines,
+                   const char *kernel_,
+                   double periodic) {
+    static_assert(d==3, "might work for d==2, too, with slight modifications");
+    Kernel<d> &kernel = kernels.at(kernel_);
+    kernel.require_table_size(0,1024);
+
+    //printf("build 2D tree of the projected positions...\n");
+    std::vector<double> pos_2D(2*N);
+    for (size_t j=0; j<N; j++) {
+        pos_2D[2*j]   = pos[d*j];
+        pos_2D[2*j+1] = pos[d*j+1];
+    }
+    Tree<2> *tree = new_tree_from_pos<2>(N, pos_2D.data());
+    tree->fill_max_H(hsml);
+
+    assert( extent[1] > extent[0] );
+    double res = (extent[1]-extent[0]) / Npx;
+#pragma omp parallel for default(shared) schedule(dynamic,1)
+    for (size_t l=0; l<N_los; l++) {
+        double *los_l = los+(2*l);
+        double *line = lines+(Npx*l);
+        memset(line, 0, Npx*sizeof(double));
+
+        std::vector<size_t> ngbs = tree->ngbs_SPH(los_l, hsml, pos_2D.data(), periodic, 0.0);
+        for (const size_t j : ngbs) {
+            double *rj = pos+(d*j);
+            double hj = hsml[j];
+
+            // calculate the impact parameter
+            double b = dist_periodic<2>(los_l, rj, periodic);
+            if ( b > hj )
+                continue;
+
+            // minimum and maximum bin along the l.o.s. in z-direction
+            double z = rj[2];
+            double l_max = std::sqrt(hj*hj-b*b);
+            double d_i_min = (z-l_max-extent[0]) / res;
+            double d_i_max = (z+l_max-extent[0]) / res;
+            if ( d_i_max < 0.0 or Npx < d_i_min )
+                continue;   // does not overlap with the extent
+            size_t i_min, i_max;
+            i_min = std::max<double>( d_i_min-0.1, 0.0 );
+            i_max = std::min<double>( d_i_max+1.1, Npx );
+
+            double dVj_Qj = dV[j] * qty[j];
+            for ( size_t i=i_min; i<i_max; i++ ) {
+                double z1 = extent[0] +  i   *res;
+                double z2 = extent[0] + (i+1)*res;
+                double Wj = kernel.los_integ_value(b/hj, (z1-z)/hj, (z2-z)/hj, hj);
+                line[i] += dVj_Qj * Wj;
+            }
+        }
+    }
+
+    delete tree;
+}
+
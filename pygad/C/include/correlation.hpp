@@ -0,0 +1,45 @@
+#pragma once
+#include "general.hpp"
+#include "tree.hpp"
+
+/*
+ * Count the (weighted) pairs of particles in logarithmic bins of their
+ * separation between r_min and r_max by a dual-tree traversal: pairs of nodes
+ * whose separations fall entirely into one bin are counted as a whole by the
+ * sums of their weights.
+ *
+ * If N_pi is not zero, the separations are split into the projected one r_p
+ * in the x-y-plane (binned logarithmically between r_min and r_max) and the
+ * one along the line of sight pi = |dz| (binned linearly in [0,pi_max) into
+ * N_pi bins). The counts are then of shape (N_bins,N_pi), otherwise of length
+ * N_bins.
+ *
+ * If pos2 is NULL, the unordered pairs (i<j) of the first set are counted,
+ * otherwise all pairs between the two sets. The weights (NULL for unit
+ * weights) are filled into the trees (see `Tree<3>::fill_sum_w`); if the trees
+ * are NULL, they are built from the positions.
+ *
+ * If the velocities vel1 (and vel2 for cross-counts) are given, vel_sums
+ * (twice the size of counts) is filled with the weighted sums of the radial
+ * relative velocity u = (v_j-v_i).(r_j-r_i)/|r_j-r_i| of the pairs and, after
+ * those, of u^2. These need every pair in range to be visited.
+ */
+extern "C"
+void pair_counts(size_t N1,
+                 const double *pos1,
+                 const double *w1,
+                 const double *vel1,
+                 void *octree1,
+                 size_t N2,
+                 const double *pos2,
+                 const double *w2,
+                 const double *vel2,
+                 void *octree2,
+                 double r_min,
+                 double r_max,
+                 size_t N_bins,
+                 double pi_max,
+                 size_t N_pi,
+                 double periodic,
+                 double *counts,
+                 double *vel_sums);
@@ -14,3 +14,57 @@ void eval_sph_at(size_t M,
                  const char *kernel_,
                  void *octree=NULL);
 
+
+// Evaluate K quantities at once (with a single tree walk per position): `qty`
+// is a (N x K) array and `vals` a (M x K) array. The positions are wrapped into
+// a periodic box of side length `periodic` (pass INFINITY for no box), such
+// that they may lie outside of the box the particles are in.
+// If not NULL, the number of neighbours and the sum of the kernel weights
+// sum_j dV_j W_j (for a Shepard correction) are stored in `n_ngbs` and `norm`.
+extern "C"
+void eval_sph_at_multi(size_t M,
+                       double *r,
+                       size_t K,
+                       double *vals,
+                       size_t N,
+                       double *pos,
+                       double *hsml,
+                       double *dV,
+                       double *qty,
+                       double periodic,
+                       size_t *n_ngbs,
+                       double *norm,
+                       const char *kernel_,
+                       void *octree=NULL);
+
+
+// the side length (in pixels) of the square tiles of pixels of a plane, which
+// are evaluated together by one thread (neighbouring pixels visit mostly the
+// same nodes and particles, which then are in the cache)
+#define SLICE_TILE 16
+
+// Evaluate K quantities (as with `eval_sph_at_multi`) at the centers of the
+// Npx[0] x Npx[1] pixels of an infinitesimally thin slice: the plane through
+// `origin` spanned by the orthonormal directions e_u and e_v, with the pixels
+// covering [extent[0],extent[1]] x [extent[2],extent[3]] in the coordinates
+// along these directions. The values are stored in `vals` (a
+// (Npx[0] x Npx[1] x K) array) and, if not NULL, the sums of the kernel
+// weights in `norm` (a (Npx[0] x Npx[1]) array). The cost is one tree query
+// per pixel.
+extern "C"
+void eval_sph_on_plane(const double origin[3],
+                       const double e_u[3],
+                       const double e_v[3],
+                       const double extent[4],
+                       const size_t Npx[2],
+                       size_t K,
+                       double *vals,
+                       size_t N,
+                       double *pos,
+                       double *hsml,
+                       double *dV,
+                       double *qty,
+                       double periodic,
+                       double *norm,
+                       const char *kernel_,
+                       void *octree=NULL);
@@ -0,0 +1,47 @@
+#pragma once
+#include "general.hpp"
+
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> cmplx;
+
+// A (mixed-radix) fast Fourier transform of a fixed length. The transform is
+// not normalized, i.e. a forward followed by a backward transform multiplies by
+// the length. Lengths with large prime factors fall back to plain DFTs for
+// those factors.
+class FFT {
+    public:
+        FFT(size_t n, int sign=-1);
+
+        size_t size() const {return _n;}
+        int sign() const {return _sign;}
+
+        // in-place transform of the `n` values data[0], data[stride], ...;
+        // `scratch` needs to hold `n` values
+        void operator()(cmplx *data, cmplx *scratch, size_t stride=1) const;
+        void operator()(cmplx *data, size_t stride=1) const {
+            std::vector<cmplx> scratch(_n);
+            (*this)(data, scratch.data(), stride);
+        }
+
+    private:
+        size_t _n;
+        int _sign;
+        std::vector<size_t> _factors;
+        std::vector<cmplx> _twiddle;
+
+        void _transform(const cmplx *in, size_t stride, cmplx *out,
+                        size_t n, unsigned level) const;
+};
+
+// The in-place forward transform of a real n[0] x n[1] x n[2] grid, whose rows
+// along the last axis are padded to 2*(n[2]/2+1) values (the layout of the
+// in-place transforms of FFTW). Afterwards the rows hold the n[2]/2+1 complex
+// values of the non-negative frequencies along the last axis. n[2] has to be
+// even. If compiled with HAVE_FFTW, FFTW is used.
+void rfft_3D(const size_t n[3], double *data);
+// The inverse of `rfft_3D` (also not normalized, i.e. it multiplies by
+// n[0]*n[1]*n[2]), from the non-negative frequencies along the last axis back
+// to the real, padded grid.
+void irfft_3D(const size_t n[3], double *data);
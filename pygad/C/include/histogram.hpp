@@ -0,0 +1,51 @@
+#pragma once
+#include "general.hpp"
+
+// the maximum number of doubles for the thread-local bins of histogram_dd
+// (i.e. 256 MB)
+#define HISTOGRAM_MAX_LOCAL_BINS (size_t(1) << 25)
+// the number of points whose bins are looked up at once, if the bins are shared
+#define HISTOGRAM_CHUNK (size_t(1) << 16)
+
+/*
+ * Histogram the N points `pnts` (of shape (N,D)) on a regular D-dimensional
+ * grid with Nbins[d] bins along the axis d between extent[2*d] and
+ * extent[2*d+1]. If log_axis[d] is non-zero, the bins along d are equally
+ * spaced in the logarithm (the extent is still given linearly) and points with
+ * non-positive coordinates are dropped. Points outside of the extent (or with
+ * NaN coordinates) are dropped as well; the upper edges are inclusive, as for
+ * numpy's histograms.
+ *
+ * Along with the number of points per bin, which is always written to `count`
+ * (of the shape of the grid, C order), the statistics of the K quantities
+ * `qty` (of shape (N,K); may be NULL for K=0) are accumulated in a single pass
+ * over the points with thread-local bins -- or, if these would take more than
+ * HISTOGRAM_MAX_LOCAL_BINS doubles, in shared bins, where each thread only
+ * accumulates the points of its own block of bins (going through the points
+ * in chunks of HISTOGRAM_CHUNK, whose bins are looked up in parallel). Each of the following
+ * outputs, of shape (bins..., K), is only computed, if it is not NULL:
+ *
+ *   sum    the sums of the quantities
+ *   mean   their means
+ *   var    their (population) variances, accumulated with Welford's update
+ *          and merged among the threads as in Chan et al. (1979)
+ *   min    their minima
+ *   max    their maxima
+ *
+ * The mean, variance, minimum, and maximum of empty bins are NaN.
+ */
+extern "C"
+void histogram_dd(size_t N,
+                  size_t D,
+                  const double *pnts,
+                  const size_t *Nbins,
+                  const double *extent,
+                  const int *log_axis,
+                  size_t K,
+                  const double *qty,
+                  double *count,
+                  double *sum,
+                  double *mean,
+                  double *var,
+                  double *min,
+                  double *max);
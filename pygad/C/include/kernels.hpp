@@ -49,6 +49,19 @@ class Kernel {
         }
         double operator()(double q, double H) const {return value(q,H);}
 
+        // the radial derivative dW/dr of the kernel (in units of 1/H^(d+1)),
+        // interpolated from a table
+        void generate_derivative(int N);
+        int deriv_table_size() const {return _deriv.size();}
+        void require_deriv_table_size(unsigned deriv_tbl_size) {
+            if ( deriv_tbl_size > _deriv.size() )
+                generate_derivative(deriv_tbl_size);
+        }
+        double deriv_value_ql1(double q, double H) const;
+        double deriv_value(double q, double H) const {
+            return q<1.0 ? deriv_value_ql1(q,H) : 0.0;
+        }
+
         // the following function do not make sense for d == 2 and are only tested for
         // d == 3, no higher dimension
 
@@ -66,13 +79,39 @@ class Kernel {
 
         double los_integ_value(double b, double x, double y, double H) const;
 
+        // The fraction of the kernel (of a particle at distance r) within a
+        // sphere of radius R, and the fraction of the projected kernel within a
+        // circle of radius R. The spherical one is analytic in the cumulative
+        // integrals of q^k w(q) (k=1,2,3), which are tabulated and
+        // interpolated by cubic Hermite polynomials; the circular one also
+        // needs a quadrature over the arcs within the circle.
+        void generate_shell_integrals(int N);
+        int shell_table_size() const {return _shell[0].size();}
+        void require_shell_table_size(unsigned shell_tbl_size) {
+            if ( shell_tbl_size > _shell[0].size() )
+                generate_shell_integrals(shell_tbl_size);
+        }
+        double mass_within_sphere(double R, double r, double H) const;
+        double mass_within_circle(double R, double r, double H) const;
+
     private:
         KernelType _type;
         double _norm;
         double (*_w)(double q);
 
         std::vector<double> _proj;
+        std::vector<double> _deriv;
         std::vector<std::vector<double>> _los_integ;
+        // the cumulative integrals int_0^q 4 pi t^k W(t) dt (k=2,1,3) and the
+        // one of the projected kernel, int_0^q 2 pi t W_proj(t) dt, with their
+        // integrands
+        std::vector<double> _shell[4];
+        std::vector<double> _shell_deriv[4];
+        // the projected kernel (in units of the norm) for the shell integrals
+        std::vector<double> _shell_proj;
+
+        double _shell_integ(int k, double q) const;
+        double _shell_proj_value(double q) const;
 
         double _los_integ_loockup(int b1, int b2, double alpha_b,
                                   int x1, int x2, double alpha_x) const;
@@ -256,6 +295,34 @@ void Kernel<d>::generate_projection(int N) {
     gsl_integration_workspace_free(ws);
 }
 
+template<int d>
+void Kernel<d>::generate_derivative(int N) {
+    assert(0<N);
+    //printf("differentiating kernel '%s' - table with %d entries\n", name(), N);
+
+    // central differences of the (smooth) kernel functions, one-sided at the
+    // boundaries of [0,1]
+    _deriv.resize(N+1);
+    const double eps = 1e-6;
+    for (int i=0; i<=N; i++) {
+        double q = double(i) / N;
+        double q1 = std::max(q-eps, 0.0);
+        double q2 = std::min(q+eps, 1.0);
+        _deriv[i] = (_w(q2) - _w(q1)) / (q2 - q1);
+    }
+}
+
+template<int d>
+double Kernel<d>::deriv_value_ql1(double q, double H) const {
+    assert(0.0 <= q and q <= 1.0);
+    assert(_deriv.size() > 1);
+    double qi = q * (_deriv.size()-1);
+    int i1=std::min<int>(int(qi), _deriv.size()-2), i2=i1+1;
+    double alpha = qi-i1;
+    double deriv_w = (1.0-alpha)*_deriv[i1] + alpha*_deriv[i2];
+    return pow(H,-d-1) * _norm * deriv_w;
+}
+
 template<int d>
 void Kernel<d>::generate_los_integrals(int N, int M) {
     assert(0<N);
@@ -366,3 +433,147 @@ double Kernel<d>::los_integ_value(double b, double x, double y, double H) const
     return pow(H,-d+1) * _norm * I;
 }
 
+
+// the number of pieces of the (composite) quadrature over the arcs in
+// `mass_within_circle`
+#define SHELL_ARC_PIECES 4
+// the nodes and weights of the 8-point Gauss-Legendre quadrature on [-1,1]
+extern const double GAUSS_LEGENDRE_8_X[8];
+extern const double GAUSS_LEGENDRE_8_W[8];
+
+template<int d>
+void Kernel<d>::generate_shell_integrals(int N) {
+    assert(d == 3);
+    assert(0<N);
+    //printf("integrating kernel '%s' over shells - table with %d entries\n", name(), N);
+
+    // the projected kernel, integrated along the line of sight in four
+    // pieces by Gauss-Legendre quadratures
+    auto proj = [this](double q) {
+        double l_max = std::sqrt(std::max(1.0 - q*q, 0.0));
+        double I = 0.0;
+        for (int p=0; p<4; p++) {
+            for (int n=0; n<8; n++) {
+                double l = l_max/4.0 * (p + 0.5*(1.0 + GAUSS_LEGENDRE_8_X[n]));
+                I += GAUSS_LEGENDRE_8_W[n] * _w(std::sqrt(q*q + l*l));
+            }
+        }
+        return 2.0 * I * l_max/8.0;
+    };
+    _shell_proj.resize(N+1);
+    for (int i=0; i<=N; i++)
+        _shell_proj[i] = proj(double(i) / N);
+
+    auto integrand = [this,&proj](int k, double q) {
+        switch (k) {
+            case 0: return 4.0*M_PI * q*q * _norm * _w(q);
+            case 1: return 4.0*M_PI * q * _norm * _w(q);
+            case 2: return 4.0*M_PI * q*q*q * _norm * _w(q);
+            default: return 2.0*M_PI * q * _norm * proj(q);
+        }
+    };
+    for (int k=0; k<4; k++) {
+        _shell[k].resize(N+1);
+        _shell_deriv[k].resize(N+1);
+        _shell[k][0] = 0.0;
+        for (int i=0; i<=N; i++) {
+            double q = double(i) / N;
+            _shell_deriv[k][i] = integrand(k, q);
+            if ( i == 0 )
+                continue;
+            // Gauss-Legendre quadrature over [q-1/N, q]
+            double I = 0.0;
+            for (int n=0; n<8; n++) {
+                double t = q - (1.0 - GAUSS_LEGENDRE_8_X[n]) / (2.0*N);
+                I += GAUSS_LEGENDRE_8_W[n] * integrand(k, t);
+            }
+            _shell[k][i] = _shell[k][i-1] + I / (2.0*N);
+        }
+    }
+}
+
+template<int d>
+double Kernel<d>::_shell_integ(int k, double q) const {
+    assert(0.0 <= q and q <= 1.0);
+    const std::vector<double> &G = _shell[k], &g = _shell_deriv[k];
+    assert(G.size() > 1);
+    const int N = G.size() - 1;
+    double qi = q * N;
+    int i = std::min<int>(int(qi), N-1);
+    double t = qi - i, h = 1.0 / N;
+    // cubic Hermite interpolation
+    double t2 = t*t, t3 = t2*t;
+    return (2*t3 - 3*t2 + 1) * G[i] + (t3 - 2*t2 + t) * h * g[i]
+         + (-2*t3 + 3*t2) * G[i+1] + (t3 - t2) * h * g[i+1];
+}
+
+template<int d>
+double Kernel<d>::_shell_proj_value(double q) const {
+    assert(0.0 <= q and q <= 1.0);
+    const int N = _shell_proj.size() - 1;
+    double qi = q * N;
+    int i = std::min<int>(int(qi), N-1);
+    double alpha = qi - i;
+    return _norm * ((1.0-alpha)*_shell_proj[i] + alpha*_shell_proj[i+1]);
+}
+
+template<int d>
+double Kernel<d>::mass_within_sphere(double R, double r, double H) const {
+    R /= H;
+    r /= H;
+    if ( R >= r+1.0 )
+        return 1.0;
+    if ( R <= r-1.0 )
+        return 0.0;
+    if ( r < 1e-6 )   // the error is of order r^2
+        return _shell_integ(0, std::min(R, 1.0));
+
+    // The sphere of radius q around the particle is entirely within the
+    // sphere for q<R-r and partially for |R-r|<q<R+r, where its fraction
+    // within is 1/2 - (r^2-R^2)/(4rq) - q/(4r).
+    double M = R > r ? _shell_integ(0, std::min(R-r, 1.0)) : 0.0;
+    double a = std::min(std::abs(R-r), 1.0), b = std::min(R+r, 1.0);
+    if ( a < b ) {
+        M += 0.5 * (_shell_integ(0,b) - _shell_integ(0,a))
+           - (r*r - R*R) / (4.0*r) * (_shell_integ(1,b) - _shell_integ(1,a))
+           - (_shell_integ(2,b) - _shell_integ(2,a)) / (4.0*r);
+    }
+    return std::min(std::max(M, 0.0), 1.0);
+}
+
+template<int d>
+double Kernel<d>::mass_within_circle(double R, double r, double H) const {
+    R /= H;
+    r /= H;
+    if ( R >= r+1.0 )
+        return 1.0;
+    if ( R <= r-1.0 )
+        return 0.0;
+    if ( r < 1e-6 )
+        return _shell_integ(3, std::min(R, 1.0));
+
+    // The circle of radius q around the particle is entirely within the
+    // circle of radius R for q<R-r and the fraction arccos(c)/pi with
+    // c = (r^2+q^2-R^2)/(2rq) of it for |R-r|<q<R+r. The substitution
+    // q = a + (b-a) sin^2(t) removes the square root singularities at the ends.
+    double M = R > r ? _shell_integ(3, std::min(R-r, 1.0)) : 0.0;
+    double a = std::min(std::abs(R-r), 1.0), b = std::min(R+r, 1.0);
+    if ( a < b ) {
+        double I = 0.0;
+        for (int p=0; p<SHELL_ARC_PIECES; p++) {
+            for (int n=0; n<8; n++) {
+                double t = M_PI/2.0 * (p + 0.5*(1.0 + GAUSS_LEGENDRE_8_X[n]))
+                           / SHELL_ARC_PIECES;
+                double s = std::sin(t), c = std::cos(t);
+                double q = a + (b-a) * s*s;
+                double cos_phi = (r*r + q*q - R*R) / (2.0*r*q);
+                cos_phi = std::min(std::max(cos_phi, -1.0), 1.0);
+                double dq_dt = 2.0 * (b-a) * s*c;
+                I += GAUSS_LEGENDRE_8_W[n] * 2.0*q * _shell_proj_value(q)
+                     * std::acos(cos_phi) * dq_dt;
+            }
+        }
+        M += M_PI/4.0 * I / SHELL_ARC_PIECES;
+    }
+    return std::min(std::max(M, 0.0), 1.0);
+}
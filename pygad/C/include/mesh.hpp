@@ -0,0 +1,43 @@
+#pragma once
+#include "general.hpp"
+#include "fft.hpp"
+
+/*
+ * Particle-mesh functions on periodic grids of Ng^3 cells covering the box
+ * [0,L)^3. The mass assignment schemes are given by their order: 1 (NGP,
+ * nearest grid point), 2 (CIC, cloud in cell), 3 (TSC, triangular shaped
+ * cloud), or 4 (PCS, piecewise cubic spline).
+ */
+
+// Assign the weights w (NULL for unit weights) of the particles onto the grid
+// (in C order), with the positions shifted by `shift` cells along all axes
+// (e.g. 0.5 for interlacing).
+extern "C"
+void mesh_assign(size_t N,
+                 const double *pos,
+                 const double *w,
+                 double L,
+                 size_t Ng,
+                 int order,
+                 double shift,
+                 double *grid);
+
+// The power spectrum P(k) = L^3 <|delta_k|^2> of the density contrast of the
+// (weighted) particles, binned in |k| with the `N_k+1` bin edges k_edges (in
+// units of 1/L), the window of the mass assignment deconvolved. Interlacing
+// (a second grid shifted by half a cell) removes the leading aliasing, but
+// needs twice the memory. Also returns the mean |k| and the number of modes
+// per bin. The shot noise is not subtracted. Ng has to be even.
+extern "C"
+void mesh_power_spectrum(size_t N,
+                         const double *pos,
+                         const double *w,
+                         double L,
+                         size_t Ng,
+                         int order,
+                         int interlace,
+                         size_t N_k,
+                         const double *k_edges,
+                         double *P_k,
+                         double *k_mean,
+                         double *N_modes);
@@ -0,0 +1,56 @@
+#pragma once
+#include "general.hpp"
+#include "kernels.hpp"
+#include "absorption_spectra.hpp"
+
+extern double H_lim_out_of_grid;
+
+// the number of pixel rows of the cube per tile, which are binned by a single
+// thread each
+#define PPV_TILE_ROWS 4
+
+/*
+ * Bin the quantity `qty` of N SPH particles into a position-position-velocity
+ * cube of Npx[0] x Npx[1] pixels within `extent` (x_min, x_max, y_min, y_max)
+ * and N_vel velocity bins of equal width between vel_extent[0] and
+ * vel_extent[1]. The particles are given by their projected positions `pos`
+ * (of shape (N,2)), their line-of-sight velocities `vel`, their smoothing
+ * lengths `hsml`, and their volumes `dV`.
+ *
+ * Spatially a particle is spread with the projected kernel, normalized on the
+ * grid as for sph_3D_bin_2D; along the velocity axis with a Gaussian line of
+ * Doppler parameter b = sqrt(b_0^2 T + v_turb^2) with the temperatures `temp`
+ * and the turbulent velocities `v_turb` (either may be NULL, in which case it
+ * does not contribute; without any broadening a particle falls into a single
+ * velocity bin). Hence, the cube (of shape (Npx[0],Npx[1],N_vel)) holds the
+ * column densities of the quantity per velocity bin.
+ *
+ * If `moments` (of shape (3,Npx[0],Npx[1])) is not NULL, the zeroth moment
+ * (the column density within the velocity range), the first one (the mean
+ * velocity), and the square root of the second central one (the velocity
+ * dispersion) of the cube along the velocity axis are computed in the same
+ * pass -- without needing the cube, which may be NULL. The mean velocity and
+ * the dispersion are NaN for empty pixels.
+ *
+ * The pixel rows are processed in tiles of PPV_TILE_ROWS rows, each binned by
+ * a single thread with all the particles overlapping the tile, such that no
+ * thread-local copies of the (possibly large) cube are needed.
+ */
+extern "C"
+void sph_ppv_cube(size_t N,
+                  const double *pos,
+                  const double *vel,
+                  const double *hsml,
+                  const double *dV,
+                  const double *qty,
+                  const double *temp,
+                  double b_0,
+                  const double *v_turb,
+                  const double *extent,
+                  const size_t *Npx,
+                  const double *vel_extent,
+                  size_t N_vel,
+                  double *cube,
+                  double *moments,
+                  const char *kernel_,
+                  double periodic);
@@ -0,0 +1,27 @@
+#pragma once
+#include "general.hpp"
+#include "kernels.hpp"
+
+// the size of the tables of the shell integrals of the kernels
+#define SHELL_TABLE_SIZE 1024
+
+/*
+ * Bin the `K` quantities qty (of shape (N,K)) of SPH particles radially
+ * around `center` by distributing their kernels over the spherical shells (if
+ * proj<0) or over the cylindrical annuli around the axis `proj` with the
+ * `N_bins+1` edges r_edges. The binned (summed) quantities are written to
+ * `profile` (of shape (N_bins,K)); the parts of the kernels outside of the
+ * edges are lost.
+ */
+extern "C"
+void sph_radial_profile(size_t N,
+                        const double *pos,
+                        const double *hsml,
+                        size_t K,
+                        const double *qty,
+                        const double *center,
+                        int proj,
+                        size_t N_bins,
+                        const double *r_edges,
+                        const char *kernel_,
+                        double *profile);
@@ -0,0 +1,197 @@
+#pragma once
+#include "general.hpp"
+
+/*
+ * Geometric regions for tree queries (see `Tree<d>::visit_region`).
+ *
+ * A region provides
+ *   ref():                 a reference point; in periodic boxes, positions are
+ *                          taken as their image closest to it,
+ *   contains(x, g):        whether x lies within distance g of the region,
+ *   overlaps(c, s_2, g):   false, only if no point of the cube around c with
+ *                          half side length s_2 is within distance g of the
+ *                          region (it is allowed to be conservative).
+ * All regions are convex, such that a cube lies entirely within a region, if
+ * all of its corners do.
+ */
+
+// an axis-aligned box [lo,hi] (the boundaries included); other than for the
+// other regions, the growth by g is along the axes (i.e. in the max-norm)
+struct BoxRegion {
+    double lo[3], hi[3], mid[3];
+
+    BoxRegion(const double lo_[3], const double hi_[3]) {
+        for (int k=0; k<3; k++) {
+            lo[k] = lo_[k];
+            hi[k] = hi_[k];
+            mid[k] = (lo[k] + hi[k]) / 2.0;
+        }
+    }
+
+    const double *ref() const {return mid;}
+    bool contains(const double x[3], double g) const {
+        for (int k=0; k<3; k++) {
+            if (x[k] < lo[k]-g or hi[k]+g < x[k])
+                return false;
+        }
+        return true;
+    }
+    bool overlaps(const double c[3], double side_2, double g) const {
+        for (int k=0; k<3; k++) {
+            if (c[k]+side_2 < lo[k]-g or hi[k]+g < c[k]-side_2)
+                return false;
+        }
+        return true;
+    }
+};
+
+// a ball (excluding its surface)
+struct BallRegion {
+    double center[3], R;
+
+    BallRegion(const double center_[3], double R_) : R(R_) {
+        std::copy(center_, center_+3, center);
+    }
+
+    const double *ref() const {return center;}
+    bool contains(const double x[3], double g) const {
+        return dist2<3>(x, center) < (R+g)*(R+g);
+    }
+    bool overlaps(const double c[3], double side_2, double g) const {
+        double d2 = 0.0;
+        for (int k=0; k<3; k++) {
+            double dk = std::max(std::abs(c[k]-center[k]) - side_2, 0.0);
+            d2 += dk*dk;
+        }
+        return d2 < (R+g)*(R+g);
+    }
+};
+
+// the decomposition of x-origin into the components along and perpendicular
+// to the unit vector `axis`
+inline void _axial_coords(const double x[3], const double origin[3],
+                          const double axis[3], double &z, double &rho) {
+    double dx[3], r2 = 0.0;
+    z = 0.0;
+    for (int k=0; k<3; k++) {
+        dx[k] = x[k] - origin[k];
+        z += dx[k] * axis[k];
+        r2 += dx[k] * dx[k];
+    }
+    rho = std::sqrt(std::max(r2 - z*z, 0.0));
+}
+
+inline void _normalize(const double v[3], double n[3]) {
+    double l = norm<3>(v);
+    for (int k=0; k<3; k++)
+        n[k] = v[k] / l;
+}
+
+// the extent of a cube with half side length `side_2` along the unit vector n
+inline double _projected_side_2(const double n[3], double side_2) {
+    return side_2 * (std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]));
+}
+
+// an oriented cylinder (or disc) of radius R and half height h around its
+// center
+struct CylinderRegion {
+    double center[3], axis[3], R, h;
+
+    CylinderRegion(const double center_[3], const double axis_[3], double R_,
+                   double h_) : R(R_), h(h_) {
+        std::copy(center_, center_+3, center);
+        _normalize(axis_, axis);
+    }
+
+    const double *ref() const {return center;}
+    double dist(const double x[3]) const {
+        double z, rho;
+        _axial_coords(x, center, axis, z, rho);
+        double dz = std::max(std::abs(z)-h, 0.0);
+        double dr = std::max(rho-R, 0.0);
+        return std::sqrt(dz*dz + dr*dr);
+    }
+    bool contains(const double x[3], double g) const {
+        return dist(x) <= g;
+    }
+    bool overlaps(const double c[3], double side_2, double g) const {
+        double z, rho;
+        _axial_coords(c, center, axis, z, rho);
+        if (std::abs(z) > h + _projected_side_2(axis, side_2) + g)
+            return false;
+        return dist(c) <= std::sqrt(3.0)*side_2 + g;
+    }
+};
+
+// the slab of all points within distance h of the plane through `center` with
+// the given normal
+struct SlabRegion {
+    double center[3], normal[3], h;
+
+    SlabRegion(const double center_[3], const double normal_[3], double h_)
+        : h(h_) {
+        std::copy(center_, center_+3, center);
+        _normalize(normal_, normal);
+    }
+
+    const double *ref() const {return center;}
+    double height(const double x[3]) const {
+        double z = 0.0;
+        for (int k=0; k<3; k++)
+            z += (x[k] - center[k]) * normal[k];
+        return std::abs(z);
+    }
+    bool contains(const double x[3], double g) const {
+        return height(x) <= h + g;
+    }
+    bool overlaps(const double c[3], double side_2, double g) const {
+        return height(c) <= h + _projected_side_2(normal, side_2) + g;
+    }
+};
+
+// the distance of the point p to the segment from a to b (all in 2D)
+inline double _dist_segment_2D(const double p[2], const double a[2],
+                               const double b[2]) {
+    double ab[2] = {b[0]-a[0], b[1]-a[1]};
+    double ap[2] = {p[0]-a[0], p[1]-a[1]};
+    double l2 = ab[0]*ab[0] + ab[1]*ab[1];
+    double t = l2>0.0 ? (ap[0]*ab[0] + ap[1]*ab[1]) / l2 : 0.0;
+    t = std::min(std::max(t, 0.0), 1.0);
+    double dx = ap[0] - t*ab[0], dy = ap[1] - t*ab[1];
+    return std::sqrt(dx*dx + dy*dy);
+}
+
+// a cone with the tip at `apex`, opening along `axis` with the half opening
+// angle alpha (0 < alpha < pi/2) and cut perpendicular to the axis at the
+// length L
+struct ConeRegion {
+    double apex[3], axis[3], tan_alpha, L;
+
+    ConeRegion(const double apex_[3], const double axis_[3], double alpha,
+               double L_) : tan_alpha(std::tan(alpha)), L(L_) {
+        std::copy(apex_, apex_+3, apex);
+        _normalize(axis_, axis);
+    }
+
+    const double *ref() const {return apex;}
+    double dist(const double x[3]) const {
+        double z, rho;
+        _axial_coords(x, apex, axis, z, rho);
+        if (0.0 <= z and z <= L and rho <= z*tan_alpha)
+            return 0.0;
+        // outside the cone: the distance in the (z,rho)-plane to the
+        // triangle's mantle or cap
+        double p[2] = {z, rho};
+        double tip[2] = {0.0, 0.0};
+        double edge[2] = {L, L*tan_alpha};
+        double cap[2] = {L, 0.0};
+        return std::min(_dist_segment_2D(p, tip, edge),
+                        _dist_segment_2D(p, cap, edge));
+    }
+    bool contains(const double x[3], double g) const {
+        return dist(x) <= g;
+    }
+    bool overlaps(const double c[3], double side_2, double g) const {
+        return dist(c) <= std::sqrt(3.0)*side_2 + g;
+    }
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include "general.hpp"
+#include "kernels.hpp"
+#include "fft.hpp"
+
+// grids are convolved directly up to this many (non-zero) weights per cell
+// (summed over the axes for the separable Gaussian), beyond by FFTs
+#define SMOOTH_DIRECT_MAX_WEIGHTS 128
+// the Gaussian is truncated at this many standard deviations
+#define SMOOTH_GAUSS_TRUNCATE 4.0
+
+/*
+ * Smooth the D-dimensional (D=2 or 3) grid with Npx[d] cells along the axis d
+ * (in C order) in place by convolving it with a kernel, which is normalized to
+ * one on the discrete grid.
+ *
+ * The kernel is either one of the SPH kernels, given by its name, with a
+ * support of `sml` cells -- the 3D kernel for 3D grids and the projected one
+ * for 2D grids -- or a Gaussian ("gaussian") with a standard deviation of
+ * `sml` cells, which is truncated at SMOOTH_GAUSS_TRUNCATE standard
+ * deviations (rounded to whole cells as by scipy's gaussian_filter). The
+ * Gaussian is separable and convolved axis by axis.
+ *
+ * If `periodic` is non-zero, the grid is periodic, otherwise the values
+ * beyond its boundaries are taken to be `cval`.
+ *
+ * Small kernels are convolved directly (in parallel over rows of the grid),
+ * larger ones by FFTs of the grid (zero-padded, if not periodic). For
+ * periodic grids with an odd number of cells along the last axis, the direct
+ * convolution is always used.
+ */
+extern "C"
+void smooth_grid(size_t D,
+                 const size_t *Npx,
+                 double *grid,
+                 double sml,
+                 const char *kernel_,
+                 int periodic,
+                 double cval);
@@ -0,0 +1,72 @@
+#pragma once
+#include "general.hpp"
+#include "kernels.hpp"
+#include "tree.hpp"
+
+/*
+ * SPH estimators of spatial derivatives (in the scatter approach, i.e. with the
+ * smoothing lengths of the particles as for `eval_sph_at`).
+ *
+ * At the position r_i the gradient of a quantity A is estimated as
+ *
+ *   grad A (r_i) = sum_j dV_j (A_j - A_i) grad_i W(r_i - r_j, h_j)
+ *
+ * or, if `corrected` is non-zero, in its matrix-corrected form, which is exact
+ * for linear fields:
+ *
+ *   grad A (r_i) = C_i^-1 sum_j dV_j (A_j - A_i) grad_i W(r_i - r_j, h_j)
+ *   (C_i)_ab = sum_j dV_j (r_j - r_i)_a (grad_i W(r_i - r_j, h_j))_b
+ *
+ * (falling back to the standard form, if C_i is (nearly) singular).
+ *
+ * If the values A_i are not known (e.g. at arbitrary points), the standard form
+ * uses the Shepard interpolated value, whereas the corrected form solves for
+ * A_i along with the gradient, additionally requiring the interpolation
+ *
+ *   sum_j dV_j W(r_i - r_j, h_j) (A_j - A_i - grad A . (r_j - r_i)) = 0
+ *
+ * to be exact, which again is linearly exact.
+ */
+
+// the size of the table for the kernel derivative
+#define SPH_DERIV_TABLE_SIZE 2048
+
+// The gradients of K quantities `qty` (a (N x K) array) at the M positions
+// `r`, stored in `grads` (a (M x K x 3) array). The values A_i at `r` are given
+// in `qty_at_r` (a (M x K) array) or, if it is NULL, are estimated. The
+// positions are wrapped into a periodic box of side length `periodic` (pass
+// INFINITY for no box).
+extern "C"
+void sph_gradients(size_t M,
+                   double *r,
+                   const double *qty_at_r,
+                   size_t K,
+                   double *grads,
+                   size_t N,
+                   double *pos,
+                   double *hsml,
+                   double *dV,
+                   double *qty,
+                   double periodic,
+                   int corrected,
+                   const char *kernel_,
+                   void *octree=NULL);
+
+// The divergence `div` (M values) and, if not NULL, the curl `curl` (a (M x 3)
+// array) of the vector field `vec` (a (N x 3) array), computed from the
+// gradients as above.
+extern "C"
+void sph_div_curl(size_t M,
+                  double *r,
+                  const double *vec_at_r,
+                  double *div,
+                  double *curl,
+                  size_t N,
+                  double *pos,
+                  double *hsml,
+                  double *dV,
+                  double *vec,
+                  double periodic,
+                  int corrected,
+                  const char *kernel_,
+                  void *octree=NULL);
@@ -5,6 +5,7 @@
 
 extern const int MAX_TREE_LEVEL;
 extern const double TREE_NODE_OPEN_TOL;
+const uint32_t ALL_CATEGORIES = ~uint32_t(0);
 
 template<int d>
 class Tree {
@@ -33,7 +34,19 @@ class Tree {
             // avoid code dublication and call const-version of this
             return const_cast<Tree<d> *>(const_cast<const Tree<d> *>(this)->child(i));
         }
+        // the child in the given octant (NULL, if empty) of a non-leaf node
+        const Tree<d> *octant_child(unsigned oct) const {
+            assert(not _leaf and oct<(unsigned)NC);
+            return _child.node[oct];
+        }
+        // the indices of the `num_children()` particles of a leaf
+        const size_t *leaf_parts() const {
+            assert(_leaf);
+            return _leaf_idx();
+        }
         double max_H() const {return _max_H;}
+        double sum_w() const {return _sum_w;}
+        uint32_t categories() const {return _cats;}
 
         bool is_in_region(const double pos[d]) const;
         unsigned get_oct(const double pos[d]) const;
@@ -42,44 +55,110 @@ class Tree {
         void add_point(const double *pos, size_t idx, int depth=0);
         void fill_max_H(const double *H);
         void fill_max_H(double H);
+        // fill the sums of the particle weights (e.g. masses) of the nodes
+        void fill_sum_w(const double *w);
+        // fill the bitmasks of the categories (e.g. 1<<type) of the particles in
+        // the nodes; until then all nodes have all categories
+        void fill_categories(const uint32_t *cat);
 
         size_t count_nodes(bool count_non_leaves=true) const;
         size_t count_particles() const;
         int get_max_depth() const;
 
+        // The conditional queries can additionally be restricted to particles
+        // of the categories in the bitmask `cats` (see `fill_categories`), which
+        // skips all nodes without any such particles. The condition still has
+        // to test the categories of the particles themselves.
         template<typename F>
         std::vector<size_t> ngbs_within_if(const double r[d], double H,
                                            const double *pos,
                                            const double periodic,
-                                           F cond) const;
+                                           F cond,
+                                           uint32_t cats=ALL_CATEGORIES) const;
         std::vector<size_t> ngbs_within(const double r[d], double H,
                                         const double *pos,
-                                        const double periodic) const {
-            return ngbs_within_if(r, H, pos, periodic, [](size_t i){return true;});
-        }
+                                        const double periodic) const;
         std::vector<size_t> ngbs_SPH(const double r[d], const double *H,
                                      const double *pos,
                                      const double periodic,
                                      const double tol) const;
+        // the number of particles and the sum of their weights (needs
+        // `fill_sum_w`) within distance H from r, taking the totals of the
+        // nodes that lie entirely within the sphere without descending
+        size_t count_within(const double r[d], double H,
+                            const double *pos,
+                            const double periodic) const;
+        double sum_within(const double r[d], double H,
+                          const double *pos,
+                          const double *w,
+                          const double periodic) const;
+        // all the particles of this node (and its children)
+        void collect(std::vector<size_t> &idx) const;
+        template<typename F>
+        void for_each_part(F f) const;
+        // Call `on_node` for all nodes entirely within the region `reg` (see
+        // regions.hpp) and `on_part` for all other particles within it. If `H`
+        // is not NULL, also particles within their H of the region are taken
+        // (and the max_H of the tree have to be filled with these H).
+        template<typename R, typename N, typename P>
+        void visit_region(const R &reg, const double *pos, const double *H,
+                          const double periodic, N on_node, P on_part) const;
         template<typename F>
         std::pair<size_t,double> next_ngb_with(const double r[d],
                                                const double *pos,
                                                const double periodic,
-                                               F cond) const;
+                                               F cond,
+                                               uint32_t cats=ALL_CATEGORIES) const;
 
     private:
         double _center[d];
         double _side_2;
         bool _leaf;
+        // whether the particles of this leaf are stored in the bucket
+        bool _overflow;
         size_t _tot_part;
         unsigned _num_child;
         double _max_H;
+        double _sum_w;
+        uint32_t _cats;
         union {
             size_t idx[NC];
             Tree<d> *node[NC];
+            // the particles of leaves at MAX_TREE_LEVEL, which cannot be split
+            // any further, if there are more than NC of them
+            std::vector<size_t> *bucket;
         } _child;
+
+        const size_t *_leaf_idx() const {
+            return _overflow ? _child.bucket->data() : _child.idx;
+        }
+        Tree<d> *_get_child(unsigned oct);
+        void _split(const double *pos);
+
+        // an entry of the stack of the iterative traversals: a node to visit and
+        // whether it is to be taken as a whole
+        struct _StackEntry {
+            const Tree<d> *node;
+            bool whole;
+        };
+        // The stack is one per thread, such that its memory gets reused by all
+        // the queries. Nested traversals (e.g. from within callbacks) simply
+        // stack on top.
+        static std::vector<_StackEntry> &_stack();
+
+        bool _entirely_within(const double r[d], double H, const double periodic) const;
+        template<typename N, typename P>
+        void _visit_within(const double r[d], double H,
+                           const double *pos,
+                           const double periodic,
+                           N on_node, P on_part) const;
+        template<typename R>
+        bool _region_contains(const R &reg, const double c[d]) const;
 };
 
+template<int d>
+Tree<d> *new_tree_from_pos(size_t N, const double *const pos);
+
 extern "C" void *new_octree_uninitialized();
 extern "C" void *new_octree(const double center_[3], double side_2_);
 extern "C" void *new_octree_from_pos(size_t N, const double *const pos);
@@ -116,17 +195,235 @@ extern "C" size_t get_octree_next_ngb(void *const octree,
                                       const double periodic,
                                       const int32_t *cond);
 
+// the same for 2D trees (quadtrees), e.g. for queries in projection
+extern "C" void *new_quadtree_from_pos(size_t N, const double *const pos);
+extern "C" void free_quadtree(void *const quadtree);
+extern "C" void update_quadtree_max_H(void *const quadtree, const double *const H);
+extern "C" void update_quadtree_const_max_H(void *const quadtree, double H);
+extern "C" void get_quadtree_center(const void *const quadtree, double center[2]);
+extern "C" double get_quadtree_side_2(const void *const quadtree);
+extern "C" int get_quadtree_is_leaf(const void *const quadtree);
+extern "C" unsigned get_quadtree_num_children(const void *const quadtree);
+extern "C" size_t get_quadtree_tot_part(const void *const quadtree);
+extern "C" double get_quadtree_max_H(const void *const quadtree);
+extern "C" size_t get_quadtree_max_depth(const void *const quadtree);
+extern "C" size_t get_quadtree_node_count(const void *const quadtree, int count_non_leaves);
+extern "C" int get_quadtree_in_region(const void *const quadtree, const double r[2]);
+extern "C" void *get_quadtree_child(void *const quadtree, int i);
+extern "C" unsigned get_quadtree_quadrant(void *const quadtree, const double r[2]);
+extern "C" void get_quadtree_ngbs_within(void *const quadtree,
+                                         const double r[2], double H,
+                                         size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
+                                         const double *const pos,
+                                         const double periodic,
+                                         const int32_t *cond);
+extern "C" void get_quadtree_ngbs_SPH(void *const quadtree,
+                                      const double r[2], const double *const H,
+                                      size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
+                                      const double *const pos,
+                                      const double periodic,
+                                      const double tol);
+extern "C" size_t get_quadtree_next_ngb(void *const quadtree,
+                                        const double r[2],
+                                        const double *const pos,
+                                        const double periodic,
+                                        const int32_t *cond);
+
+// Batched queries at the M positions `r` (in parallel): the neighbours of query
+// i are stored in ngbs[offsets[i]:offsets[i+1]] (offsets has M+1 entries). Only
+// if the total number of neighbours (which is returned) does not exceed
+// `max_tot`, the neighbours are stored at all.
+// For `get_*_ngbs_within_batch`, `H` holds one radius per query.
+extern "C" size_t get_octree_ngbs_within_batch(void *const octree,
+                                               size_t M, const double *r,
+                                               const double *H,
+                                               size_t max_tot, size_t *ngbs,
+                                               size_t *offsets,
+                                               const double *const pos,
+                                               const double periodic);
+extern "C" size_t get_octree_ngbs_SPH_batch(void *const octree,
+                                            size_t M, const double *r,
+                                            const double *const H,
+                                            size_t max_tot, size_t *ngbs,
+                                            size_t *offsets,
+                                            const double *const pos,
+                                            const double periodic,
+                                            const double tol);
+extern "C" void get_octree_next_ngb_batch(void *const octree,
+                                          size_t M, const double *r,
+                                          size_t *ngbs,
+                                          const double *const pos,
+                                          const double periodic);
+extern "C" size_t get_quadtree_ngbs_within_batch(void *const quadtree,
+                                                 size_t M, const double *r,
+                                                 const double *H,
+                                                 size_t max_tot, size_t *ngbs,
+                                                 size_t *offsets,
+                                                 const double *const pos,
+                                                 const double periodic);
+extern "C" size_t get_quadtree_ngbs_SPH_batch(void *const quadtree,
+                                              size_t M, const double *r,
+                                              const double *const H,
+                                              size_t max_tot, size_t *ngbs,
+                                              size_t *offsets,
+                                              const double *const pos,
+                                              const double periodic,
+                                              const double tol);
+extern "C" void get_quadtree_next_ngb_batch(void *const quadtree,
+                                            size_t M, const double *r,
+                                            size_t *ngbs,
+                                            const double *const pos,
+                                            const double periodic);
+
+// Count the particles and sum their weights within the distances `H` (one per
+// query) from the M positions `r` (in parallel). The weights have to be filled
+// into the tree by `update_*_sum_w` before summing them.
+extern "C" void update_octree_sum_w(void *const octree, const double *const w);
+extern "C" void get_octree_count_within_batch(void *const octree,
+                                              size_t M, const double *r,
+                                              const double *H,
+                                              size_t *counts,
+                                              const double *const pos,
+                                              const double periodic);
+extern "C" void get_octree_sum_within_batch(void *const octree,
+                                            size_t M, const double *r,
+                                            const double *H,
+                                            double *sums,
+                                            const double *const pos,
+                                            const double *const w,
+                                            const double periodic);
+extern "C" void update_quadtree_sum_w(void *const quadtree, const double *const w);
+extern "C" void get_quadtree_count_within_batch(void *const quadtree,
+                                                size_t M, const double *r,
+                                                const double *H,
+                                                size_t *counts,
+                                                const double *const pos,
+                                                const double periodic);
+extern "C" void get_quadtree_sum_within_batch(void *const quadtree,
+                                              size_t M, const double *r,
+                                              const double *H,
+                                              double *sums,
+                                              const double *const pos,
+                                              const double *const w,
+                                              const double periodic);
+
+// Queries restricted to the particles with categories (e.g. 1<<type) `cat` that
+// share a bit with `cats`. The categories have to be filled into the tree by
+// `update_*_categories` first, such that nodes without any such particles are
+// skipped. `cond` may be NULL as for the unrestricted queries.
+extern "C" void update_octree_categories(void *const octree, const uint32_t *const cat);
+extern "C" void get_octree_ngbs_within_in_categories(void *const octree,
+                                                     const double r[3], double H,
+                                                     size_t max_ngbs, size_t *ngbs,
+                                                     size_t *N_ngbs,
+                                                     const double *const pos,
+                                                     const double periodic,
+                                                     uint32_t cats,
+                                                     const uint32_t *const cat,
+                                                     const int32_t *cond);
+extern "C" size_t get_octree_next_ngb_in_categories(void *const octree,
+                                                    const double r[3],
+                                                    const double *const pos,
+                                                    const double periodic,
+                                                    uint32_t cats,
+                                                    const uint32_t *const cat,
+                                                    const int32_t *cond);
+extern "C" void get_octree_next_ngb_in_categories_batch(void *const octree,
+                                                        size_t M, const double *r,
+                                                        size_t *ngbs,
+                                                        const double *const pos,
+                                                        const double periodic,
+                                                        uint32_t cats,
+                                                        const uint32_t *const cat);
+extern "C" void update_quadtree_categories(void *const quadtree, const uint32_t *const cat);
+extern "C" void get_quadtree_ngbs_within_in_categories(void *const quadtree,
+                                                       const double r[2], double H,
+                                                       size_t max_ngbs, size_t *ngbs,
+                                                       size_t *N_ngbs,
+                                                       const double *const pos,
+                                                       const double periodic,
+                                                       uint32_t cats,
+                                                       const uint32_t *const cat,
+                                                       const int32_t *cond);
+extern "C" size_t get_quadtree_next_ngb_in_categories(void *const quadtree,
+                                                      const double r[2],
+                                                      const double *const pos,
+                                                      const double periodic,
+                                                      uint32_t cats,
+                                                      const uint32_t *const cat,
+                                                      const int32_t *cond);
+extern "C" void get_quadtree_next_ngb_in_categories_batch(void *const quadtree,
+                                                          size_t M, const double *r,
+                                                          size_t *ngbs,
+                                                          const double *const pos,
+                                                          const double periodic,
+                                                          uint32_t cats,
+                                                          const uint32_t *const cat);
+
+// The particles of the octree within a region (the boundaries are included
+// except for the ball): if `H` is not NULL, also those within their H of the
+// region are taken (needs the max_H of the tree filled with H). The number of
+// these particles is returned; if `ngbs` is not NULL, the indices of the first
+// up to `max_ngbs` of them are stored there and if `mask` is not NULL, the
+// entries of these particles in it (one per particle, e.g. a numpy bool array)
+// are set to 1 (the others are left untouched).
+// The regions are an axis-aligned box [lo,hi], a ball, an oriented cylinder or
+// disc (with radius R and half height h), a slab (within h of the plane through
+// `center` with normal `normal`), and a cone (half opening angle alpha in
+// (0,pi/2) and length L along the axis).
+extern "C" size_t get_octree_in_box(void *const octree,
+                                    const double lo[3], const double hi[3],
+                                    const double *const H,
+                                    size_t max_ngbs, size_t *ngbs,
+                                    unsigned char *mask,
+                                    const double *const pos,
+                                    const double periodic);
+extern "C" size_t get_octree_in_ball(void *const octree,
+                                     const double center[3], double R,
+                                     const double *const H,
+                                     size_t max_ngbs, size_t *ngbs,
+                                     unsigned char *mask,
+                                     const double *const pos,
+                                     const double periodic);
+extern "C" size_t get_octree_in_cylinder(void *const octree,
+                                         const double center[3],
+                                         const double axis[3],
+                                         double R, double h,
+                                         const double *const H,
+                                         size_t max_ngbs, size_t *ngbs,
+                                         unsigned char *mask,
+                                         const double *const pos,
+                                         const double periodic);
+extern "C" size_t get_octree_in_slab(void *const octree,
+                                     const double center[3],
+                                     const double normal[3], double h,
+                                     const double *const H,
+                                     size_t max_ngbs, size_t *ngbs,
+                                     unsigned char *mask,
+                                     const double *const pos,
+                                     const double periodic);
+extern "C" size_t get_octree_in_cone(void *const octree,
+                                     const double apex[3],
+                                     const double axis[3],
+                                     double alpha, double L,
+                                     const double *const H,
+                                     size_t max_ngbs, size_t *ngbs,
+                                     unsigned char *mask,
+                                     const double *const pos,
+                                     const double periodic);
+
 
 template<int d>
 Tree<d>::Tree()
-    : _center(), _side_2(), _leaf(true), _tot_part(0), _num_child(0), _max_H(), _child()
+    : _center(), _side_2(), _leaf(true), _overflow(false), _tot_part(0),
+      _num_child(0), _max_H(), _sum_w(), _cats(ALL_CATEGORIES), _child()
 {
 }
 
 template<int d>
 Tree<d>::Tree(const double center_[d], double side_2_)
-    : _center(), _side_2(side_2_), _leaf(true), _tot_part(0), _num_child(0),
-      _max_H(), _child()
+    : _center(), _side_2(side_2_), _leaf(true), _overflow(false), _tot_part(0),
+      _num_child(0), _max_H(), _sum_w(), _cats(ALL_CATEGORIES), _child()
 {
     for (int i=0; i<d; i++)
         _center[i] = center_[i];
@@ -137,9 +434,19 @@ Tree<d>::~Tree() {
     if (not _leaf) {
         for (int i=0; i<NC; i++)
             delete _child.node[i];
+    } else if (_overflow) {
+        delete _child.bucket;
     }
 }
 
+template<int d>
+std::vector<typename Tree<d>::_StackEntry> &Tree<d>::_stack() {
+    thread_local std::vector<_StackEntry> stack;
+    if (stack.capacity() == 0)
+        stack.reserve(NC*(MAX_TREE_LEVEL+1) + 1);
+    return stack;
+}
+
 template<int d>
 bool Tree<d>::is_in_region(const double pos[d]) const {
     double max_d = std::abs(pos[0]-_center[0]);
@@ -176,57 +483,67 @@ void Tree<d>::get_oct_center(unsigned oct, double center[d]) const {
 }
 
 template<int d>
-void Tree<d>::add_point(const double *pos, size_t idx, int depth) {
-    if (_leaf) {
-        if (_num_child < NC) {
-            _child.idx[_num_child++] = idx;
-        } else {
-            size_t idcs[NC];
-            std::memcpy(idcs, _child.idx, sizeof(idcs));
-            for (int i=0; i<NC; i++)
-                _child.node[i] = NULL;
-            _num_child = 0;
-            _leaf = false;
-            _tot_part = 0;
-            for (const auto j : idcs) {
-                add_point(pos, j, depth);
-            }
-            add_point(pos, idx, depth);
-            _tot_part--;    // would otherwise be counted twice!
-        }
-    } else {
-        unsigned oct;
-        if (depth < MAX_TREE_LEVEL) {
-            oct = get_oct(&pos[d*idx]);
-        } else {
-            oct = 0;    // in case all the child nodes are still NULL
-            size_t min = -1;
-            for (int i=0; i<NC; i++) {
-                Tree<d> *node = _child.node[i];
-                if (not node) {
-                    min = 0;
-                    oct = i;
-                } else if ((node->_tot_part)<min) {
-                    min = node->_tot_part;
-                    oct = i;
-                }
-            }
-        }
-        Tree<d> *child = _child.node[oct];
+Tree<d> *Tree<d>::_get_child(unsigned oct) {
+    Tree<d> *child = _child.node[oct];
+    if (not child) {
+        double oct_center[d];
+        get_oct_center(oct, oct_center);
+        child = _child.node[oct] = new Tree<d>(oct_center, _side_2/2.0);
         if (not child) {
-            double oct_center[d];
-            get_oct_center(oct, oct_center);
-            child = _child.node[oct] = new Tree<d>(oct_center, _side_2/2.0);
-            if (not child) {
-                fprintf(stderr, "not enough memmory!!!\n");
-                exit(-1);
+            fprintf(stderr, "not enough memmory!!!\n");
+            exit(-1);
+        }
+        _num_child++;
+    }
+    return child;
+}
+
+// turn this full leaf into a node with its particles in the child leaves (where
+// they fit in any case)
+template<int d>
+void Tree<d>::_split(const double *pos) {
+    size_t idcs[NC];
+    std::memcpy(idcs, _child.idx, sizeof(idcs));
+    for (int i=0; i<NC; i++)
+        _child.node[i] = NULL;
+    _num_child = 0;
+    _leaf = false;
+    for (const auto j : idcs) {
+        Tree<d> *child = _get_child(get_oct(&pos[d*j]));
+        child->_child.idx[child->_num_child++] = j;
+        child->_tot_part++;
+    }
+}
+
+template<int d>
+void Tree<d>::add_point(const double *pos, size_t idx, int depth) {
+    Tree<d> *node = this;
+    while (true) {
+        if (node->_leaf) {
+            if (node->_overflow) {
+                node->_child.bucket->push_back(idx);
+                node->_num_child++;
+                break;
+            } else if (node->_num_child < NC) {
+                node->_child.idx[node->_num_child++] = idx;
+                break;
+            } else if (depth >= MAX_TREE_LEVEL) {
+                // e.g. (nearly) duplicate positions
+                std::vector<size_t> *bucket
+                    = new std::vector<size_t>(node->_child.idx, node->_child.idx+NC);
+                bucket->push_back(idx);
+                node->_child.bucket = bucket;
+                node->_overflow = true;
+                node->_num_child++;
+                break;
             }
-            _num_child++;
+            node->_split(pos);
         }
-        child->add_point(pos, idx, depth+1);
+        node->_tot_part++;
+        node = node->_get_child(node->get_oct(&pos[d*idx]));
+        depth++;
     }
-    _tot_part++;
-    return;
+    node->_tot_part++;
 }
 
 template<int d>
@@ -234,7 +551,7 @@ void Tree<d>::fill_max_H(const double *H) {
     _max_H = 0.0;
     if (_leaf) {
         for (unsigned i=0; i<_num_child; i++)
-            _max_H = std::max(_max_H, H[_child.idx[i]]);
+            _max_H = std::max(_max_H, H[_leaf_idx()[i]]);
     } else {
         for (unsigned i=0; i<NC; i++) {
             Tree<d> *node = _child.node[i];
@@ -258,6 +575,40 @@ void Tree<d>::fill_max_H(double H) {
     }
 }
 
+template<int d>
+void Tree<d>::fill_categories(const uint32_t *cat) {
+    _cats = 0;
+    if (_leaf) {
+        for (unsigned i=0; i<_num_child; i++)
+            _cats |= cat[_leaf_idx()[i]];
+    } else {
+        for (unsigned i=0; i<NC; i++) {
+            Tree<d> *node = _child.node[i];
+            if (node) {
+                node->fill_categories(cat);
+                _cats |= node->_cats;
+            }
+        }
+    }
+}
+
+template<int d>
+void Tree<d>::fill_sum_w(const double *w) {
+    _sum_w = 0.0;
+    if (_leaf) {
+        for (unsigned i=0; i<_num_child; i++)
+            _sum_w += w[_leaf_idx()[i]];
+    } else {
+        for (unsigned i=0; i<NC; i++) {
+            Tree<d> *node = _child.node[i];
+            if (node) {
+                node->fill_sum_w(w);
+                _sum_w += node->_sum_w;
+            }
+        }
+    }
+}
+
 template<int d>
 size_t Tree<d>::count_nodes(bool count_non_leaves) const {
     if (_leaf)
@@ -304,51 +655,270 @@ template<typename F>
 std::vector<size_t> Tree<d>::ngbs_within_if(const double r[d], double H,
                                             const double *pos,
                                             const double periodic,
-                                            F cond) const {
+                                            F cond,
+                                            uint32_t cats) const {
     std::vector<size_t> ngb_idx;
-    if (_leaf) {
-        for (unsigned i=0; i<_num_child; i++) {
-            size_t idx = _child.idx[i];
-            if (dist2_periodic<d>(r,&pos[d*idx],periodic) < H*H and cond(idx)) {
-                ngb_idx.push_back(idx);
+    auto &stack = _stack();
+    const size_t base = stack.size();
+    stack.push_back({this, false});
+    while (stack.size() > base) {
+        const Tree<d> *node = stack.back().node;
+        stack.pop_back();
+        if (node->_leaf) {
+            const size_t *leaf_idx = node->_leaf_idx();
+            for (unsigned i=0; i<node->_num_child; i++) {
+                size_t idx = leaf_idx[i];
+                if (dist2_periodic<d>(r,&pos[d*idx],periodic) < H*H and cond(idx)) {
+                    ngb_idx.push_back(idx);
+                }
             }
+            continue;
         }
-    } else {
-        double side_2_H = _side_2/2.0 + H;  // the same for all children
-        for (const auto node : _child.node) {
-            if (node) {
-                double max_d = dist_max_periodic<d>(r, node->_center, periodic);
-                if (TREE_NODE_OPEN_TOL*max_d < side_2_H) { // open node and add neighbors therein
-                    std::vector<size_t> node_ngbs = node->ngbs_within_if(r, H, pos, periodic, cond);
-                    ngb_idx.insert(ngb_idx.end(), node_ngbs.begin(), node_ngbs.end());
+        double side_2_H = node->_side_2/2.0 + H;  // the same for all children
+        // push in reverse order to visit the children in order
+        for (int i=NC-1; i>=0; i--) {
+            const Tree<d> *child = node->_child.node[i];
+            if (child and (child->_cats & cats)) {
+                double max_d = dist_max_periodic<d>(r, child->_center, periodic);
+                if (TREE_NODE_OPEN_TOL*max_d < side_2_H) // open node and add neighbors therein
+                    stack.push_back({child, false});
+            }
+        }
+    }
+    return ngb_idx;
+}
+
+// whether the entire node lies within distance H from r
+template<int d>
+bool Tree<d>::_entirely_within(const double r[d], double H, const double periodic) const {
+    double max_d2 = 0.0;
+    for (int i=0; i<d; i++) {
+        // the largest (periodic) distance of any point in the node along axis i
+        double di = dist_periodic_1D(r[i], _center[i], periodic) + _side_2;
+        di = std::min(di, periodic/2.0);
+        max_d2 += di*di;
+    }
+    return TREE_NODE_OPEN_TOL*TREE_NODE_OPEN_TOL*max_d2 < H*H;
+}
+
+// Call `on_node` for all nodes entirely within the sphere and `on_part` for all
+// particles within the sphere that are not in such nodes.
+template<int d>
+template<typename N, typename P>
+void Tree<d>::_visit_within(const double r[d], double H,
+                            const double *pos,
+                            const double periodic,
+                            N on_node, P on_part) const {
+    auto &stack = _stack();
+    const size_t base = stack.size();
+    stack.push_back({this, false});
+    while (stack.size() > base) {
+        _StackEntry e = stack.back();
+        stack.pop_back();
+        const Tree<d> *node = e.node;
+        if (e.whole) {
+            on_node(node);
+        } else if (node->_leaf) {
+            const size_t *leaf_idx = node->_leaf_idx();
+            for (unsigned i=0; i<node->_num_child; i++) {
+                size_t idx = leaf_idx[i];
+                if (dist2_periodic<d>(r,&pos[d*idx],periodic) < H*H)
+                    on_part(idx);
+            }
+        } else {
+            double side_2_H = node->_side_2/2.0 + H;  // the same for all children
+            for (int i=NC-1; i>=0; i--) {
+                const Tree<d> *child = node->_child.node[i];
+                if (not child)
+                    continue;
+                double max_d = dist_max_periodic<d>(r, child->_center, periodic);
+                if (TREE_NODE_OPEN_TOL*max_d < side_2_H)
+                    stack.push_back({child, child->_entirely_within(r, H, periodic)});
+            }
+        }
+    }
+}
+
+template<int d>
+void Tree<d>::collect(std::vector<size_t> &idx) const {
+    idx.reserve(idx.size() + _tot_part);
+    for_each_part([&idx](size_t i){idx.push_back(i);});
+}
+
+template<int d>
+template<typename F>
+void Tree<d>::for_each_part(F f) const {
+    auto &stack = _stack();
+    const size_t base = stack.size();
+    stack.push_back({this, true});
+    while (stack.size() > base) {
+        const Tree<d> *node = stack.back().node;
+        stack.pop_back();
+        if (node->_leaf) {
+            const size_t *leaf_idx = node->_leaf_idx();
+            for (unsigned i=0; i<node->_num_child; i++)
+                f(leaf_idx[i]);
+            continue;
+        }
+        for (int i=NC-1; i>=0; i--) {
+            if (node->_child.node[i])
+                stack.push_back({node->_child.node[i], true});
+        }
+    }
+}
+
+// whether all corners of the node (centered at c) lie within the region
+template<int d>
+template<typename R>
+bool Tree<d>::_region_contains(const R &reg, const double c[d]) const {
+    double x[d];
+    for (int n=0; n<NC; n++) {
+        for (int k=0; k<d; k++)
+            x[k] = c[k] + (n & (1<<k) ? _side_2 : -_side_2);
+        if (not reg.contains(x, 0.0))
+            return false;
+    }
+    return true;
+}
+
+// In periodic boxes, positions are taken as their images closest to the
+// reference point of the region. Nodes whose images are split by this wrapping
+// are never taken as a whole, and only pruned, if none of their pieces can
+// overlap the region.
+template<int d>
+template<typename R, typename N, typename P>
+void Tree<d>::visit_region(const R &reg, const double *pos, const double *H,
+                           const double periodic, N on_node, P on_part) const {
+    const double *ref = reg.ref();
+    const bool wrap = not std::isinf(periodic);
+    double x[d], shift[d], y[d];
+    auto &stack = _stack();
+    const size_t base = stack.size();
+    stack.push_back({this, false});
+    while (stack.size() > base) {
+        _StackEntry e = stack.back();
+        stack.pop_back();
+        const Tree<d> *node = e.node;
+        if (e.whole) {
+            on_node(node);
+            continue;
+        }
+        if (node->_leaf) {
+            const size_t *leaf_idx = node->_leaf_idx();
+            for (unsigned i=0; i<node->_num_child; i++) {
+                size_t idx = leaf_idx[i];
+                for (int k=0; k<d; k++) {
+                    x[k] = pos[d*idx+k];
+                    if (wrap)
+                        x[k] = ref[k] + std::remainder(x[k]-ref[k], periodic);
+                }
+                if (reg.contains(x, H ? H[idx] : 0.0))
+                    on_part(idx);
+            }
+            continue;
+        }
+        for (int i=NC-1; i>=0; i--) {
+            const Tree<d> *child = node->_child.node[i];
+            if (not child)
+                continue;
+            unsigned split = 0;
+            for (int k=0; k<d; k++) {
+                x[k] = child->_center[k];
+                shift[k] = 0.0;
+                if (wrap) {
+                    x[k] = ref[k] + std::remainder(x[k]-ref[k], periodic);
+                    if (std::abs(x[k]-ref[k]) + child->_side_2 > periodic/2.0) {
+                        // the piece beyond the boundary is wrapped to the other side
+                        shift[k] = x[k] > ref[k] ? -periodic : periodic;
+                        split |= 1<<k;
+                    }
                 }
             }
+            double g = H ? child->_max_H : 0.0;
+            bool overlap = false;
+            for (unsigned n=0; n<NC and not overlap; n++) {
+                if (n & ~split)
+                    continue;
+                for (int k=0; k<d; k++)
+                    y[k] = x[k] + (n & (1<<k) ? shift[k] : 0.0);
+                overlap = reg.overlaps(y, child->_side_2, g);
+            }
+            if (overlap)
+                stack.push_back({child, not split and child->_region_contains(reg, x)});
         }
     }
+}
+
+template<int d>
+std::vector<size_t> Tree<d>::ngbs_within(const double r[d], double H,
+                                         const double *pos,
+                                         const double periodic) const {
+    std::vector<size_t> ngb_idx;
+    if (_entirely_within(r, H, periodic)) {
+        collect(ngb_idx);
+        return ngb_idx;
+    }
+    _visit_within(r, H, pos, periodic,
+                  [&ngb_idx](const Tree<d> *node){node->collect(ngb_idx);},
+                  [&ngb_idx](size_t idx){ngb_idx.push_back(idx);});
     return ngb_idx;
 }
 
+template<int d>
+size_t Tree<d>::count_within(const double r[d], double H,
+                             const double *pos,
+                             const double periodic) const {
+    if (_entirely_within(r, H, periodic))
+        return _tot_part;
+    size_t N = 0;
+    _visit_within(r, H, pos, periodic,
+                  [&N](const Tree<d> *node){N += node->_tot_part;},
+                  [&N](size_t idx){N++;});
+    return N;
+}
+
+template<int d>
+double Tree<d>::sum_within(const double r[d], double H,
+                           const double *pos,
+                           const double *w,
+                           const double periodic) const {
+    if (_entirely_within(r, H, periodic))
+        return _sum_w;
+    double sum = 0.0;
+    _visit_within(r, H, pos, periodic,
+                  [&sum](const Tree<d> *node){sum += node->_sum_w;},
+                  [&sum,w](size_t idx){sum += w[idx];});
+    return sum;
+}
+
 template<int d>
 std::vector<size_t> Tree<d>::ngbs_SPH(const double r[d], const double *H,
                                       const double *pos,
                                       const double periodic,
                                       const double tol) const {
     std::vector<size_t> ngb_idx;
-    if (_leaf) {
-        for (unsigned i=0; i<_num_child; i++) {
-            size_t idx = _child.idx[i];
-            double Hi = H[idx] + tol;
-            if (dist2_periodic<d>(r,&pos[d*idx],periodic) < Hi*Hi)
-                ngb_idx.push_back(idx);
+    auto &stack = _stack();
+    const size_t base = stack.size();
+    stack.push_back({this, false});
+    while (stack.size() > base) {
+        const Tree<d> *node = stack.back().node;
+        stack.pop_back();
+        if (node->_leaf) {
+            const size_t *leaf_idx = node->_leaf_idx();
+            for (unsigned i=0; i<node->_num_child; i++) {
+                size_t idx = leaf_idx[i];
+                double Hi = H[idx] + tol;
+                if (dist2_periodic<d>(r,&pos[d*idx],periodic) < Hi*Hi)
+                    ngb_idx.push_back(idx);
+            }
+            continue;
         }
-    } else {
-        for (const auto node : _child.node) {
-            if (node) {
-                double max_d = dist_max_periodic<d>(r, node->_center, periodic);
-                if (TREE_NODE_OPEN_TOL*max_d < node->_side_2 + node->_max_H + tol) {
-                    std::vector<size_t> node_ngbs = node->ngbs_SPH(r, H, pos, periodic, tol);
-                    ngb_idx.insert(ngb_idx.end(), node_ngbs.begin(), node_ngbs.end());
-                }
+        for (int i=NC-1; i>=0; i--) {
+            const Tree<d> *child = node->_child.node[i];
+            if (child) {
+                double max_d = dist_max_periodic<d>(r, child->_center, periodic);
+                if (TREE_NODE_OPEN_TOL*max_d < child->_side_2 + child->_max_H + tol)
+                    stack.push_back({child, false});
             }
         }
     }
@@ -360,32 +930,81 @@ template<typename F>
 std::pair<size_t,double> Tree<d>::next_ngb_with(const double r[d],
                                                 const double *pos,
                                                 const double periodic,
-                                                F cond) const {
-    std::pair<size_t,double> ngb = {-1, periodic};
-    if (_leaf) {
-        ngb.second = std::pow(ngb.second,2);
-        for (unsigned i=0; i<_num_child; i++) {
-            size_t idx = _child.idx[i];
-            double d2 = dist2_periodic<d>(r,&pos[d*idx],periodic);
-            if (d2 < ngb.second and cond(idx)) {
-                ngb.first = idx;
-                ngb.second = d2;
+                                                F cond,
+                                                uint32_t cats) const {
+    size_t ngb = -1;
+    double ngb_d = periodic, ngb_d2 = periodic*periodic;
+    auto &stack = _stack();
+    const size_t base = stack.size();
+    stack.push_back({this, false});
+    while (stack.size() > base) {
+        const Tree<d> *node = stack.back().node;
+        stack.pop_back();
+        if (node->_leaf) {
+            const size_t *leaf_idx = node->_leaf_idx();
+            for (unsigned i=0; i<node->_num_child; i++) {
+                size_t idx = leaf_idx[i];
+                double d2 = dist2_periodic<d>(r,&pos[d*idx],periodic);
+                if (d2 < ngb_d2 and cond(idx)) {
+                    ngb = idx;
+                    ngb_d2 = d2;
+                    ngb_d = std::sqrt(d2);
+                }
             }
+            continue;
         }
-        ngb.second = std::sqrt(ngb.second);
-    } else {
-        for (const auto node : _child.node) {
-            if (node) {
-                double max_d = dist_max_periodic<d>(r, node->_center, periodic);
-                if (max_d - node->_side_2 < ngb.second) {
-                    std::pair<size_t,double> ngb_oct;
-                    ngb_oct = node->next_ngb_with(r, pos, periodic, cond);
-                    if (ngb_oct.second < ngb.second)
-                        ngb = ngb_oct;
-                }
+        for (int i=NC-1; i>=0; i--) {
+            const Tree<d> *child = node->_child.node[i];
+            if (child and (child->_cats & cats)) {
+                double max_d = dist_max_periodic<d>(r, child->_center, periodic);
+                if (max_d - child->_side_2 < ngb_d)
+                    stack.push_back({child, false});
             }
         }
+        // the neighbour found so far might already be closer than the nodes
+        // pushed earlier
+        while (stack.size() > base) {
+            const Tree<d> *next = stack.back().node;
+            double max_d = dist_max_periodic<d>(r, next->_center, periodic);
+            if (max_d - next->_side_2 < ngb_d)
+                break;
+            stack.pop_back();
+        }
     }
-    return ngb;
+    return {ngb, ngb_d};
 }
 
+
+template<int d>
+Tree<d> *new_tree_from_pos(size_t N, const double *const pos) {
+    // find extent of positions
+    double min[d], max[d];
+    for (int k=0; k<d; k++) {
+        min[k] = N ? pos[k] : 0.0;
+        max[k] = N ? pos[k] : 0.0;
+    }
+    for (size_t j=1; j<N; j++) {
+        for (int k=0; k<d; k++) {
+            if (min[k] > pos[d*j+k])
+                min[k] = pos[d*j+k];
+            if (max[k] < pos[d*j+k])
+                max[k] = pos[d*j+k];
+        }
+    }
+
+    // calculate center and side length
+    double center[d];
+    double side_2 = 0.0;
+    for (int k=0; k<d; k++) {
+        center[k] = (min[k]+max[k]) / 2.0;
+        side_2 = fmax(side_2, (max[k]-min[k])/2.0);
+    }
+
+    // build tree
+    Tree<d> *tree = new Tree<d>(center, side_2);
+    assert(tree);
+    for (size_t j=0; j<N; j++)
+        tree->add_point(pos, j);
+
+    return tree;
+}
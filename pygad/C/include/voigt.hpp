@@ -1,5 +1,9 @@
+#pragma once
 #include "Faddeeva.hpp"
 
+#include <cmath>
+#include <cstddef>
+
 inline double Gaussian(double x, double sigma) {
     return std::exp(-x*x/(2.*sigma*sigma)) / sigma / std::sqrt(2*M_PI);
 }
@@ -9,3 +13,49 @@ inline double Lorentzian(double x, double gamma) {
 
 extern "C" double Voigt(double x, double sigma, double gamma);
 
+// The error function by the rational approximation 7.1.28 of Abramowitz &
+// Stegun, erf(x) = 1 - (1 + a1 x + ... + a6 x^6)^-16 for x>=0, which needs no
+// exp and vectorizes well; the absolute error is below 3e-7. It is strictly
+// monotonic, such that differences of it are never negative.
+inline double erf_fast(double x) {
+    double ax = std::abs(x);
+    double p = 1.0 + ax*(0.0705230784 + ax*(0.0422820123 + ax*(0.0092705272
+                   + ax*(0.0001520143 + ax*(0.0002765672 + ax*0.0000430638)))));
+    p *= p; p *= p; p *= p; p *= p;
+    double e = 1.0 - 1.0/p;
+    return x < 0.0 ? -e : e;
+}
+// `erf_fast` at the n points x0, x0+dx, ..., x0+(n-1)*dx
+extern "C" void erf_fast_sweep(double x0, double dx, size_t n, double *out);
+// the Gaussian exp(-x^2) at the n points x0, x0+dx, ..., x0+(n-1)*dx by
+// recurrence (three calls to exp in total); meant for ranges where exp(-x^2)
+// does not underflow
+extern "C" void Gaussian_sweep(double x0, double dx, size_t n, double *out);
+
+// Humlicek's (1982) W4 approximation of the Faddeeva function w(z) for
+// Im(z)>=0; its relative error is below ~1e-4.
+std::complex<double> w_Humlicek(std::complex<double> z);
+
+// the Voigt profile using the approximation by Humlicek
+extern "C" double Voigt_fast(double x, double sigma, double gamma);
+// the Voigt profile (with Humlicek's approximation) at the n points x0,
+// x0+dx, ..., x0+(n-1)*dx; the regions of the approximation are contiguous
+// ranges in x for fixed sigma and gamma, which are evaluated in vectorized loops
+extern "C" void Voigt_fast_sweep(double x0, double dx, size_t n,
+                                 double sigma, double gamma, double *out);
+
+// the number of terms in Weideman's expansion of the Faddeeva function used
+// for the sweeps below
+#define WEIDEMAN_N 32
+
+// the Faddeeva function w(z) for `n` values at once (`z` and `w` are arrays of
+// n complex numbers, i.e. interleaved real and imaginary parts)
+extern "C" void Faddeeva_w_batch(size_t n, const double *z, double *w);
+// w(x+iy) (for y>=0) at the n points x = x0, x0+dx, ..., x0+(n-1)*dx by
+// Weideman's (1994) rational expansion; `w` is an array of n complex numbers
+extern "C" void Faddeeva_w_sweep(double x0, double dx, double y, size_t n,
+                                 double *w);
+// the Voigt profile at the n points x0, x0+dx, ..., x0+(n-1)*dx (as
+// `Voigt_fast_sweep`, but by Weideman's expansion of w(z))
+extern "C" void Voigt_sweep(double x0, double dx, size_t n,
+                            double sigma, double gamma, double *out);
@@ -0,0 +1,63 @@
+#pragma once
+#include "general.hpp"
+#include "voigt.hpp"
+
+/*
+ * Multi-component Voigt profile models of absorption lines and their fitting.
+ *
+ * A model consists of `N_comp` components of the same line transition, each
+ * with the parameters (log10 N, b, l0): the (log) column density, the Doppler
+ * parameter and the central wavelength. The optical depth at wavelength l is
+ *
+ *   tau(l) = sum_c Xsec * N_c * Voigt(c/l - c/l0_c, b_c/(sqrt(2) l0_c), gamma)
+ *
+ * which is evaluated in "velocity over length" units: with the speed of light
+ * `c_light` and b in the same velocity units and l, l0 in the same length
+ * units, `gamma` (the natural line width) has to be given in velocity over
+ * length units and `Xsec` in area times velocity over length.
+ */
+
+// the optical depths of the model with parameters `p` (3*N_comp values) at the
+// `n` wavelengths `l` and, if `jac` is not NULL, their derivatives w.r.t. the
+// parameters (a (n x 3*N_comp) array)
+extern "C"
+void vp_model_tau(size_t N_comp,
+                  const double *p,
+                  size_t n,
+                  const double *l,
+                  double Xsec,
+                  double gamma,
+                  double c_light,
+                  double *tau,
+                  double *jac);
+
+/*
+ * Fit the normalized fluxes of `N_reg` independent spectral regions with
+ * multi-component Voigt profiles by the Levenberg-Marquardt algorithm (in
+ * parallel over the regions). The pixels of region r are the indices
+ * pix_offsets[r] to pix_offsets[r+1]-1 in `l`, `flux`, and `noise` and its
+ * parameters are par_offsets[r] to par_offsets[r+1]-1 in `p` (a multiple of 3),
+ * which hold the initial guesses and are overwritten by the best fit. The
+ * parameters are kept within [`lower`,`upper`].
+ * Per region, the reduced chi^2 and the number of iterations are stored in
+ * `chisq` and `n_iter`; if `cov` is not NULL, the covariance matrices of the
+ * parameters (the inverse of J^T J) are stored there (for region r starting at
+ * sum_{r'<r} (3*N_comp_r')^2).
+ */
+extern "C"
+void vpfit_regions(size_t N_reg,
+                   const size_t *pix_offsets,
+                   const double *l,
+                   const double *flux,
+                   const double *noise,
+                   const size_t *par_offsets,
+                   double *p,
+                   const double *lower,
+                   const double *upper,
+                   double Xsec,
+                   double gamma,
+                   double c_light,
+                   size_t max_iter,
+                   double *chisq,
+                   size_t *n_iter,
+                   double *cov);
@@ -1,20 +1,52 @@
 #include "absorption_spectra.hpp"
-#include "voigt.hpp"
 
 static inline bool in_lims(double v, double *v_lims) {
     return ( v_lims[0] <= v ) and ( v <= v_lims[1] );
 }
 
+// convert the binned column densities into optical depths and the weighted sums
+// into the (optical depth-weighted) mean l.o.s. fields
+static void _normalize_spectrum(size_t Nbins, double dv, double Xsec,
+                                double *taus, double *los_dens,
+                                size_t K, double *const *los_fields) {
+    for (size_t i=0; i<Nbins; i++) {
+        taus[i] = los_dens[i] * (Xsec / dv);
+
+        if ( los_dens[i] != 0.0 ) {
+            for (size_t k=0; k<K; k++)
+                los_fields[k][i] /= los_dens[i];
+        }
+    }
+}
+
+// add the bins [i_min,i_max) of a spectrum with the column density and the K
+// weighted fields interleaved per bin to the l.o.s. fields
+static void _add_acc_spectrum(size_t i_min, size_t i_max, const double *acc,
+                              double *los_dens, size_t K,
+                              double *const *los_fields) {
+    for (size_t i=i_min; i<i_max; i++) {
+        const double *acc_i = acc + (K+1)*i;
+        los_dens[i] += acc_i[0];
+        for (size_t k=0; k<K; k++)
+            los_fields[k][i] += acc_i[k+1];
+    }
+}
+
+/*
+ * The spectrum along a single l.o.s.. Besides the optical depths `taus` and the
+ * column densities `los_dens` per velocity bin, the optical depth-weighted
+ * averages of the K per particle / cell quantities `fields[k]` are stored in
+ * `los_fields[k]` (all accumulated in a single pass over the particles).
+ */
 template <bool particles>
 void _absorption_spectrum(size_t N,
                           double *pos,
                           double *vel,
-			  double *vpec_z, // DS: LOS peculiar velocity array
                           double *hsml,
                           double *n,
                           double *temp,
-			  double *rho, // DS: density array
-			  double *metal_frac, // SA: metal mass fraction
+                          size_t K,
+                          const double *const *fields,
                           double *los_pos,
                           double *vel_extent,
                           size_t Nbins,
@@ -22,12 +54,11 @@ void _absorption_spectrum(size_t N,
                           double *v_turb,
                           double Xsec,
                           double Gamma,
+                          double wing_tau_tol,
+                          bool deterministic,
                           double *taus,
                           double *los_dens,
-			  double *los_dens_phys, // DS: density array
-			  double *los_metal_frac, // SA: LOS metal mass fraction
-                          double *los_temp,
-			  double *los_vpec, // DS LOS peculiar velocity field
+                          double *const *los_fields,
                           double *v_lims,
                           double *column,
                           const char *kernel_,
@@ -40,22 +71,34 @@ void _absorption_spectrum(size_t N,
         kernel.require_table_size(0,1024);
     }
 
-    std::memset(taus, 0, Nbins*sizeof(double));
     std::memset(los_dens, 0, Nbins*sizeof(double));
-    std::memset(los_dens_phys, 0, Nbins*sizeof(double)); // DS: density array
-    std::memset(los_metal_frac, 0, Nbins*sizeof(double)); // SA: LOS metal mass fraction
-    std::memset(los_temp, 0, Nbins*sizeof(double));
-    std::memset(los_vpec, 0, Nbins*sizeof(double)); // DS: LOS peculiar velocity field
+    for (size_t k=0; k<K; k++)
+        std::memset(los_fields[k], 0, Nbins*sizeof(double));
 
-    const double FWHM_L = 2 * Gamma;
+    // Every thread bins into its own spectrum (the column density and the
+    // weighted fields interleaved per bin) in order to avoid contention on the
+    // few bins of the spectrum. These are summed at the end -- or, if
+    // deterministic, the particles are split into a fixed number of chunks
+    // whose spectra are added in order, such that the result does not depend
+    // on the number of threads.
+    const size_t NF = K+1;
+    const size_t N_chunks = deterministic
+                                ? std::min<size_t>(N, DETERMINISTIC_CHUNKS)
+                                : 0;
+    int N_threads = omp_get_max_threads();
+    std::vector<double> acc(N_threads * NF * Nbins);
 
-#pragma omp parallel for default(shared) schedule(dynamic,10)
-    for (size_t j=0; j<N; j++) {
+#pragma omp parallel default(shared)
+    {
+    double *acc_t = acc.data() + omp_get_thread_num() * NF * Nbins;
+    std::memset(acc_t, 0, NF*Nbins*sizeof(double));
+
+    auto bin_particle = [&](size_t j) {
         column[j] = 0.0;    // for proper values when skipping
         double Nj = n[j];
 
         if ( Nj == 0.0 )
-            continue;
+            return;
 
         if ( particles ) {
             double *rj = pos+(2*j);
@@ -64,146 +107,62 @@ void _absorption_spectrum(size_t N,
             double dj = dist_periodic<2>(los_pos, rj, periodic);
             // skip particles that are too far away
             if ( dj > hj )
-                continue;
+                return;
             Nj *= kernel.proj_value(dj/hj, hj);
         }
-        column[j] = Nj; // store that quantity
 
         // column density of the particles / cells along the line of sight
         double vj = vel[j];
-	double vzj = vpec_z[j]; // DS: LOS peculiar velocity array
-        double Tj = temp[j];
-	double Rhj = rho[j]; // DS: density array
-	double Zj = metal_frac[j]; // SA: metal mass fraction array
-
-        // get the (middle) velocity bin index
-        double vi = (vj - vel_extent[0]) / dv;
-
-        // thermal broadening tb_b(v) = 1/(b*sqrt(pi)) * exp( -(v/b)^2 )
-        // natural line width L(v) = 1/pi * (Gamma / (v**2 + Gamma**2))
-        // convolution: the Voigt function
-        double b; // = b_0 * std::sqrt(Tj);
-        if (v_turb==nullptr) {
-            b = std::sqrt(Tj) * b_0;
-        } else {
-            register double b_turb = v_turb[j];
-            b = std::sqrt(b_0*b_0*Tj + b_turb*b_turb);
-        }
-        double sigma = b / std::sqrt(2);
-        // FWHM are (FWHM for Voigt is approx., but with accuracy of ~0.02%):
-        double FWHM_b = 2 * std::sqrt(2 * std::log(2)) * sigma;
-        double FWHM_V = 0.5346*FWHM_L + std::sqrt(0.5346*FWHM_L*FWHM_L
-                                + FWHM_b*FWHM_b);
-
-        // how far to go away from the line centre
-        size_t vi_min;
-        size_t vi_max;
-        if ( Gamma > 0.0 ) {
-            vi_min = 0;
-            vi_max = Nbins-1;
-        } else {
-            double v_width = 5.0 * b;
-            if ( vj+v_width < vel_extent[0] or vj-v_width > vel_extent[1] ) {
-                column[j] = 0.0;
-                continue;   // out of bounds -- don't bin into bin #0 or #Nbins-1
-            }
-            vi_min = std::max<double>(0.0,     std::floor((vj-v_width - vel_extent[0]) / dv));
-            vi_max = std::min<double>(Nbins-1, std::ceil( (vj+v_width - vel_extent[0]) / dv));
-        }
+        double b = line_b_param(temp[j], b_0, v_turb, j);
 
-        if ( vi_min == vi_max ) {
-            assert( std::abs(vi_min - vi) < 0.501 );
-#pragma omp atomic
-            taus[vi_min] += Nj;
-#pragma omp atomic
-            los_dens[vi_min] += Nj;
-#pragma omp atomic
-	    los_dens_phys[vi_min] += Rhj * Nj; // DS: density skewer
-#pragma omp atomic
-            los_temp[vi_min] += Tj * Nj;
-#pragma omp atomic
-	    los_vpec[vi_min] += vzj * Nj; // DS: LOS peculiar velocity field
-#pragma omp atomic
-	    los_metal_frac[vi_min] += Zj * Nj; // SA: LOS metal mass fraction
-
-            if( not in_lims(vj,v_lims) )
-                column[j] = 0.0;
-        } else {
-            double contrib_lim = 0.0;
-            //double contrib_total = 0.0;
-            for ( size_t i=vi_min; i<=vi_max; i++ ) {
-                double Dtb;
-                double Dv = (i-vi) * dv;
-                if ( FWHM_V < 10.*dv ) {
-                    // FWHM gets comparable with the bin size, do proper
-                    // integrals of the line-profile over the bins
-                    double v0 = (i-vi-0.5) * dv;
-                    double v1 = (i-vi+0.5) * dv;
-                    if ( Gamma > 0.0 ) {
-                        // Antiderivative of the Voigt function requires the
-                        // generalized hypergeometric function 2F2, which I
-                        // do not have. Hence, the numeric integration by
-                        // Simpson's method:
-                        int K = std::min<int>( 10*dv/FWHM_V, 1000 );
-                        K = std::max( 2*(K/2), 10 );
-                        double h = dv/K;
-                        Dtb = 2. * Voigt(v0+h, sigma, Gamma);
-                        for ( int k=2; k<K; k+=2 ) {
-                            Dtb +=      Voigt(v0+ k   *h, sigma, Gamma)
-                                 + 2. * Voigt(v0+(k+1)*h, sigma, Gamma);
-                        }
-                        Dtb *= 2;
-                        Dtb += Voigt(v0, sigma, Gamma)
-                                + Voigt(v1, sigma, Gamma);
-                        Dtb *= h/3.;
-                    } else {
-                        // antiderivative of tb_b:
-                        // int_0_v dv' tb_b(v') = 1/2 * erf(v/b)
-                        Dtb = 0.5 * (std::erf(v1/b) - std::erf(v0/b));
-                    }
-                } else {
-                    // approximate the line as constant over the bin
-                    if ( Gamma > 0.0 ) {
-                        Dtb = Voigt(Dv, sigma, Gamma) * dv;
-                    } else {
-                        Dtb = std::exp(-std::pow(Dv/b,2.0))
-                                / (b * std::sqrt(M_PI)) * dv;
-                    }
-                }
+        double contrib_lim = 0.0;
+        bool in_spectrum = add_line_profile(vj, b, Gamma, Xsec*Nj, wing_tau_tol,
+                                            vel_extent, Nbins, dv,
+            [&](size_t i, double Dtb, double v) {
                 double DtbNj = Dtb * Nj;
-                // TODO: addtional loop for the Lorentz profile
-#pragma omp atomic
-                taus[i] += DtbNj;
-#pragma omp atomic
-                los_dens[i] += DtbNj;
-#pragma omp atomic
-		los_dens_phys[i] += Rhj * DtbNj; // DS: density skewer
-#pragma omp atomic
-                los_temp[i] += Tj * DtbNj;
-#pragma omp atomic
-		los_vpec[i] += vzj * DtbNj; // DS: LOS peculiar velocity field
-#pragma omp atomic
-		los_metal_frac[i] += Zj * DtbNj; // SA: LOS metal mass fraction
+                double *acc_i = acc_t + NF*i;
+                acc_i[0] += DtbNj;
+                for (size_t k=0; k<K; k++)
+                    acc_i[k+1] += fields[k][j] * DtbNj;
 
-                //contrib_total += Dtb;
-                if ( in_lims(vj+Dv,v_lims) )
+                if ( in_lims(v,v_lims) )
                     contrib_lim += Dtb;
-            }
+        });
 
-            column[j] *= contrib_lim; //  / contrib_total;
-        }
-    }
+        // store the column density within the limits
+        if ( in_spectrum )
+            column[j] = Nj * contrib_lim;
+    };
 
-    for (size_t i=0; i<Nbins; i++) {
-        taus[i] *= Xsec / dv;
+    if ( N_chunks ) {
+#pragma omp for schedule(static,1) ordered
+        for (size_t c=0; c<N_chunks; c++) {
+            for (size_t j=c*N/N_chunks; j<(c+1)*N/N_chunks; j++)
+                bin_particle(j);
+#pragma omp ordered
+            {
+            _add_acc_spectrum(0, Nbins, acc_t, los_dens, K, los_fields);
+            }
+            std::memset(acc_t, 0, NF*Nbins*sizeof(double));
+        }
+    } else {
+#pragma omp for schedule(dynamic,10)
+        for (size_t j=0; j<N; j++)
+            bin_particle(j);
 
-        if ( los_dens[i] != 0.0 ) {
-            los_temp[i] /= los_dens[i];
-	    los_dens_phys[i] /= los_dens[i]; // DS: density skewer
-	    los_vpec[i] /= los_dens[i]; // DS: LOS peculiar velocity field
-	    los_metal_frac[i] /= los_dens[i]; // SA: LOS metal mass fraction
+        // reduce the thread spectra, parallel over blocks of bins
+        const size_t block = 256;
+#pragma omp for schedule(static)
+        for (size_t i=0; i<Nbins; i+=block) {
+            for (int t=0; t<N_threads; t++) {
+                _add_acc_spectrum(i, std::min(i+block,Nbins), acc.data()+t*NF*Nbins,
+                                  los_dens, K, los_fields);
+            }
         }
     }
+    }
+
+    _normalize_spectrum(Nbins, dv, Xsec, taus, los_dens, K, los_fields);
 }
 
 extern "C"
@@ -234,26 +193,607 @@ void absorption_spectrum(bool particles,
                          double *column,
                          const char *kernel_,
                          double periodic) {
+    // the former hard-coded l.o.s. fields
+    const double *fields[4] = {rho, temp, vpec_z, metal_frac};
+    double *los_fields[4] = {los_dens_phys, los_temp, los_vpec, los_metal_frac};
+    if ( particles ) {
+      return _absorption_spectrum<true>(N, pos, vel, hsml, n, temp,
+                                        4, fields, los_pos, vel_extent, Nbins,
+                                        b_0, v_turb, Xsec, Gamma, 0.0, false,
+                                        taus, los_dens, los_fields, v_lims, column,
+                                        kernel_, periodic);
+    } else {
+      return _absorption_spectrum<false>(N, pos, vel, hsml, n, temp,
+                                         4, fields, los_pos, vel_extent, Nbins,
+                                         b_0, v_turb, Xsec, Gamma, 0.0, false,
+                                         taus, los_dens, los_fields, v_lims, column,
+                                         kernel_, periodic);
+    }
+}
+
+extern "C"
+void absorption_spectrum_fields(bool particles,
+                                size_t N,
+                                double *pos,
+                                double *vel,
+                                double *hsml,
+                                double *n,
+                                double *temp,
+                                size_t K,
+                                double *fields,
+                                double *los_pos,
+                                double *vel_extent,
+                                size_t Nbins,
+                                double b_0,
+                                double *v_turb,
+                                double Xsec,
+                                double Gamma,
+                                double wing_tau_tol,
+                                int deterministic,
+                                double *taus,
+                                double *los_dens,
+                                double *los_fields,
+                                double *v_lims,
+                                double *column,
+                                const char *kernel_,
+                                double periodic) {
+    std::vector<const double *> fields_k(K);
+    std::vector<double *> los_fields_k(K);
+    for (size_t k=0; k<K; k++) {
+        fields_k[k] = fields + k*N;
+        los_fields_k[k] = los_fields + k*Nbins;
+    }
     if ( particles ) {
-      return _absorption_spectrum<true>(N, pos, vel, vpec_z, hsml, n, temp, rho,
-                                          metal_frac, los_pos, vel_extent, Nbins,
-                                          b_0, v_turb, Xsec, Gamma,
-					taus, los_dens, los_dens_phys, los_metal_frac,
-					los_temp, los_vpec, v_lims, column,
-                                          kernel_, periodic);
-      // DS: Added rho and los_dens_phys in the arguments of the function above
-      // DS: Also vpec_z and los_vpec
-      // SA: Added metal_frac and los_metal_frac in the arguments above
+      return _absorption_spectrum<true>(N, pos, vel, hsml, n, temp,
+                                        K, fields_k.data(), los_pos, vel_extent, Nbins,
+                                        b_0, v_turb, Xsec, Gamma, wing_tau_tol, deterministic,
+                                        taus, los_dens, los_fields_k.data(), v_lims, column,
+                                        kernel_, periodic);
     } else {
-      return _absorption_spectrum<false>(N, pos, vel, vpec_z, hsml, n, temp, rho,
-                                           metal_frac, los_pos, vel_extent, Nbins,
-                                           b_0, v_turb, Xsec, Gamma,
-					 taus, los_dens, los_dens_phys, los_metal_frac,
-					 los_temp,los_vpec, v_lims, column,
-                                           kernel_, periodic);
-      // DS: Added rho and los_dens_phys in the arguments of the function above
-      // DS: Also vpec_z and los_vpec
-      // SA: Added metal_frac and los_metal_frac in the arguments above
+      return _absorption_spectrum<false>(N, pos, vel, hsml, n, temp,
+                                         K, fields_k.data(), los_pos, vel_extent, Nbins,
+                                         b_0, v_turb, Xsec, Gamma, wing_tau_tol, deterministic,
+                                         taus, los_dens, los_fields_k.data(), v_lims, column,
+                                         kernel_, periodic);
+    }
+}
+
+
+extern "C"
+void absorption_spectra_batch(size_t N,
+                              double *pos,
+                              double *vel,
+                              double *hsml,
+                              double *n,
+                              double *temp,
+                              size_t K,
+                              double *fields,
+                              size_t N_los,
+                              double *los_pos,
+                              double *vel_extent,
+                              size_t Nbins,
+                              double b_0,
+                              double *v_turb,
+                              double Xsec,
+                              double Gamma,
+                              double wing_tau_tol,
+                              double *taus,
+                              double *los_dens,
+                              double *los_fields,
+                              double *v_lims,
+                              double *column,
+                              const char *kernel_,
+                              double periodic) {
+    double dv = (vel_extent[1] - vel_extent[0]) / Nbins;
+    Kernel<3> &kernel = kernels.at(kernel_);
+    kernel.require_table_size(2048,0);
+
+    //printf("initizalize quadtree of the projected positions...\n");
+    Tree<2> *tree = new_tree_from_pos<2>(N, pos);
+    tree->fill_max_H(hsml);
+
+#pragma omp parallel default(shared)
+    {
+    std::vector<double *> los_fields_l(K);
+
+#pragma omp for schedule(dynamic,1)
+    for (size_t l=0; l<N_los; l++) {
+        double *los_l = los_pos+(2*l);
+        double *taus_l = taus+(l*Nbins);
+        double *los_dens_l = los_dens+(l*Nbins);
+        for (size_t k=0; k<K; k++) {
+            los_fields_l[k] = los_fields+((l*K+k)*Nbins);
+            std::memset(los_fields_l[k], 0, Nbins*sizeof(double));
+        }
+        std::memset(los_dens_l, 0, Nbins*sizeof(double));
+
+        // all particles whose (projected) kernel intersects the l.o.s.; sorted
+        // for a summation order that does not depend on the tree
+        std::vector<size_t> ngbs = tree->ngbs_SPH(los_l, hsml, pos, periodic, 0.0);
+        std::sort(ngbs.begin(), ngbs.end());
+
+        double column_l = 0.0;
+        for (const size_t j : ngbs) {
+            double hj = hsml[j];
+            double dj = dist_periodic<2>(los_l, pos+(2*j), periodic);
+            double Nj = n[j] * kernel.proj_value(dj/hj, hj);
+            if ( Nj == 0.0 )
+                continue;
+
+            double b = line_b_param(temp[j], b_0, v_turb, j);
+
+            add_line_profile(vel[j], b, Gamma, Xsec*Nj, wing_tau_tol,
+                             vel_extent, Nbins, dv,
+                [&](size_t i, double Dtb, double v) {
+                    double DtbNj = Dtb * Nj;
+                    los_dens_l[i] += DtbNj;
+                    for (size_t k=0; k<K; k++)
+                        los_fields_l[k][i] += fields[k*N+j] * DtbNj;
+
+                    if ( in_lims(v,v_lims) )
+                        column_l += DtbNj;
+            });
+        }
+        column[l] = column_l;
+
+        _normalize_spectrum(Nbins, dv, Xsec, taus_l, los_dens_l, K, los_fields_l.data());
+    }
     }
+
+    //printf("delete tree...\n");
+    delete tree;
 }
 
+extern "C"
+void absorption_spectrum_multiline(size_t N,
+                                   double *pos,
+                                   double *vel,
+                                   double *hsml,
+                                   double *temp,
+                                   double *los_pos,
+                                   size_t N_lines,
+                                   double *n,
+                                   double *vel_extents,
+                                   double *b_0,
+                                   double *Xsec,
+                                   double *Gamma,
+                                   double wing_tau_tol,
+                                   int deterministic,
+                                   double *v_turb,
+                                   size_t Nbins,
+                                   double *taus,
+                                   const char *kernel_,
+                                   double periodic) {
+    Kernel<3> &kernel = kernels.at(kernel_);
+    kernel.require_table_size(2048,0);
+
+    std::vector<double> dv(N_lines);
+    for (size_t k=0; k<N_lines; k++)
+        dv[k] = (vel_extents[2*k+1] - vel_extents[2*k]) / Nbins;
+
+    std::memset(taus, 0, Nbins*sizeof(double));
+
+    // thread-private spectra as in _absorption_spectrum
+    const size_t N_chunks = deterministic
+                                ? std::min<size_t>(N, DETERMINISTIC_CHUNKS)
+                                : 0;
+    int N_threads = omp_get_max_threads();
+    std::vector<double> acc(N_threads * Nbins);
+
+#pragma omp parallel default(shared)
+    {
+    double *acc_t = acc.data() + omp_get_thread_num() * Nbins;
+    std::memset(acc_t, 0, Nbins*sizeof(double));
+
+    auto bin_particle = [&](size_t j) {
+        double *rj = pos+(2*j);
+        double hj = hsml[j];
+        // calculate the projected distance of the particle to the l.o.s.
+        double dj = dist_periodic<2>(los_pos, rj, periodic);
+        // skip particles that are too far away
+        if ( dj >= hj )
+            return;
+        // the geometry is the same for all lines
+        double Wj = kernel.proj_value_ql1(dj/hj, hj);
+        double vj = vel[j];
+        double Tj = temp[j];
+
+        for (size_t k=0; k<N_lines; k++) {
+            double Nj = n[k*N+j] * Wj;
+            if ( Nj == 0.0 )
+                continue;
+            double b = line_b_param(Tj, b_0[k], v_turb, j);
+            double tau_scale = Xsec[k] / dv[k];
+            add_line_profile(vj, b, Gamma[k], Xsec[k]*Nj, wing_tau_tol,
+                             vel_extents+(2*k), Nbins, dv[k],
+                [&](size_t i, double Dtb, double v) {
+                    acc_t[i] += tau_scale * Dtb * Nj;
+            });
+        }
+    };
+
+    if ( N_chunks ) {
+#pragma omp for schedule(static,1) ordered
+        for (size_t c=0; c<N_chunks; c++) {
+            for (size_t j=c*N/N_chunks; j<(c+1)*N/N_chunks; j++)
+                bin_particle(j);
+#pragma omp ordered
+            {
+            for (size_t i=0; i<Nbins; i++)
+                taus[i] += acc_t[i];
+            }
+            std::memset(acc_t, 0, Nbins*sizeof(double));
+        }
+    } else {
+#pragma omp for schedule(dynamic,10)
+        for (size_t j=0; j<N; j++)
+            bin_particle(j);
+
+#pragma omp for schedule(static)
+        for (size_t i=0; i<Nbins; i++) {
+            for (int t=0; t<N_threads; t++)
+                taus[i] += acc[t*Nbins + i];
+        }
+    }
+    }
+}
+
+// linear interpolation in a table with ascending x_tab (constant beyond)
+static double _interp_table(double x, size_t N_tab, const double *x_tab,
+                            const double *y_tab) {
+    if ( x <= x_tab[0] )
+        return y_tab[0];
+    if ( x >= x_tab[N_tab-1] )
+        return y_tab[N_tab-1];
+    size_t i = std::upper_bound(x_tab, x_tab+N_tab, x) - x_tab;
+    double f = (x - x_tab[i-1]) / (x_tab[i] - x_tab[i-1]);
+    return (1.0-f) * y_tab[i-1] + f * y_tab[i];
+}
+
+extern "C"
+void absorption_skewer(size_t N_snaps,
+                       const size_t *N,
+                       double *const *pos,
+                       double *const *vel,
+                       double *const *hsml,
+                       double *const *n,
+                       double *const *temp,
+                       double *const *v_turb,
+                       const double *boxsize,
+                       const double *col_fac,
+                       const double *d_lims,
+                       const double *origin,
+                       const double *dir,
+                       double length,
+                       size_t N_tab,
+                       const double *d_tab,
+                       const double *lnz1_tab,
+                       double ln_l_min,
+                       double dlnl,
+                       size_t Nbins,
+                       double b_0,
+                       double Xsec,
+                       double Gamma,
+                       double wing_tau_tol,
+                       double c_light,
+                       double *taus,
+                       const char *kernel_) {
+    // in velocity space the bins are equidistant
+    double dv = c_light * dlnl;
+    double vel_extent[2] = {0.0, Nbins*dv};
+    Kernel<3> &kernel = kernels.at(kernel_);
+    kernel.require_table_size(2048,0);
+
+    double u[3];
+    double u_norm = std::sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+    for (int k=0; k<3; k++)
+        u[k] = dir[k] / u_norm;
+
+    // thread-private spectra
+    int N_threads = omp_get_max_threads();
+    std::vector<double> acc(N_threads * Nbins, 0.0);
+
+    for (size_t s=0; s<N_snaps; s++) {
+        double t_start = std::max(0.0, d_lims[s]);
+        double t_end = std::min(length, d_lims[s+1]);
+        if ( t_end <= t_start or N[s] == 0 )
+            continue;
+        const double L = boxsize[s];
+        const double *pos_s = pos[s], *vel_s = vel[s], *hsml_s = hsml[s];
+        const double *n_s = n[s], *temp_s = temp[s];
+        const double *v_turb_s = v_turb ? v_turb[s] : nullptr;
+        size_t N_seg = std::ceil((t_end - t_start) / (L/4.0));
+        double seg = (t_end - t_start) / N_seg;
+
+        //printf("initizalize octree of snapshot %zu...\n", s);
+        Tree<3> *tree = new_tree_from_pos<3>(N[s], pos_s);
+        tree->fill_max_H(hsml_s);
+
+#pragma omp parallel default(shared)
+        {
+        double *acc_t = acc.data() + omp_get_thread_num() * Nbins;
+
+#pragma omp for schedule(dynamic,1)
+        for (size_t k=0; k<N_seg; k++) {
+            double t0 = t_start + k*seg;
+            double t1 = (k+1 == N_seg) ? t_end : t0 + seg;
+            double tc = (t0 + t1) / 2.0;
+            // the segment centre, wrapped into the box
+            double c[3];
+            for (int i=0; i<3; i++) {
+                c[i] = origin[i] + u[i]*tc;
+                c[i] -= L * std::floor(c[i] / L);
+            }
+
+            // all particles whose kernel might intersect the segment; sorted
+            // for a summation order that does not depend on the tree
+            std::vector<size_t> ngbs = tree->ngbs_SPH(c, hsml_s, pos_s, L, seg/2.0);
+            std::sort(ngbs.begin(), ngbs.end());
+
+            for (const size_t j : ngbs) {
+                // the (nearest image) offset from the segment centre
+                double D[3], s_par = 0.0, D2 = 0.0;
+                for (int i=0; i<3; i++) {
+                    D[i] = pos_s[3*j+i] - c[i];
+                    D[i] -= L * std::round(D[i] / L);
+                    s_par += D[i] * u[i];
+                    D2 += D[i] * D[i];
+                }
+                // each particle is attributed to the segment of its closest
+                // approach
+                double tj = tc + s_par;
+                if ( tj < t0 or t1 <= tj )
+                    continue;
+                double hj = hsml_s[j];
+                double dj = std::sqrt(std::max(0.0, D2 - s_par*s_par));
+                if ( dj >= hj )
+                    continue;
+                double Nj = n_s[j] * kernel.proj_value(dj/hj, hj) * col_fac[s];
+                if ( Nj == 0.0 )
+                    continue;
+
+                double v_pec = vel_s[3*j]*u[0] + vel_s[3*j+1]*u[1] + vel_s[3*j+2]*u[2];
+                double lnz1 = _interp_table(tj, N_tab, d_tab, lnz1_tab);
+                double vj = c_light * (lnz1 + std::log1p(v_pec/c_light) - ln_l_min);
+                double b = line_b_param(temp_s[j], b_0, v_turb_s, j);
+
+                add_line_profile(vj, b, Gamma, Xsec*Nj, wing_tau_tol,
+                                 vel_extent, Nbins, dv,
+                    [&](size_t i, double Dtb, double v) {
+                        acc_t[i] += Dtb * Nj;
+                });
+            }
+        }
+        }
+
+        //printf("delete octree...\n");
+        delete tree;
+    }
+
+    for (size_t i=0; i<Nbins; i++) {
+        double col = 0.0;
+        for (int t=0; t<N_threads; t++)
+            col += acc[t*Nbins + i];
+        taus[i] = col * (Xsec / dv);
+    }
+}
+
+// the range of pixels (with centres at x0+(i+0.5)*res) within [x-h,x+h]
+static inline void _pixel_range(double x, double h, double x0, double res,
+                                size_t Npx, size_t &i_min, size_t &i_max) {
+    double d_i_min = (x-h-x0) / res - 0.5;
+    double d_i_max = (x+h-x0) / res + 0.5;
+    if ( d_i_max <= 0.0 or d_i_min >= Npx ) {
+        i_min = i_max = 0;
+        return;
+    }
+    i_min = std::max<double>( std::ceil(d_i_min), 0.0 );
+    i_max = std::min<double>( std::ceil(d_i_max), Npx );
+}
+
+extern "C"
+void line_profile_bins(double vj,
+                       double b,
+                       double Gamma,
+                       double tau_0,
+                       double wing_tau_tol,
+                       const double *vel_extent,
+                       size_t Nbins,
+                       double *Dtb) {
+    double dv = (vel_extent[1] - vel_extent[0]) / Nbins;
+    std::memset(Dtb, 0, Nbins*sizeof(double));
+    add_line_profile(vj, b, Gamma, tau_0, wing_tau_tol, vel_extent, Nbins, dv,
+        [&](size_t i, double Dtb_i, double v) {
+            Dtb[i] += Dtb_i;
+    });
+}
+
+extern "C"
+void absorption_forest(size_t N,
+                       double *pos,
+                       double *vel,
+                       double *hsml,
+                       double *n,
+                       double *temp,
+                       double *extent,
+                       size_t Npx[2],
+                       double *vel_extent,
+                       size_t Nbins,
+                       int periodic_v,
+                       double b_0,
+                       double *v_turb,
+                       double Xsec,
+                       double Gamma,
+                       double wing_tau_tol,
+                       double *taus,
+                       double *mean_flux,
+                       double *flux_pk,
+                       size_t Npdf,
+                       double *flux_pdf,
+                       size_t block_rows,
+                       const char *kernel_,
+                       double periodic) {
+    double dv = (vel_extent[1] - vel_extent[0]) / Nbins;
+    double v_period = vel_extent[1] - vel_extent[0];
+    Kernel<3> &kernel = kernels.at(kernel_);
+    kernel.require_table_size(2048,0);
+
+    double res[2];
+    for (int k=0; k<2; k++)
+        res[k] = (extent[2*k+1]-extent[2*k]) / Npx[k];
+    // the periodic images of the particles to consider
+    std::vector<double> images = {0.0};
+    if ( std::isfinite(periodic) ) {
+        images.push_back(-periodic);
+        images.push_back(+periodic);
+    }
+
+    if ( block_rows == 0 or taus != nullptr )
+        block_rows = Npx[0];
+    size_t N_blocks = (Npx[0] + block_rows - 1) / block_rows;
+
+    //printf("assign particles to blocks of l.o.s....\n");
+    std::vector<std::vector<size_t>> block_parts(N_blocks);
+    std::vector<size_t> blocks_j;
+    for (size_t j=0; j<N; j++) {
+        if ( n[j] == 0.0 )
+            continue;
+        double hj = hsml[j];
+        // the blocks of all periodic images, each only once (the images may
+        // overlap, if the kernel is larger than the box)
+        blocks_j.clear();
+        for (const double img : images) {
+            size_t i_min, i_max;
+            _pixel_range(pos[2*j]+img, hj, extent[0], res[0], Npx[0], i_min, i_max);
+            if ( i_min == i_max )
+                continue;
+            for (size_t B=i_min/block_rows; B<=(i_max-1)/block_rows; B++)
+                blocks_j.push_back(B);
+        }
+        std::sort(blocks_j.begin(), blocks_j.end());
+        auto blocks_end = std::unique(blocks_j.begin(), blocks_j.end());
+        for (auto B=blocks_j.begin(); B!=blocks_end; ++B)
+            block_parts[*B].push_back(j);
+    }
+
+    size_t N_pk = Nbins/2 + 1;
+    double F_sum = 0.0;
+    std::vector<double> P_sum(N_pk, 0.0);
+    std::vector<double> pdf(Npdf, 0.0);
+    std::vector<double> block_taus;
+
+    for (size_t B=0; B<N_blocks; B++) {
+        size_t r0 = B*block_rows;
+        size_t r1 = std::min(r0+block_rows, Npx[0]);
+        size_t N_block_los = (r1-r0)*Npx[1];
+        double *cube;
+        if ( taus != nullptr ) {
+            cube = taus;
+        } else {
+            block_taus.resize(N_block_los*Nbins);
+            cube = block_taus.data();
+        }
+        std::memset(cube, 0, N_block_los*Nbins*sizeof(double));
+
+        //printf("deposit %zu particles into block %zu...\n", block_parts[B].size(), B);
+        const std::vector<size_t> &parts = block_parts[B];
+#pragma omp parallel for default(shared) schedule(dynamic,10)
+        for (size_t jj=0; jj<parts.size(); jj++) {
+            size_t j = parts[jj];
+            double hj = hsml[j];
+            double vj = vel[j];
+            double b = line_b_param(temp[j], b_0, v_turb, j);
+            if ( periodic_v )
+                vj = vel_extent[0] + std::fmod(std::fmod(vj-vel_extent[0], v_period)
+                                                + v_period, v_period);
+
+            for (const double img_x : images) {
+                double xj = pos[2*j] + img_x;
+                size_t ix_min, ix_max;
+                _pixel_range(xj, hj, extent[0], res[0], Npx[0], ix_min, ix_max);
+                ix_min = std::max(ix_min, r0);
+                ix_max = std::min(ix_max, r1);
+                for (const double img_y : images) {
+                    double yj = pos[2*j+1] + img_y;
+                    size_t iy_min, iy_max;
+                    _pixel_range(yj, hj, extent[2], res[1], Npx[1], iy_min, iy_max);
+                    for (size_t ix=ix_min; ix<ix_max; ix++) {
+                        double dx = extent[0] + (ix+0.5)*res[0] - xj;
+                        for (size_t iy=iy_min; iy<iy_max; iy++) {
+                            double dy = extent[2] + (iy+0.5)*res[1] - yj;
+                            double dj = std::sqrt(dx*dx + dy*dy);
+                            if ( dj >= hj )
+                                continue;
+                            double Nj = n[j] * kernel.proj_value_ql1(dj/hj, hj);
+                            double *tau_los = cube + ((ix-r0)*Npx[1] + iy)*Nbins;
+                            auto add = [&](size_t i, double Dtb, double v) {
+#pragma omp atomic
+                                tau_los[i] += Dtb * Nj;
+                            };
+                            add_line_profile(vj, b, Gamma, Xsec*Nj, wing_tau_tol,
+                                             vel_extent, Nbins, dv, add);
+                            if ( periodic_v ) {
+                                double v_img[2] = {vj-v_period, vj+v_period};
+                                for (const double v : v_img)
+                                    add_line_profile(v, b, Gamma, Xsec*Nj, wing_tau_tol,
+                                                     vel_extent, Nbins, dv, add);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        //printf("reduce block %zu to flux statistics...\n", B);
+#pragma omp parallel default(shared)
+        {
+            FFT fft(Nbins);
+            std::vector<cmplx> F_k(Nbins), scratch(Nbins);
+            std::vector<double> P_priv(N_pk, 0.0), pdf_priv(Npdf, 0.0);
+            double F_priv = 0.0;
+#pragma omp for schedule(static)
+            for (size_t l=0; l<N_block_los; l++) {
+                double *tau_los = cube + l*Nbins;
+                for (size_t i=0; i<Nbins; i++) {
+                    tau_los[i] *= Xsec / dv;
+                    double F = std::exp(-tau_los[i]);
+                    F_priv += F;
+                    if ( Npdf ) {
+                        size_t k = std::min<size_t>(F * Npdf, Npdf-1);
+                        pdf_priv[k] += 1.0;
+                    }
+                    F_k[i] = F;
+                }
+                if ( flux_pk ) {
+                    fft(F_k.data(), scratch.data());
+                    for (size_t k=0; k<N_pk; k++)
+                        P_priv[k] += std::norm(F_k[k]);
+                }
+            }
+#pragma omp critical
+            {
+                F_sum += F_priv;
+                for (size_t k=0; k<N_pk; k++)
+                    P_sum[k] += P_priv[k];
+                for (size_t k=0; k<Npdf; k++)
+                    pdf[k] += pdf_priv[k];
+            }
+        }
+    }
+
+    size_t N_los = Npx[0]*Npx[1];
+    double F_mean = F_sum / (N_los*Nbins);
+    if ( mean_flux )
+        *mean_flux = F_mean;
+    if ( flux_pk ) {
+        // P(k) = L/N^2 <|F_k|^2> / <F>^2 with L = N*dv; the constant shift of
+        // F/<F>-1 only affects the k=0 mode
+        for (size_t k=0; k<N_pk; k++)
+            flux_pk[k] = P_sum[k] / N_los * dv / Nbins / (F_mean*F_mean);
+        flux_pk[0] = 0.0;
+    }
+    if ( flux_pdf ) {
+        for (size_t k=0; k<Npdf; k++)
+            flux_pdf[k] = pdf[k] / (N_los*Nbins) * Npdf;
+    }
+}
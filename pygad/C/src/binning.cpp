@@ -68,3 +68,18 @@ void bin_sph_along_line(size_t N,
     bin_sph_line<3>(N, pos, hsml, dV, qty, los, extent, Npx, line, kernel_, periodic);
 }
 
+void bin_sph_along_lines(size_t N,
+                         double *pos,
+                         double *hsml,
+                         double *dV,
+                         double *qty,
+                         size_t N_los,
+                         double *los,
+                         double *extent,
+                         size_t Npx,
+                         double *lines,
+                         const char *kernel_,
+                         double periodic) {
+    bin_sph_lines<3>(N, pos, hsml, dV, qty, N_los, los, extent, Npx, lines, kernel_, periodic);
+}
+
@@ -0,0 +1,304 @@
+#include "correlation.hpp"
+
+#include <vector>
+
+// the minimum number of node pairs per thread to distribute
+#define PAIR_TASKS_PER_THREAD 64
+// node pairs with at most this many pairs of particles are counted directly
+#define PAIR_DIRECT_COUNT 1024
+
+namespace {
+struct NodePair {
+    const Tree<3> *A, *B;
+    // whether these are the pairs within one node (of the auto-counts)
+    bool self;
+};
+
+struct PairCounter {
+    const double *pos1, *pos2, *w1, *w2, *vel1, *vel2;
+    double r_min2, r_max2, log_r_min2, dlog2;
+    // the squared bin edges
+    std::vector<double> edges2;
+    size_t N_bins;
+    // the linear bins along the line of sight (none, if N_pi==0)
+    double pi_max, dpi;
+    size_t N_pi;
+    // the number of bins of the counts (the velocity sums follow after them)
+    size_t N_tot;
+    double periodic;
+
+    // the bin of the squared distance r2 (within [r_min2,r_max2)); the
+    // estimate from the logarithm is corrected for round-off by the edges
+    size_t bin(double r2) const {
+        double est = std::max((std::log(r2) - log_r_min2) / dlog2, 0.0);
+        size_t b = std::min(size_t(est), N_bins-1);
+        while (b > 0 and r2 < edges2[b])
+            b--;
+        while (b+1 < N_bins and edges2[b+1] <= r2)
+            b++;
+        return b;
+    }
+
+    // the bin along the line of sight of pi within [0,pi_max)
+    size_t pi_bin(double pi) const {
+        return std::min(size_t(pi / dpi), N_pi-1);
+    }
+
+    double weight(const Tree<3> *node, const double *w) const {
+        return w ? node->sum_w() : node->tot_part();
+    }
+
+    // Count all the pairs of particles of two nodes directly. Their squared
+    // (projected) distances are known to be within [d2_min,d2_max], which
+    // limits the bins to search (avoiding the logarithm per pair). The
+    // positions, weights, and velocities of B are gathered into `buf`
+    // (x,y,z,w[,vx,vy,vz]) for contiguous access.
+    void direct_pairs(const NodePair &p, double d2_min, double d2_max,
+                      double *bins, std::vector<double> &buf) const {
+        size_t b_min = bin(std::max(d2_min, r_min2));
+        size_t b_max = bin(std::min(d2_max, r_max2));
+        const size_t stride = vel1 ? 7 : 4;
+        buf.clear();
+        p.B->for_each_part([&](size_t j) {
+            buf.insert(buf.end(), pos2+3*j, pos2+3*j+3);
+            buf.push_back(w2 ? w2[j] : 1.0);
+            if (vel1)
+                buf.insert(buf.end(), vel2+3*j, vel2+3*j+3);
+        });
+        const size_t N_B = buf.size() / stride;
+        size_t a = 0;
+        p.A->for_each_part([&](size_t i) {
+            const double *r_i = pos1 + 3*i;
+            double w_i = w1 ? w1[i] : 1.0;
+            // in the same node, B is A and only the later particles are taken
+            for (size_t n = p.self ? ++a : 0; n<N_B; n++) {
+                const double *q = &buf[stride*n];
+                double dx[3];
+                for (int k=0; k<3; k++) {
+                    dx[k] = q[k] - r_i[k];
+                    if (dx[k] > periodic/2.0)
+                        dx[k] -= periodic;
+                    else if (dx[k] < -periodic/2.0)
+                        dx[k] += periodic;
+                }
+                double r2 = dx[0]*dx[0] + dx[1]*dx[1];
+                if (not N_pi)
+                    r2 += dx[2]*dx[2];
+                if (r2 < r_min2 or r_max2 <= r2)
+                    continue;
+                size_t b = b_min;
+                while (b < b_max and edges2[b+1] <= r2)
+                    b++;
+                if (N_pi) {
+                    double pi = std::fabs(dx[2]);
+                    if (pi_max <= pi)
+                        continue;
+                    b = b*N_pi + pi_bin(pi);
+                }
+                double w = w_i * q[3];
+                bins[b] += w;
+                if (vel1) {
+                    const double *v_i = vel1 + 3*i;
+                    double r = std::sqrt(dx[0]*dx[0] + dx[1]*dx[1]
+                                         + dx[2]*dx[2]);
+                    if (r == 0.0)
+                        continue;
+                    double u = ((q[4]-v_i[0])*dx[0] + (q[5]-v_i[1])*dx[1]
+                                + (q[6]-v_i[2])*dx[2]) / r;
+                    bins[N_tot + b] += w * u;
+                    bins[2*N_tot + b] += w * u*u;
+                }
+            }
+        });
+    }
+
+    // Count the pairs of a node pair, if they are all within one bin (or none)
+    // or both are leaves; otherwise push the pairs of their children to `out`.
+    // With velocities, the pairs are never counted as a whole.
+    void process(const NodePair &p, double *bins,
+                 std::vector<NodePair> &out,
+                 std::vector<double> &buf) const {
+        const Tree<3> *A = p.A, *B = p.B;
+        double s = A->side_2() + B->side_2();
+        double lo[3], hi[3];
+        for (int k=0; k<3; k++) {
+            double dc = p.self ? 0.0
+                               : dist_periodic_1D(A->center(k), B->center(k),
+                                                  periodic);
+            lo[k] = std::max(dc - s, 0.0);
+            hi[k] = std::min(dc + s, periodic/2.0);
+        }
+        // the binned distances are the projected ones, if binned along the
+        // line of sight as well
+        double d2_min = 0.0, d2_max = 0.0;
+        for (int k=0; k<(N_pi ? 2 : 3); k++) {
+            d2_min += lo[k]*lo[k];
+            d2_max += hi[k]*hi[k];
+        }
+        if (d2_max < r_min2 or r_max2 <= d2_min)
+            return;
+        if (N_pi and pi_max <= lo[2])
+            return;
+        if (not p.self and not vel1 and r_min2 <= d2_min and d2_max < r_max2
+                and bin(d2_min) == bin(d2_max)
+                and (not N_pi or (hi[2] < pi_max
+                                  and pi_bin(lo[2]) == pi_bin(hi[2])))) {
+            size_t b = bin(d2_min);
+            if (N_pi)
+                b = b*N_pi + pi_bin(lo[2]);
+            bins[b] += weight(A, w1) * weight(B, w2);
+            return;
+        }
+
+        if ((A->is_leaf() and B->is_leaf())
+                or A->tot_part()*B->tot_part() <= PAIR_DIRECT_COUNT) {
+            direct_pairs(p, d2_min, d2_max, bins, buf);
+        } else if (p.self) {
+            for (unsigned i=0; i<Tree<3>::NC; i++) {
+                const Tree<3> *c_i = A->octant_child(i);
+                if (not c_i)
+                    continue;
+                out.push_back({c_i, c_i, true});
+                for (unsigned j=i+1; j<Tree<3>::NC; j++) {
+                    const Tree<3> *c_j = A->octant_child(j);
+                    if (c_j)
+                        out.push_back({c_i, c_j, false});
+                }
+            }
+        } else if (B->is_leaf() or (not A->is_leaf()
+                                    and A->side_2() >= B->side_2())) {
+            for (unsigned i=0; i<Tree<3>::NC; i++) {
+                if (A->octant_child(i))
+                    out.push_back({A->octant_child(i), B, false});
+            }
+        } else {
+            for (unsigned i=0; i<Tree<3>::NC; i++) {
+                if (B->octant_child(i))
+                    out.push_back({A, B->octant_child(i), false});
+            }
+        }
+    }
+};
+}
+
+extern "C"
+void pair_counts(size_t N1,
+                 const double *pos1,
+                 const double *w1,
+                 const double *vel1,
+                 void *octree1,
+                 size_t N2,
+                 const double *pos2,
+                 const double *w2,
+                 const double *vel2,
+                 void *octree2,
+                 double r_min,
+                 double r_max,
+                 size_t N_bins,
+                 double pi_max,
+                 size_t N_pi,
+                 double periodic,
+                 double *counts,
+                 double *vel_sums) {
+    const size_t N_tot = N_bins * (N_pi ? N_pi : 1);
+    std::memset(counts, 0, N_tot*sizeof(double));
+    if (vel1)
+        std::memset(vel_sums, 0, 2*N_tot*sizeof(double));
+    bool auto_counts = pos2 == NULL;
+    if (N_tot == 0 or N1 == 0 or (not auto_counts and N2 == 0))
+        return;
+    assert(0.0 < r_min and r_min < r_max);
+    assert(N_pi == 0 or 0.0 < pi_max);
+
+    Tree<3> *tree1 = octree1 ? (Tree<3> *)octree1
+                             : (Tree<3> *)new_octree_from_pos(N1, pos1);
+    Tree<3> *tree2 = tree1;
+    // the second set needs its own tree for its own sums of the weights
+    bool own_tree2 = false;
+    if (not auto_counts) {
+        own_tree2 = octree2 == NULL or octree2 == (void *)tree1;
+        tree2 = own_tree2 ? (Tree<3> *)new_octree_from_pos(N2, pos2)
+                          : (Tree<3> *)octree2;
+    }
+    if (w1)
+        tree1->fill_sum_w(w1);
+    if (w2 and not auto_counts)
+        tree2->fill_sum_w(w2);
+
+    PairCounter pc;
+    pc.pos1 = pos1;
+    pc.pos2 = auto_counts ? pos1 : pos2;
+    pc.w1 = w1;
+    pc.w2 = auto_counts ? w1 : w2;
+    pc.vel1 = vel1;
+    pc.vel2 = auto_counts ? vel1 : vel2;
+    pc.r_min2 = r_min*r_min;
+    pc.r_max2 = r_max*r_max;
+    pc.log_r_min2 = std::log(pc.r_min2);
+    pc.dlog2 = (std::log(pc.r_max2) - pc.log_r_min2) / N_bins;
+    pc.N_bins = N_bins;
+    pc.edges2.resize(N_bins+1);
+    for (size_t b=0; b<=N_bins; b++)
+        pc.edges2[b] = std::exp(pc.log_r_min2 + b*pc.dlog2);
+    pc.pi_max = pi_max;
+    pc.N_pi = N_pi;
+    pc.dpi = N_pi ? pi_max / N_pi : 0.0;
+    pc.N_tot = N_tot;
+    pc.periodic = periodic;
+
+    // the counts followed by the velocity sums, if any
+    const size_t N_out = vel1 ? 3*N_tot : N_tot;
+    std::vector<double> bins(N_out, 0.0);
+
+    // expand the node pairs breadth-first until there are enough of them to
+    // distribute among the threads
+    int N_threads = omp_get_max_threads();
+    std::vector<NodePair> tasks(1, NodePair{tree1, tree2, auto_counts});
+    std::vector<NodePair> next;
+    std::vector<double> buf;
+    while (tasks.size() and tasks.size() < size_t(PAIR_TASKS_PER_THREAD*N_threads)) {
+        next.clear();
+        for (const NodePair &p : tasks) {
+            if (p.A->is_leaf() and p.B->is_leaf())
+                next.push_back(p);
+            else
+                pc.process(p, bins.data(), next, buf);
+        }
+        bool leaves_only = true;
+        for (const NodePair &p : next)
+            leaves_only = leaves_only and p.A->is_leaf() and p.B->is_leaf();
+        tasks.swap(next);
+        if (leaves_only)
+            break;
+    }
+
+    // the remaining node pairs depth-first, with thread-local bins
+    std::vector<double> acc(N_threads * N_out, 0.0);
+#pragma omp parallel default(shared)
+    {
+    double *acc_t = acc.data() + omp_get_thread_num() * N_out;
+    std::vector<NodePair> stack;
+    std::vector<double> buf;
+#pragma omp for schedule(dynamic,1)
+    for (size_t t=0; t<tasks.size(); t++) {
+        stack.push_back(tasks[t]);
+        while (stack.size()) {
+            NodePair p = stack.back();
+            stack.pop_back();
+            pc.process(p, acc_t, stack, buf);
+        }
+    }
+    }
+    for (int t=0; t<N_threads; t++) {
+        for (size_t b=0; b<N_out; b++)
+            bins[b] += acc[t*N_out + b];
+    }
+    std::memcpy(counts, bins.data(), N_tot*sizeof(double));
+    if (vel1)
+        std::memcpy(vel_sums, bins.data()+N_tot, 2*N_tot*sizeof(double));
+
+    if (octree1 == NULL)
+        delete tree1;
+    if (own_tree2)
+        delete tree2;
+}
@@ -1,7 +1,88 @@
+#include "eval_sph.hpp"
 #include "binning.hpp"
 #include "kernels.hpp"
 #include "tree.hpp"
 
+// Evaluate the K quantities at r (wrapped into the periodic box around the
+// tree's center) into vals_r. Returns the number of neighbours and stores the
+// sum of the kernel weights in `norm`.
+static size_t _eval_sph_at_pos(const Kernel<3> &kernel, const Tree<3> *tree,
+                               const double *r, size_t K, double *vals_r,
+                               const double *pos, const double *hsml,
+                               const double *dV, const double *qty,
+                               double periodic, double &norm) {
+    double ri[3];
+    for (int k=0; k<3; k++) {
+        ri[k] = r[k];
+        if (std::isfinite(periodic))
+            ri[k] = tree->center(k) + std::remainder(ri[k] - tree->center(k), periodic);
+    }
+
+    std::vector<size_t> ngbs = tree->ngbs_SPH(ri, hsml, pos, periodic, 0.0);
+
+    for (size_t k=0; k<K; k++)
+        vals_r[k] = 0.0;
+    norm = 0.0;
+    for (const size_t j : ngbs) {
+        double dj = dist_periodic<3>(ri, pos+(3*j), periodic);
+        double hj = hsml[j];
+        double dVj_Wj = dV[j] * kernel.value_ql1(dj/hj, hj);
+
+        const double *qty_j = qty+(K*j);
+        for (size_t k=0; k<K; k++)
+            vals_r[k] += dVj_Wj * qty_j[k];
+        norm += dVj_Wj;
+    }
+    return ngbs.size();
+}
+
+extern "C"
+void eval_sph_at_multi(size_t M,
+                       double *r,
+                       size_t K,
+                       double *vals,
+                       size_t N,
+                       double *pos,
+                       double *hsml,
+                       double *dV,
+                       double *qty,
+                       double periodic,
+                       size_t *n_ngbs,
+                       double *norm,
+                       const char *kernel_,
+                       void *octree) {
+    //printf("initialze kernel...\n");
+    Kernel<3> kernel(kernel_);
+
+    Tree<3> *tree = NULL;
+    if (octree == NULL) {
+        //printf("initizalize tree...\n");
+        tree = (Tree<3> *)new_octree_from_pos(N, pos);
+        assert(tree);
+        tree->fill_max_H(hsml);
+    } else {
+        tree = (Tree<3> *)octree;
+    }
+
+    //printf("calculate %zu SPH properties from %zu particles at %zu positions...\n", K, N, M);
+#pragma omp parallel for default(shared) schedule(dynamic,64)
+    for (size_t i=0; i<M; i++) {
+        double norm_i;
+        size_t n_ngbs_i = _eval_sph_at_pos(kernel, tree, r+3*i, K, vals+K*i,
+                                           pos, hsml, dV, qty, periodic,
+                                           norm_i);
+        if (n_ngbs)
+            n_ngbs[i] = n_ngbs_i;
+        if (norm)
+            norm[i] = norm_i;
+    }
+
+    if (octree == NULL) {
+        //printf("delete tree...\n");
+        delete tree;
+    }
+}
+
 extern "C"
 void eval_sph_at(size_t M,
                  double *r,
@@ -13,14 +94,31 @@ void eval_sph_at(size_t M,
                  double *qty,
                  const char *kernel_,
                  void *octree) {
-    double periodic = INFINITY;
+    eval_sph_at_multi(M, r, 1, vals, N, pos, hsml, dV, qty, INFINITY,
+                      NULL, NULL, kernel_, octree);
+}
 
-    //printf("initialze kernel...\n");
+extern "C"
+void eval_sph_on_plane(const double origin[3],
+                       const double e_u[3],
+                       const double e_v[3],
+                       const double extent[4],
+                       const size_t Npx[2],
+                       size_t K,
+                       double *vals,
+                       size_t N,
+                       double *pos,
+                       double *hsml,
+                       double *dV,
+                       double *qty,
+                       double periodic,
+                       double *norm,
+                       const char *kernel_,
+                       void *octree) {
     Kernel<3> kernel(kernel_);
 
     Tree<3> *tree = NULL;
     if (octree == NULL) {
-        //printf("initizalize tree...\n");
         tree = (Tree<3> *)new_octree_from_pos(N, pos);
         assert(tree);
         tree->fill_max_H(hsml);
@@ -28,26 +126,32 @@ void eval_sph_at(size_t M,
         tree = (Tree<3> *)octree;
     }
 
-    //printf("calculate SPH property from %zu particles at %zu positions...\n", N, M);
-#pragma omp parallel for shared(r, vals, pos, hsml, dV, qty, tree)
-    for (size_t i=0; i<M; i++) {
-        double *ri = r+(3*i);
-
-        std::vector<size_t> ngbs = tree->ngbs_SPH(ri, hsml, pos, periodic, 0.0);
-
-        vals[i] = 0.0;
-        for (const size_t j : ngbs) {
-            double dj = dist_periodic<3>(ri, pos+(3*j), periodic);
-            double hj = hsml[j];
-            double dVj_Wj = dV[j] * kernel.value_ql1(dj/hj, hj);
-
-            vals[i] += dVj_Wj * qty[j];
+    const double du = (extent[1] - extent[0]) / Npx[0];
+    const double dv = (extent[3] - extent[2]) / Npx[1];
+    const size_t T_u = (Npx[0] + SLICE_TILE-1) / SLICE_TILE;
+    const size_t T_v = (Npx[1] + SLICE_TILE-1) / SLICE_TILE;
+#pragma omp parallel for default(shared) schedule(dynamic,1)
+    for (size_t t=0; t<T_u*T_v; t++) {
+        size_t a0 = (t / T_v) * SLICE_TILE, b0 = (t % T_v) * SLICE_TILE;
+        size_t a1 = std::min(a0+SLICE_TILE, Npx[0]);
+        size_t b1 = std::min(b0+SLICE_TILE, Npx[1]);
+        for (size_t a=a0; a<a1; a++) {
+            double u = extent[0] + (a+0.5) * du;
+            for (size_t b=b0; b<b1; b++) {
+                double v = extent[2] + (b+0.5) * dv;
+                double r[3];
+                for (int k=0; k<3; k++)
+                    r[k] = origin[k] + u*e_u[k] + v*e_v[k];
+                size_t px = a*Npx[1] + b;
+                double norm_px;
+                _eval_sph_at_pos(kernel, tree, r, K, vals+K*px, pos, hsml,
+                                 dV, qty, periodic, norm_px);
+                if (norm)
+                    norm[px] = norm_px;
+            }
         }
     }
 
-    if (octree == NULL) {
-        //printf("delete tree...\n");
+    if (octree == NULL)
         delete tree;
-    }
 }
-
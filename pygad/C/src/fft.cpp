@@ -0,0 +1,217 @@
+#include "fft.hpp"
+
+FFT::FFT(size_t n, int sign)
+    : _n(n), _sign(sign<0 ? -1 : 1), _factors(), _twiddle(n)
+{
+    assert(n > 0);
+    // factorize, smallest factors first
+    size_t m = n;
+    for (size_t p=2; p*p<=m; p++) {
+        while (m % p == 0) {
+            _factors.push_back(p);
+            m /= p;
+        }
+    }
+    if (m > 1)
+        _factors.push_back(m);
+
+    for (size_t j=0; j<n; j++)
+        _twiddle[j] = std::polar(1.0, _sign * 2.0*M_PI * double(j) / n);
+}
+
+void FFT::_transform(const cmplx *in, size_t stride, cmplx *out,
+                     size_t n, unsigned level) const {
+    if (n == 1) {
+        out[0] = in[0];
+        return;
+    }
+    // decimation in time: transform the p interleaved sub-sequences...
+    size_t p = _factors[level];
+    size_t m = n / p;
+    for (size_t q=0; q<p; q++)
+        _transform(in+q*stride, stride*p, out+q*m, m, level+1);
+
+    // ...and combine them with p-point DFTs
+    size_t tw_step = _n / n;    // twiddle W_n^j is at _twiddle[j*tw_step]
+    cmplx buf_stack[8];
+    std::vector<cmplx> buf_heap;
+    cmplx *buf = buf_stack;
+    if (p > 8) {
+        buf_heap.resize(p);
+        buf = buf_heap.data();
+    }
+    for (size_t k=0; k<m; k++) {
+        for (size_t q=0; q<p; q++)
+            buf[q] = out[q*m+k] * _twiddle[(q*k*tw_step) % _n];
+        if (p == 2) {
+            out[k]   = buf[0] + buf[1];
+            out[m+k] = buf[0] - buf[1];
+        } else {
+            for (size_t s=0; s<p; s++) {
+                cmplx X = buf[0];
+                for (size_t q=1; q<p; q++)
+                    X += buf[q] * _twiddle[((q*s) % p) * m * tw_step];
+                out[s*m+k] = X;
+            }
+        }
+    }
+}
+
+void FFT::operator()(cmplx *data, cmplx *scratch, size_t stride) const {
+    _transform(data, stride, scratch, _n, 0);
+    for (size_t j=0; j<_n; j++)
+        data[j*stride] = scratch[j];
+}
+
+#ifdef HAVE_FFTW
+#include <fftw3.h>
+
+// plan (the planner is not thread-safe), execute, and destroy an in-place
+// real-to-complex (forward) or complex-to-real (backward) transform
+static void _fftw_rfft_3D(const size_t n[3], double *data, bool forward) {
+    static bool threads_initialized = false;
+    fftw_plan plan;
+#pragma omp critical (fftw_plan)
+    {
+    if (not threads_initialized) {
+        fftw_init_threads();
+        threads_initialized = true;
+    }
+    fftw_plan_with_nthreads(omp_get_max_threads());
+    if (forward) {
+        plan = fftw_plan_dft_r2c_3d(n[0], n[1], n[2], data,
+                                    (fftw_complex *)data, FFTW_ESTIMATE);
+    } else {
+        plan = fftw_plan_dft_c2r_3d(n[0], n[1], n[2], (fftw_complex *)data,
+                                    data, FFTW_ESTIMATE);
+    }
+    }
+    fftw_execute(plan);
+#pragma omp critical (fftw_plan)
+    fftw_destroy_plan(plan);
+}
+
+void rfft_3D(const size_t n[3], double *data) {
+    _fftw_rfft_3D(n, data, true);
+}
+
+void irfft_3D(const size_t n[3], double *data) {
+    _fftw_rfft_3D(n, data, false);
+}
+
+#else
+
+// the number of lines transformed together along the strided axes (for
+// contiguous memory access)
+#define RFFT_LINE_BATCH 16
+
+// Complex transforms (of the given sign) along the first two axes of the
+// n[0] x n[1] x (n[2]/2+1) complex grid c, done in batches of neighbouring
+// lines gathered into a contiguous buffer.
+static void _fft_lines(const size_t n[3], cmplx *c, int sign) {
+    const size_t Nz = n[2]/2 + 1;
+    for (int axis=1; axis>=0; axis--) {
+        const size_t L = n[axis];
+        const size_t stride = axis==1 ? Nz : n[1]*Nz;
+        const size_t N_outer = axis==1 ? n[0] : 1;
+        const size_t N_inner = axis==1 ? Nz : n[1]*Nz;
+        const size_t N_batches = (N_inner + RFFT_LINE_BATCH-1) / RFFT_LINE_BATCH;
+#pragma omp parallel default(shared)
+        {
+        FFT fft(L, sign);
+        std::vector<cmplx> buf(L*RFFT_LINE_BATCH), scratch(L);
+#pragma omp for schedule(static)
+        for (size_t t=0; t<N_outer*N_batches; t++) {
+            size_t o = t / N_batches;
+            size_t i0 = (t % N_batches) * RFFT_LINE_BATCH;
+            size_t B = std::min<size_t>(RFFT_LINE_BATCH, N_inner-i0);
+            cmplx *base = c + o*L*stride + i0;
+            for (size_t j=0; j<L; j++) {
+                for (size_t b=0; b<B; b++)
+                    buf[b*L+j] = base[j*stride+b];
+            }
+            for (size_t b=0; b<B; b++)
+                fft(&buf[b*L], scratch.data());
+            for (size_t j=0; j<L; j++) {
+                for (size_t b=0; b<B; b++)
+                    base[j*stride+b] = buf[b*L+j];
+            }
+        }
+        }
+    }
+}
+
+void rfft_3D(const size_t n[3], double *data) {
+    assert(n[2] % 2 == 0);
+    const size_t M = n[2] / 2;
+    const size_t Nz = M + 1;
+    cmplx *c = (cmplx *)data;
+
+    // along the last axis: a real transform of length 2M by a complex one of
+    // length M of the even and odd values as real and imaginary parts
+    std::vector<cmplx> tw(M+1);
+    for (size_t k=0; k<=M; k++)
+        tw[k] = std::polar(1.0, -M_PI * double(k) / M);
+#pragma omp parallel default(shared)
+    {
+    FFT fft(M);
+    std::vector<cmplx> scratch(M);
+#pragma omp for schedule(static)
+    for (size_t row=0; row<n[0]*n[1]; row++) {
+        cmplx *z = c + row*Nz;
+        fft(z, scratch.data());
+        cmplx Z0 = z[0];
+        z[0] = Z0.real() + Z0.imag();
+        z[M] = Z0.real() - Z0.imag();
+        for (size_t k=1; 2*k<=M; k++) {
+            size_t l = M - k;
+            cmplx Zk = z[k], Zl_c = std::conj(z[l]);
+            cmplx E_k = 0.5 * (Zk + Zl_c);
+            cmplx O_k = cmplx(0.0, -0.5) * (Zk - Zl_c);
+            // E_l = conj(E_k) and O_l = conj(O_k)
+            z[k] = E_k + tw[k] * O_k;
+            z[l] = std::conj(E_k) + tw[l] * std::conj(O_k);
+        }
+    }
+    }
+
+    _fft_lines(n, c, -1);
+}
+
+void irfft_3D(const size_t n[3], double *data) {
+    assert(n[2] % 2 == 0);
+    const size_t M = n[2] / 2;
+    const size_t Nz = M + 1;
+    cmplx *c = (cmplx *)data;
+
+    _fft_lines(n, c, +1);
+
+    // along the last axis: the inverse of the above, combining the halves of
+    // the spectrum to the one of the even and odd values as real and
+    // imaginary parts (the factor 2 keeps the result unnormalized)
+    std::vector<cmplx> tw(M+1);
+    for (size_t k=0; k<=M; k++)
+        tw[k] = std::polar(1.0, M_PI * double(k) / M);
+#pragma omp parallel default(shared)
+    {
+    FFT fft(M, +1);
+    std::vector<cmplx> scratch(M);
+#pragma omp for schedule(static)
+    for (size_t row=0; row<n[0]*n[1]; row++) {
+        cmplx *z = c + row*Nz;
+        double X0 = z[0].real(), XM = z[M].real();
+        z[0] = cmplx(X0 + XM, X0 - XM);
+        for (size_t k=1; 2*k<=M; k++) {
+            size_t l = M - k;
+            cmplx Xk = z[k], Xl = z[l];
+            cmplx E_k = Xk + std::conj(Xl), O_k = (Xk - std::conj(Xl)) * tw[k];
+            cmplx E_l = Xl + std::conj(Xk), O_l = (Xl - std::conj(Xk)) * tw[l];
+            z[k] = E_k + cmplx(0.0, 1.0) * O_k;
+            z[l] = E_l + cmplx(0.0, 1.0) * O_l;
+        }
+        fft(z, scratch.data());
+    }
+    }
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include "histogram.hpp"
+
+#include <vector>
+#include <limits>
+
+extern "C"
+void histogram_dd(size_t N,
+                  size_t D,
+                  const double *pnts,
+                  const size_t *Nbins,
+                  const double *extent,
+                  const int *log_axis,
+                  size_t K,
+                  const double *qty,
+                  double *count,
+                  double *sum,
+                  double *mean,
+                  double *var,
+                  double *min,
+                  double *max) {
+    // the lower edges and the bins per unit along each axis
+    std::vector<double> lo(D), upper(D), scale(D);
+    size_t N_tot = 1;
+    for (size_t d=0; d<D; d++) {
+        double a = extent[2*d], b = extent[2*d+1];
+        if (log_axis[d]) {
+            assert(a > 0.0);
+            a = std::log(a);
+            b = std::log(b);
+        }
+        assert(a < b and Nbins[d] > 0);
+        lo[d] = a;
+        upper[d] = b;
+        scale[d] = Nbins[d] / (b - a);
+        N_tot *= Nbins[d];
+    }
+
+    // the flat index of the bin of the point i (or N_tot, if not binned)
+    auto bin = [&](size_t i) {
+        size_t idx = 0;
+        for (size_t d=0; d<D; d++) {
+            double x = pnts[i*D+d];
+            if (log_axis[d]) {
+                if (not (x > 0.0))
+                    return N_tot;
+                x = std::log(x);
+            }
+            double u = (x - lo[d]) * scale[d];
+            if (not (u >= 0.0) or x > upper[d])
+                return N_tot;
+            size_t b = std::min(size_t(u), Nbins[d]-1);
+            idx = idx * Nbins[d] + b;
+        }
+        return idx;
+    };
+
+    // the layout of the thread-local bins: the counts, then per quantity its
+    // sum and, as needed, its sum of squared deviations, minimum, and maximum
+    const bool do_var = var != NULL;
+    const bool do_min = min != NULL;
+    const bool do_max = max != NULL;
+    const size_t width = 1 + do_var + do_min + do_max;
+    const size_t stride = 1 + K * width;
+    const double inf = std::numeric_limits<double>::infinity();
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    auto init_bin = [&](double *bin_b) {
+        bin_b[0] = 0.0;
+        for (size_t k=0; k<K; k++) {
+            double *s = bin_b + 1 + k*width;
+            size_t n = 0;
+            s[n++] = 0.0;
+            if (do_var) s[n++] = 0.0;
+            if (do_min) s[n++] = inf;
+            if (do_max) s[n++] = -inf;
+        }
+    };
+    auto add_point = [&](double *bin_b, size_t i) {
+        double n_old = bin_b[0];
+        bin_b[0] = n_old + 1.0;
+        for (size_t k=0; k<K; k++) {
+            double x = qty[i*K+k];
+            double *s = bin_b + 1 + k*width;
+            if (do_var and n_old > 0.0) {
+                // Welford's update with the mean of the previous points
+                double delta = x - s[0]/n_old;
+                s[1] += delta*delta * n_old / (n_old + 1.0);
+            }
+            s[0] += x;
+            size_t n = 1 + do_var;
+            if (do_min) {
+                if (x < s[n]) s[n] = x;
+                n++;
+            }
+            if (do_max) {
+                if (x > s[n]) s[n] = x;
+            }
+        }
+    };
+    auto merge_bins = [&](double *bin_b, const double *bin_t) {
+        double n_a = bin_b[0], n_b = bin_t[0];
+        if (n_b == 0.0)
+            return;
+        bin_b[0] = n_a + n_b;
+        for (size_t k=0; k<K; k++) {
+            double *s = bin_b + 1 + k*width;
+            const double *s_t = bin_t + 1 + k*width;
+            if (do_var) {
+                double delta = n_a > 0.0 ? s_t[0]/n_b - s[0]/n_a : 0.0;
+                s[1] += s_t[1] + delta*delta * n_a*n_b / (n_a + n_b);
+            }
+            s[0] += s_t[0];
+            size_t n = 1 + do_var;
+            if (do_min) {
+                s[n] = std::min(s[n], s_t[n]);
+                n++;
+            }
+            if (do_max)
+                s[n] = std::max(s[n], s_t[n]);
+        }
+    };
+    auto store_bin = [&](size_t b, const double *bin_b) {
+        double n_b = bin_b[0];
+        count[b] = n_b;
+        for (size_t k=0; k<K; k++) {
+            const double *s = bin_b + 1 + k*width;
+            size_t n = 1 + do_var;
+            if (sum)
+                sum[b*K+k] = s[0];
+            if (mean)
+                mean[b*K+k] = n_b > 0.0 ? s[0] / n_b : nan;
+            if (do_var)
+                var[b*K+k] = n_b > 0.0 ? s[1] / n_b : nan;
+            if (do_min) {
+                min[b*K+k] = n_b > 0.0 ? s[n] : nan;
+                n++;
+            }
+            if (do_max)
+                max[b*K+k] = n_b > 0.0 ? s[n] : nan;
+        }
+    };
+
+    int N_threads = omp_get_max_threads();
+    if (N_threads > 1 and N_threads * N_tot * stride > HISTOGRAM_MAX_LOCAL_BINS) {
+        // too many bins for copies per thread: find the bins of a chunk of
+        // points first, then let each thread go through all of them, binning
+        // only those in its own block of bins (in the order of the points)
+        std::vector<size_t> idx(std::min(N, size_t(HISTOGRAM_CHUNK)));
+        std::vector<double> acc(N_tot * stride);
+#pragma omp parallel default(shared)
+        {
+        const size_t N_t = omp_get_num_threads(), t = omp_get_thread_num();
+        const size_t b_min = t*N_tot/N_t, b_max = (t+1)*N_tot/N_t;
+        for (size_t b=b_min; b<b_max; b++)
+            init_bin(acc.data() + b*stride);
+        for (size_t i0=0; i0<N; i0+=HISTOGRAM_CHUNK) {
+            const size_t i1 = std::min(N, i0+HISTOGRAM_CHUNK);
+#pragma omp for schedule(static)
+            for (size_t i=i0; i<i1; i++)
+                idx[i-i0] = bin(i);
+            for (size_t i=i0; i<i1; i++) {
+                size_t b = idx[i-i0];
+                if (b_min <= b and b < b_max)
+                    add_point(acc.data() + b*stride, i);
+            }
+            // do not overwrite the indices before all threads are done
+#pragma omp barrier
+        }
+        for (size_t b=b_min; b<b_max; b++)
+            store_bin(b, acc.data() + b*stride);
+        }
+        return;
+    }
+
+    std::vector<double> acc(N_threads * N_tot * stride);
+#pragma omp parallel default(shared)
+    {
+    double *acc_t = acc.data() + omp_get_thread_num() * N_tot * stride;
+    for (size_t b=0; b<N_tot; b++)
+        init_bin(acc_t + b*stride);
+#pragma omp for schedule(static)
+    for (size_t i=0; i<N; i++) {
+        size_t b = bin(i);
+        if (b == N_tot)
+            continue;
+        add_point(acc_t + b*stride, i);
+    }
+
+    // merge the threads' bins (in parallel over the bins)
+#pragma omp for schedule(static)
+    for (size_t b=0; b<N_tot; b++) {
+        double *bin_b = acc.data() + b*stride;
+        for (int t=1; t<N_threads; t++)
+            merge_bins(bin_b, acc.data() + (t*N_tot + b)*stride);
+        store_bin(b, bin_b);
+    }
+    }
+}
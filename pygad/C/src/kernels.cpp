@@ -35,6 +35,17 @@ std::map<std::string,Kernel<3>> kernels = {
     {"Wendland C6", Kernel<3>(WENDLAND_C6)},
 };
 
+const double GAUSS_LEGENDRE_8_X[8] = {
+    -0.9602898564975363, -0.7966664774136267, -0.5255324099163290,
+    -0.1834346424956498,  0.1834346424956498,  0.5255324099163290,
+     0.7966664774136267,  0.9602898564975363,
+};
+const double GAUSS_LEGENDRE_8_W[8] = {
+    0.1012285362903763, 0.2223810344533745, 0.3137066458778873,
+    0.3626837833783620, 0.3626837833783620, 0.3137066458778873,
+    0.2223810344533745, 0.1012285362903763,
+};
+
 double _gsl_integ_w_along_b(double l, void *params) {
     struct _gsl_integ_w_along_b_param_t *param = (struct _gsl_integ_w_along_b_param_t *)params;
     return param->w( std::sqrt(l*l + std::pow(param->b,2.0)) );
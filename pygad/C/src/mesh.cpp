@@ -0,0 +1,250 @@
+#include "mesh.hpp"
+
+#include <vector>
+
+// The first cell (not yet wrapped) and the `order` weights along one axis of
+// the assignment of a particle at u (in units of cells, relative to the cell
+// centers).
+static inline long _mesh_weights(int order, double u, double *wts) {
+    long i;
+    double t;
+    switch (order) {
+        case 1:
+            wts[0] = 1.0;
+            return std::floor(u + 0.5);
+        case 2:
+            i = std::floor(u);
+            t = u - i;
+            wts[0] = 1.0 - t;
+            wts[1] = t;
+            return i;
+        case 3:
+            i = std::floor(u + 0.5);
+            t = u - i;
+            wts[0] = 0.5 * (0.5-t)*(0.5-t);
+            wts[1] = 0.75 - t*t;
+            wts[2] = 0.5 * (0.5+t)*(0.5+t);
+            return i - 1;
+        case 4:
+            i = std::floor(u);
+            t = u - i;
+            wts[0] = (1.0-t)*(1.0-t)*(1.0-t) / 6.0;
+            wts[1] = (4.0 - 6.0*t*t + 3.0*t*t*t) / 6.0;
+            wts[2] = (4.0 - 6.0*(1.0-t)*(1.0-t) + 3.0*(1.0-t)*(1.0-t)*(1.0-t)) / 6.0;
+            wts[3] = t*t*t / 6.0;
+            return i - 1;
+        default:
+            fprintf(stderr, "ERROR: unknown mass assignment order %d!\n", order);
+            assert(false);
+            return 0;
+    }
+}
+
+static inline size_t _wrap(long i, size_t Ng) {
+    long r = i % (long)Ng;
+    return r < 0 ? r + Ng : r;
+}
+
+// Assign onto a grid, whose rows along the last axis are `row` values long
+// (for padded grids). The grid is not zeroed.
+//
+// The particles are sorted into slabs of at least `order` planes along the
+// first axis. A particle only contributes to its slab and the next one, such
+// that all the slabs of the same parity can be filled in parallel.
+static void _mesh_assign(size_t N, const double *pos, const double *w,
+                         double L, size_t Ng, int order, double shift,
+                         size_t row, double *grid) {
+    const double cells_per_L = Ng / L;
+    const double offset = shift - 0.5;  // relative to the cell centers
+    size_t N_slabs = Ng / order;
+    N_slabs = N_slabs >= 2 ? N_slabs - N_slabs%2 : 1;
+    auto slab = [&](size_t i) {
+        double wts[4];
+        long first = _mesh_weights(order, pos[3*i]*cells_per_L + offset, wts);
+        return _wrap(first, Ng) * N_slabs / Ng;
+    };
+
+    // counting sort of the particles by their slab
+    int N_threads = omp_get_max_threads();
+    std::vector<size_t> counts(N_threads * N_slabs, 0);
+    std::vector<size_t> slab_start(N_slabs+1, 0);
+    std::vector<size_t> idx(N);
+#pragma omp parallel default(shared)
+    {
+    size_t *counts_t = counts.data() + omp_get_thread_num() * N_slabs;
+#pragma omp for schedule(static)
+    for (size_t i=0; i<N; i++)
+        counts_t[slab(i)]++;
+#pragma omp single
+    {
+    size_t n = 0;
+    for (size_t s=0; s<N_slabs; s++) {
+        slab_start[s] = n;
+        for (int t=0; t<N_threads; t++) {
+            size_t c = counts[t*N_slabs + s];
+            counts[t*N_slabs + s] = n;
+            n += c;
+        }
+    }
+    slab_start[N_slabs] = n;
+    }
+    // (the same static schedule as above assigns the same particles)
+#pragma omp for schedule(static)
+    for (size_t i=0; i<N; i++)
+        idx[counts_t[slab(i)]++] = i;
+    }
+
+    for (size_t parity=0; parity<2; parity++) {
+#pragma omp parallel for default(shared) schedule(dynamic,1)
+        for (size_t s=parity; s<N_slabs; s+=2) {
+            for (size_t n=slab_start[s]; n<slab_start[s+1]; n++) {
+                size_t i = idx[n];
+                double wts[3][4];
+                size_t first[3];
+                for (int k=0; k<3; k++) {
+                    first[k] = _wrap(_mesh_weights(order,
+                                                   pos[3*i+k]*cells_per_L + offset,
+                                                   wts[k]), Ng);
+                }
+                double w_i = w ? w[i] : 1.0;
+                for (int a=0; a<order; a++) {
+                    size_t ix = (first[0]+a) % Ng;
+                    double w_x = w_i * wts[0][a];
+                    for (int b=0; b<order; b++) {
+                        size_t iy = (first[1]+b) % Ng;
+                        double w_xy = w_x * wts[1][b];
+                        double *grid_xy = grid + (ix*Ng + iy)*row;
+                        for (int c=0; c<order; c++)
+                            grid_xy[(first[2]+c) % Ng] += w_xy * wts[2][c];
+                    }
+                }
+            }
+        }
+    }
+}
+
+extern "C"
+void mesh_assign(size_t N,
+                 const double *pos,
+                 const double *w,
+                 double L,
+                 size_t Ng,
+                 int order,
+                 double shift,
+                 double *grid) {
+    assert(1 <= order and order <= 4);
+    std::memset(grid, 0, Ng*Ng*Ng*sizeof(double));
+    _mesh_assign(N, pos, w, L, Ng, order, shift, Ng, grid);
+}
+
+// the signed frequency of the index i of a transform of length Ng
+static inline long _freq(size_t i, size_t Ng) {
+    return 2*i < Ng ? long(i) : long(i) - long(Ng);
+}
+
+// the Fourier transform of the mass assignment window at the frequency n
+static inline double _mesh_window(long n, size_t Ng, int order) {
+    if (n == 0)
+        return 1.0;
+    double x = M_PI * n / Ng;
+    return std::pow(std::sin(x) / x, order);
+}
+
+extern "C"
+void mesh_power_spectrum(size_t N,
+                         const double *pos,
+                         const double *w,
+                         double L,
+                         size_t Ng,
+                         int order,
+                         int interlace,
+                         size_t N_k,
+                         const double *k_edges,
+                         double *P_k,
+                         double *k_mean,
+                         double *N_modes) {
+    assert(1 <= order and order <= 4);
+    assert(Ng % 2 == 0);
+    const size_t Nz = Ng/2 + 1;
+    const size_t n[3] = {Ng, Ng, Ng};
+
+    double W = 0.0;
+    if (w) {
+        for (size_t i=0; i<N; i++)
+            W += w[i];
+    } else {
+        W = N;
+    }
+
+    std::vector<double> grid(Ng*Ng*2*Nz, 0.0);
+    _mesh_assign(N, pos, w, L, Ng, order, 0.0, 2*Nz, grid.data());
+    rfft_3D(n, grid.data());
+    cmplx *F = (cmplx *)grid.data();
+    std::vector<double> grid_shifted;
+    cmplx *F_shifted = NULL;
+    if (interlace) {
+        grid_shifted.resize(Ng*Ng*2*Nz, 0.0);
+        _mesh_assign(N, pos, w, L, Ng, order, 0.5, 2*Nz, grid_shifted.data());
+        rfft_3D(n, grid_shifted.data());
+        F_shifted = (cmplx *)grid_shifted.data();
+    }
+
+    // P(k) = L^3 |F_k|^2 / W^2 for the transform F of the weights on the grid
+    const double k_F = 2.0*M_PI / L;
+    const double norm = L*L*L / (W*W);
+    int N_threads = omp_get_max_threads();
+    std::vector<double> acc(N_threads * 3 * N_k, 0.0);
+#pragma omp parallel default(shared)
+    {
+    double *P_t = acc.data() + omp_get_thread_num() * 3 * N_k;
+    double *k_t = P_t + N_k;
+    double *N_t = k_t + N_k;
+#pragma omp for schedule(static)
+    for (size_t ix=0; ix<Ng; ix++) {
+        long nx = _freq(ix, Ng);
+        double W_x = _mesh_window(nx, Ng, order);
+        for (size_t iy=0; iy<Ng; iy++) {
+            long ny = _freq(iy, Ng);
+            double W_xy = W_x * _mesh_window(ny, Ng, order);
+            size_t offset = (ix*Ng + iy) * Nz;
+            for (size_t iz=0; iz<Nz; iz++) {
+                long nz = iz;
+                if (nx==0 and ny==0 and nz==0)
+                    continue;
+                double k = k_F * std::sqrt(double(nx*nx + ny*ny + nz*nz));
+                const double *e = std::upper_bound(k_edges, k_edges+N_k+1, k);
+                if (e == k_edges or e == k_edges+N_k+1)
+                    continue;
+                size_t b = e - k_edges - 1;
+
+                cmplx F_k = F[offset+iz];
+                if (interlace) {
+                    // the shift by half a cell is a phase in Fourier space
+                    double phase = M_PI * (nx + ny + nz) / Ng;
+                    F_k = 0.5 * (F_k + F_shifted[offset+iz]
+                                        * std::polar(1.0, phase));
+                }
+                double W_k = W_xy * _mesh_window(nz, Ng, order);
+                // the modes with nz>0 (except the Nyquist one) also stand for
+                // their complex conjugates at -n
+                double mult = (iz==0 or 2*iz==Ng) ? 1.0 : 2.0;
+                P_t[b] += mult * norm * std::norm(F_k) / (W_k*W_k);
+                k_t[b] += mult * k;
+                N_t[b] += mult;
+            }
+        }
+    }
+    }
+
+    for (size_t b=0; b<N_k; b++) {
+        double P = 0.0, k = 0.0, N_b = 0.0;
+        for (int t=0; t<N_threads; t++) {
+            P += acc[(t*3 + 0)*N_k + b];
+            k += acc[(t*3 + 1)*N_k + b];
+            N_b += acc[(t*3 + 2)*N_k + b];
+        }
+        P_k[b] = N_b>0 ? P / N_b : 0.0;
+        k_mean[b] = N_b>0 ? k / N_b : 0.0;
+        N_modes[b] = N_b;
+    }
+}
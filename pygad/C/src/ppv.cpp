@@ -0,0 +1,207 @@
+#include "ppv.hpp"
+
+#include <vector>
+#include <limits>
+
+extern "C"
+void sph_ppv_cube(size_t N,
+                  const double *pos,
+                  const double *vel,
+                  const double *hsml,
+                  const double *dV,
+                  const double *qty,
+                  const double *temp,
+                  double b_0,
+                  const double *v_turb,
+                  const double *extent,
+                  const size_t *Npx,
+                  const double *vel_extent,
+                  size_t N_vel,
+                  double *cube,
+                  double *moments,
+                  const char *kernel_,
+                  double periodic) {
+    Kernel<3> &kernel = kernels.at(kernel_);
+    kernel.require_table_size(2048,0);
+
+    const size_t N_px = Npx[0]*Npx[1];
+    if (cube)
+        memset(cube, 0, N_px*N_vel*sizeof(double));
+    if (moments)
+        memset(moments, 0, 3*N_px*sizeof(double));
+    if (N_px == 0 or N_vel == 0)
+        return;
+
+    double res[2];
+    for (int k=0; k<2; k++)
+        res[k] = (extent[2*k+1]-extent[2*k]) / Npx[k];
+    const double res_min = std::min(res[0], res[1]);
+    const double dA_px = res[0]*res[1];
+    const double dv = (vel_extent[1]-vel_extent[0]) / N_vel;
+    // add_line_profile takes the velocity of bin i to be vel_extent[0]+i*dv,
+    // hence pass it the centres of the first and the last bin
+    const double vel_centres[2] = {vel_extent[0] + 0.5*dv,
+                                   vel_extent[1] - 0.5*dv};
+
+    // the pixel ranges of the particles and the discrete grid integrals of
+    // their projected kernels (as in bin_sph), where S<0 marks particles that
+    // are binned into a single pixel
+    std::vector<size_t> i_min(2*N), i_max(2*N);
+    std::vector<double> S(N);
+#pragma omp parallel for default(shared) schedule(dynamic,1000)
+    for (size_t j=0; j<N; j++) {
+        const double *rj = pos+2*j;
+        const double hj = hsml[j];
+        size_t *lo = &i_min[2*j], *hi = &i_max[2*j];
+        bool out_of_grid = false;
+        for (int k=0; k<2; k++) {
+            lo[k] = std::min<double>(std::max((rj[k]-extent[2*k]-hj) / res[k], 0.0),
+                                     Npx[k]);
+            hi[k] = std::min<double>(std::max((rj[k]-extent[2*k]+hj) / res[k] + 1.0, 0.0),
+                                     Npx[k]);
+            if (lo[k] == 0 or hi[k] == Npx[k])
+                out_of_grid = true;
+        }
+
+        if (hj > H_lim_out_of_grid*res_min and out_of_grid) {
+            S[j] = 1.0;
+            continue;
+        }
+        double Sj = 0.0;
+        double grid_r[2];
+        for (size_t a=lo[0]; a<hi[0]; a++) {
+            grid_r[0] = extent[0] + (a+0.5)*res[0];
+            for (size_t b=lo[1]; b<hi[1]; b++) {
+                grid_r[1] = extent[2] + (b+0.5)*res[1];
+                double dj = dist_periodic<2>(grid_r, rj, periodic);
+                Sj += dA_px * kernel.proj_value(dj/hj, hj);
+            }
+        }
+        if (Sj < 1e-4) {
+            // the kernel falls between the pixel centres: take the pixel of
+            // the particle itself (if within the grid)
+            Sj = -1.0;
+            for (int k=0; k<2; k++) {
+                double u = (rj[k]-extent[2*k]) / res[k];
+                if (not (u >= 0.0 and u < Npx[k])) {
+                    lo[k] = hi[k] = 0;
+                } else {
+                    lo[k] = u;
+                    hi[k] = lo[k] + 1;
+                }
+            }
+        }
+        S[j] = Sj;
+    }
+
+    // the lists of the particles overlapping each tile of pixel rows
+    const size_t N_tiles = (Npx[0] + PPV_TILE_ROWS-1) / PPV_TILE_ROWS;
+    std::vector<size_t> tile_start(N_tiles+1, 0);
+    auto has_pixels = [&](size_t j) {
+        return i_min[2*j] < i_max[2*j] and i_min[2*j+1] < i_max[2*j+1]
+               and dV[j]*qty[j] != 0.0;
+    };
+    for (size_t j=0; j<N; j++) {
+        if (not has_pixels(j))
+            continue;
+        for (size_t t=i_min[2*j]/PPV_TILE_ROWS; t<=(i_max[2*j]-1)/PPV_TILE_ROWS; t++)
+            tile_start[t+1]++;
+    }
+    for (size_t t=0; t<N_tiles; t++)
+        tile_start[t+1] += tile_start[t];
+    std::vector<size_t> tile_parts(tile_start[N_tiles]);
+    {
+        std::vector<size_t> fill(tile_start.begin(), tile_start.end()-1);
+        for (size_t j=0; j<N; j++) {
+            if (not has_pixels(j))
+                continue;
+            for (size_t t=i_min[2*j]/PPV_TILE_ROWS; t<=(i_max[2*j]-1)/PPV_TILE_ROWS; t++)
+                tile_parts[fill[t]++] = j;
+        }
+    }
+
+    double *M0 = moments, *M1 = moments + N_px, *M2 = moments + 2*N_px;
+#pragma omp parallel default(shared)
+    {
+    // the velocity profile of the current particle
+    std::vector<size_t> prof_i;
+    std::vector<double> prof_f;
+#pragma omp for schedule(dynamic,1)
+    for (size_t t=0; t<N_tiles; t++) {
+        const size_t row_min = t*PPV_TILE_ROWS;
+        const size_t row_max = std::min(row_min+PPV_TILE_ROWS, Npx[0]);
+        for (size_t p=tile_start[t]; p<tile_start[t+1]; p++) {
+            const size_t j = tile_parts[p];
+            const double *rj = pos+2*j;
+            const double hj = hsml[j];
+
+            prof_i.clear();
+            prof_f.clear();
+            double f_0 = 0.0, f_1 = 0.0, f_2 = 0.0;
+            auto add = [&](size_t i, double Dtb, double v) {
+                prof_i.push_back(i);
+                prof_f.push_back(Dtb);
+                f_0 += Dtb;
+                f_1 += Dtb * v;
+                f_2 += Dtb * v*v;
+            };
+            double bj = line_b_param(temp ? temp[j] : 0.0, b_0, v_turb, j);
+            if (bj > 0.0) {
+                add_line_profile(vel[j], bj, 0.0, 0.0, 0.0, vel_centres, N_vel, dv, add);
+            } else {
+                double u = (vel[j] - vel_extent[0]) / dv;
+                if (u >= 0.0 and u < N_vel)
+                    add(size_t(u), 1.0, vel_extent[0] + (size_t(u)+0.5)*dv);
+            }
+            if (prof_i.empty())
+                continue;
+
+            const double Sj = S[j];
+            const double DQj = Sj < 0.0 ? dV[j] * qty[j] / dA_px
+                                        : dV[j] * qty[j] / Sj;
+            double grid_r[2];
+            const size_t a_min = std::max(i_min[2*j], row_min);
+            const size_t a_max = std::min(i_max[2*j], row_max);
+            for (size_t a=a_min; a<a_max; a++) {
+                grid_r[0] = extent[0] + (a+0.5)*res[0];
+                for (size_t b=i_min[2*j+1]; b<i_max[2*j+1]; b++) {
+                    double w = DQj;
+                    if (Sj >= 0.0) {
+                        grid_r[1] = extent[2] + (b+0.5)*res[1];
+                        double dj = dist_periodic<2>(grid_r, rj, periodic);
+                        w *= kernel.proj_value(dj/hj, hj);
+                        if (w == 0.0)
+                            continue;
+                    }
+                    const size_t I = a*Npx[1] + b;
+                    if (cube) {
+                        double *spec = cube + I*N_vel;
+                        for (size_t n=0; n<prof_i.size(); n++)
+                            spec[prof_i[n]] += w * prof_f[n];
+                    }
+                    if (moments) {
+                        M0[I] += w * f_0;
+                        M1[I] += w * f_1;
+                        M2[I] += w * f_2;
+                    }
+                }
+            }
+        }
+    }
+
+    if (moments) {
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+#pragma omp for schedule(static)
+        for (size_t I=0; I<N_px; I++) {
+            double m_0 = M0[I];
+            if (m_0 == 0.0) {
+                M1[I] = M2[I] = nan;
+                continue;
+            }
+            double m_1 = M1[I] / m_0;
+            M1[I] = m_1;
+            M2[I] = std::sqrt(std::max(M2[I]/m_0 - m_1*m_1, 0.0));
+        }
+    }
+    }
+}
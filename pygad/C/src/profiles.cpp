@@ -0,0 +1,72 @@
+#include "profiles.hpp"
+
+#include <vector>
+
+extern "C"
+void sph_radial_profile(size_t N,
+                        const double *pos,
+                        const double *hsml,
+                        size_t K,
+                        const double *qty,
+                        const double *center,
+                        int proj,
+                        size_t N_bins,
+                        const double *r_edges,
+                        const char *kernel_,
+                        double *profile) {
+    Kernel<3> kernel(kernel_);
+    kernel.require_shell_table_size(SHELL_TABLE_SIZE);
+
+    int N_threads = omp_get_max_threads();
+    std::vector<double> acc(N_threads * N_bins * K, 0.0);
+#pragma omp parallel default(shared)
+    {
+    double *prof_t = acc.data() + omp_get_thread_num() * N_bins * K;
+#pragma omp for schedule(dynamic,1000)
+    for (size_t j=0; j<N; j++) {
+        double r2 = 0.0;
+        for (int k=0; k<3; k++) {
+            if (k == proj)
+                continue;
+            double dx = pos[3*j+k] - center[k];
+            r2 += dx*dx;
+        }
+        double r = std::sqrt(r2);
+        double H = hsml[j];
+        const double *qty_j = qty + j*K;
+        auto mass_within = [&](double R) {
+            if (H <= 0.0)
+                return r < R ? 1.0 : 0.0;
+            return proj < 0 ? kernel.mass_within_sphere(R, r, H)
+                            : kernel.mass_within_circle(R, r, H);
+        };
+
+        // the first edge that cuts the kernel (or lies beyond it)
+        size_t e = std::upper_bound(r_edges, r_edges+N_bins+1, r-H) - r_edges;
+        if (e > N_bins)
+            continue;
+        double M_below = e==0 ? mass_within(r_edges[0]) : 0.0;
+        if (e == 0)
+            e = 1;
+        for (; e<=N_bins; e++) {
+            double M = mass_within(r_edges[e]);
+            double f = M - M_below;
+            if (f > 0.0) {
+                double *prof_b = prof_t + (e-1)*K;
+                for (size_t k=0; k<K; k++)
+                    prof_b[k] += f * qty_j[k];
+            }
+            if (M >= 1.0)
+                break;
+            M_below = M;
+        }
+    }
+    }
+
+    std::memset(profile, 0, N_bins*K*sizeof(double));
+    for (int t=0; t<N_threads; t++) {
+        const double *prof_t = acc.data() + t * N_bins * K;
+        for (size_t i=0; i<N_bins*K; i++)
+            profile[i] += prof_t[i];
+    }
+}
@@ -0,0 +1,313 @@
+#include "smoothing.hpp"
+
+#include <vector>
+
+namespace {
+// the convolution kernel on the grid: either separable with the same 1D
+// weights `w1D` (from -R to R) along each axis, or with the weights `w` at the
+// offsets `off` (in cells along the axes of the 3D view of the grid)
+struct Stencil {
+    bool separable;
+    long R[3];
+    std::vector<double> w1D;
+    std::vector<long> off;
+    std::vector<double> w;
+
+    size_t num_weights() const {
+        if (not separable)
+            return w.size();
+        size_t N = 0;
+        for (int a=0; a<3; a++)
+            N += R[a] ? 2*R[a]+1 : 0;
+        return N;
+    }
+};
+}
+
+// the projected kernel (in units of its norm) at q, integrated along the line
+// of sight in four pieces by Gauss-Legendre quadratures
+static double _proj_kernel(const Kernel<3> &kernel, double q) {
+    double l_max = std::sqrt(std::max(1.0 - q*q, 0.0));
+    double I = 0.0;
+    for (int p=0; p<4; p++) {
+        for (int n=0; n<8; n++) {
+            double l = l_max/4.0 * (p + 0.5*(1.0 + GAUSS_LEGENDRE_8_X[n]));
+            I += GAUSS_LEGENDRE_8_W[n]
+                 * kernel.value(std::sqrt(q*q + l*l), 1.0);
+        }
+    }
+    return 2.0 * I * l_max/8.0;
+}
+
+static Stencil _make_stencil(size_t D, double sml, const char *kernel_) {
+    Stencil st;
+    if (not strcmp(kernel_, "gaussian")) {
+        st.separable = true;
+        // rounded as by scipy.ndimage.gaussian_filter
+        long R = long(SMOOTH_GAUSS_TRUNCATE * sml + 0.5);
+        st.R[0] = D==3 ? R : 0;
+        st.R[1] = st.R[2] = R;
+        st.w1D.resize(2*R+1);
+        double W = 0.0;
+        for (long t=-R; t<=R; t++) {
+            st.w1D[t+R] = std::exp(-0.5 * t*t / (sml*sml));
+            W += st.w1D[t+R];
+        }
+        for (double &w : st.w1D)
+            w /= W;
+        return st;
+    }
+
+    Kernel<3> kernel(kernel_);
+    st.separable = false;
+    long R = std::ceil(sml);
+    st.R[0] = D==3 ? R : 0;
+    st.R[1] = st.R[2] = R;
+    double W = 0.0;
+    for (long i=-st.R[0]; i<=st.R[0]; i++) {
+        for (long j=-R; j<=R; j++) {
+            for (long k=-R; k<=R; k++) {
+                double q = std::sqrt(double(i*i + j*j + k*k)) / sml;
+                if (q >= 1.0)
+                    continue;
+                double w = D==3 ? kernel.value_ql1(q, 1.0)
+                                : _proj_kernel(kernel, q);
+                if (w <= 0.0)
+                    continue;
+                st.off.insert(st.off.end(), {i, j, k});
+                st.w.push_back(w);
+                W += w;
+            }
+        }
+    }
+    for (double &w : st.w)
+        w /= W;
+    return st;
+}
+
+static inline long _wrap(long i, long n) {
+    long r = i % n;
+    return r < 0 ? r + n : r;
+}
+
+// the number of lines convolved together along the strided axes (for
+// contiguous memory access)
+#define SMOOTH_LINE_BATCH 16
+
+// Convolve the grid of the (3D) shape n with the separable stencil, axis by
+// axis. The lines along an axis are gathered, padded by R[a] values at both
+// ends, into a buffer and written back convolved.
+static void _smooth_separable(const size_t n[3], double *grid,
+                              const Stencil &st, bool periodic, double cval) {
+    for (int a=0; a<3; a++) {
+        const long R = st.R[a];
+        if (R == 0)
+            continue;
+        const size_t L = n[a];
+        const size_t stride = a==2 ? 1 : (a==1 ? n[2] : n[1]*n[2]);
+        const size_t N_outer = a==0 ? 1 : (a==1 ? n[0] : n[0]*n[1]);
+        const size_t N_inner = stride;
+        const size_t B_max = std::min<size_t>(SMOOTH_LINE_BATCH, N_inner);
+        const size_t N_batches = (N_inner + B_max-1) / B_max;
+        const size_t L_pad = L + 2*R;
+#pragma omp parallel default(shared)
+        {
+        std::vector<double> buf(L_pad*B_max);
+#pragma omp for schedule(static)
+        for (size_t t=0; t<N_outer*N_batches; t++) {
+            size_t o = t / N_batches;
+            size_t i0 = (t % N_batches) * B_max;
+            size_t B = std::min(B_max, N_inner-i0);
+            double *base = grid + o*L*stride + i0;
+            for (long j=-R; j<long(L)+R; j++) {
+                bool inside = 0 <= j and j < long(L);
+                size_t jj = inside ? j : (periodic ? _wrap(j, L) : 0);
+                for (size_t b=0; b<B; b++) {
+                    buf[b*L_pad + j+R] = (inside or periodic)
+                                         ? base[jj*stride+b] : cval;
+                }
+            }
+            for (size_t b=0; b<B; b++) {
+                const double *line = &buf[b*L_pad];
+                for (size_t j=0; j<L; j++) {
+                    double s = 0.0;
+                    for (long u=0; u<=2*R; u++)
+                        s += st.w1D[u] * line[j+u];
+                    base[j*stride+b] = s;
+                }
+            }
+        }
+        }
+    }
+}
+
+// Convolve the grid of the (3D) shape n directly with the general stencil by
+// summing over the weights for each row of a padded copy of the grid.
+static void _smooth_direct(const size_t n[3], double *grid,
+                           const Stencil &st, bool periodic, double cval) {
+    size_t P[3];
+    for (int a=0; a<3; a++)
+        P[a] = n[a] + 2*st.R[a];
+    std::vector<double> pad(P[0]*P[1]*P[2]);
+#pragma omp parallel for default(shared) schedule(static)
+    for (size_t row=0; row<P[0]*P[1]; row++) {
+        long i = long(row / P[1]) - st.R[0], j = long(row % P[1]) - st.R[1];
+        bool inside = 0 <= i and i < long(n[0]) and 0 <= j and j < long(n[1]);
+        double *pad_row = pad.data() + row*P[2];
+        if (not inside and not periodic) {
+            std::fill(pad_row, pad_row+P[2], cval);
+            continue;
+        }
+        const double *grid_row = grid
+            + (_wrap(i, n[0])*n[1] + _wrap(j, n[1])) * n[2];
+        for (long k=-st.R[2]; k<long(n[2])+st.R[2]; k++) {
+            bool inside_k = 0 <= k and k < long(n[2]);
+            pad_row[k+st.R[2]] = (inside_k or periodic) ? grid_row[_wrap(k, n[2])]
+                                                        : cval;
+        }
+    }
+
+    // the offsets of the weights in the padded grid
+    std::vector<long> off(st.w.size());
+    for (size_t s=0; s<st.w.size(); s++) {
+        off[s] = (st.off[3*s]*long(P[1]) + st.off[3*s+1])*long(P[2])
+               + st.off[3*s+2];
+    }
+
+#pragma omp parallel for default(shared) schedule(static)
+    for (size_t row=0; row<n[0]*n[1]; row++) {
+        size_t i = row / n[1], j = row % n[1];
+        double *out = grid + row*n[2];
+        const double *in = pad.data()
+            + ((i+st.R[0])*P[1] + j+st.R[1])*P[2] + st.R[2];
+        std::fill(out, out+n[2], 0.0);
+        for (size_t s=0; s<st.w.size(); s++) {
+            const double *in_s = in + off[s];
+            const double w = st.w[s];
+            for (size_t k=0; k<n[2]; k++)
+                out[k] += w * in_s[k];
+        }
+    }
+}
+
+// the smallest size >= n (and even, if requested) without prime factors
+// larger than 7, for fast transforms
+static size_t _fft_size(size_t n, bool even) {
+    for (size_t m=std::max<size_t>(n, 1); ; m++) {
+        if (even and m%2)
+            continue;
+        size_t r = m;
+        for (size_t p : {2, 3, 5, 7}) {
+            while (r % p == 0)
+                r /= p;
+        }
+        if (r == 1)
+            return m;
+    }
+}
+
+// Convolve the grid of the (3D) shape n with the stencil by FFTs of the grid,
+// which is zero-padded by at least R cells along each axis, if not periodic
+// (the constant `cval` is subtracted before and added after, since the
+// stencil is normalized).
+static void _smooth_fft(const size_t n[3], double *grid,
+                        const Stencil &st, bool periodic, double cval) {
+    size_t P[3];
+    for (int a=0; a<3; a++) {
+        if (periodic or st.R[a] == 0)
+            P[a] = n[a];
+        else
+            P[a] = _fft_size(n[a] + st.R[a], a==2);
+    }
+    assert(P[2] % 2 == 0);
+    const size_t Nz = P[2]/2 + 1;
+    const double shift = periodic ? 0.0 : cval;
+
+    std::vector<double> data(P[0]*P[1]*2*Nz, 0.0);
+#pragma omp parallel for default(shared) schedule(static)
+    for (size_t row=0; row<n[0]*n[1]; row++) {
+        size_t i = row / n[1], j = row % n[1];
+        const double *in = grid + row*n[2];
+        double *out = data.data() + (i*P[1] + j)*2*Nz;
+        for (size_t k=0; k<n[2]; k++)
+            out[k] = in[k] - shift;
+    }
+    rfft_3D(P, data.data());
+    cmplx *F = (cmplx *)data.data();
+
+    // the transform of the (real and symmetric) stencil is real
+    std::vector<double> K;
+    if (st.separable) {
+        // ...and for the separable one a product of the 1D transforms
+        std::vector<double> K_a[3];
+        for (int a=0; a<3; a++) {
+            size_t N_f = a==2 ? Nz : P[a];
+            K_a[a].assign(N_f, 1.0);
+            if (st.R[a] == 0)
+                continue;
+            for (size_t f=0; f<N_f; f++) {
+                double s = 0.0;
+                for (long t=-st.R[a]; t<=st.R[a]; t++)
+                    s += st.w1D[t+st.R[a]] * std::cos(2.0*M_PI * f*t / P[a]);
+                K_a[a][f] = s;
+            }
+        }
+#pragma omp parallel for default(shared) schedule(static)
+        for (size_t row=0; row<P[0]*P[1]; row++) {
+            double K_xy = K_a[0][row / P[1]] * K_a[1][row % P[1]];
+            for (size_t k=0; k<Nz; k++)
+                F[row*Nz + k] *= K_xy * K_a[2][k];
+        }
+    } else {
+        K.assign(P[0]*P[1]*2*Nz, 0.0);
+        for (size_t s=0; s<st.w.size(); s++) {
+            size_t i = _wrap(st.off[3*s], P[0]);
+            size_t j = _wrap(st.off[3*s+1], P[1]);
+            size_t k = _wrap(st.off[3*s+2], P[2]);
+            K[(i*P[1] + j)*2*Nz + k] += st.w[s];
+        }
+        rfft_3D(P, K.data());
+        const cmplx *K_f = (const cmplx *)K.data();
+#pragma omp parallel for default(shared) schedule(static)
+        for (size_t c=0; c<P[0]*P[1]*Nz; c++)
+            F[c] *= K_f[c].real();
+    }
+
+    irfft_3D(P, data.data());
+    const double norm = 1.0 / (double(P[0]) * P[1] * P[2]);
+#pragma omp parallel for default(shared) schedule(static)
+    for (size_t row=0; row<n[0]*n[1]; row++) {
+        size_t i = row / n[1], j = row % n[1];
+        double *out = grid + row*n[2];
+        const double *in = data.data() + (i*P[1] + j)*2*Nz;
+        for (size_t k=0; k<n[2]; k++)
+            out[k] = norm * in[k] + shift;
+    }
+}
+
+extern "C"
+void smooth_grid(size_t D,
+                 const size_t *Npx,
+                 double *grid,
+                 double sml,
+                 const char *kernel_,
+                 int periodic,
+                 double cval) {
+    assert(D == 2 or D == 3);
+    if (sml <= 0.0)
+        return;
+    // a 2D grid is taken as a single slab of a 3D one
+    size_t n[3] = {1, Npx[0], Npx[1]};
+    if (D == 3)
+        std::copy(Npx, Npx+3, n);
+
+    Stencil st = _make_stencil(D, sml, kernel_);
+    bool fft_possible = not periodic or n[2] % 2 == 0;
+    if (st.num_weights() > SMOOTH_DIRECT_MAX_WEIGHTS and fft_possible) {
+        _smooth_fft(n, grid, st, periodic, cval);
+    } else if (st.separable) {
+        _smooth_separable(n, grid, st, periodic, cval);
+    } else {
+        _smooth_direct(n, grid, st, periodic, cval);
+    }
+}
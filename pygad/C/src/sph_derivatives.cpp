@@ -0,0 +1,209 @@
+#include "sph_derivatives.hpp"
+
+// invert the (n x n) matrix A (row-major, overwritten) by Gauss-Jordan
+// elimination with partial pivoting into A_inv, return false if (nearly)
+// singular
+static bool _invert(int n, double *A, double *A_inv) {
+    double scale = 0.0;
+    for (int k=0; k<n*n; k++)
+        scale = std::max(scale, std::abs(A[k]));
+    for (int a=0; a<n; a++) {
+        for (int b=0; b<n; b++)
+            A_inv[n*a+b] = a==b ? 1.0 : 0.0;
+    }
+    for (int c=0; c<n; c++) {
+        int p = c;
+        for (int a=c+1; a<n; a++) {
+            if ( std::abs(A[n*a+c]) > std::abs(A[n*p+c]) )
+                p = a;
+        }
+        if ( not (std::abs(A[n*p+c]) > 1e-9 * scale) )
+            return false;
+        if ( p != c ) {
+            for (int b=0; b<n; b++) {
+                std::swap(A[n*p+b], A[n*c+b]);
+                std::swap(A_inv[n*p+b], A_inv[n*c+b]);
+            }
+        }
+        double inv_piv = 1.0 / A[n*c+c];
+        for (int b=0; b<n; b++) {
+            A[n*c+b] *= inv_piv;
+            A_inv[n*c+b] *= inv_piv;
+        }
+        for (int a=0; a<n; a++) {
+            if ( a == c )
+                continue;
+            double f = A[n*a+c];
+            for (int b=0; b<n; b++) {
+                A[n*a+b] -= f * A[n*c+b];
+                A_inv[n*a+b] -= f * A_inv[n*c+b];
+            }
+        }
+    }
+    return true;
+}
+
+extern "C"
+void sph_gradients(size_t M,
+                   double *r,
+                   const double *qty_at_r,
+                   size_t K,
+                   double *grads,
+                   size_t N,
+                   double *pos,
+                   double *hsml,
+                   double *dV,
+                   double *qty,
+                   double periodic,
+                   int corrected,
+                   const char *kernel_,
+                   void *octree) {
+    Kernel<3> kernel(kernel_);
+    kernel.require_deriv_table_size(SPH_DERIV_TABLE_SIZE);
+
+    Tree<3> *tree = NULL;
+    if (octree == NULL) {
+        tree = (Tree<3> *)new_octree_from_pos(N, pos);
+        assert(tree);
+        tree->fill_max_H(hsml);
+    } else {
+        tree = (Tree<3> *)octree;
+    }
+
+#pragma omp parallel default(shared)
+    {
+    // per quantity: sum_j dV_j A_j grad W_ij and sum_j dV_j A_j W_ij
+    std::vector<double> v(3*K), u(K);
+#pragma omp for schedule(dynamic,64)
+    for (size_t i=0; i<M; i++) {
+        // wrap the position into the periodic box around the tree's center
+        double ri[3];
+        for (int k=0; k<3; k++) {
+            ri[k] = r[3*i+k];
+            if (std::isfinite(periodic))
+                ri[k] = tree->center(k) + std::remainder(ri[k] - tree->center(k), periodic);
+        }
+
+        std::vector<size_t> ngbs = tree->ngbs_SPH(ri, hsml, pos, periodic, 0.0);
+
+        std::fill(v.begin(), v.end(), 0.0);
+        std::fill(u.begin(), u.end(), 0.0);
+        // the correction matrix C_ba, S_b = sum_j dV_j grad_b W_ij,
+        // m_a = sum_j dV_j W_ij (r_j - r_i)_a, and w0 = sum_j dV_j W_ij
+        double C[9] = {0.0}, S[3] = {0.0}, m[3] = {0.0}, w0 = 0.0;
+        for (const size_t j : ngbs) {
+            // r_i - r_j (minimum image)
+            double rij[3];
+            for (int k=0; k<3; k++) {
+                rij[k] = ri[k] - pos[3*j+k];
+                if (std::isfinite(periodic))
+                    rij[k] = std::remainder(rij[k], periodic);
+            }
+            double dj = std::sqrt(rij[0]*rij[0] + rij[1]*rij[1] + rij[2]*rij[2]);
+            double hj = hsml[j];
+            if ( dj >= hj )
+                continue;
+            double dVj_Wj = dV[j] * kernel.value_ql1(dj/hj, hj);
+            double dVj_dWj = dj > 0.0 ? dV[j] * kernel.deriv_value_ql1(dj/hj, hj) / dj : 0.0;
+            double gradW[3] = {dVj_dWj*rij[0], dVj_dWj*rij[1], dVj_dWj*rij[2]};
+
+            const double *qty_j = qty+(K*j);
+            for (size_t k=0; k<K; k++) {
+                for (int b=0; b<3; b++)
+                    v[3*k+b] += qty_j[k] * gradW[b];
+                u[k] += qty_j[k] * dVj_Wj;
+            }
+            for (int b=0; b<3; b++) {
+                S[b] += gradW[b];
+                m[b] -= dVj_Wj * rij[b];
+                for (int a=0; a<3; a++)
+                    C[3*b+a] -= rij[a] * gradW[b];
+            }
+            w0 += dVj_Wj;
+        }
+
+        double *grads_i = grads+(3*K*i);
+        double A[16], A_inv[16];
+        if ( qty_at_r ) {
+            for (int k=0; k<9; k++)
+                A[k] = C[k];
+            bool inv = corrected and _invert(3, A, A_inv);
+            for (size_t k=0; k<K; k++) {
+                double A_i = qty_at_r[K*i+k];
+                double g[3];
+                for (int b=0; b<3; b++)
+                    g[b] = v[3*k+b] - A_i * S[b];
+                for (int a=0; a<3; a++) {
+                    grads_i[3*k+a] = inv ? A_inv[3*a+0] * g[0]
+                                         + A_inv[3*a+1] * g[1]
+                                         + A_inv[3*a+2] * g[2]
+                                         : g[a];
+                }
+            }
+        } else {
+            // solve for the gradient and A_i at once:
+            //  [ C  S ] [grad A]   [ sum_j dV_j A_j grad W_ij ]
+            //  [ m w0 ] [  A_i ] = [ sum_j dV_j A_j W_ij      ]
+            for (int b=0; b<3; b++) {
+                for (int a=0; a<3; a++)
+                    A[4*b+a] = C[3*b+a];
+                A[4*b+3] = S[b];
+                A[4*3+b] = m[b];
+            }
+            A[4*3+3] = w0;
+            bool inv = corrected and _invert(4, A, A_inv);
+            for (size_t k=0; k<K; k++) {
+                if (inv) {
+                    for (int a=0; a<3; a++) {
+                        grads_i[3*k+a] = A_inv[4*a+0] * v[3*k+0]
+                                       + A_inv[4*a+1] * v[3*k+1]
+                                       + A_inv[4*a+2] * v[3*k+2]
+                                       + A_inv[4*a+3] * u[k];
+                    }
+                } else {
+                    // the Shepard interpolated value as A_i
+                    double A_i = w0 > 0.0 ? u[k] / w0 : 0.0;
+                    for (int b=0; b<3; b++)
+                        grads_i[3*k+b] = v[3*k+b] - A_i * S[b];
+                }
+            }
+        }
+    }
+    }
+
+    if (octree == NULL) {
+        delete tree;
+    }
+}
+
+extern "C"
+void sph_div_curl(size_t M,
+                  double *r,
+                  const double *vec_at_r,
+                  double *div,
+                  double *curl,
+                  size_t N,
+                  double *pos,
+                  double *hsml,
+                  double *dV,
+                  double *vec,
+                  double periodic,
+                  int corrected,
+                  const char *kernel_,
+                  void *octree) {
+    // the full (M x 3 x 3) tensors D_ab = d v_a / d x_b
+    std::vector<double> D(9*M);
+    sph_gradients(M, r, vec_at_r, 3, D.data(), N, pos, hsml, dV, vec,
+                  periodic, corrected, kernel_, octree);
+
+#pragma omp parallel for default(shared)
+    for (size_t i=0; i<M; i++) {
+        const double *D_i = &D[9*i];
+        div[i] = D_i[0] + D_i[4] + D_i[8];
+        if (curl) {
+            curl[3*i+0] = D_i[3*2+1] - D_i[3*1+2];
+            curl[3*i+1] = D_i[3*0+2] - D_i[3*2+0];
+            curl[3*i+2] = D_i[3*1+0] - D_i[3*0+1];
+        }
+    }
+}
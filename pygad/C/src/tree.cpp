@@ -1,4 +1,5 @@
 #include "tree.hpp"
+#include "regions.hpp"
 
 // 2**10 =  1e3 side length ratio
 // 2**15 = 33e3 side length ratio
@@ -18,36 +19,7 @@ extern "C" void *new_octree(const double center_[3], double side_2_) {
     return new Tree<3>(center_, side_2_);
 }
 extern "C" void *new_octree_from_pos(size_t N, const double *const pos) {
-    // find extent of positions
-    double min[3], max[3];
-    for (int k=0; k<3; k++) {
-        min[k] = pos[k];
-        max[k] = pos[k];
-    }
-    for (size_t j=1; j<N; j++) {
-        for (size_t k=0; k<3; k++) {
-            if (min[k] > pos[3*j+k])
-                min[k] = pos[3*j+k];
-            if (max[k] < pos[3*j+k])
-                max[k] = pos[3*j+k];
-        }
-    }
-
-    // calculate center and side length
-    double center[3];
-    double side_2 = 0.0;
-    for (int k=0; k<3; k++) {
-        center[k] = (min[k]+max[k]) / 2.0;
-        side_2 = fmax(side_2, (max[k]-min[k])/2.0);
-    }
-
-    // build tree
-    Tree<3> *tree = new Tree<3>(center, side_2);
-    assert(tree);
-    for (size_t j=0; j<N; j++)
-        tree->add_point(pos, j);
-
-    return tree;
+    return new_tree_from_pos<3>(N, pos);
 }
 extern "C" void fill_octree(void *const octree, size_t N, const double *const pos) {
     Tree<3> *tree = (Tree<3> *)octree;
@@ -102,13 +74,64 @@ extern "C" unsigned get_octree_octant(void *const octree, const double r[3]) {
     Tree<3> *const tree = (Tree<3> *)octree;
     return tree->get_oct(r);
 }
-extern "C" void get_octree_ngbs_within(void *const octree,
-                                       const double r[3], double H,
-                                       size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
-                                       const double *const pos,
-                                       const double periodic,
-                                       const int32_t *cond) {
-    const Tree<3> *tree = (const Tree<3> *)octree;
+extern "C" void *new_quadtree_from_pos(size_t N, const double *const pos) {
+    return new_tree_from_pos<2>(N, pos);
+}
+extern "C" void update_quadtree_max_H(void *const quadtree, const double *const H) {
+    Tree<2> *tree = (Tree<2> *)quadtree;
+    tree->fill_max_H(H);
+}
+extern "C" void update_quadtree_const_max_H(void *const quadtree, double H) {
+    Tree<2> *tree = (Tree<2> *)quadtree;
+    tree->fill_max_H(H);
+}
+extern "C" void free_quadtree(void *const quadtree) {
+    delete (Tree<2> *)quadtree;
+}
+extern "C" void get_quadtree_center(const void *const quadtree, double center[2]) {
+    const Tree<2> *tree = (const Tree<2> *)quadtree;
+    for (int i=0; i<2; i++)
+        center[i] = tree->center(i);
+}
+extern "C" double get_quadtree_side_2(const void *const quadtree) {
+    return ((const Tree<2> *)quadtree)->side_2();
+}
+extern "C" int get_quadtree_is_leaf(const void *const quadtree) {
+    return ((const Tree<2> *)quadtree)->is_leaf();
+}
+extern "C" unsigned get_quadtree_num_children(const void *const quadtree) {
+    return ((const Tree<2> *)quadtree)->num_children();
+}
+extern "C" size_t get_quadtree_tot_part(const void *const quadtree) {
+    return ((const Tree<2> *)quadtree)->tot_part();
+}
+extern "C" double get_quadtree_max_H(const void *const quadtree) {
+    return ((const Tree<2> *)quadtree)->max_H();
+}
+extern "C" size_t get_quadtree_max_depth(const void *const quadtree) {
+    return ((const Tree<2> *)quadtree)->get_max_depth();
+}
+extern "C" size_t get_quadtree_node_count(const void *const quadtree, int count_non_leaves) {
+    return ((const Tree<2> *)quadtree)->count_nodes(count_non_leaves);
+}
+extern "C" int get_quadtree_in_region(const void *const quadtree, const double r[2]) {
+    return ((const Tree<2> *)quadtree)->is_in_region(r);
+}
+extern "C" void *get_quadtree_child(void *const quadtree, int i) {
+    Tree<2> *const tree = (Tree<2> *)quadtree;
+    return tree->child(i);
+}
+extern "C" unsigned get_quadtree_quadrant(void *const quadtree, const double r[2]) {
+    Tree<2> *const tree = (Tree<2> *)quadtree;
+    return tree->get_oct(r);
+}
+
+template<int d>
+static void _get_ngbs_within(void *const tree_, const double r[d], double H,
+                             size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
+                             const double *const pos, const double periodic,
+                             const int32_t *cond) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
     std::vector<size_t> v_ngbs;
     if (cond) {
         v_ngbs = tree->ngbs_within_if(r, H, pos, periodic,
@@ -121,25 +144,23 @@ extern "C" void get_octree_ngbs_within(void *const octree,
         ngbs[i] = v_ngbs[i];
     }
 }
-extern "C" void get_octree_ngbs_SPH(void *const octree,
-                                    const double r[3], const double *const H,
-                                    size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
-                                    const double *const pos,
-                                    const double periodic,
-                                    const double tol) {
-    const Tree<3> *tree = (const Tree<3> *)octree;
+template<int d>
+static void _get_ngbs_SPH(void *const tree_, const double r[d], const double *const H,
+                          size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
+                          const double *const pos, const double periodic,
+                          const double tol) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
     std::vector<size_t> v_ngbs = tree->ngbs_SPH(r, H, pos, periodic, tol);
     *N_ngbs = std::min(v_ngbs.size(), max_ngbs);
     for (size_t i=0; i<*N_ngbs; i++) {
         ngbs[i] = v_ngbs[i];
     }
 }
-extern "C" size_t get_octree_next_ngb(void *const octree,
-                                      const double r[3],
-                                      const double *const pos,
-                                      const double periodic,
-                                      const int32_t *cond) {
-    const Tree<3> *tree = (const Tree<3> *)octree;
+template<int d>
+static size_t _get_next_ngb(void *const tree_, const double r[d],
+                            const double *const pos, const double periodic,
+                            const int32_t *cond) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
     std::pair<size_t,double> ngb;
     if (cond) {
         ngb = tree->next_ngb_with(r, pos, periodic,
@@ -150,3 +171,401 @@ extern "C" size_t get_octree_next_ngb(void *const octree,
     return ngb.first;
 }
 
+extern "C" void get_octree_ngbs_within(void *const octree,
+                                       const double r[3], double H,
+                                       size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
+                                       const double *const pos,
+                                       const double periodic,
+                                       const int32_t *cond) {
+    _get_ngbs_within<3>(octree, r, H, max_ngbs, ngbs, N_ngbs, pos, periodic, cond);
+}
+extern "C" void get_octree_ngbs_SPH(void *const octree,
+                                    const double r[3], const double *const H,
+                                    size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
+                                    const double *const pos,
+                                    const double periodic,
+                                    const double tol) {
+    _get_ngbs_SPH<3>(octree, r, H, max_ngbs, ngbs, N_ngbs, pos, periodic, tol);
+}
+extern "C" size_t get_octree_next_ngb(void *const octree,
+                                      const double r[3],
+                                      const double *const pos,
+                                      const double periodic,
+                                      const int32_t *cond) {
+    return _get_next_ngb<3>(octree, r, pos, periodic, cond);
+}
+extern "C" void get_quadtree_ngbs_within(void *const quadtree,
+                                         const double r[2], double H,
+                                         size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
+                                         const double *const pos,
+                                         const double periodic,
+                                         const int32_t *cond) {
+    _get_ngbs_within<2>(quadtree, r, H, max_ngbs, ngbs, N_ngbs, pos, periodic, cond);
+}
+extern "C" void get_quadtree_ngbs_SPH(void *const quadtree,
+                                      const double r[2], const double *const H,
+                                      size_t max_ngbs, size_t *ngbs, size_t *N_ngbs,
+                                      const double *const pos,
+                                      const double periodic,
+                                      const double tol) {
+    _get_ngbs_SPH<2>(quadtree, r, H, max_ngbs, ngbs, N_ngbs, pos, periodic, tol);
+}
+extern "C" size_t get_quadtree_next_ngb(void *const quadtree,
+                                        const double r[2],
+                                        const double *const pos,
+                                        const double periodic,
+                                        const int32_t *cond) {
+    return _get_next_ngb<2>(quadtree, r, pos, periodic, cond);
+}
+
+// run the queries in parallel and concatenate their results
+template<typename Q>
+static size_t _batch_query(size_t M, size_t max_tot, size_t *ngbs,
+                           size_t *offsets, Q query) {
+    std::vector<std::vector<size_t>> res(M);
+#pragma omp parallel for default(shared) schedule(dynamic,64)
+    for (size_t i=0; i<M; i++)
+        res[i] = query(i);
+
+    offsets[0] = 0;
+    for (size_t i=0; i<M; i++)
+        offsets[i+1] = offsets[i] + res[i].size();
+    size_t tot = offsets[M];
+    if (tot <= max_tot) {
+#pragma omp parallel for default(shared) schedule(static)
+        for (size_t i=0; i<M; i++)
+            std::copy(res[i].begin(), res[i].end(), ngbs+offsets[i]);
+    }
+    return tot;
+}
+
+template<int d>
+static size_t _get_ngbs_within_batch(void *const tree_, size_t M, const double *r,
+                                     const double *H, size_t max_tot, size_t *ngbs,
+                                     size_t *offsets, const double *const pos,
+                                     const double periodic) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
+    return _batch_query(M, max_tot, ngbs, offsets,
+            [&](size_t i){return tree->ngbs_within(r+d*i, H[i], pos, periodic);});
+}
+template<int d>
+static size_t _get_ngbs_SPH_batch(void *const tree_, size_t M, const double *r,
+                                  const double *const H, size_t max_tot, size_t *ngbs,
+                                  size_t *offsets, const double *const pos,
+                                  const double periodic, const double tol) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
+    return _batch_query(M, max_tot, ngbs, offsets,
+            [&](size_t i){return tree->ngbs_SPH(r+d*i, H, pos, periodic, tol);});
+}
+template<int d>
+static void _get_next_ngb_batch(void *const tree_, size_t M, const double *r,
+                                size_t *ngbs, const double *const pos,
+                                const double periodic) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
+#pragma omp parallel for default(shared) schedule(dynamic,64)
+    for (size_t i=0; i<M; i++) {
+        ngbs[i] = tree->next_ngb_with(r+d*i, pos, periodic,
+                                      [](size_t i){return true;}).first;
+    }
+}
+
+extern "C" size_t get_octree_ngbs_within_batch(void *const octree,
+                                               size_t M, const double *r,
+                                               const double *H,
+                                               size_t max_tot, size_t *ngbs,
+                                               size_t *offsets,
+                                               const double *const pos,
+                                               const double periodic) {
+    return _get_ngbs_within_batch<3>(octree, M, r, H, max_tot, ngbs, offsets, pos, periodic);
+}
+extern "C" size_t get_octree_ngbs_SPH_batch(void *const octree,
+                                            size_t M, const double *r,
+                                            const double *const H,
+                                            size_t max_tot, size_t *ngbs,
+                                            size_t *offsets,
+                                            const double *const pos,
+                                            const double periodic,
+                                            const double tol) {
+    return _get_ngbs_SPH_batch<3>(octree, M, r, H, max_tot, ngbs, offsets, pos, periodic, tol);
+}
+extern "C" void get_octree_next_ngb_batch(void *const octree,
+                                          size_t M, const double *r,
+                                          size_t *ngbs,
+                                          const double *const pos,
+                                          const double periodic) {
+    _get_next_ngb_batch<3>(octree, M, r, ngbs, pos, periodic);
+}
+extern "C" size_t get_quadtree_ngbs_within_batch(void *const quadtree,
+                                                 size_t M, const double *r,
+                                                 const double *H,
+                                                 size_t max_tot, size_t *ngbs,
+                                                 size_t *offsets,
+                                                 const double *const pos,
+                                                 const double periodic) {
+    return _get_ngbs_within_batch<2>(quadtree, M, r, H, max_tot, ngbs, offsets, pos, periodic);
+}
+extern "C" size_t get_quadtree_ngbs_SPH_batch(void *const quadtree,
+                                              size_t M, const double *r,
+                                              const double *const H,
+                                              size_t max_tot, size_t *ngbs,
+                                              size_t *offsets,
+                                              const double *const pos,
+                                              const double periodic,
+                                              const double tol) {
+    return _get_ngbs_SPH_batch<2>(quadtree, M, r, H, max_tot, ngbs, offsets, pos, periodic, tol);
+}
+extern "C" void get_quadtree_next_ngb_batch(void *const quadtree,
+                                            size_t M, const double *r,
+                                            size_t *ngbs,
+                                            const double *const pos,
+                                            const double periodic) {
+    _get_next_ngb_batch<2>(quadtree, M, r, ngbs, pos, periodic);
+}
+
+template<int d>
+static void _get_count_within_batch(void *const tree_, size_t M, const double *r,
+                                    const double *H, size_t *counts,
+                                    const double *const pos, const double periodic) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
+#pragma omp parallel for default(shared) schedule(dynamic,64)
+    for (size_t i=0; i<M; i++)
+        counts[i] = tree->count_within(r+d*i, H[i], pos, periodic);
+}
+template<int d>
+static void _get_sum_within_batch(void *const tree_, size_t M, const double *r,
+                                  const double *H, double *sums,
+                                  const double *const pos, const double *const w,
+                                  const double periodic) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
+#pragma omp parallel for default(shared) schedule(dynamic,64)
+    for (size_t i=0; i<M; i++)
+        sums[i] = tree->sum_within(r+d*i, H[i], pos, w, periodic);
+}
+
+extern "C" void update_octree_sum_w(void *const octree, const double *const w) {
+    Tree<3> *tree = (Tree<3> *)octree;
+    tree->fill_sum_w(w);
+}
+extern "C" void get_octree_count_within_batch(void *const octree,
+                                              size_t M, const double *r,
+                                              const double *H,
+                                              size_t *counts,
+                                              const double *const pos,
+                                              const double periodic) {
+    _get_count_within_batch<3>(octree, M, r, H, counts, pos, periodic);
+}
+extern "C" void get_octree_sum_within_batch(void *const octree,
+                                            size_t M, const double *r,
+                                            const double *H,
+                                            double *sums,
+                                            const double *const pos,
+                                            const double *const w,
+                                            const double periodic) {
+    _get_sum_within_batch<3>(octree, M, r, H, sums, pos, w, periodic);
+}
+extern "C" void update_quadtree_sum_w(void *const quadtree, const double *const w) {
+    Tree<2> *tree = (Tree<2> *)quadtree;
+    tree->fill_sum_w(w);
+}
+extern "C" void get_quadtree_count_within_batch(void *const quadtree,
+                                                size_t M, const double *r,
+                                                const double *H,
+                                                size_t *counts,
+                                                const double *const pos,
+                                                const double periodic) {
+    _get_count_within_batch<2>(quadtree, M, r, H, counts, pos, periodic);
+}
+extern "C" void get_quadtree_sum_within_batch(void *const quadtree,
+                                              size_t M, const double *r,
+                                              const double *H,
+                                              double *sums,
+                                              const double *const pos,
+                                              const double *const w,
+                                              const double periodic) {
+    _get_sum_within_batch<2>(quadtree, M, r, H, sums, pos, w, periodic);
+}
+
+template<int d>
+static void _get_ngbs_within_in_categories(void *const tree_, const double r[d],
+                                           double H, size_t max_ngbs, size_t *ngbs,
+                                           size_t *N_ngbs, const double *const pos,
+                                           const double periodic, uint32_t cats,
+                                           const uint32_t *const cat,
+                                           const int32_t *cond) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
+    std::vector<size_t> v_ngbs = tree->ngbs_within_if(r, H, pos, periodic,
+            [cats,cat,cond](size_t i){return (cat[i] & cats) and (not cond or cond[i]);},
+            cats);
+    *N_ngbs = std::min(v_ngbs.size(), max_ngbs);
+    std::copy(v_ngbs.begin(), v_ngbs.begin()+*N_ngbs, ngbs);
+}
+template<int d>
+static size_t _get_next_ngb_in_categories(void *const tree_, const double r[d],
+                                          const double *const pos,
+                                          const double periodic, uint32_t cats,
+                                          const uint32_t *const cat,
+                                          const int32_t *cond) {
+    const Tree<d> *tree = (const Tree<d> *)tree_;
+    return tree->next_ngb_with(r, pos, periodic,
+            [cats,cat,cond](size_t i){return (cat[i] & cats) and (not cond or cond[i]);},
+            cats).first;
+}
+template<int d>
+static void _get_next_ngb_in_categories_batch(void *const tree_, size_t M,
+                                              const double *r, size_t *ngbs,
+                                              const double *const pos,
+                                              const double periodic, uint32_t cats,
+                                              const uint32_t *const cat) {
+#pragma omp parallel for default(shared) schedule(dynamic,64)
+    for (size_t i=0; i<M; i++) {
+        ngbs[i] = _get_next_ngb_in_categories<d>(tree_, r+d*i, pos, periodic,
+                                                 cats, cat, NULL);
+    }
+}
+
+extern "C" void update_octree_categories(void *const octree, const uint32_t *const cat) {
+    Tree<3> *tree = (Tree<3> *)octree;
+    tree->fill_categories(cat);
+}
+extern "C" void get_octree_ngbs_within_in_categories(void *const octree,
+                                                     const double r[3], double H,
+                                                     size_t max_ngbs, size_t *ngbs,
+                                                     size_t *N_ngbs,
+                                                     const double *const pos,
+                                                     const double periodic,
+                                                     uint32_t cats,
+                                                     const uint32_t *const cat,
+                                                     const int32_t *cond) {
+    _get_ngbs_within_in_categories<3>(octree, r, H, max_ngbs, ngbs, N_ngbs, pos,
+                                      periodic, cats, cat, cond);
+}
+extern "C" size_t get_octree_next_ngb_in_categories(void *const octree,
+                                                    const double r[3],
+                                                    const double *const pos,
+                                                    const double periodic,
+                                                    uint32_t cats,
+                                                    const uint32_t *const cat,
+                                                    const int32_t *cond) {
+    return _get_next_ngb_in_categories<3>(octree, r, pos, periodic, cats, cat, cond);
+}
+extern "C" void get_octree_next_ngb_in_categories_batch(void *const octree,
+                                                        size_t M, const double *r,
+                                                        size_t *ngbs,
+                                                        const double *const pos,
+                                                        const double periodic,
+                                                        uint32_t cats,
+                                                        const uint32_t *const cat) {
+    _get_next_ngb_in_categories_batch<3>(octree, M, r, ngbs, pos, periodic, cats, cat);
+}
+extern "C" void update_quadtree_categories(void *const quadtree, const uint32_t *const cat) {
+    Tree<2> *tree = (Tree<2> *)quadtree;
+    tree->fill_categories(cat);
+}
+extern "C" void get_quadtree_ngbs_within_in_categories(void *const quadtree,
+                                                       const double r[2], double H,
+                                                       size_t max_ngbs, size_t *ngbs,
+                                                       size_t *N_ngbs,
+                                                       const double *const pos,
+                                                       const double periodic,
+                                                       uint32_t cats,
+                                                       const uint32_t *const cat,
+                                                       const int32_t *cond) {
+    _get_ngbs_within_in_categories<2>(quadtree, r, H, max_ngbs, ngbs, N_ngbs, pos,
+                                      periodic, cats, cat, cond);
+}
+extern "C" size_t get_quadtree_next_ngb_in_categories(void *const quadtree,
+                                                      const double r[2],
+                                                      const double *const pos,
+                                                      const double periodic,
+                                                      uint32_t cats,
+                                                      const uint32_t *const cat,
+                                                      const int32_t *cond) {
+    return _get_next_ngb_in_categories<2>(quadtree, r, pos, periodic, cats, cat, cond);
+}
+extern "C" void get_quadtree_next_ngb_in_categories_batch(void *const quadtree,
+                                                          size_t M, const double *r,
+                                                          size_t *ngbs,
+                                                          const double *const pos,
+                                                          const double periodic,
+                                                          uint32_t cats,
+                                                          const uint32_t *const cat) {
+    _get_next_ngb_in_categories_batch<2>(quadtree, M, r, ngbs, pos, periodic, cats, cat);
+}
+
+template<typename R>
+static size_t _get_in_region(void *const octree, const R &reg,
+                             const double *const H,
+                             size_t max_ngbs, size_t *ngbs,
+                             unsigned char *mask,
+                             const double *const pos,
+                             const double periodic) {
+    const Tree<3> *tree = (const Tree<3> *)octree;
+    size_t N = 0;
+    auto take = [&](size_t idx){
+        if (ngbs and N < max_ngbs)
+            ngbs[N] = idx;
+        if (mask)
+            mask[idx] = 1;
+        N++;
+    };
+    tree->visit_region(reg, pos, H, periodic,
+                       [&take](const Tree<3> *node){node->for_each_part(take);},
+                       take);
+    return N;
+}
+
+extern "C" size_t get_octree_in_box(void *const octree,
+                                    const double lo[3], const double hi[3],
+                                    const double *const H,
+                                    size_t max_ngbs, size_t *ngbs,
+                                    unsigned char *mask,
+                                    const double *const pos,
+                                    const double periodic) {
+    return _get_in_region(octree, BoxRegion(lo, hi), H, max_ngbs, ngbs, mask,
+                          pos, periodic);
+}
+extern "C" size_t get_octree_in_ball(void *const octree,
+                                     const double center[3], double R,
+                                     const double *const H,
+                                     size_t max_ngbs, size_t *ngbs,
+                                     unsigned char *mask,
+                                     const double *const pos,
+                                     const double periodic) {
+    return _get_in_region(octree, BallRegion(center, R), H, max_ngbs, ngbs,
+                          mask, pos, periodic);
+}
+extern "C" size_t get_octree_in_cylinder(void *const octree,
+                                         const double center[3],
+                                         const double axis[3],
+                                         double R, double h,
+                                         const double *const H,
+                                         size_t max_ngbs, size_t *ngbs,
+                                         unsigned char *mask,
+                                         const double *const pos,
+                                         const double periodic) {
+    return _get_in_region(octree, CylinderRegion(center, axis, R, h), H,
+                          max_ngbs, ngbs, mask, pos, periodic);
+}
+extern "C" size_t get_octree_in_slab(void *const octree,
+                                     const double center[3],
+                                     const double normal[3], double h,
+                                     const double *const H,
+                                     size_t max_ngbs, size_t *ngbs,
+                                     unsigned char *mask,
+                                     const double *const pos,
+                                     const double periodic) {
+    return _get_in_region(octree, SlabRegion(center, normal, h), H,
+                          max_ngbs, ngbs, mask, pos, periodic);
+}
+extern "C" size_t get_octree_in_cone(void *const octree,
+                                     const double apex[3],
+                                     const double axis[3],
+                                     double alpha, double L,
+                                     const double *const H,
+                                     size_t max_ngbs, size_t *ngbs,
+                                     unsigned char *mask,
+                                     const double *const pos,
+                                     const double periodic) {
+    return _get_in_region(octree, ConeRegion(apex, axis, alpha, L), H,
+                          max_ngbs, ngbs, mask, pos, periodic);
+}
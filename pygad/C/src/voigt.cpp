@@ -1,5 +1,8 @@
 #include "voigt.hpp"
 
+#include <algorithm>
+#include <vector>
+
 typedef std::complex<double> cmplx;
 
 double Voigt(double x, double sigma, double gamma) {
@@ -8,3 +11,275 @@ double Voigt(double x, double sigma, double gamma) {
     return Faddeeva::w(z).real() / (std::sqrt(2*M_PI) * sigma);
 }
 
+/*
+ * The regions of Humlicek's W4 algorithm (with t = y - ix and s = |x| + y):
+ *   I:   s >= 15
+ *   II:  5.5 <= s < 15
+ *   III: s < 5.5 and y >= 0.195|x| - 0.176
+ *   IV:  otherwise
+ * The real parts are written out in real arithmetic, such that the loops over
+ * them can be vectorized.
+ */
+static inline double _w4_re_I_II(double x, double y) {
+    double s = std::abs(x) + y;
+    // u = t^2
+    double ur = y*y - x*x, ui = -2.0*x*y;
+    double nr, ni, dr, di;
+    if ( s >= 15.0 ) {
+        // w = t * 0.5641896 / (0.5 + t^2)
+        nr = 0.5641896*y;
+        ni = -0.5641896*x;
+        dr = 0.5 + ur;
+        di = ui;
+    } else {
+        // w = t * (1.410474 + u*0.5641896) / (0.75 + u*(3 + u))
+        double pr = 1.410474 + 0.5641896*ur, pi = 0.5641896*ui;
+        nr = y*pr + x*pi;
+        ni = y*pi - x*pr;
+        double qr = 3.0 + ur, qi = ui;
+        dr = 0.75 + ur*qr - ui*qi;
+        di = ur*qi + ui*qr;
+    }
+    return (nr*dr + ni*di) / (dr*dr + di*di);
+}
+
+static inline double _w4_re_III(double x, double y) {
+    const double tr = y, ti = -x;
+    // numerator and denominator polynomials in t by Horner's scheme
+    double pr = 0.5642236, pi = 0.0;
+    const double p[] = {3.778987, 11.96482, 20.20933, 16.4955};
+    for (const double c : p) {
+        double r = pr*tr - pi*ti + c;
+        pi = pr*ti + pi*tr;
+        pr = r;
+    }
+    double qr = 1.0, qi = 0.0;
+    const double q[] = {6.699398, 21.69274, 39.27121, 38.82363, 16.4955};
+    for (const double c : q) {
+        double r = qr*tr - qi*ti + c;
+        qi = qr*ti + qi*tr;
+        qr = r;
+    }
+    return (pr*qr + pi*qi) / (qr*qr + qi*qi);
+}
+
+static inline double _w4_re_IV(double x, double y) {
+    const double tr = y, ti = -x;
+    const double ur = y*y - x*x, ui = -2.0*x*y;
+    // polynomials in u by Horner's scheme (with alternating signs)
+    double pr = 0.56419, pi = 0.0;
+    const double p[] = {1.320522, 35.76683, 219.0313, 1540.787, 3321.9905, 36183.31};
+    for (const double c : p) {
+        double r = c - (pr*ur - pi*ui);
+        pi = -(pr*ui + pi*ur);
+        pr = r;
+    }
+    double qr = 1.0, qi = 0.0;
+    const double q[] = {1.841439, 61.57037, 364.2191, 2186.181, 9022.228, 24322.84, 32066.6};
+    for (const double c : q) {
+        double r = c - (qr*ur - qi*ui);
+        qi = -(qr*ui + qi*ur);
+        qr = r;
+    }
+    // t * P / Q
+    double nr = tr*pr - ti*pi, ni = tr*pi + ti*pr;
+    double tPQ = (nr*qr + ni*qi) / (qr*qr + qi*qi);
+    return std::exp(ur) * std::cos(ui) - tPQ;
+}
+
+static inline bool _w4_in_III(double x, double y) {
+    return y >= 0.195*std::abs(x) - 0.176;
+}
+
+cmplx w_Humlicek(cmplx z) {
+    double x = z.real(), y = z.imag();
+    cmplx t(y, -x);
+    double s = std::abs(x) + y;
+    if ( s >= 15.0 ) {
+        return t * 0.5641896 / (0.5 + t*t);
+    } else if ( s >= 5.5 ) {
+        cmplx u = t*t;
+        return t * (1.410474 + u*0.5641896) / (0.75 + u*(3.0 + u));
+    } else if ( _w4_in_III(x, y) ) {
+        return (16.4955 + t*(20.20933 + t*(11.96482 + t*(3.778987 + t*0.5642236))))
+             / (16.4955 + t*(38.82363 + t*(39.27121 + t*(21.69274 + t*(6.699398 + t)))));
+    } else {
+        cmplx u = t*t;
+        return std::exp(u) - t*(36183.31 - u*(3321.9905 - u*(1540.787 - u*(219.0313
+                    - u*(35.76683 - u*(1.320522 - u*0.56419))))))
+                / (32066.6 - u*(24322.84 - u*(9022.228 - u*(2186.181 - u*(364.2191
+                    - u*(61.57037 - u*(1.841439 - u)))))));
+    }
+}
+
+double Voigt_fast(double x, double sigma, double gamma) {
+    cmplx z =
+        (cmplx(0.,gamma) + x) / (std::sqrt(2) * sigma);
+    return w_Humlicek(z).real() / (std::sqrt(2*M_PI) * sigma);
+}
+
+void erf_fast_sweep(double x0, double dx, size_t n, double *out) {
+#pragma omp simd
+    for (size_t i=0; i<n; i++)
+        out[i] = erf_fast(x0 + i*dx);
+}
+
+extern "C"
+void Gaussian_sweep(double x0, double dx, size_t n, double *out) {
+    if ( n == 0 )
+        return;
+    // exp(-(x+dx)^2) = exp(-x^2) * exp(-2 x dx - dx^2), where the ratio itself
+    // changes by the constant factor exp(-2 dx^2) from point to point
+    double g = std::exp(-x0*x0);
+    double r = std::exp(-(2.*x0 + dx)*dx);
+    const double q = std::exp(-2.*dx*dx);
+    for (size_t i=0; i<n; i++) {
+        out[i] = g;
+        g *= r;
+        r *= q;
+    }
+}
+
+extern "C"
+void Voigt_fast_sweep(double x0, double dx, size_t n,
+                      double sigma, double gamma, double *out) {
+    const double scale = 1.0 / (std::sqrt(2) * sigma);
+    const double norm = 1.0 / (std::sqrt(2*M_PI) * sigma);
+    const double y = gamma * scale;
+    const double X0 = x0 * scale, DX = dx * scale;
+
+    // regions I and II everywhere first...
+#pragma omp simd
+    for (size_t i=0; i<n; i++)
+        out[i] = _w4_re_I_II(X0 + i*DX, y) * norm;
+
+    // ...then overwrite the (contiguous) range of regions III and IV, where
+    // |x| < 5.5 - y
+    double x_lim = 5.5 - y;
+    if ( x_lim <= 0.0 or DX == 0.0 )
+        return;
+    double i_a = (-x_lim - X0) / DX, i_b = (x_lim - X0) / DX;
+    if ( DX < 0.0 )
+        std::swap(i_a, i_b);
+    size_t i_min = std::max(0.0, std::floor(i_a));
+    size_t i_max = std::min<double>(n, std::max(0.0, std::ceil(i_b)+1.0));
+    for (size_t i=i_min; i<i_max; i++) {
+        double x = X0 + i*DX;
+        if ( std::abs(x) + y >= 5.5 )
+            continue;   // rounding at the edges of the range
+        out[i] = (_w4_in_III(x, y) ? _w4_re_III(x, y) : _w4_re_IV(x, y)) * norm;
+    }
+}
+
+extern "C"
+void Faddeeva_w_batch(size_t n, const double *z, double *w) {
+    const cmplx *z_ = reinterpret_cast<const cmplx *>(z);
+    cmplx *w_ = reinterpret_cast<cmplx *>(w);
+#pragma omp parallel for default(shared) schedule(static) if(n>1000)
+    for (size_t i=0; i<n; i++)
+        w_[i] = Faddeeva::w(z_[i]);
+}
+
+/*
+ * Weideman's (1994) rational expansion of the Faddeeva function,
+ *   w(z) = 2 p(Z) / (L-iz)^2  +  1 / (sqrt(pi) (L-iz)),   Z = (L+iz) / (L-iz),
+ * where p is a polynomial of degree WEIDEMAN_N-1, whose coefficients are the
+ * Fourier coefficients of exp(-t^2) (L^2+t^2) with t = L tan(theta/2).
+ */
+namespace {
+struct WeidemanCoeffs {
+    double L;
+    double a[WEIDEMAN_N+1];   // a[1..N]
+    WeidemanCoeffs() {
+        const int N = WEIDEMAN_N, M = 2*N;
+        L = std::sqrt(N / std::sqrt(2));
+        a[0] = 0.0;
+        for (int m=1; m<=N; m++) {
+            double sum = 0.0;
+            for (int k=-M+1; k<M; k++) {
+                double theta = k * M_PI / M;
+                double t = L * std::tan(0.5*theta);
+                sum += std::exp(-t*t) * (L*L + t*t) * std::cos(m*theta);
+            }
+            a[m] = sum / (2*M);
+        }
+    }
+};
+const WeidemanCoeffs weideman;
+}
+
+// w(x+iy) with Weideman's expansion for a sweep in x (real arithmetic, such
+// that the loops vectorize; everything depending on y is hoisted); `w_re` and
+// `w_im` get the real and imaginary parts (the latter only if `imag`)
+template <bool imag>
+static void _weideman_sweep(double x0, double dx, double y, size_t n,
+                            double *w_re, double *w_im) {
+    const double L = weideman.L;
+    const double *a = weideman.a;
+    // L - iz = Lp - ix  and  L + iz = Lm + ix
+    const double Lp = L + y, Lm = L - y, LmLp = Lm * Lp, Lsum = Lm + Lp;
+    const double inv_sqrt_pi = 1.0 / std::sqrt(M_PI);
+    // in blocks that fit into the L1 cache, with Horner's scheme over the
+    // coefficients in the outer loop
+    const size_t B = 256;
+    double iD_re[B], iD_im[B], Z_re[B], Z_im[B], p_re[B], p_im[B];
+    for (size_t i0=0; i0<n; i0+=B) {
+        const int nb = std::min(B, n-i0);
+        const double x_b = x0 + i0*dx;
+#pragma omp simd
+        for (int i=0; i<nb; i++) {
+            double x = x_b + i*dx;
+            double D2 = Lp*Lp + x*x;
+            // 1/(L-iz) = (Lp + ix) / D2
+            iD_re[i] = Lp / D2;
+            iD_im[i] = x / D2;
+            // Z = (Lm + ix) (Lp + ix) / D2
+            Z_re[i] = (LmLp - x*x) / D2;
+            Z_im[i] = x * Lsum / D2;
+            p_re[i] = a[WEIDEMAN_N];
+            p_im[i] = 0.0;
+        }
+        for (int m=WEIDEMAN_N-1; m>=1; m--) {
+            const double a_m = a[m];
+#pragma omp simd
+            for (int i=0; i<nb; i++) {
+                double t = p_re[i]*Z_re[i] - p_im[i]*Z_im[i] + a_m;
+                p_im[i] = p_re[i]*Z_im[i] + p_im[i]*Z_re[i];
+                p_re[i] = t;
+            }
+        }
+#pragma omp simd
+        for (int i=0; i<nb; i++) {
+            // w = 2 p(Z) / (L-iz)^2 + 1 / (sqrt(pi) (L-iz))
+            double iD2_re = iD_re[i]*iD_re[i] - iD_im[i]*iD_im[i];
+            double iD2_im = 2.0*iD_re[i]*iD_im[i];
+            w_re[i0+i] = 2.0 * (p_re[i]*iD2_re - p_im[i]*iD2_im)
+                            + inv_sqrt_pi * iD_re[i];
+            if ( imag ) {
+                w_im[i0+i] = 2.0 * (p_re[i]*iD2_im + p_im[i]*iD2_re)
+                                + inv_sqrt_pi * iD_im[i];
+            }
+        }
+    }
+}
+
+extern "C"
+void Faddeeva_w_sweep(double x0, double dx, double y, size_t n, double *w) {
+    std::vector<double> w_re(n), w_im(n);
+    _weideman_sweep<true>(x0, dx, y, n, w_re.data(), w_im.data());
+    for (size_t i=0; i<n; i++) {
+        w[2*i] = w_re[i];
+        w[2*i+1] = w_im[i];
+    }
+}
+
+extern "C"
+void Voigt_sweep(double x0, double dx, size_t n,
+                 double sigma, double gamma, double *out) {
+    const double scale = 1.0 / (std::sqrt(2) * sigma);
+    const double norm = 1.0 / (std::sqrt(2*M_PI) * sigma);
+    _weideman_sweep<false>(x0*scale, dx*scale, gamma*scale, n, out, nullptr);
+#pragma omp simd
+    for (size_t i=0; i<n; i++)
+        out[i] *= norm;
+}
@@ -0,0 +1,259 @@
+#include "vpfit.hpp"
+
+#include <vector>
+
+typedef std::complex<double> cmplx;
+
+// the optical depth at which the flux is clipped (avoiding underflows)
+#define VPFIT_TAU_MAX 50.0
+
+extern "C"
+void vp_model_tau(size_t N_comp,
+                  const double *p,
+                  size_t n,
+                  const double *l,
+                  double Xsec,
+                  double gamma,
+                  double c_light,
+                  double *tau,
+                  double *jac) {
+    const size_t Np = 3*N_comp;
+    const cmplx dw_const(0.0, 2.0/std::sqrt(M_PI));
+    std::memset(tau, 0, n*sizeof(double));
+    if ( jac )
+        std::memset(jac, 0, n*Np*sizeof(double));
+
+    for (size_t c=0; c<N_comp; c++) {
+        double N = std::pow(10.0, p[3*c]);
+        double b = p[3*c+1];
+        double l0 = p[3*c+2];
+        double sigma = b / (std::sqrt(2) * l0);
+        double z_scale = 1.0 / (std::sqrt(2) * sigma);
+        double norm = Xsec * N / (std::sqrt(2*M_PI) * sigma);
+        double nu0 = c_light / l0;
+
+        for (size_t i=0; i<n; i++) {
+            double x = c_light / l[i] - nu0;
+            cmplx z = cmplx(x, gamma) * z_scale;
+            cmplx w = Faddeeva::w(z);
+            double tau_c = norm * w.real();
+            tau[i] += tau_c;
+            if ( not jac )
+                continue;
+
+            // w'(z) = -2 z w(z) + 2i/sqrt(pi)
+            cmplx dw = -2.0 * z * w + dw_const;
+            // d tau / d x  and  d tau / d sigma
+            double dtau_dx = norm * dw.real() * z_scale;
+            double dtau_dsigma = -norm * (dw * z).real() / sigma - tau_c / sigma;
+            double *jac_i = jac + i*Np + 3*c;
+            jac_i[0] = M_LN10 * tau_c;
+            jac_i[1] = dtau_dsigma * sigma / b;
+            jac_i[2] = dtau_dx * nu0 / l0 - dtau_dsigma * sigma / l0;
+        }
+    }
+}
+
+// Solve A x = y for the symmetric positive definite (n x n) matrix A by a
+// Cholesky decomposition (A is overwritten). Returns false, if A is not
+// positive definite.
+static bool _cholesky_solve(size_t n, double *A, const double *y, double *x) {
+    for (size_t j=0; j<n; j++) {
+        double d = A[j*n+j];
+        for (size_t k=0; k<j; k++)
+            d -= A[j*n+k] * A[j*n+k];
+        if ( d <= 0.0 )
+            return false;
+        d = std::sqrt(d);
+        A[j*n+j] = d;
+        for (size_t i=j+1; i<n; i++) {
+            double s = A[i*n+j];
+            for (size_t k=0; k<j; k++)
+                s -= A[i*n+k] * A[j*n+k];
+            A[i*n+j] = s / d;
+        }
+    }
+    // forward and backward substitution with L and L^T
+    for (size_t i=0; i<n; i++) {
+        double s = y[i];
+        for (size_t k=0; k<i; k++)
+            s -= A[i*n+k] * x[k];
+        x[i] = s / A[i*n+i];
+    }
+    for (size_t i=n; i-- > 0; ) {
+        double s = x[i];
+        for (size_t k=i+1; k<n; k++)
+            s -= A[k*n+i] * x[k];
+        x[i] = s / A[i*n+i];
+    }
+    return true;
+}
+
+namespace {
+// the residuals (F-flux)/noise of a region and their Jacobian
+struct VPRegion {
+    size_t n, Np;
+    const double *l, *flux, *noise;
+    double Xsec, gamma, c_light;
+    std::vector<double> tau, jac, r;
+
+    double chi2(const double *p, bool with_jac) {
+        vp_model_tau(Np/3, p, n, l, Xsec, gamma, c_light, tau.data(),
+                     with_jac ? jac.data() : nullptr);
+        double chi2 = 0.0;
+        for (size_t i=0; i<n; i++) {
+            double F = std::exp(-std::min(tau[i], VPFIT_TAU_MAX));
+            r[i] = (F - flux[i]) / noise[i];
+            chi2 += r[i] * r[i];
+            if ( with_jac ) {
+                double dF = tau[i] < VPFIT_TAU_MAX ? -F / noise[i] : 0.0;
+                for (size_t k=0; k<Np; k++)
+                    jac[i*Np+k] *= dF;
+            }
+        }
+        return chi2;
+    }
+};
+}
+
+static size_t _levenberg_marquardt(VPRegion &reg, double *p,
+                                   const double *lower, const double *upper,
+                                   size_t max_iter, double &chi2, double *cov) {
+    const size_t Np = reg.Np, n = reg.n;
+    std::vector<double> A(Np*Np), A_damp(Np*Np), g(Np), delta(Np), p_new(Np);
+    double lambda = 1e-3;
+
+    chi2 = reg.chi2(p, true);
+    size_t iter = 0;
+    bool update = true;
+    while ( iter < max_iter ) {
+        iter++;
+        if ( update ) {
+            // normal equations J^T J and the gradient J^T r
+            std::fill(A.begin(), A.end(), 0.0);
+            std::fill(g.begin(), g.end(), 0.0);
+            for (size_t i=0; i<n; i++) {
+                const double *J_i = &reg.jac[i*Np];
+                for (size_t a=0; a<Np; a++) {
+                    g[a] += J_i[a] * reg.r[i];
+                    for (size_t b=0; b<=a; b++)
+                        A[a*Np+b] += J_i[a] * J_i[b];
+                }
+            }
+            for (size_t a=0; a<Np; a++) {
+                for (size_t b=0; b<a; b++)
+                    A[b*Np+a] = A[a*Np+b];
+            }
+        }
+
+        A_damp = A;
+        for (size_t a=0; a<Np; a++)
+            A_damp[a*Np+a] += lambda * std::max(A[a*Np+a], 1e-12);
+        for (size_t a=0; a<Np; a++)
+            g[a] = -g[a];
+        bool solved = _cholesky_solve(Np, A_damp.data(), g.data(), delta.data());
+        for (size_t a=0; a<Np; a++)
+            g[a] = -g[a];
+        if ( not solved ) {
+            lambda *= 10.0;
+            update = false;
+            if ( lambda > 1e12 )
+                break;
+            continue;
+        }
+
+        // the step, projected onto the bounds
+        for (size_t a=0; a<Np; a++)
+            p_new[a] = std::min(std::max(p[a] + delta[a], lower[a]), upper[a]);
+        double chi2_new = reg.chi2(p_new.data(), false);
+        if ( chi2_new < chi2 ) {
+            double rel_change = (chi2 - chi2_new) / chi2;
+            std::copy(p_new.begin(), p_new.end(), p);
+            chi2 = reg.chi2(p, true);
+            lambda = std::max(lambda / 10.0, 1e-12);
+            update = true;
+            if ( rel_change < 1e-8 )
+                break;
+        } else {
+            lambda *= 10.0;
+            update = false;
+            if ( lambda > 1e12 )
+                break;
+        }
+    }
+
+    if ( cov ) {
+        // the covariance of the parameters: the inverse of J^T J at the best fit
+        reg.chi2(p, true);
+        std::fill(A.begin(), A.end(), 0.0);
+        for (size_t i=0; i<n; i++) {
+            const double *J_i = &reg.jac[i*Np];
+            for (size_t a=0; a<Np; a++) {
+                for (size_t b=0; b<Np; b++)
+                    A[a*Np+b] += J_i[a] * J_i[b];
+            }
+        }
+        for (size_t a=0; a<Np; a++) {
+            A_damp = A;
+            std::fill(g.begin(), g.end(), 0.0);
+            g[a] = 1.0;
+            if ( not _cholesky_solve(Np, A_damp.data(), g.data(), delta.data()) )
+                std::fill(delta.begin(), delta.end(), INFINITY);
+            for (size_t b=0; b<Np; b++)
+                cov[b*Np+a] = delta[b];
+        }
+    }
+
+    return iter;
+}
+
+extern "C"
+void vpfit_regions(size_t N_reg,
+                   const size_t *pix_offsets,
+                   const double *l,
+                   const double *flux,
+                   const double *noise,
+                   const size_t *par_offsets,
+                   double *p,
+                   const double *lower,
+                   const double *upper,
+                   double Xsec,
+                   double gamma,
+                   double c_light,
+                   size_t max_iter,
+                   double *chisq,
+                   size_t *n_iter,
+                   double *cov) {
+    // the offsets of the covariance matrices
+    std::vector<size_t> cov_offsets(N_reg+1, 0);
+    for (size_t r=0; r<N_reg; r++) {
+        size_t Np = par_offsets[r+1] - par_offsets[r];
+        cov_offsets[r+1] = cov_offsets[r] + Np*Np;
+    }
+
+#pragma omp parallel for default(shared) schedule(dynamic,1)
+    for (size_t r=0; r<N_reg; r++) {
+        VPRegion reg;
+        reg.n = pix_offsets[r+1] - pix_offsets[r];
+        reg.Np = par_offsets[r+1] - par_offsets[r];
+        reg.l = l + pix_offsets[r];
+        reg.flux = flux + pix_offsets[r];
+        reg.noise = noise + pix_offsets[r];
+        reg.Xsec = Xsec;
+        reg.gamma = gamma;
+        reg.c_light = c_light;
+        reg.tau.resize(reg.n);
+        reg.jac.resize(reg.n * reg.Np);
+        reg.r.resize(reg.n);
+
+        double chi2 = 0.0;
+        size_t iter = 0;
+        if ( reg.Np > 0 and reg.n > 0 ) {
+            size_t o = par_offsets[r];
+            iter = _levenberg_marquardt(reg, p+o, lower+o, upper+o, max_iter,
+                                        chi2, cov ? cov+cov_offsets[r] : nullptr);
+        }
+        chisq[r] = reg.n > 0 ? chi2 / reg.n : 0.0;
+        n_iter[r] = iter;
+    }
+}
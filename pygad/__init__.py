@@ -37,7 +37,7 @@ doctests:
     TestResults(failed=0, attempted=118)
     >>> print('testing module octree...', file=sys.stderr)
     >>> doctest.testmod(octree)
-    TestResults(failed=0, attempted=3)
+    TestResults(failed=0, attempted=4)
     >>> print('testing module ssp...', file=sys.stderr)
     >>> doctest.testmod(ssp)
     TestResults(failed=0, attempted=2)
@@ -46,7 +46,7 @@ doctests:
     TestResults(failed=0, attempted=5)
     >>> print('testing module analysis...', file=sys.stderr)
     >>> doctest.testmod(analysis)
-    TestResults(failed=0, attempted=6)
+    TestResults(failed=0, attempted=7)
 
     #>>> print('testing module tools...', file=sys.stderr)
     #>>> doctest.testmod(.tools)
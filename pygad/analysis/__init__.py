@@ -4,15 +4,19 @@ Module for snapshot analysis.
 Also doctest other parts of this sub-module:
     >>> import doctest
     >>> doctest.testmod(sph_eval)
-    TestResults(failed=0, attempted=15)
+    TestResults(failed=0, attempted=25)
     >>> doctest.testmod(properties)
     TestResults(failed=0, attempted=34)
     >>> doctest.testmod(halo)
     TestResults(failed=0, attempted=29)
     >>> doctest.testmod(profiles)
-    TestResults(failed=0, attempted=19)
+    TestResults(failed=0, attempted=32)
     >>> doctest.testmod(absorption_spectra)
-    TestResults(failed=0, attempted=17)
+    TestResults(failed=0, attempted=76)
+    >>> doctest.testmod(clustering)
+    TestResults(failed=0, attempted=40)
+    >>> doctest.testmod(vpfit)
+    TestResults(failed=0, attempted=23)
 
     #>>> doctest.testmod(analysis)
     #TestResults(failed=0, attempted=20)
@@ -21,6 +25,7 @@ from .sph_eval import *
 from .properties import *
 from .halo import *
 from .profiles import *
+from .clustering import *
 
 # from analysis import *
 from .absorption_spectra import *
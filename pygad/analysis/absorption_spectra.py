@@ -32,6 +32,44 @@ Doctests:
     >>> EW(tau, l[1]-l[0])  # doctest: +ELLIPSIS
     UnitArr(0.2787..., units="Angstrom")
 
+    The Faddeeva function and the Voigt profile of the C library agree with
+    those of scipy:
+    >>> from scipy.special import voigt_profile
+    >>> x = np.linspace(-30., 30., 2001)
+    >>> for y in [0.0, 0.1, 1.0, 10.0]:
+    ...     z = x + 1j*y
+    ...     for w in [Faddeeva_w(z), Faddeeva_w_sweep(x[0], x[1]-x[0], y, len(x))]:
+    ...         err = np.max(np.abs(w - wofz(z)) / np.abs(wofz(z)))
+    ...         if not err < 1e-10: print(y, err)
+    >>> for sigma, gamma in [(1.0, 0.0), (1.0, 1e-3), (0.3, 2.0)]:
+    ...     V = Voigt_sweep(x[0], x[1]-x[0], len(x), sigma, gamma)
+    ...     V_ref = voigt_profile(x, sigma, gamma)
+    ...     err = np.max(np.abs(V - V_ref)) / np.max(V_ref)
+    ...     if not err < 1e-10: print(sigma, gamma, err)
+
+    The binned thermal profiles of the C library agree with the scalar
+    integration over the bins -- up to the absolute error of 3e-7 of the
+    approximated error function for the narrow lines, and to rounding for the
+    broad ones, which are evaluated at the bin centres (bin i is centred at
+    vel_extent[0] + i*dv):
+    >>> from scipy.special import erf
+    >>> vel_extent, Nbins = [-500., 500.], 1000
+    >>> dv = (vel_extent[1] - vel_extent[0]) / Nbins
+    >>> v_mid = vel_extent[0] + dv * np.arange(Nbins)
+    >>> v_edges = vel_extent[0] + dv * (np.arange(Nbins+1) - 0.5)
+    >>> for v, b in [(0., 0.3), (12.34, 1.5), (-123.4, 5.0), (250.6, 12.8),
+    ...              (0.2, 40.), (-499.7, 25.)]:
+    ...     Dtb = line_profile_bins(v, b, vel_extent, Nbins)
+    ...     if 2. * np.sqrt(np.log(2.)) * b < 10. * dv:
+    ...         Dtb_ref = 0.5 * np.diff(erf((v_edges - v) / b))
+    ...         tol = 1e-6
+    ...     else:
+    ...         Dtb_ref = dv / (b*np.sqrt(np.pi)) * np.exp(-((v_mid - v) / b)**2)
+    ...         tol = 1e-10
+    ...     err = np.max(np.abs(Dtb - Dtb_ref))
+    ...     if not err < tol: print(v, b, err)
+    ...     if np.any(Dtb < 0.0): print(v, b, 'negative')
+
     Broadly following Oppenheimer & Dave (2009) for the OVI turbulent broadening
     (adding the minimum of 100 km/s):
     >>> nH = s.gas['nH'].in_units_of('cm**-3')
@@ -87,13 +125,133 @@ Doctests:
         N = 1.098e+14 [cm**-2]; EW = 0.184 [Angstrom]
         N = 1.097e+14 [cm**-2]; EW = 0.167 [Angstrom]
         N = 1.099e+14 [cm**-2]; EW = 0.167 [Angstrom]
+
+    The batched spectra are the same as the individual ones:
+    >>> taus, dens, temp, v_edges, restr_column = mock_absorption_spectra(
+    ...         s, los_arr, 'H1215', vel_extent=UnitArr([2000.,3500.], 'km/s'))
+    >>> for i, los in enumerate(los_arr):
+    ...     tau = mock_absorption_spectrum_of(s, los, 'H1215',
+    ...                 vel_extent=UnitArr([2000.,3500.], 'km/s'))[0]
+    ...     assert np.allclose(tau, taus[i])
+
+    The skewers of the forest are the spectra along the pixel centres (away
+    from the periodic wrapping of the velocities):
+    >>> Npx, Nbins = 100, 512
+    >>> taus = mock_absorption_forest(s, 'H1215', Npx, Nbins=Nbins,
+    ...                               return_taus=True)[-1]
+    >>> res = s.boxsize.in_units_of(s['pos'].units, subs=s) / Npx
+    >>> v_box = (s.cosmology.H(s.redshift) * s.boxsize).in_units_of('km/s', subs=s)
+    >>> inner = slice(Nbins//10, -Nbins//10)
+    >>> for i, j in [(34, 35), (34, 36)]:
+    ...     los = UnitArr([(i+0.5)*res, (j+0.5)*res], s['pos'].units)
+    ...     tau = mock_absorption_spectrum_of(s, los, 'H1215', Nbins=Nbins,
+    ...                 vel_extent=UnitArr([0.,float(v_box)], 'km/s'))[0]
+    ...     err = np.max(np.abs(taus[i,j,inner] - tau[inner])) / np.max(tau[inner])
+    ...     if not err < 1e-6: print(i, j, err)
+
+    Processing the skewers in blocks of rows does not change the statistics,
+    even if the kernels of the particles span several blocks and their periodic
+    images overlap:
+    >>> sub = s.gas[::100]
+    >>> h = 0.6 * sub.boxsize.in_units_of(sub['hsml'].units, subs=s) * np.ones(len(sub))
+    >>> F, k, pk, pdf_edges, pdf, taus = mock_absorption_forest(sub, 'H1215', 8,
+    ...                 Nbins=64, hsml=h, return_taus=True)
+    >>> F_b, k, pk_b, pdf_edges, pdf_b = mock_absorption_forest(sub, 'H1215', 8,
+    ...                 Nbins=64, hsml=h, block_rows=3)
+    >>> if not abs(F_b / F - 1.0) < 1e-12: print(F, F_b)
+    >>> if not np.max(np.abs(pk_b - pk)) < 1e-12 * np.max(pk): print(pk, pk_b)
+    >>> np.array_equal(pdf, pdf_b)
+    True
+
+    The spectrum of several lines is the sum of the single line spectra:
+    >>> l_extent = UnitArr([1020.,1240.], 'Angstrom') * (1.0+s.redshift)
+    >>> taus, l_edges = mock_absorption_spectrum_lines(s, los_arr[0],
+    ...                     ['H1215','OVI1031'], l_extent, Nbins=20000)
+    >>> tau_sum = np.zeros(len(taus))
+    >>> for line in ['H1215', 'OVI1031']:
+    ...     vel_extent = redshifts_to_velocities(
+    ...             l_extent / lines[line]['l'] - 1.0, z0=s.redshift)
+    ...     tau_sum += mock_absorption_spectrum_of(s, los_arr[0], line,
+    ...                     vel_extent=vel_extent, Nbins=len(taus))[0]
+    >>> err = np.max(np.abs(taus - tau_sum)) / np.max(tau_sum)
+    >>> if not err < 1e-6: print(err)
+
+    The light-cone spectrum through a single box has the same column density
+    (i.e. integral of the optical depth over velocity) as the spectrum through it:
+    >>> from scipy.optimize import brentq
+    >>> comoving = {'a': 1.0, 'z': 0.0, 'h_0': s.cosmology.h_0}
+    >>> L = float(s.boxsize.in_units_of('Mpc', subs=comoving))
+    >>> D = lambda z: float(s.cosmology.comoving_distance(z, 'Mpc'))
+    >>> z1 = brentq(lambda z: D(z) - D(s.redshift) - L, s.redshift, s.redshift+1.)
+    >>> origin = UnitArr(list(los_arr[0]) + [0.], los_arr.units)
+    >>> taus, l_edges = mock_light_cone_spectrum([s], 'H1215', origin,
+    ...                     [0,0,1], [s.redshift, z1], pixel_v='5 km/s')
+    >>> dv = float(c.in_units_of('km/s')) * np.log(l_edges[1] / l_edges[0])
+    >>> tau, dens, temp, v_edges, restr_column = mock_absorption_spectrum_of(
+    ...         s, los_arr[0], 'H1215', Nbins=10000,
+    ...         vel_extent=UnitArr([-1e3,float(v_box)+1e3], 'km/s'))
+    >>> err = np.sum(taus) * dv / (np.sum(tau) * float(v_edges[1]-v_edges[0])) - 1.0
+    >>> if not abs(err) < 1e-2: print(err)
+
+    Truncating the Lorentz wings of the damped lines changes the optical depths
+    and the equivalent width only marginally:
+    >>> vel_extent = UnitArr([-3000.,3000.], 'km/s')
+    >>> tau_full, dens, temp, v_edges, restr_column = mock_absorption_spectrum_of(
+    ...         s, los_arr[0], 'H1215', vel_extent=vel_extent)
+    >>> tau = mock_absorption_spectrum_of(s, los_arr[0], 'H1215',
+    ...                 vel_extent=vel_extent, wing_tau_tol=1e-6)[0]
+    >>> np.any(tau != tau_full)
+    True
+    >>> if not np.max(np.abs(tau_full - tau)) < 1e-2:
+    ...     print(np.max(np.abs(tau_full - tau)))
+    >>> err = EW(tau, v_edges) / EW(tau_full, v_edges) - 1.0
+    >>> if not abs(err) < 1e-4: print(err)
+
+    Deterministic spectra do not depend on the number of threads:
+    >>> N_threads = C.cpygad.omp_get_max_threads()
+    >>> taus, taus_lines = [], []
+    >>> for n in [1, 3, 8]:
+    ...     C.cpygad.omp_set_num_threads(n)
+    ...     taus.append(mock_absorption_spectrum_of(s, los_arr[0], 'H1215',
+    ...                     vel_extent=vel_extent, deterministic=True)[0])
+    ...     taus_lines.append(mock_absorption_spectrum_lines(s, los_arr[0],
+    ...                     ['H1215','OVI1031'], l_extent, Nbins=2000,
+    ...                     deterministic=True)[0])
+    >>> C.cpygad.omp_set_num_threads(N_threads)
+    >>> all(np.array_equal(taus[0], tau) for tau in taus[1:])
+    True
+    >>> all(np.array_equal(taus_lines[0], tau) for tau in taus_lines[1:])
+    True
+
+    Otherwise the threads bin into private spectra, whose sum equals the serial
+    accumulation up to rounding (relative to the maximum optical depth):
+    >>> taus, taus_lines = [], []
+    >>> for n in [1, 3, 8]:
+    ...     C.cpygad.omp_set_num_threads(n)
+    ...     taus.append(mock_absorption_spectrum_of(s, los_arr[0], 'H1215',
+    ...                     vel_extent=vel_extent)[0])
+    ...     taus_lines.append(mock_absorption_spectrum_lines(s, los_arr[0],
+    ...                     ['H1215','OVI1031'], l_extent, Nbins=2000)[0])
+    >>> C.cpygad.omp_set_num_threads(N_threads)
+    >>> for ts in [taus, taus_lines]:
+    ...     for t in ts[1:]:
+    ...         err = np.max(np.abs(t - ts[0])) / np.max(ts[0])
+    ...         if not err < 1e-12: print(err)
     >>> environment.verbose = environment.VERBOSE_NORMAL
 """
 __all__ = [
     "mock_absorption_spectrum_of",
     "mock_absorption_spectrum",
+    "mock_absorption_spectra",
+    "mock_absorption_forest",
+    "mock_absorption_spectrum_lines",
+    "mock_light_cone_spectrum",
     "EW",
     "Voigt",
+    "Voigt_sweep",
+    "Faddeeva_w",
+    "Faddeeva_w_sweep",
+    "line_profile_bins",
     "Gaussian",
     "Lorentzian",
     "thermal_b_param",
@@ -469,6 +627,95 @@ def Voigt(x, sigma, gamma):
     return np.real(wofz(z)) / (sigma * np.sqrt(2.0 * np.pi))
 
 
+def Voigt_sweep(x0, dx, n, sigma, gamma):
+    """
+    The Voigt function (see `Voigt`) at the n equidistant points x0, x0+dx, ...,
+    x0+(n-1)*dx, calculated by Weideman's expansion of the Faddeeva function in
+    the C library.
+
+    Args:
+        x0 (float):             The first point.
+        dx (float):             The distance of the points.
+        n (int):                The number of points.
+        sigma (float):          The standard deviation of the Gaussian.
+        gamma (float):          The gamma value of the Lorentz function.
+
+    Returns:
+        y (np.ndarray):         The values of the Voigt profile.
+    """
+    y = np.empty(int(n), dtype=np.float64)
+    C.cpygad.Voigt_sweep(float(x0), float(dx), len(y), float(sigma),
+                         float(gamma), y.ctypes.data)
+    return y
+
+
+def Faddeeva_w(z):
+    """
+    The Faddeeva function w(z) = exp(-z^2) erfc(-iz) (as `scipy.special.wofz`),
+    calculated by the C library.
+
+    Args:
+        z (complex, array-like):    The argument(s).
+
+    Returns:
+        w (np.ndarray):             The values of the Faddeeva function (of the
+                                    shape of `z`).
+    """
+    z = np.ascontiguousarray(z, dtype=np.complex128)
+    w = np.empty_like(z)
+    C.cpygad.Faddeeva_w_batch(z.size, z.ctypes.data, w.ctypes.data)
+    return w
+
+
+def Faddeeva_w_sweep(x0, dx, y, n):
+    """
+    The Faddeeva function w(x+iy) for y>=0 at the n equidistant points x = x0,
+    x0+dx, ..., x0+(n-1)*dx, calculated by Weideman's expansion in the C library.
+
+    Args:
+        x0 (float):             The first real part.
+        dx (float):             The distance of the points.
+        y (float):              The (non-negative) imaginary part.
+        n (int):                The number of points.
+
+    Returns:
+        w (np.ndarray):         The values of the Faddeeva function.
+    """
+    w = np.empty(int(n), dtype=np.complex128)
+    C.cpygad.Faddeeva_w_sweep(float(x0), float(dx), float(y), len(w),
+                              w.ctypes.data)
+    return w
+
+
+def line_profile_bins(v, b, vel_extent, Nbins, Gamma=0.0, tau_0=0.0,
+                      wing_tau_tol=0):
+    """
+    The profile of a single line binned onto the velocity bins of a spectrum as
+    done for the mock spectra by the C library.
+
+    Args:
+        v (float):              The line centre.
+        b (float):              The Doppler parameter.
+        vel_extent (array-like):The velocity limits of the spectrum.
+        Nbins (int):            The number of velocity bins.
+        Gamma (float):          The natural line width (in velocity).
+        tau_0 (float):          The velocity integrated optical depth of the
+                                line (only relevant for truncating the Lorentz
+                                wings).
+        wing_tau_tol (float):   The truncation of the Lorentz wings (see
+                                `mock_absorption_spectrum`).
+
+    Returns:
+        Dtb (np.ndarray):       The fraction of the line within each bin.
+    """
+    vel_extent = np.array(vel_extent, dtype=np.float64)
+    Dtb = np.empty(int(Nbins), dtype=np.float64)
+    C.cpygad.line_profile_bins(float(v), float(b), float(Gamma), float(tau_0),
+                               float(wing_tau_tol), vel_extent.ctypes.data,
+                               len(Dtb), Dtb.ctypes.data)
+    return Dtb
+
+
 def thermal_b_param(line, T, units="km/s"):
     """Calculate the thermal Doppler b-parameter for given line and temperature."""
     if isinstance(line, str):
@@ -795,6 +1042,219 @@ def find_line_contributers(
     return contributing
 
 
+def _line_constants(s, l, f, atomwt, A_ki, v_units, l_units):
+    """
+    Calculate the natural line width Gamma (in velocity space), the thermal
+    Doppler parameter at 1 K and the cross section for a line transition.
+    """
+    # natural line width in frequency space, when using a Lorentzian
+    # defined as: L(f) = 1/pi * (Gamma / (f**2 + Gamma**2))
+    Gamma = A_ki / (4.0 * np.pi)
+    # ...and the velocity needed for an appropiate redshift
+    # (i.e. a conversion of the width to velocity space)
+    # Gamma = (Gamma / (c/l)) * c   # c/l = f
+    Gamma = (Gamma * l).in_units_of(v_units, subs=s)
+
+    b_0 = np.sqrt(2.0 * kB * UnitScalar("1 K") / atomwt)
+    b_0.convert_to(v_units)
+    s0 = q_e ** 2 / (4.0 * epsilon0 * m_e * c)
+    Xsec = f * s0 * l
+    Xsec = Xsec.in_units_of(l_units ** 2 * v_units, subs=s)
+
+    return Gamma, b_0, Xsec
+
+
+def _los_field_values(s, los_fields):
+    """
+    Get the per particle values of the additional l.o.s. fields as a (K,N) array
+    of doubles, together with their names and units.
+    """
+    if los_fields is None:
+        return [], np.empty((0, len(s.gas)), dtype=np.float64), []
+    names = list(los_fields.keys())
+    values = np.empty((len(names), len(s.gas)), dtype=np.float64)
+    units = []
+    for k, name in enumerate(names):
+        field = los_fields[name]
+        if isinstance(field, str):
+            field = s.gas.get(field)
+        field = UnitQty(field)
+        if field.shape != (len(s.gas),):
+            raise ValueError(
+                "The l.o.s. field '%s' has to be given per gas particle!" % name
+            )
+        values[k] = field.view(np.ndarray)
+        units.append(getattr(field, "units", Unit("1")))
+    return names, values, units
+
+
+def _v_turb_values(s, v_turb):
+    """
+    Get the turbulent velocities -- given as a constant, a block name, or a
+    block-like array for the gas particles -- as an array of doubles in km/s per
+    gas particle, or None if there are none.
+    """
+    if v_turb is None:
+        return None
+    if isinstance(v_turb, str):
+        try:
+            v_turb = UnitScalar(v_turb)
+        except:
+            v_turb = s.gas.get(v_turb)
+    v_turb = UnitQty(v_turb, "km/s", dtype=np.float64, subs=s)
+    if v_turb.shape == tuple():
+        v_turb = UnitQty(
+            float(v_turb) * np.ones(len(s.gas), dtype=np.float64),
+            units=getattr(v_turb, "units", "km/s"),
+        )
+    if v_turb.shape != (len(s.gas),):
+        raise ValueError("The turbulent velocities have to be given per gas "
+                         "particle!")
+    v_turb = v_turb.in_units_of("km/s", subs=s).view(np.ndarray)
+    if np.all(v_turb == 0):
+        return None
+    return v_turb.astype(np.float64).copy()
+
+
+def _spectrum_setup(s, lines_, v_turb, kernel):
+    """
+    The setup common to the mock spectra: look up the line transitions given by
+    name, calculate their constants, get the turbulent velocities per gas
+    particle (see `_v_turb_values`) and default the kernel.
+
+    Returns:
+        lines_ (list):          The line transitions as dictionaries, with the
+                                additional entries 'Gamma', 'b_0', and 'Xsec'
+                                (see `_line_constants`) as floats in km/s and
+                                cm, and 'l' and 'atomwt' as UnitScalars.
+        v_turb (np.ndarray):    The turbulent velocities in km/s (or None).
+        kernel (str):           The kernel to use.
+    """
+    v_units = Unit("km/s")
+    l_units = Unit("cm")
+    setup = []
+    for line in lines_:
+        if isinstance(line, str):
+            try:
+                line = lines[str(line)]
+            except KeyError:
+                raise KeyError(
+                    "unkown line '%s' -- " % line
+                    + "see `analysis.absorption_spectra.lines.keys()`"
+                )
+        line = dict(line)
+        line["l"] = UnitScalar(line["l"], "Angstrom")
+        line["atomwt"] = UnitScalar(line["atomwt"], "u")
+        A_ki = UnitScalar(line.get("A_ki", 0.0), "s**-1", dtype=float)
+        Gamma, b_0, Xsec = _line_constants(
+            s, line["l"], float(line["f"]), line["atomwt"], A_ki, v_units, l_units
+        )
+        line["Gamma"] = float(Gamma.in_units_of(v_units))
+        line["b_0"] = float(b_0.in_units_of(v_units, subs=s))
+        line["Xsec"] = float(Xsec.in_units_of(l_units ** 2 * v_units, subs=s))
+        setup.append(line)
+    if kernel is None:
+        kernel = gadget.general["kernel"]
+    return setup, _v_turb_values(s, v_turb), kernel
+
+
+def _los_axis(xaxis, yaxis):
+    """The axis along the l.o.s. for the given x- and y-axis."""
+    zaxis = (set([0, 1, 2]) - set([xaxis, yaxis])).pop()
+    if set([xaxis, yaxis, zaxis]) != set([0, 1, 2]):
+        raise ValueError("x- and y-axis must be in [0,1,2] and different!")
+    return zaxis
+
+
+def _particle_setup(s, lines_, v_turb, kernel, hsml="hsml", xaxis=0, yaxis=1,
+                    zero_Hubble_flow_at=0, los_phys=False):
+    """
+    The setup common to the mock spectra with the 'particles' method: the line
+    setup of `_spectrum_setup` and the data of the gas particles, converted to
+    arrays of doubles in the internally used units.
+
+    Returns:
+        lines_, v_turb, kernel: As returned by `_spectrum_setup`.
+        parts (dict):           The gas particle data:
+                                'pos':  the positions in the plane of `xaxis`
+                                        and `yaxis` (in cm, shape (N,2)),
+                                'vel':  the velocities along the l.o.s.,
+                                        including the Hubble flow relative to
+                                        `zero_Hubble_flow_at` (in km/s),
+                                'vpec': the peculiar velocities along the l.o.s.
+                                        (in km/s),
+                                'hsml': the smoothing lengths (in cm),
+                                'temp': the temperatures (in K),
+                                'n':    the number of ions for each line (shape
+                                        (N_lines,N)),
+                                and, if `los_phys`, 'rho' the densities (in
+                                g/cm**3) and 'metal_frac' the metal mass
+                                fractions of the element of the first line.
+    """
+    v_units = Unit("km/s")
+    l_units = Unit("cm")
+
+    zaxis = _los_axis(xaxis, yaxis)
+    lines_, v_turb, kernel = _spectrum_setup(s, lines_, v_turb, kernel)
+    gas = s.gas
+    parts = {}
+
+    # the number of ions per particle (in double precision in order not to
+    # overflow: 1 Msol / 1 u = 1.2e57, float max = 3.4e38)
+    n = np.empty((len(lines_), len(gas)), dtype=np.float64)
+    ions = {}
+    for k, line in enumerate(lines_):
+        ion = line["ion"]
+        if isinstance(ion, str):
+            if ion not in ions:
+                ions[ion] = gas.get(ion)
+            ion = ions[ion]
+        else:
+            ion = UnitQty(ion, units=s["mass"].units, subs=s)
+        n[k] = (ion.astype(np.float64) / line["atomwt"]).in_units_of(1, subs=s)
+    del ions
+    parts["n"] = n
+
+    if isinstance(hsml, str):
+        hsml = gas[hsml]
+    else:
+        hsml = UnitQty(hsml, s["pos"].units, subs=s)
+        if hsml.shape == ():
+            hsml = hsml * np.ones(len(gas), dtype=np.float64)
+    parts["hsml"] = np.ascontiguousarray(
+        hsml.in_units_of(l_units, subs=s).view(np.ndarray), dtype=np.float64
+    )
+
+    # add the Hubble flow
+    vel = gas["vel"][:, zaxis]
+    los_pos = gas["pos"][:, zaxis]
+    zero_Hubble_flow_at = UnitScalar(zero_Hubble_flow_at, s["pos"].units, subs=s)
+    zero_Hubble_flow_at.convert_to(los_pos.units, subs=s)
+    H_flow = s.cosmology.H(s.redshift) * (los_pos - zero_Hubble_flow_at)
+    H_flow.convert_to(vel.units, subs=s)
+
+    def _doubles(x, units):
+        x = x.astype(np.float64).in_units_of(units, subs=s).view(np.ndarray)
+        return np.ascontiguousarray(x)
+
+    parts["pos"] = _doubles(gas["pos"][:, (xaxis, yaxis)], l_units)
+    parts["vel"] = _doubles(vel + H_flow, v_units)
+    parts["vpec"] = _doubles(vel, v_units)
+    parts["temp"] = _doubles(gas["temp"], "K")
+    if los_phys:
+        parts["rho"] = _doubles(gas["rho"], "g/cm**3")
+        element = lines_[0].get("element")
+        if element is not None and element != "H" and element != "He":
+            metal_frac = gas[element] / gas["mass"]  # SA: metal mass fraction
+        else:
+            metal_frac = gas["metallicity"]
+        parts["metal_frac"] = np.ascontiguousarray(
+            metal_frac.view(np.ndarray), dtype=np.float64
+        )
+
+    return lines_, v_turb, kernel, parts
+
+
 def mock_absorption_spectrum_of(s, los, line, vel_extent, **kwargs):
     """
     Create a mock absorption spectrum for the given line of sight (l.o.s.) for the
@@ -864,6 +1324,9 @@ def mock_absorption_spectrum(
     xaxis=0,
     yaxis=1,
     return_los_phys=False,
+    los_fields=None,
+    wing_tau_tol=0,
+    deterministic=False,
 ):
     """
     Create a mock absorption spectrum for the given line of sight (l.o.s.) for the
@@ -970,6 +1433,25 @@ def mock_absorption_spectrum(
         return_los_phys (Bool): Returns additional LOS info, currently
                                 los_phys_dens (optical depth-weighted density), and
                                 vel (optical depth-weighted peculiar velocity)
+        los_fields (dict):      Additional quantities (block names or arrays per
+                                gas particle) to average along the l.o.s. (with
+                                the optical depth as weight), e.g.
+                                {'fHI': 'HI/H', 'P': 'P'}. Only for the
+                                'particles' method. If given, a dictionary of
+                                the resulting l.o.s. fields is returned as an
+                                additional last value.
+        wing_tau_tol (float):   The optical depth below which the Lorentz wings
+                                of the lines are truncated (only relevant for
+                                damped lines, i.e. A_ki > 0). If positive, the
+                                Voigt profiles are also evaluated by Humlicek's
+                                approximation (relative error below 1e-4),
+                                which is much faster, e.g. with 1e-6. By
+                                default, the profiles are exact and span the
+                                entire spectrum.
+        deterministic (bool):   Accumulate the spectrum in a fixed order, such
+                                that it is reproducible bit by bit independent
+                                of the number of threads (at the cost of some
+                                speed).
 
     Returns:
         taus (np.ndarray):      The optical depths for the velocity bins.
@@ -991,9 +1473,7 @@ def mock_absorption_spectrum(
 
     if isinstance(ion, str):
         ion = str(ion)
-    zaxis = (set([0, 1, 2]) - set([xaxis, yaxis])).pop()
-    if set([xaxis, yaxis, zaxis]) != set([0, 1, 2]):
-        raise ValueError("x- and y-axis must be in [0,1,2] and different!")
+    zaxis = _los_axis(xaxis, yaxis)
     los = UnitQty(los, s["pos"].units, dtype=np.float64, subs=s)
     zero_Hubble_flow_at = UnitScalar(zero_Hubble_flow_at, s["pos"].units, subs=s)
     vel_extent = UnitQty(vel_extent, "km/s", dtype=np.float64, subs=s)
@@ -1001,45 +1481,19 @@ def mock_absorption_spectrum(
         restr_column_lims = vel_extent.copy()
     else:
         restr_column_lims = UnitQty(restr_column_lims, "km/s", dtype=np.float64, subs=s)
-    l = UnitScalar(l, "Angstrom")
-    if v_turb is not None:
-        if isinstance(v_turb, str):
-            try:
-                v_turb = UnitScalar(v_turb)
-            except:
-                v_turb = s.gas.get(v_turb)
-        v_turb = UnitQty(v_turb, "km/s", dtype=np.float64)
-        if v_turb.shape == tuple():
-            v_turb = UnitQty(
-                float(v_turb) * np.ones(len(s.gas), dtype=np.float64),
-                units=getattr(v_turb, "units", "km/s"),
-            )
-        assert v_turb.shape == (len(s.gas),)
-        assert v_turb.units == "km/s"
-        if np.all(v_turb == 0):
-            v_turb = None
     if method != "particles":
-        if v_turb is not None:
-            v_turb = None
+        v_turb = None
     A_ki = UnitScalar(A_ki, "s**-1", dtype=float)
     f = float(f)
-    atomwt = UnitScalar(atomwt, "u")
-    if kernel is None:
-        kernel = gadget.general["kernel"]
-
-    # natural line width in frequency space, when using a Lorentzian
-    # defined as: L(f) = 1/pi * (Gamma / (f**2 + Gamma**2))
-    Gamma = A_ki / (4.0 * np.pi)
-    # ...and the velocity needed for an appropiate redshift
-    # (i.e. a conversion of the width to velocity space)
-    # Gamma = (Gamma / (c/l)) * c   # c/l = f
-    Gamma = (Gamma * l).in_units_of(v_units, subs=s)
-
-    b_0 = np.sqrt(2.0 * kB * UnitScalar("1 K") / atomwt)
-    b_0.convert_to(v_units)
-    s0 = q_e ** 2 / (4.0 * epsilon0 * m_e * c)
-    Xsec = f * s0 * l
-    Xsec = Xsec.in_units_of(l_units ** 2 * v_units, subs=s)
+    line = {"ion": ion, "l": l, "f": f, "atomwt": atomwt, "A_ki": A_ki,
+            "element": element}
+    (line,), v_turb, kernel, parts = _particle_setup(
+        s, [line], v_turb, kernel, hsml=hsml,
+        xaxis=xaxis, yaxis=yaxis, zero_Hubble_flow_at=zero_Hubble_flow_at,
+        los_phys=True,
+    )
+    l, atomwt = line["l"], line["atomwt"]
+    Gamma, b_0, Xsec = line["Gamma"], line["b_0"], line["Xsec"]
 
     if environment.verbose >= environment.VERBOSE_NORMAL:
         print("create a mock absorption spectrum:")
@@ -1049,16 +1503,16 @@ def mock_absorption_spectrum(
         else:
             print("  at lambda =", l)
         print("  with oscillator strength f =", f)
-        print("  => Xsec =", Xsec)
+        print("  => Xsec =", UnitScalar(Xsec, l_units ** 2 * v_units))
         print("  and atomic weight", atomwt)
-        print("  => b(T=1e4K) =", b_0 * np.sqrt(1e4))
+        print("  => b(T=1e4K) =", UnitScalar(b_0 * np.sqrt(1e4), v_units))
         print("  and a lifetime of 1/A_ki =", (1.0 / A_ki))
-        print("  => Gamma =", Gamma)
+        print("  => Gamma =", UnitScalar(Gamma, v_units))
         if v_turb is not None:
             v_perc = np.percentile(v_turb, [10, 90])
             print(
                 "  and a turbulent motion per particle of v_turb ~(%.1f - %.1f) %s"
-                % (v_perc[0], v_perc[-1], v_turb.units)
+                % (v_perc[0], v_perc[-1], v_units)
             )
         print('  using kernel "%s"' % kernel)
 
@@ -1067,15 +1521,8 @@ def mock_absorption_spectrum(
         vel_extent.units,
     )
 
-    # get ne number of ions per particle
-    if isinstance(ion, str):
-        ion = s.gas.get(ion)
-    else:
-        ion = UnitQty(ion, units=s["mass"].units, subs=s)
-    # double precision needed in order not to overflow
-    # 1 Msol / 1 u = 1.2e57, float max = 3.4e38, but double max = 1.8e308
-    n = (ion.astype(np.float64) / atomwt).in_units_of(1, subs=s)
-    # n = n.view(np.ndarray).astype(np.float64)
+    # the number of ions per particle
+    n = UnitArr(parts["n"][0], "1")
 
     if method != "particles":
         # do SPH smoothing along the l.o.s.
@@ -1255,61 +1702,32 @@ def mock_absorption_spectrum(
         # inplace conversion possible (later conversion does not add to runtime!)
         vel.convert_to(v_units, subs=s)
         temp.convert_to("K", subs=s)
-    else:
-        pos = s.gas["pos"][:, (xaxis, yaxis)]
-        vel = s.gas["vel"][:, zaxis]
-        temp = s.gas["temp"]
-        rho = s.gas["rho"]  # DS: gas density
-        if element is not None and element != "H" and element != "He":
-            metal_frac = s.gas[element] / s.gas["mass"]  # SA: metal mass fraction
-        else:
-            metal_frac = s.gas["metallicity"]
-
-        if temp.base is not None:
-            temp.copy()
-
-        if isinstance(hsml, str):
-            hsml = s.gas[hsml]
-        elif isinstance(hsml, (Number, Unit)):
-            hsml = UnitScalar(hsml, s["pos"].units) * np.ones(
-                len(s.gas), dtype=np.float64
-            )
-        else:
-            hsml = UnitQty(hsml, s["pos"].units, subs=s)
-        if hsml.base is not None:
-            hsml.copy()
 
+        # add the Hubble flow
+        zero_Hubble_flow_at.convert_to(los_pos.units, subs=s)
+        H_flow = s.cosmology.H(s.redshift) * (los_pos - zero_Hubble_flow_at)
+        H_flow.convert_to(vel.units, subs=s)
+        vpec_z = vel  # DS: peculiar LOS velocities
+        vel = vel + H_flow
+
+        vel = vel.astype(np.float64).in_units_of(v_units, subs=s).view(np.ndarray).copy()
+        vpec_z = (
+            vpec_z.astype(np.float64).in_units_of(v_units, subs=s).view(np.ndarray).copy()
+        )  # DS LOS peculiar velocities
+        temp = temp.in_units_of("K", subs=s).view(np.ndarray).astype(np.float64)
+        rho = (
+            rho.in_units_of("g/cm**3", subs=s).view(np.ndarray).astype(np.float64)
+        )  # DS: gas density
+        metal_frac = metal_frac.view(np.ndarray).astype(
+            np.float64
+        )  # SA metal mass fraction
+    else:
+        pos, vel, vpec_z = parts["pos"], parts["vel"], parts["vpec"]
+        hsml, temp, rho = parts["hsml"], parts["temp"], parts["rho"]
+        metal_frac = parts["metal_frac"]
+        n = parts["n"][0]
         N = len(s.gas)
 
-        # the z-coordinates for the Hubble flow
-        los_pos = s.gas["pos"][:, zaxis]
-
-    # add the Hubble flow
-    zero_Hubble_flow_at.convert_to(los_pos.units, subs=s)
-    H_flow = s.cosmology.H(s.redshift) * (los_pos - zero_Hubble_flow_at)
-    H_flow.convert_to(vel.units, subs=s)
-    vpec_z = vel  # DS: peculiar LOS velocities
-    vel = vel + H_flow
-
-    if pos is not None:
-        pos = (
-            pos.astype(np.float64).in_units_of(l_units, subs=s).view(np.ndarray).copy()
-        )
-    vel = vel.astype(np.float64).in_units_of(v_units, subs=s).view(np.ndarray).copy()
-    vpec_z = (
-        vpec_z.astype(np.float64).in_units_of(v_units, subs=s).view(np.ndarray).copy()
-    )  # DS LOS peculiar velocities
-    temp = temp.in_units_of("K", subs=s).view(np.ndarray).astype(np.float64)
-    rho = (
-        rho.in_units_of("g/cm**3", subs=s).view(np.ndarray).astype(np.float64)
-    )  # DS: gas density
-    metal_frac = metal_frac.view(np.ndarray).astype(
-        np.float64
-    )  # SA metal mass fraction
-
-    if hsml is not None:
-        hsml = hsml.in_units_of(l_units, subs=s).view(np.ndarray).astype(np.float64)
-
     los = los.in_units_of(l_units, subs=s).view(np.ndarray).astype(np.float64).copy()
     vel_extent = (
         vel_extent.in_units_of(v_units, subs=s)
@@ -1317,37 +1735,36 @@ def mock_absorption_spectrum(
         .astype(np.float64)
         .copy()
     )
-    if v_turb is not None:
-        v_turb = (
-            v_turb.in_units_of(v_units, subs=s)
-            .view(np.ndarray)
-            .astype(np.float64)
-            .copy()
-        )
 
-    b_0 = float(b_0.in_units_of(v_units, subs=s))
-    Xsec = float(Xsec.in_units_of(l_units ** 2 * v_units, subs=s))
-    Gamma = float(Gamma.in_units_of(v_units))
+    if los_fields is not None and method != "particles":
+        raise ValueError("Additional l.o.s. fields are only supported with the "
+                         "'particles' method!")
+    field_names, field_values, field_units = _los_field_values(s, los_fields)
+    # the weighted l.o.s. fields: density, temperature, peculiar velocity, metal
+    # mass fraction (DS & SA), and the additional ones
+    fields = np.empty((4 + len(field_names), N), dtype=np.float64)
+    fields[0] = rho
+    fields[1] = temp
+    fields[2] = vpec_z
+    fields[3] = metal_frac
+    if field_names:
+        fields[4:] = field_values
 
     taus = np.empty(Nbins, dtype=np.float64)
     los_dens = np.empty(Nbins, dtype=np.float64)
-    los_dens_phys = np.empty(Nbins, dtype=np.float64)  # DS: gas density field
-    los_temp = np.empty(Nbins, dtype=np.float64)
-    los_vpec = np.empty(Nbins, dtype=np.float64)  # DS: LOS peculiar velocity field
-    los_metal_frac = np.empty(Nbins, dtype=np.float64)  # SA: LOS metallicity field
+    los_fields_ = np.empty((len(fields), Nbins), dtype=np.float64)
     restr_column_lims = restr_column_lims.view(np.ndarray).astype(np.float64)
     restr_column = np.empty(N, dtype=np.float64)
-    C.cpygad.absorption_spectrum(
+    C.cpygad.absorption_spectrum_fields(
         method == "particles",
         C.c_size_t(N),
         C.c_void_p(pos.ctypes.data) if pos is not None else None,
         C.c_void_p(vel.ctypes.data),
-        C.c_void_p(vpec_z.ctypes.data),  # DS Los peculiar velocities
         C.c_void_p(hsml.ctypes.data) if hsml is not None else None,
         C.c_void_p(n.ctypes.data),
         C.c_void_p(temp.ctypes.data),
-        C.c_void_p(rho.ctypes.data),  # DS: gas density
-        C.c_void_p(metal_frac.ctypes.data),  # SA: metal mass fraction
+        C.c_size_t(len(fields)),
+        C.c_void_p(fields.ctypes.data),
         C.c_void_p(los.ctypes.data),
         C.c_void_p(vel_extent.ctypes.data),
         C.c_size_t(Nbins),
@@ -1355,17 +1772,21 @@ def mock_absorption_spectrum(
         C.c_void_p(v_turb.ctypes.data) if v_turb is not None else None,
         C.c_double(Xsec),
         C.c_double(Gamma),
+        C.c_double(wing_tau_tol),
+        C.c_int(bool(deterministic)),
         C.c_void_p(taus.ctypes.data),
         C.c_void_p(los_dens.ctypes.data),
-        C.c_void_p(los_dens_phys.ctypes.data),  # DS gas density
-        C.c_void_p(los_metal_frac.ctypes.data),  # SA LOS metal mass fraction
-        C.c_void_p(los_temp.ctypes.data),
-        C.c_void_p(los_vpec.ctypes.data),  # DS LOS peculiar velocity field
+        C.c_void_p(los_fields_.ctypes.data),
         C.c_void_p(restr_column_lims.ctypes.data),
         C.c_void_p(restr_column.ctypes.data),
         C.create_string_buffer(kernel.encode("ascii")),
         C.c_double(s.boxsize.in_units_of(l_units)),
     )
+    los_dens_phys, los_temp, los_vpec, los_metal_frac = los_fields_[:4]
+    los_fields = {
+        name: UnitArr(los_fields_[4 + k], field_units[k])
+        for k, name in enumerate(field_names)
+    }
 
     los_dens = UnitArr(los_dens, "cm**-2")
     los_dens_phys = UnitArr(los_dens_phys, "g cm**-3")  # DS gas density field
@@ -1401,7 +1822,7 @@ def mock_absorption_spectrum(
             pass
 
     if return_los_phys:
-        return (
+        ret = (
             taus,
             los_dens,
             los_dens_phys,
@@ -1412,7 +1833,548 @@ def mock_absorption_spectrum(
             restr_column,
         )
     else:
-        return taus, los_dens, los_temp, v_edges, restr_column
+        ret = taus, los_dens, los_temp, v_edges, restr_column
+    if field_names:
+        ret += (los_fields,)
+    return ret
+
+
+def mock_absorption_spectra(
+    s,
+    los,
+    line,
+    vel_extent,
+    Nbins=1000,
+    v_turb=None,
+    hsml="hsml",
+    kernel=None,
+    restr_column_lims=None,
+    zero_Hubble_flow_at=0,
+    xaxis=0,
+    yaxis=1,
+    return_los_phys=False,
+    los_fields=None,
+    wing_tau_tol=0,
+):
+    """
+    Create mock absorption spectra for many lines of sight at once.
+
+    This is the equivalent of calling `mock_absorption_spectrum_of` with
+    method='particles' for each of the lines of sight, but the unit conversions
+    are done only once and the particles intersecting the individual l.o.s. are
+    found by a quadtree on the C side, where the l.o.s. are processed in
+    parallel.
+
+    Args:
+        s (Snap):               The snapshot to shoot the l.o.s. though.
+        los (UnitQty):          The positions of the l.o.s. (shape (N_los,2)).
+                                By default understood as in units of s['pos'].
+        line (str, dict):       The line transition (see
+                                `mock_absorption_spectrum_of`).
+        vel_extent (UnitQty):   The limits of the spectra in (rest frame)
+                                velocity space. Units default to 'km/s'.
+        For the remaining arguments, see `mock_absorption_spectrum`.
+
+    Returns:
+        taus (np.ndarray):      The optical depths, shape (N_los,Nbins).
+        los_dens (UnitArr):     The column densities restricted to the velocity
+                                bins (in cm^-2), shape (N_los,Nbins).
+        los_dens_phys (UnitArr):The gas density for the velocity bins (in g
+                                cm^-3); only returned if `return_los_phys`.
+        los_temp (UnitArr):     The (optical depth-weighted) temperatures.
+        los_metal_frac (UnitArr):
+                                The metal mass fraction for the velocity bins;
+                                only returned if `return_los_phys`.
+        los_vpec (UnitArr):     The peculiar velocities for the velocity bins;
+                                only returned if `return_los_phys`.
+        v_edges (UnitArr):      The velocities at the bin edges.
+        restr_column (UnitArr): The column densities within `restr_column_lims`
+                                for each l.o.s..
+        los_fields (dict):      The additional l.o.s. fields (each of shape
+                                (N_los,Nbins)); only returned if `los_fields` was
+                                given.
+    """
+    # internally used units
+    v_units = Unit("km/s")
+    l_units = Unit("cm")
+
+    los = UnitQty(los, s["pos"].units, dtype=np.float64, subs=s)
+    los = los.reshape((-1, 2))
+    vel_extent = UnitQty(vel_extent, "km/s", dtype=np.float64, subs=s)
+    if restr_column_lims is None:
+        restr_column_lims = vel_extent.copy()
+    else:
+        restr_column_lims = UnitQty(restr_column_lims, "km/s", dtype=np.float64, subs=s)
+    (line,), v_turb, kernel, parts = _particle_setup(
+        s, [line], v_turb, kernel, hsml=hsml, xaxis=xaxis, yaxis=yaxis,
+        zero_Hubble_flow_at=zero_Hubble_flow_at, los_phys=True,
+    )
+    Gamma, b_0, Xsec = line["Gamma"], line["b_0"], line["Xsec"]
+    pos, vel, hsml, temp = parts["pos"], parts["vel"], parts["hsml"], parts["temp"]
+    n = parts["n"][0]
+
+    v_edges = UnitArr(
+        np.linspace(float(vel_extent[0]), float(vel_extent[1]), Nbins + 1),
+        vel_extent.units,
+    )
+
+    los = los.in_units_of(l_units, subs=s).view(np.ndarray).astype(np.float64).copy()
+    vel_extent = vel_extent.in_units_of(v_units, subs=s).view(np.ndarray).copy()
+    restr_column_lims = restr_column_lims.view(np.ndarray).astype(np.float64)
+
+    field_names, field_values, field_units = _los_field_values(s, los_fields)
+    fields = np.empty((4 + len(field_names), len(s.gas)), dtype=np.float64)
+    fields[0] = parts["rho"]
+    fields[1] = temp
+    fields[2] = parts["vpec"]
+    fields[3] = parts["metal_frac"]
+    fields[4:] = field_values
+
+    N_los = len(los)
+    taus = np.empty((N_los, Nbins), dtype=np.float64)
+    los_dens = np.empty((N_los, Nbins), dtype=np.float64)
+    los_fields_ = np.empty((N_los, len(fields), Nbins), dtype=np.float64)
+    restr_column = np.empty(N_los, dtype=np.float64)
+    C.cpygad.absorption_spectra_batch(
+        C.c_size_t(len(s.gas)),
+        C.c_void_p(pos.ctypes.data),
+        C.c_void_p(vel.ctypes.data),
+        C.c_void_p(hsml.ctypes.data),
+        C.c_void_p(n.ctypes.data),
+        C.c_void_p(temp.ctypes.data),
+        C.c_size_t(len(fields)),
+        C.c_void_p(fields.ctypes.data),
+        C.c_size_t(N_los),
+        C.c_void_p(los.ctypes.data),
+        C.c_void_p(vel_extent.ctypes.data),
+        C.c_size_t(Nbins),
+        C.c_double(b_0),
+        C.c_void_p(v_turb.ctypes.data) if v_turb is not None else None,
+        C.c_double(Xsec),
+        C.c_double(Gamma),
+        C.c_double(wing_tau_tol),
+        C.c_void_p(taus.ctypes.data),
+        C.c_void_p(los_dens.ctypes.data),
+        C.c_void_p(los_fields_.ctypes.data),
+        C.c_void_p(restr_column_lims.ctypes.data),
+        C.c_void_p(restr_column.ctypes.data),
+        C.create_string_buffer(kernel.encode("ascii")),
+        C.c_double(s.boxsize.in_units_of(l_units)),
+    )
+    los_dens_phys = los_fields_[:, 0]
+    los_temp = los_fields_[:, 1]
+    los_vpec = los_fields_[:, 2]
+    los_metal_frac = los_fields_[:, 3]
+    los_fields = {
+        name: UnitArr(los_fields_[:, 4 + k], field_units[k])
+        for k, name in enumerate(field_names)
+    }
+
+    los_dens = UnitArr(los_dens, "cm**-2")
+    los_dens_phys = UnitArr(los_dens_phys, "g cm**-3")
+    los_temp = UnitArr(los_temp, "K")
+    los_metal_frac = UnitArr(los_metal_frac)
+    los_vpec = UnitArr(los_vpec, "km/s")
+    restr_column = UnitArr(restr_column, "cm**-2")
+
+    if return_los_phys:
+        ret = (
+            taus,
+            los_dens,
+            los_dens_phys,
+            los_temp,
+            los_metal_frac,
+            los_vpec,
+            v_edges,
+            restr_column,
+        )
+    else:
+        ret = taus, los_dens, los_temp, v_edges, restr_column
+    if field_names:
+        ret += (los_fields,)
+    return ret
+
+
+def mock_absorption_forest(
+    s,
+    line,
+    Npx,
+    Nbins=1024,
+    xaxis=0,
+    yaxis=1,
+    v_turb=None,
+    hsml="hsml",
+    kernel=None,
+    Npdf=20,
+    return_taus=False,
+    block_rows=0,
+    wing_tau_tol=0,
+):
+    """
+    Create a regular grid of mock absorption spectra ("skewers") through the
+    entire periodic box and reduce them to the flux statistics.
+
+    All particles are deposited in a single sweep onto the (Npx x Npx x Nbins)
+    optical depth cube, where the velocity extent of the spectra is the Hubble
+    flow across the box and the spectra are periodic. Unless the optical depths
+    are asked for, the cube is only held in blocks of `block_rows` rows of
+    skewers, which are reduced to the mean flux, the flux power spectrum and the
+    flux PDF on the fly.
+
+    Args:
+        s (Snap):               The (cosmological) snapshot.
+        line (str, dict):       The line transition (see
+                                `mock_absorption_spectrum_of`).
+        Npx (int, tuple):       The number of skewers along the x- and y-axis.
+        Nbins (int):            The number of bins for the spectra.
+        xaxis/yaxis (int):      The x- and y-axis of the skewer grid; the skewers
+                                run along the remaining axis.
+        v_turb (UnitScalar, str, UnitQty):
+                                A turbulent velocity (see
+                                `mock_absorption_spectrum`).
+        hsml (str, UnitQty, Unit):
+                                The smoothing lengths to use.
+        kernel (str):           The kernel to use for smoothing. (By default use
+                                the kernel defined in `gadget.cfg`.)
+        Npdf (int):             The number of bins for the flux PDF.
+        return_taus (bool):     Whether to also return the optical depth cube.
+        block_rows (int):       The number of rows of skewers to process at
+                                once, if the optical depths are not returned.
+                                Zero means all at once.
+        wing_tau_tol (float):   The truncation of the Lorentz wings (see
+                                `mock_absorption_spectrum`).
+
+    Returns:
+        mean_flux (float):      The mean transmitted flux.
+        k (UnitArr):            The wavenumbers of the flux power spectrum.
+        flux_pk (UnitArr):      The power spectrum of F/<F>-1.
+        pdf_edges (np.ndarray): The bin edges of the flux PDF.
+        flux_pdf (np.ndarray):  The flux PDF.
+        taus (np.ndarray):      The optical depths (only if `return_taus`).
+    """
+    # internally used units
+    v_units = Unit("km/s")
+    l_units = Unit("cm")
+
+    if isinstance(Npx, Number):
+        Npx = (Npx, Npx)
+    Npx = np.array(Npx, dtype=np.uintp)
+    (line,), v_turb, kernel, parts = _particle_setup(
+        s, [line], v_turb, kernel, hsml=hsml, xaxis=xaxis, yaxis=yaxis
+    )
+    Gamma, b_0, Xsec = line["Gamma"], line["b_0"], line["Xsec"]
+    pos, vel, hsml, temp = parts["pos"], parts["vel"], parts["hsml"], parts["temp"]
+    n = parts["n"][0]
+
+    boxsize = float(s.boxsize.in_units_of(l_units, subs=s))
+    v_box = (s.cosmology.H(s.redshift) * s.boxsize).in_units_of(v_units, subs=s)
+    vel_extent = np.array([0.0, float(v_box)], dtype=np.float64)
+    extent = np.array([0.0, boxsize, 0.0, boxsize], dtype=np.float64)
+
+    taus = np.empty((Npx[0], Npx[1], Nbins), dtype=np.float64) if return_taus else None
+    mean_flux = C.c_double()
+    flux_pk = np.empty(Nbins // 2 + 1, dtype=np.float64)
+    flux_pdf = np.empty(Npdf, dtype=np.float64)
+    C.cpygad.absorption_forest(
+        C.c_size_t(len(s.gas)),
+        C.c_void_p(pos.ctypes.data),
+        C.c_void_p(vel.ctypes.data),
+        C.c_void_p(hsml.ctypes.data),
+        C.c_void_p(n.ctypes.data),
+        C.c_void_p(temp.ctypes.data),
+        C.c_void_p(extent.ctypes.data),
+        C.c_void_p(Npx.ctypes.data),
+        C.c_void_p(vel_extent.ctypes.data),
+        C.c_size_t(Nbins),
+        C.c_int(1),
+        C.c_double(b_0),
+        C.c_void_p(v_turb.ctypes.data) if v_turb is not None else None,
+        C.c_double(Xsec),
+        C.c_double(Gamma),
+        C.c_double(wing_tau_tol),
+        C.c_void_p(taus.ctypes.data) if taus is not None else None,
+        C.byref(mean_flux),
+        C.c_void_p(flux_pk.ctypes.data),
+        C.c_size_t(Npdf),
+        C.c_void_p(flux_pdf.ctypes.data),
+        C.c_size_t(block_rows),
+        C.create_string_buffer(kernel.encode("ascii")),
+        C.c_double(boxsize),
+    )
+
+    dv = float(v_box) / Nbins
+    k = UnitArr(2.0 * np.pi * np.arange(Nbins // 2 + 1) / (Nbins * dv), "s/km")
+    flux_pk = UnitArr(flux_pk, "km/s")
+    pdf_edges = np.linspace(0.0, 1.0, Npdf + 1)
+
+    if return_taus:
+        return mean_flux.value, k, flux_pk, pdf_edges, flux_pdf, taus
+    else:
+        return mean_flux.value, k, flux_pk, pdf_edges, flux_pdf
+
+
+def mock_absorption_spectrum_lines(
+    s,
+    los,
+    lines_,
+    l_extent,
+    Nbins=10000,
+    v_turb=None,
+    hsml="hsml",
+    kernel=None,
+    zero_Hubble_flow_at=0,
+    xaxis=0,
+    yaxis=1,
+    wing_tau_tol=0,
+    deterministic=False,
+):
+    """
+    Create a mock absorption spectrum of many line transitions at once along a
+    single line of sight (with the 'particles' method).
+
+    The geometry (the projected kernel weight) of each particle is calculated
+    only once and all lines are deposited onto a common wavelength grid.
+
+    Args:
+        s (Snap):               The snapshot to shoot the l.o.s. though.
+        los (UnitQty):          The position of the l.o.s.. By default understood
+                                as in units of s['pos'].
+        lines_ (list):          The line transitions, each given as a name from
+                                `lines` or a dictionary like their entries (with
+                                'ion', 'l', 'f', 'atomwt', and optionally 'A_ki').
+        l_extent (UnitQty):     The (observed) wavelength range of the spectrum.
+                                Units default to Angstrom.
+        Nbins (int):            The number of bins of the spectrum.
+        For the remaining arguments, see `mock_absorption_spectrum`.
+
+    Returns:
+        taus (np.ndarray):      The total optical depths of all the lines.
+        l_edges (UnitArr):      The wavelengths at the bin edges.
+    """
+    # internally used units
+    v_units = Unit("km/s")
+    l_units = Unit("cm")
+
+    los = UnitQty(los, s["pos"].units, dtype=np.float64, subs=s)
+    l_extent = UnitQty(l_extent, "Angstrom", dtype=np.float64, subs=s)
+    lines_, v_turb, kernel, parts = _particle_setup(
+        s, lines_, v_turb, kernel, hsml=hsml, xaxis=xaxis, yaxis=yaxis,
+        zero_Hubble_flow_at=zero_Hubble_flow_at,
+    )
+    pos, vel, hsml, temp = parts["pos"], parts["vel"], parts["hsml"], parts["temp"]
+    n = parts["n"]
+
+    N_lines = len(lines_)
+    vel_extents = np.empty((N_lines, 2), dtype=np.float64)
+    b_0 = np.array([line["b_0"] for line in lines_], dtype=np.float64)
+    Xsec = np.array([line["Xsec"] for line in lines_], dtype=np.float64)
+    Gamma = np.array([line["Gamma"] for line in lines_], dtype=np.float64)
+    for k, line in enumerate(lines_):
+        # the same wavelength range for each line
+        vel_extents[k] = redshifts_to_velocities(
+            (l_extent / line["l"]).in_units_of(1, subs=s) - 1.0, z0=s.redshift
+        ).in_units_of(v_units)
+
+    los = los.in_units_of(l_units, subs=s).view(np.ndarray).astype(np.float64).copy()
+
+    taus = np.empty(Nbins, dtype=np.float64)
+    C.cpygad.absorption_spectrum_multiline(
+        C.c_size_t(len(s.gas)),
+        C.c_void_p(pos.ctypes.data),
+        C.c_void_p(vel.ctypes.data),
+        C.c_void_p(hsml.ctypes.data),
+        C.c_void_p(temp.ctypes.data),
+        C.c_void_p(los.ctypes.data),
+        C.c_size_t(N_lines),
+        C.c_void_p(n.ctypes.data),
+        C.c_void_p(vel_extents.ctypes.data),
+        C.c_void_p(b_0.ctypes.data),
+        C.c_void_p(Xsec.ctypes.data),
+        C.c_void_p(Gamma.ctypes.data),
+        C.c_double(wing_tau_tol),
+        C.c_int(bool(deterministic)),
+        C.c_void_p(v_turb.ctypes.data) if v_turb is not None else None,
+        C.c_size_t(Nbins),
+        C.c_void_p(taus.ctypes.data),
+        C.create_string_buffer(kernel.encode("ascii")),
+        C.c_double(s.boxsize.in_units_of(l_units)),
+    )
+
+    l_edges = UnitArr(
+        np.linspace(float(l_extent[0]), float(l_extent[1]), Nbins + 1), l_extent.units
+    )
+    return taus, l_edges
+
+
+def mock_light_cone_spectrum(
+    snaps,
+    line,
+    origin,
+    direction,
+    z_lims,
+    pixel_v="2 km/s",
+    z_switch=None,
+    v_turb=None,
+    hsml="hsml",
+    kernel=None,
+    wing_tau_tol=0,
+):
+    """
+    Create a mock absorption spectrum along a long skewer, that crosses many
+    periodic replicas of the boxes of a stack of snapshots, e.g. for mock quasar
+    spectra spanning a large range in redshift.
+
+    The skewer is a straight line (in comoving coordinates) starting at
+    redshift z_lims[0] and going until z_lims[1]. Along the way, the snapshot
+    closest in redshift is used (or as defined by `z_switch`).
+
+    Args:
+        snaps (list):           The snapshots to use (in any order).
+        line (str, dict):       The line transition (see
+                                `mock_absorption_spectrum_of`).
+        origin (UnitQty):       The (comoving) starting point of the skewer in
+                                the box. Defaults to the units of the positions
+                                of the first snapshot.
+        direction (array-like): The direction of the skewer (does not need to
+                                be normalized).
+        z_lims (array-like):    The redshift range of the skewer.
+        pixel_v (UnitScalar):   The size of the pixels in velocity space. The
+                                pixels are equidistant in log(wavelength).
+        z_switch (array-like):  The redshifts at which to switch from one
+                                snapshot to the next (ordered by redshift).
+                                Defaults to the midpoints between the
+                                redshifts of the snapshots.
+        v_turb (UnitScalar, str, UnitQty):
+                                A turbulent velocity (see
+                                `mock_absorption_spectrum`). Blocks and
+                                block-like arrays are taken per snapshot.
+        hsml (str):             The block of the smoothing lengths.
+        kernel (str):           The kernel to use for smoothing. (By default
+                                use the kernel defined in `gadget.cfg`.)
+        wing_tau_tol (float):   The truncation of the Lorentz wings (see
+                                `mock_absorption_spectrum`).
+
+    Returns:
+        taus (np.ndarray):      The optical depths of the pixels.
+        l_edges (UnitArr):      The observed wavelengths at the pixel edges.
+    """
+    # internally used units
+    v_units = Unit("km/s")
+    d_units = Unit("Mpc")   # comoving
+
+    snaps = sorted(snaps, key=lambda s: s.redshift)
+    cosmo = snaps[0].cosmology
+    comoving = {"a": 1.0, "z": 0.0, "h_0": cosmo.h_0}
+
+    z_lims = [float(z) for z in z_lims]
+    if z_switch is None:
+        zs = [s.redshift for s in snaps]
+        z_switch = [(zs[i] + zs[i + 1]) / 2.0 for i in range(len(zs) - 1)]
+    if len(z_switch) != len(snaps) - 1:
+        raise ValueError("Need one redshift less to switch at than snapshots!")
+
+    # the comoving distances along the skewer
+    D0 = float(cosmo.comoving_distance(z_lims[0], d_units))
+
+    def _dist(z):
+        return float(cosmo.comoving_distance(z, d_units)) - D0
+
+    length = _dist(z_lims[1])
+    d_lims = np.array(
+        [-np.inf] + [_dist(z) for z in z_switch] + [np.inf], dtype=np.float64
+    )
+    z_tab = np.linspace(z_lims[0], z_lims[1], 1000)
+    d_tab = np.array([_dist(z) for z in z_tab], dtype=np.float64)
+    lnz1_tab = np.log1p(z_tab).astype(np.float64)
+
+    origin = UnitQty(origin, snaps[0]["pos"].units, dtype=np.float64)
+    origin = origin.in_units_of(d_units, subs=comoving).view(np.ndarray).copy()
+    direction = np.array(direction, dtype=np.float64)
+
+    # the (observed) wavelength grid
+    c_light = float(c.in_units_of(v_units))
+    dlnl = float(UnitScalar(pixel_v, v_units).in_units_of(v_units)) / c_light
+    ln_l_min = np.log1p(z_lims[0])
+    Nbins = int(np.ceil((np.log1p(z_lims[1]) - ln_l_min) / dlnl))
+
+    # the snapshot data
+    N, pos, vel, hsmls, ns, temps, v_turbs = [], [], [], [], [], [], []
+    boxsize = np.empty(len(snaps), dtype=np.float64)
+    col_fac = np.empty(len(snaps), dtype=np.float64)
+    Mpc_in_cm = float(UnitScalar(1.0, d_units).in_units_of("cm"))
+    for k, s in enumerate(snaps):
+        (line_s,), v_turb_s, kernel_s = _spectrum_setup(s, [line], v_turb, kernel)
+        if k == 0:
+            l, atomwt, kernel = line_s["l"], line_s["atomwt"], kernel_s
+            Gamma, b_0, Xsec = line_s["Gamma"], line_s["b_0"], line_s["Xsec"]
+        v_turbs.append(v_turb_s)
+        N.append(len(s.gas))
+        pos.append(
+            s.gas["pos"].in_units_of(d_units, subs=comoving)
+            .view(np.ndarray).astype(np.float64).copy()
+        )
+        vel.append(
+            s.gas["vel"].in_units_of(v_units, subs=s)
+            .view(np.ndarray).astype(np.float64).copy()
+        )
+        hsmls.append(
+            s.gas[hsml].in_units_of(d_units, subs=comoving)
+            .view(np.ndarray).astype(np.float64).copy()
+        )
+        ion = s.gas.get(line_s["ion"])
+        ns.append(
+            (ion.astype(np.float64) / atomwt).in_units_of(1, subs=s)
+            .view(np.ndarray).astype(np.float64).copy()
+        )
+        temps.append(
+            s.gas["temp"].in_units_of("K", subs=s)
+            .view(np.ndarray).astype(np.float64).copy()
+        )
+        boxsize[k] = float(s.boxsize.in_units_of(d_units, subs=comoving))
+        # ions per comoving area -> physical column density
+        col_fac[k] = 1.0 / (s.scale_factor * Mpc_in_cm) ** 2
+
+    def _ptrs(arrs):
+        return (C.c_void_p * len(arrs))(
+            *[a.ctypes.data if a is not None else None for a in arrs]
+        )
+
+    N = np.array(N, dtype=np.uintp)
+    taus = np.empty(Nbins, dtype=np.float64)
+    C.cpygad.absorption_skewer(
+        C.c_size_t(len(snaps)),
+        C.c_void_p(N.ctypes.data),
+        _ptrs(pos),
+        _ptrs(vel),
+        _ptrs(hsmls),
+        _ptrs(ns),
+        _ptrs(temps),
+        _ptrs(v_turbs),
+        C.c_void_p(boxsize.ctypes.data),
+        C.c_void_p(col_fac.ctypes.data),
+        C.c_void_p(d_lims.ctypes.data),
+        C.c_void_p(origin.ctypes.data),
+        C.c_void_p(direction.ctypes.data),
+        C.c_double(length),
+        C.c_size_t(len(z_tab)),
+        C.c_void_p(d_tab.ctypes.data),
+        C.c_void_p(lnz1_tab.ctypes.data),
+        C.c_double(ln_l_min),
+        C.c_double(dlnl),
+        C.c_size_t(Nbins),
+        C.c_double(b_0),
+        C.c_double(Xsec),
+        C.c_double(Gamma),
+        C.c_double(wing_tau_tol),
+        C.c_double(c_light),
+        C.c_void_p(taus.ctypes.data),
+        C.create_string_buffer(kernel.encode("ascii")),
+    )
+
+    l_edges = UnitArr(
+        float(l) * np.exp(ln_l_min + dlnl * np.arange(Nbins + 1)), "Angstrom"
+    )
+    return taus, l_edges
 
 
 def EW(taus, edges):
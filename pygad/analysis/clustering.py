@@ -0,0 +1,625 @@
+'''
+Two-point statistics of positions (e.g. of particles, halos or galaxies): the
+(weighted) pair counts in logarithmic radial bins or in bins of the projected
+separation and the one along the line of sight, the correlation functions
+derived from them, and the pairwise velocities.
+
+The pairs are counted by a dual-tree traversal in C (see `pair_counts`), which
+counts entire pairs of tree nodes at once, if all their separations fall into
+the same bin. In periodic boxes the counts of random pairs are known
+analytically, such that no random catalogue is needed.
+
+The power spectrum is estimated from the particles assigned onto a periodic
+mesh (see `power_spectrum`).
+
+Example:
+    >>> np.random.seed(42)
+    >>> pos = np.random.uniform(0, 100, size=(2000,3))
+    >>> DD, r_edges = pair_counts(pos, 2.0, 30.0, N_bins=6, boxsize=100)
+    >>> np.allclose(r_edges[1:] / r_edges[:-1], (30.0/2.0)**(1/6.))
+    True
+    >>> d = np.abs(pos[:,np.newaxis,:] - pos[np.newaxis,:,:])
+    >>> d = np.sqrt((np.minimum(d, 100-d)**2).sum(axis=-1))
+    >>> brute = np.histogram(d[np.triu_indices(len(pos), 1)], r_edges)[0]
+    >>> np.all(DD == brute)
+    True
+    >>> DD_w, r_edges = pair_counts(pos, 2.0, 30.0, N_bins=6, boxsize=100,
+    ...                             w=np.arange(len(pos)))
+    >>> i, j = np.triu_indices(len(pos), 1)
+    >>> brute = np.histogram(d[i,j], r_edges, weights=1.0*i*j)[0]
+    >>> np.allclose(DD_w, brute, rtol=1e-12)
+    True
+
+    The correlation function of a Poisson sample vanishes:
+    >>> xi, r_edges = correlation_function(pos, 2.0, 30.0, N_bins=6,
+    ...                                    boxsize=100)
+    >>> np.all(np.abs(xi[2:]) < 0.1)
+    True
+    >>> randoms = np.random.uniform(0, 100, size=(4000,3))
+    >>> xi_LS, r_edges = correlation_function(pos, 2.0, 30.0, N_bins=6,
+    ...                                       randoms=randoms, boxsize=100)
+    >>> np.all(np.abs(xi_LS[2:]) < 0.1)
+    True
+
+    Clustered points, however, are correlated on small scales:
+    >>> clustered = np.concatenate([pos, pos + np.random.normal(0, 1, pos.shape)])
+    >>> xi, r_edges = correlation_function(clustered % 100, 2.0, 30.0, N_bins=6,
+    ...                                    boxsize=100)
+    >>> xi[0] > 10 * abs(xi[-1])
+    True
+
+    In bins of the projected separation r_p and the one along the z-axis pi:
+    >>> DD, rp_edges, pi_edges = pair_counts_rp_pi(pos, 2.0, 30.0, 20.0,
+    ...                                            N_rp=6, N_pi=4, boxsize=100)
+    >>> dx = pos[np.newaxis,:,:] - pos[:,np.newaxis,:]
+    >>> dx = (dx[i,j] + 50) % 100 - 50
+    >>> brute = np.histogram2d(np.sqrt(dx[:,0]**2 + dx[:,1]**2),
+    ...                        np.abs(dx[:,2]), [rp_edges, pi_edges])[0]
+    >>> np.all(DD == brute)
+    True
+    >>> w_p, rp_edges, xi = projected_correlation_function(clustered % 100,
+    ...                             2.0, 30.0, 20.0, N_rp=6, N_pi=4, boxsize=100)
+    >>> w_p[0] > 10 * abs(w_p[-1])
+    True
+
+    The radial pairwise velocity of a linear flow v = -H r is -H |r|:
+    >>> vel = -0.5 * pos
+    >>> v12, sigma, r_edges = pairwise_velocity(pos, vel, 2.0, 30.0, N_bins=6)
+    >>> np.all((-0.5*r_edges[1:] < v12) & (v12 < -0.5*r_edges[:-1]))
+    True
+    >>> r = np.sqrt(((pos[j] - pos[i])**2).sum(axis=-1))
+    >>> N_r = np.histogram(r, r_edges)[0]
+    >>> np.allclose(v12, np.histogram(r, r_edges, weights=-0.5*r)[0] / N_r,
+    ...             rtol=1e-12)
+    True
+
+    A mark that does not depend on the position is not correlated either:
+    >>> M, r_edges = marked_correlation(pos, np.random.uniform(1, 2, len(pos)),
+    ...                                 2.0, 30.0, N_bins=6, boxsize=100)
+    >>> np.all(np.abs(M[2:] - 1) < 0.05)
+    True
+
+    The power spectrum of the Poisson sample is its shot noise:
+    >>> P, k, N_modes = power_spectrum(pos, 100, Npx=32,
+    ...                                subtract_shot_noise=False)
+    >>> P_shot = 100.0**3 / len(pos)
+    >>> np.all(np.abs(P[N_modes > 1000] / P_shot - 1) < 0.2)
+    True
+    >>> P, k, N_modes = power_spectrum(pos, 100, Npx=32, scheme='TSC')
+    >>> abs(np.mean(P[N_modes > 1000])) < 0.05 * P_shot
+    True
+'''
+__all__ = ['log_r_edges', 'pair_counts', 'pair_counts_rp_pi',
+           'random_pair_counts', 'random_pair_counts_rp_pi',
+           'correlation_function', 'projected_correlation_function',
+           'marked_correlation', 'pairwise_velocity', 'power_spectrum']
+
+import numpy as np
+from ..units import UnitArr, UnitQty, UnitScalar
+from ..binning.cbinning import _mass_assignment_order
+from .. import C
+
+
+def log_r_edges(r_min, r_max, N_bins):
+    '''
+    The edges of `N_bins` logarithmic bins between r_min and r_max as used by
+    `pair_counts`.
+    '''
+    return np.logspace(np.log10(r_min), np.log10(r_max), N_bins + 1)
+
+
+def _in_units_of_pos(x, pos):
+    '''Convert a length into the units of the (possibly unitless) positions.'''
+    units = getattr(pos, 'units', None)
+    if units is not None:
+        return float(UnitScalar(x, units, dtype=float))
+    return float(x)
+
+
+def _as_C_array(a, shape=None):
+    a = np.ascontiguousarray(np.asarray(a).view(np.ndarray), dtype=np.float64)
+    if shape is not None and a.shape != shape:
+        raise ValueError('Expected an array of shape %s, got %s!' % (shape,
+                                                                    a.shape))
+    return a
+
+
+def _pair_counts(pos, r_min, r_max, N_bins, pos2, w, w2, boxsize,
+                 pi_max=None, N_pi=0, vel=None, vel2=None):
+    '''
+    Call the C pair counting (see `pair_counts`) and return the counts, the
+    radial bin edges, and the velocity sums (None without velocities).
+    '''
+    r_min = _in_units_of_pos(r_min, pos)
+    r_max = _in_units_of_pos(r_max, pos)
+    N_bins = int(N_bins)
+    if not 0 < r_min < r_max:
+        raise ValueError('Need 0 < r_min < r_max!')
+    N_pi = int(N_pi)
+    if N_pi:
+        pi_max = _in_units_of_pos(pi_max, pos)
+        if not 0 < pi_max:
+            raise ValueError('Need 0 < pi_max!')
+    else:
+        pi_max = 0.0
+    periodic = np.inf if boxsize is None else _in_units_of_pos(boxsize, pos)
+
+    pos = _as_C_array(pos)
+    N = len(pos)
+    if pos.shape != (N, 3):
+        raise ValueError('The positions have to be of shape (N,3)!')
+    if w is not None:
+        w = _as_C_array(w, (N,))
+    if vel is not None:
+        vel = _as_C_array(vel, (N, 3))
+    if pos2 is not None:
+        pos2 = _as_C_array(pos2)
+        N2 = len(pos2)
+        if pos2.shape != (N2, 3):
+            raise ValueError('The positions have to be of shape (N,3)!')
+        if w2 is not None:
+            w2 = _as_C_array(w2, (N2,))
+        if vel is not None:
+            if vel2 is None:
+                raise ValueError('Need the velocities of both sets!')
+            vel2 = _as_C_array(vel2, (N2, 3))
+    else:
+        N2 = 0
+        w2 = None
+        vel2 = None
+
+    shape = (N_bins, N_pi) if N_pi else (N_bins,)
+    counts = np.empty(shape, dtype=np.float64)
+    vel_sums = None if vel is None else np.empty((2,) + shape,
+                                                 dtype=np.float64)
+    C.cpygad.pair_counts(C.c_size_t(N),
+                         C.c_void_p(pos.ctypes.data),
+                         None if w is None else C.c_void_p(w.ctypes.data),
+                         None if vel is None else C.c_void_p(vel.ctypes.data),
+                         None,  # build new tree
+                         C.c_size_t(N2),
+                         None if pos2 is None else C.c_void_p(pos2.ctypes.data),
+                         None if w2 is None else C.c_void_p(w2.ctypes.data),
+                         None if vel2 is None else C.c_void_p(vel2.ctypes.data),
+                         None,  # build new tree
+                         C.c_double(r_min),
+                         C.c_double(r_max),
+                         C.c_size_t(N_bins),
+                         C.c_double(pi_max),
+                         C.c_size_t(N_pi),
+                         C.c_double(periodic),
+                         C.c_void_p(counts.ctypes.data),
+                         None if vel_sums is None
+                            else C.c_void_p(vel_sums.ctypes.data),
+                         )
+    return counts, log_r_edges(r_min, r_max, N_bins), vel_sums
+
+
+def pair_counts(pos, r_min, r_max, N_bins=20, pos2=None, w=None, w2=None,
+                boxsize=None):
+    '''
+    Count the (weighted) pairs of positions in logarithmic radial bins.
+
+    Args:
+        pos (array-like):       The positions (N,3) of the first set.
+        r_min, r_max (UnitScalar):
+                                The range of the separations to count (in
+                                the units of `pos`, if plain numbers).
+        N_bins (int):           The number of logarithmic bins.
+        pos2 (array-like):      The positions of the second set. If None, the
+                                unordered pairs within the first set are
+                                counted (auto-counts), otherwise all the pairs
+                                of one position of each set (cross-counts).
+        w, w2 (array-like):     The weights of the positions of the first and
+                                the second set, respectively. Pairs count as
+                                the product of the weights. Default: unit
+                                weights.
+        boxsize (UnitScalar):   The side length of a periodic box (in which
+                                all positions have to lie). Default: no
+                                periodic boundaries.
+
+    Returns:
+        counts (np.ndarray):    The (weighted) pair counts per bin.
+        r_edges (np.ndarray):   The bin edges.
+    '''
+    counts, r_edges, _ = _pair_counts(pos, r_min, r_max, N_bins, pos2, w, w2,
+                                      boxsize)
+    return counts, r_edges
+
+
+def pair_counts_rp_pi(pos, rp_min, rp_max, pi_max, N_rp=20, N_pi=20,
+                      pos2=None, w=None, w2=None, boxsize=None):
+    '''
+    Count the (weighted) pairs of positions in bins of their projected
+    separation r_p and their separation pi along the line of sight, which is
+    the z-axis (rotate the positions for another one).
+
+    Args:
+        pos (array-like):       The positions (N,3) of the first set.
+        rp_min, rp_max (UnitScalar):
+                                The range of the projected separations, which
+                                are binned logarithmically (in the units of
+                                `pos`, if plain numbers).
+        pi_max (UnitScalar):    The maximum separation |dz| along the line of
+                                sight, which is binned linearly from zero.
+        N_rp, N_pi (int):       The numbers of bins in r_p and pi.
+        pos2, w, w2, boxsize:   See `pair_counts`.
+
+    Returns:
+        counts (np.ndarray):    The (weighted) pair counts of shape
+                                (N_rp,N_pi).
+        rp_edges (np.ndarray):  The bin edges in r_p.
+        pi_edges (np.ndarray):  The bin edges in pi.
+    '''
+    if int(N_pi) < 1:
+        raise ValueError('Need at least one bin along the line of sight!')
+    counts, rp_edges, _ = _pair_counts(pos, rp_min, rp_max, N_rp, pos2, w, w2,
+                                       boxsize, pi_max=pi_max, N_pi=N_pi)
+    pi_edges = np.linspace(0, _in_units_of_pos(pi_max, pos), int(N_pi) + 1)
+    return counts, rp_edges, pi_edges
+
+
+def _total_pairs(w, w2=None):
+    '''
+    The sum of the (weighted) pairs: for the auto-counts ((sum w)^2 -
+    sum w^2)/2, i.e. N(N-1)/2 for unit weights; otherwise (sum w) (sum w2).
+    `w` and `w2` are either the weights or the numbers of positions.
+    '''
+    if np.ndim(w) == 0:
+        w = np.ones(int(w))
+    w = np.asarray(w, dtype=np.float64)
+    if w2 is None:
+        return (w.sum()**2 - (w**2).sum()) / 2.0
+    if np.ndim(w2) == 0:
+        return w.sum() * float(w2)
+    return w.sum() * np.sum(w2, dtype=np.float64)
+
+
+def random_pair_counts(r_edges, boxsize, w, w2=None):
+    '''
+    The expected (weighted) pair counts of uniformly random positions in a
+    periodic box, i.e. the total of the pairs times the shell volumes over the
+    volume of the box.
+
+    Args:
+        r_edges (array-like):   The bin edges (smaller than half the box).
+        boxsize (float):        The side length of the periodic box.
+        w (array-like, int):    The weights of the (first) set or its number
+                                of positions.
+        w2 (array-like, int):   The weights of the second set or its number of
+                                positions for cross-counts. If None, the pairs
+                                of the auto-counts are taken.
+
+    Returns:
+        counts (np.ndarray):    The expected pair counts per bin.
+    '''
+    r_edges = np.asarray(r_edges, dtype=np.float64)
+    boxsize = float(boxsize)
+    if r_edges[-1] > boxsize / 2.0:
+        raise ValueError('The separations have to be less than half the box!')
+    V_shells = 4.0 * np.pi / 3.0 * np.diff(r_edges**3)
+    return _total_pairs(w, w2) * V_shells / boxsize**3
+
+
+def random_pair_counts_rp_pi(rp_edges, pi_edges, boxsize, w, w2=None):
+    '''
+    The expected (weighted) pair counts of uniformly random positions in a
+    periodic box in bins of r_p and pi (see `pair_counts_rp_pi`), i.e. the
+    total of the pairs times the volumes of the cylindrical shells (of both
+    signs of dz) over the volume of the box.
+
+    Args:
+        rp_edges, pi_edges (array-like):
+                                The bin edges (smaller than half the box).
+        boxsize, w, w2:         See `random_pair_counts`.
+
+    Returns:
+        counts (np.ndarray):    The expected pair counts of shape
+                                (len(rp_edges)-1,len(pi_edges)-1).
+    '''
+    rp_edges = np.asarray(rp_edges, dtype=np.float64)
+    pi_edges = np.asarray(pi_edges, dtype=np.float64)
+    boxsize = float(boxsize)
+    if rp_edges[-1] > boxsize / 2.0 or pi_edges[-1] > boxsize / 2.0:
+        raise ValueError('The separations have to be less than half the box!')
+    V = np.pi * np.outer(np.diff(rp_edges**2), 2.0 * np.diff(pi_edges))
+    return _total_pairs(w, w2) * V / boxsize**3
+
+
+def correlation_function(pos, r_min, r_max, N_bins=20, w=None, pos2=None,
+                         w2=None, randoms=None, w_randoms=None, boxsize=None):
+    '''
+    Estimate the two-point (cross-)correlation function in logarithmic radial
+    bins.
+
+    Without random positions, the pairs are compared to the analytic counts of
+    random pairs in the periodic box (DD/RR - 1). With random positions, the
+    Landy-Szalay estimator (DD - 2DR + RR)/RR is used for the auto-correlation
+    and the Davis-Peebles estimator D1D2/D1R - 1 for the cross-correlation,
+    each with the pair counts normalized by their totals.
+
+    Args:
+        pos (array-like):       The positions (N,3).
+        r_min, r_max (UnitScalar):
+                                The range of the separations (in the units of
+                                `pos`, if plain numbers).
+        N_bins (int):           The number of logarithmic bins.
+        w (array-like):         The weights of the positions (default: unit
+                                weights).
+        pos2 (array-like):      The positions of a second set to
+                                cross-correlate with.
+        w2 (array-like):        The weights of the second set.
+        randoms (array-like):   Random positions sampling the volume (with the
+                                selection function) of the positions. If None,
+                                a periodic box is required.
+        w_randoms (array-like): The weights of the random positions.
+        boxsize (UnitScalar):   The side length of a periodic box.
+
+    Returns:
+        xi (np.ndarray):        The correlation function in the bins.
+        r_edges (np.ndarray):   The bin edges.
+    '''
+    if randoms is None and boxsize is None:
+        raise ValueError('Need random positions for non-periodic volumes!')
+
+    def count(p1, w1, p2, w2):
+        return pair_counts(p1, r_min, r_max, N_bins=N_bins, pos2=p2, w=w1,
+                           w2=w2, boxsize=boxsize)[0]
+
+    r_edges = log_r_edges(_in_units_of_pos(r_min, pos),
+                          _in_units_of_pos(r_max, pos), int(N_bins))
+    if randoms is None:
+        # the expected fraction of the pairs
+        RR = random_pair_counts(r_edges, _in_units_of_pos(boxsize, pos), 1, 1)
+    else:
+        RR = None
+    return _estimate_xi(count, pos, w, pos2, w2, randoms, w_randoms,
+                        RR), r_edges
+
+
+def _estimate_xi(count, pos, w, pos2, w2, randoms, w_randoms, RR):
+    '''
+    Estimate a correlation function from the pair counts `count(pos1, w1,
+    pos2, w2)` (with pos2=None for the auto-counts) as described in
+    `correlation_function`. If `RR` is given, it is the expected fraction of
+    random pairs (in a periodic box) and no random positions are used.
+    '''
+    N = len(pos)
+    DD = count(pos, w, pos2, w2)
+    if pos2 is None:
+        DD /= _total_pairs(N if w is None else w)
+    else:
+        DD /= _total_pairs(N if w is None else w,
+                           len(pos2) if w2 is None else w2)
+
+    with np.errstate(divide='ignore', invalid='ignore'):
+        if RR is not None:
+            return DD / RR - 1.0
+
+        N_R = len(randoms) if w_randoms is None else w_randoms
+        DR = count(pos, w, randoms, w_randoms)
+        DR /= _total_pairs(N if w is None else w, N_R)
+        if pos2 is not None:
+            return DD / DR - 1.0
+        RR = count(randoms, w_randoms, None, None)
+        RR /= _total_pairs(N_R)
+        return (DD - 2.0 * DR + RR) / RR
+
+
+def projected_correlation_function(pos, rp_min, rp_max, pi_max, N_rp=20,
+                                   N_pi=20, w=None, pos2=None, w2=None,
+                                   randoms=None, w_randoms=None,
+                                   boxsize=None):
+    '''
+    Estimate the projected (cross-)correlation function
+
+        w_p(r_p) = 2 int_0^pi_max xi(r_p,pi) dpi
+
+    from the correlation function in bins of r_p and pi (with the line of
+    sight along the z-axis; see `pair_counts_rp_pi`). The estimators are the
+    ones of `correlation_function`.
+
+    Args:
+        pos (array-like):       The positions (N,3).
+        rp_min, rp_max (UnitScalar):
+                                The range of the projected separations (in
+                                the units of `pos`, if plain numbers).
+        pi_max (UnitScalar):    The maximum separation along the line of
+                                sight to integrate over.
+        N_rp, N_pi (int):       The numbers of bins in r_p and pi.
+        w, pos2, w2, randoms, w_randoms, boxsize:
+                                See `correlation_function`.
+
+    Returns:
+        w_p (np.ndarray):       The projected correlation function in the bins
+                                (in the units of the positions).
+        rp_edges (np.ndarray):  The bin edges in r_p.
+        xi (np.ndarray):        The correlation function of shape (N_rp,N_pi)
+                                in the bins of r_p and pi.
+    '''
+    if randoms is None and boxsize is None:
+        raise ValueError('Need random positions for non-periodic volumes!')
+
+    def count(p1, w1, p2, w2):
+        return pair_counts_rp_pi(p1, rp_min, rp_max, pi_max, N_rp=N_rp,
+                                 N_pi=N_pi, pos2=p2, w=w1, w2=w2,
+                                 boxsize=boxsize)[0]
+
+    rp_edges = log_r_edges(_in_units_of_pos(rp_min, pos),
+                           _in_units_of_pos(rp_max, pos), int(N_rp))
+    pi_edges = np.linspace(0, _in_units_of_pos(pi_max, pos), int(N_pi) + 1)
+    if randoms is None:
+        RR = random_pair_counts_rp_pi(rp_edges, pi_edges,
+                                      _in_units_of_pos(boxsize, pos), 1, 1)
+    else:
+        RR = None
+    xi = _estimate_xi(count, pos, w, pos2, w2, randoms, w_randoms, RR)
+    w_p = 2.0 * np.sum(xi * np.diff(pi_edges), axis=-1)
+    return w_p, rp_edges, xi
+
+
+def marked_correlation(pos, marks, r_min, r_max, N_bins=20, w=None,
+                       boxsize=None):
+    '''
+    The mark correlation function M(r) = <m_i m_j>(r) / <m>^2, i.e. the mean
+    product of the marks of the pairs at separation r relative to the one of
+    independent marks.
+
+    Args:
+        pos (array-like):       The positions (N,3).
+        marks (array-like):     The marks (e.g. masses, luminosities, ages) of
+                                the positions.
+        r_min, r_max (UnitScalar):
+                                The range of the separations (in the units of
+                                `pos`, if plain numbers).
+        N_bins (int):           The number of logarithmic bins.
+        w (array-like):         The weights of the positions (default: unit
+                                weights).
+        boxsize (UnitScalar):   The side length of a periodic box.
+
+    Returns:
+        M (np.ndarray):         The mark correlation function in the bins.
+        r_edges (np.ndarray):   The bin edges.
+    '''
+    marks = np.asarray(marks, dtype=np.float64)
+    w = np.ones(len(pos)) if w is None else np.asarray(w, dtype=np.float64)
+    mean_mark = np.sum(w * marks) / np.sum(w)
+    WW, r_edges = pair_counts(pos, r_min, r_max, N_bins=N_bins, w=w,
+                              boxsize=boxsize)
+    MM, r_edges = pair_counts(pos, r_min, r_max, N_bins=N_bins, w=w * marks,
+                              boxsize=boxsize)
+    with np.errstate(divide='ignore', invalid='ignore'):
+        return MM / WW / mean_mark**2, r_edges
+
+
+def pairwise_velocity(pos, vel, r_min, r_max, N_bins=20, w=None, pos2=None,
+                      vel2=None, w2=None, boxsize=None):
+    '''
+    The mean radial pairwise velocity v_12(r) = <(v_j-v_i).(r_j-r_i)/|r_j-r_i|>
+    of the pairs in logarithmic radial bins (negative for approaching pairs)
+    and its dispersion, weighted by the products of the weights.
+
+    Other than the plain pair counts, this has to visit every pair in range.
+
+    Args:
+        pos (array-like):       The positions (N,3).
+        vel (array-like):       The velocities (N,3).
+        r_min, r_max (UnitScalar):
+                                The range of the separations (in the units of
+                                `pos`, if plain numbers).
+        N_bins (int):           The number of logarithmic bins.
+        w (array-like):         The weights of the positions (default: unit
+                                weights).
+        pos2, vel2, w2 (array-like):
+                                The positions, velocities, and weights of a
+                                second set for the velocities of the pairs
+                                with one position of each set (from the first
+                                to the second set).
+        boxsize (UnitScalar):   The side length of a periodic box.
+
+    Returns:
+        v12 (UnitArr):          The mean radial pairwise velocity in the bins
+                                (in the units of `vel`, if any; NaN for empty
+                                bins).
+        sigma (UnitArr):        The dispersion of the radial pairwise velocity
+                                in the bins.
+        r_edges (np.ndarray):   The bin edges.
+    '''
+    units = getattr(vel, 'units', None)
+    if pos2 is not None and vel2 is not None and units is not None:
+        vel2 = UnitQty(vel2, units)
+    counts, r_edges, vel_sums = _pair_counts(pos, r_min, r_max, N_bins, pos2,
+                                             w, w2, boxsize, vel=vel,
+                                             vel2=vel2)
+    with np.errstate(divide='ignore', invalid='ignore'):
+        v12 = vel_sums[0] / counts
+        sigma = np.sqrt(np.maximum(vel_sums[1] / counts - v12**2, 0.0))
+    if units is not None:
+        v12 = UnitArr(v12, units)
+        sigma = UnitArr(sigma, units)
+    return v12, sigma, r_edges
+
+
+def power_spectrum(pos, boxsize, Npx=256, w=None, scheme='CIC',
+                   interlace=True, k_edges=None, subtract_shot_noise=True):
+    '''
+    Estimate the power spectrum of the (weighted) density of positions in a
+    periodic box.
+
+    The positions are assigned onto a periodic mesh, which is Fourier
+    transformed (with FFTW, if the C library was compiled with it). The window
+    of the mass assignment is deconvolved and, with interlacing, a second mesh
+    shifted by half a cell cancels the leading aliasing contributions. The
+    meshes take 8*Npx^2*(Npx+2) bytes of memory each.
+
+    Args:
+        pos (array-like):       The positions (N,3) within the box.
+        boxsize (UnitScalar):   The side length of the periodic box (in the
+                                units of `pos`, if a plain number).
+        Npx (int):              The number of cells of the mesh per side (has
+                                to be even).
+        w (array-like):         The weights (e.g. masses) of the positions
+                                (default: unit weights).
+        scheme (str):           The mass assignment scheme: 'NGP', 'CIC',
+                                'TSC', or 'PCS'.
+        interlace (bool):       Whether to interlace two meshes.
+        k_edges (array-like):   The edges of the bins in |k| (in the inverse
+                                units of `pos`). Default: bins of the width of
+                                the fundamental mode 2*pi/boxsize up to the
+                                Nyquist frequency.
+        subtract_shot_noise (bool):
+                                Whether to subtract the shot noise
+                                boxsize^3 sum(w^2) / sum(w)^2.
+
+    Returns:
+        P (UnitArr):            The power spectrum in the bins.
+        k (UnitArr):            The mean |k| of the modes in the bins.
+        N_modes (np.ndarray):   The number of modes in the bins.
+    '''
+    units = getattr(pos, 'units', None)
+    boxsize = _in_units_of_pos(boxsize, pos)
+    order = _mass_assignment_order(scheme)
+    Npx = int(Npx)
+    if Npx % 2:
+        raise ValueError('The number of cells per side has to be even!')
+    k_F = 2.0 * np.pi / boxsize
+    if k_edges is None:
+        k_edges = k_F * np.arange(0.5, Npx // 2 + 1)
+    elif units is not None:
+        k_edges = UnitQty(k_edges, units**-1)
+    k_edges = _as_C_array(k_edges)
+    N_k = len(k_edges) - 1
+
+    pos = _as_C_array(pos)
+    N = len(pos)
+    if pos.shape != (N, 3):
+        raise ValueError('The positions have to be of shape (N,3)!')
+    if w is not None:
+        w = _as_C_array(w, (N,))
+
+    P = np.empty(N_k, dtype=np.float64)
+    k = np.empty(N_k, dtype=np.float64)
+    N_modes = np.empty(N_k, dtype=np.float64)
+    C.cpygad.mesh_power_spectrum(C.c_size_t(N),
+                                 C.c_void_p(pos.ctypes.data),
+                                 None if w is None else C.c_void_p(w.ctypes.data),
+                                 C.c_double(boxsize),
+                                 C.c_size_t(Npx),
+                                 C.c_int(order),
+                                 C.c_int(int(bool(interlace))),
+                                 C.c_size_t(N_k),
+                                 C.c_void_p(k_edges.ctypes.data),
+                                 C.c_void_p(P.ctypes.data),
+                                 C.c_void_p(k.ctypes.data),
+                                 C.c_void_p(N_modes.ctypes.data),
+                                 )
+    if subtract_shot_noise:
+        if w is None:
+            P -= boxsize**3 / N
+        else:
+            P -= boxsize**3 * np.sum(w**2) / np.sum(w)**2
+
+    if units is not None:
+        P = UnitArr(P, units**3)
+        k = UnitArr(k, units**-1)
+    return P, k, N_modes
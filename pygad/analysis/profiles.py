@@ -42,14 +42,56 @@ Example:
     >>> smassprof2 = radially_binned(s.stars, 'mass')
     derive block r... done.
     >>> assert (np.abs(smassprof1-smassprof2)/smassprof1).max() < 1e-3
+
+    The SPH-smoothed profiles conserve the mass (of all the kernels within the
+    outermost edge) and converge to the plain binning for small smoothing
+    lengths:
+    >>> g = s.gas
+    >>> r_edges = np.linspace(0, 1.01*float(np.max(g['r'] + g['hsml'])), 20)
+    load block hsml... done.
+    >>> for proj in [None, 2]:
+    ...     M = SPH_radially_binned(g, 'mass', r_edges=r_edges, proj=proj)
+    ...     if abs(M.sum() / g['mass'].sum() - 1.0) > 1e-6:
+    ...         print(proj, M.sum(), g['mass'].sum())
+    >>> r_edges = np.linspace(0, 15, 16)
+    >>> for proj in [None, 0]:
+    ...     M_smooth = radially_binned(g, 'mass', r_edges=r_edges, proj=proj,
+    ...                                smooth=True, hsml=Unit('1e-3 kpc'))
+    ...     M = radially_binned(g, 'mass', r_edges=r_edges, proj=proj)
+    ...     if np.max(np.abs(M_smooth - M)) > 1e-3 * M.sum():
+    ...         print(proj, M_smooth, M)
+
+    The fractions of a kernel within spheres and circles around a point off
+    the particle compared to a Monte-Carlo integration:
+    >>> from ..kernels import vector_kernels
+    >>> x = 2.0*np.random.random((int(1e6),3)) - 1.0
+    >>> u = np.linalg.norm(x, axis=1)
+    >>> w = np.where(u < 1.0, vector_kernels[gadget.general['kernel']](
+    ...                             np.minimum(u,1.0)), 0.0)
+    >>> p = g[:1]
+    >>> c = p['pos'][0] + UnitArr([0.5, 0.2, 0.0], 'kpc')
+    >>> r_edges = np.linspace(0, 2, 9)
+    >>> for proj in [None, 2]:
+    ...     M = SPH_radially_binned(p, 'mass', r_edges=r_edges, proj=proj,
+    ...                             center=c, hsml=Unit('1 kpc'))
+    ...     frac = np.cumsum(M) / p['mass'][0]
+    ...     d = x + (p['pos'][0] - c).view(np.ndarray)
+    ...     d = np.linalg.norm(d if proj is None else d[:,:2], axis=1)
+    ...     frac_MC = [np.sum(w[d < R]) / np.sum(w) for R in r_edges[1:]]
+    ...     if np.max(np.abs(frac - frac_MC)) > 5e-3:
+    ...         print(proj, frac, frac_MC)
 '''
-__all__ = ['radially_binned', 'profile_dens', 'NFW', 'NFW_fit']
+__all__ = ['radially_binned', 'SPH_radially_binned', 'profile_dens', 'NFW',
+           'NFW_fit']
 
 import numpy as np
 from ..units import *
 from ..utils import dist
+from .. import gadget
+from .. import C
 
-def radially_binned(s, qty, av=None, r_edges=None, proj=None, center=None):
+def radially_binned(s, qty, av=None, r_edges=None, proj=None, center=None,
+                    smooth=False, hsml='hsml', kernel=None):
     '''
     Bin a quantity radially.
 
@@ -63,10 +105,22 @@ def radially_binned(s, qty, av=None, r_edges=None, proj=None, center=None):
                                 along this coordinate: (0:'x', 1:'y', 2:'z').
         center (array-like):    The center with respect to which the radii are
                                 calculated.
+        smooth (bool):          Whether to distribute the particles over the
+                                bins by their SPH kernels rather than
+                                assigning them to a single bin each (see
+                                `SPH_radially_binned`).
+        hsml (str, UnitQty, Unit):
+                                The smoothing lengths, if smooth is True.
+        kernel (str):           The kernel, if smooth is True. (By default use
+                                the kernel defined in `gadget.cfg`.)
 
     Returns:
         Q (UnitArr):            The binned quantity.
     '''
+    if smooth:
+        return SPH_radially_binned(s, qty, av=av, r_edges=r_edges, proj=proj,
+                                   center=center, hsml=hsml, kernel=kernel)
+
     if isinstance(qty, str):
         qty = s.get(qty)
     else:
@@ -118,7 +172,111 @@ def radially_binned(s, qty, av=None, r_edges=None, proj=None, center=None):
 
     return Q
 
-def profile_dens(s, qty, av=None, r_edges=None, proj=None, center=None):
+def SPH_radially_binned(s, qty, av=None, r_edges=None, proj=None, center=None,
+                        hsml='hsml', kernel=None):
+    '''
+    Bin quantities radially, distributing each particle over the bins by the
+    fractions of its SPH kernel that fall into the spherical shells (or the
+    cylindrical annuli for projected profiles).
+
+    The profiles are smooth already with much fewer particles per bin than
+    with `radially_binned`. The parts of the kernels outside of the outermost
+    edges are lost. Particles with a vanishing smoothing length are binned as
+    points.
+
+    Args:
+        s (Snap):               The snapshot to use.
+        qty (str, UnitQty, list):
+                                The quantity to do the binning of or a list of
+                                such quantities, which are all binned at once.
+        av (str, UnitQty):      The quantity to average over. Otherwise as 'qty'.
+        r_edges (array-like):   The edges of the radial bins.
+                                Default: 0 - 20 kpc in 50 bins
+        proj (int):             If None bin spherically, otherwise bin projected
+                                along this coordinate: (0:'x', 1:'y', 2:'z').
+        center (array-like):    The center with respect to which the radii are
+                                calculated.
+        hsml (str, UnitQty, Unit):
+                                The smoothing lengths to use. Can be a block
+                                name, a block itself or a Unit that is taken as
+                                constant smoothing length for all particles.
+        kernel (str):           The kernel to use for smoothing. (By default use
+                                the kernel defined in `gadget.cfg`.)
+
+    Returns:
+        Q (UnitArr, list):      The binned quantity (or a list of them, if a
+                                list of quantities was passed).
+    '''
+    single = not isinstance(qty, (list, tuple))
+    qtys = [qty] if single else list(qty)
+    for i, q in enumerate(qtys):
+        qtys[i] = s.get(q) if isinstance(q, str) else UnitQty(q)
+    if av is not None:
+        if isinstance(av, str):
+            av = s.get(av)
+        else:
+            av = UnitQty(av)
+    if kernel is None:
+        kernel = gadget.general['kernel']
+
+    if proj is not None and proj not in list(range(3)):
+        raise ValueError('Have to project along 0, 1, or 2!')
+    if center is None:
+        center = [0,0,0] if proj is None else [0,0]
+    center = UnitQty(center, s['pos'].units, subs=s).view(np.ndarray)
+    center = np.array(center, dtype=np.float64).ravel()
+    if proj is not None and len(center) == 2:
+        center = np.insert(center, proj, 0.0)
+
+    if r_edges is None:
+        r_edges = UnitArr(np.linspace(0,20,51), 'kpc')
+    r_edges = UnitQty(r_edges, s['pos'].units, subs=s)
+    r_edges = np.ascontiguousarray(r_edges.view(np.ndarray), dtype=np.float64)
+
+    if isinstance(hsml, str):
+        hsml = s.get(hsml).in_units_of(s['pos'].units, subs=s)
+    else:   # some array, or a number or Unit for all particles
+        hsml = UnitQty(hsml,s['pos'].units,subs=s)
+        if hsml.shape == ():
+            hsml = hsml * np.ones(len(s))
+    hsml = np.ascontiguousarray(hsml.view(np.ndarray), dtype=np.float64)
+    pos = np.ascontiguousarray(s['pos'].view(np.ndarray), dtype=np.float64)
+
+    # all quantities (weighted by `av`, which comes last) as columns
+    cols = [np.asarray(q, dtype=np.float64) for q in qtys]
+    if av is not None:
+        av_ = np.asarray(av, dtype=np.float64)
+        cols = [c*av_ for c in cols] + [av_]
+    Q = np.ascontiguousarray(np.column_stack(cols), dtype=np.float64)
+
+    prof = np.empty((len(r_edges)-1, Q.shape[1]), dtype=np.float64)
+    C.cpygad.sph_radial_profile(
+            C.c_size_t(len(s)),
+            C.c_void_p(pos.ctypes.data),
+            C.c_void_p(hsml.ctypes.data),
+            C.c_size_t(Q.shape[1]),
+            C.c_void_p(Q.ctypes.data),
+            C.c_void_p(center.ctypes.data),
+            C.c_int(-1 if proj is None else proj),
+            C.c_size_t(len(r_edges)-1),
+            C.c_void_p(r_edges.ctypes.data),
+            C.create_string_buffer(kernel.encode('ascii')),
+            C.c_void_p(prof.ctypes.data),
+    )
+
+    profs = []
+    for i, q in enumerate(qtys):
+        P = prof[:,i]
+        if av is not None:
+            with np.errstate(divide='ignore', invalid='ignore'):
+                P = P / prof[:,-1]
+            P[np.isnan(P)] = 0.0
+        profs.append( UnitArr(P, getattr(q,'units',None)) )
+
+    return profs[0] if single else profs
+
+def profile_dens(s, qty, av=None, r_edges=None, proj=None, center=None,
+                 smooth=False, hsml='hsml', kernel=None):
     '''
     Create a radial profile for the density of a quantity.
 
@@ -135,7 +293,8 @@ def profile_dens(s, qty, av=None, r_edges=None, proj=None, center=None):
         r_edges = UnitArr(np.linspace(0,20,51), 'kpc')
     r_edges = UnitQty(r_edges, s['pos'].units, subs=s)
 
-    Q = radially_binned(s, qty, av=av, r_edges=r_edges, proj=proj, center=center)
+    Q = radially_binned(s, qty, av=av, r_edges=r_edges, proj=proj, center=center,
+                        smooth=smooth, hsml=hsml, kernel=kernel)
     if proj is None:
         V = (4.0/3.0*np.pi)*r_edges**3
     else:
@@ -38,9 +38,34 @@ Examples:
     >>> if np.max(np.abs(v1-v2)/v1) > 1e-6:
     ...     print(v1)
     ...     print(v2)
+    >>> rho, el = SPH_qtys_at(s, ['rho', 'elements'], s.gas['pos'][:200])
+    >>> if np.max(np.abs(el[::10]-v2)/v2) > 1e-6:
+    ...     print(el[::10])
+    >>> if np.max(np.abs(rho - SPH_qty_at(s, 'rho', s.gas['pos'][:200])) /
+    ...           rho) > 1e-6:
+    ...     print(rho)
+
+    The (matrix-corrected) gradients are exact for linear fields, at the gas
+    particles as well as at other positions:
+    >>> r_off = s.gas['pos'][:2000:20] + UnitArr([0.1, 0.2, -0.1], 'kpc')
+    >>> a = np.array([1.5, -2.0, 0.5])
+    >>> lin = np.dot(s.gas['pos'].view(np.ndarray), a) + 3.0
+    >>> for r in [None, r_off]:
+    ...     grad = SPH_gradient_at(s, lin, r=r)
+    ...     if np.max(np.abs(grad - a)) > 1e-8:
+    ...         print(np.max(np.abs(grad - a)))
+    >>> Omega = np.array([0.3, -0.1, 0.2])
+    >>> v_rot = np.cross(Omega, s.gas['pos'].view(np.ndarray))
+    >>> for r in [None, r_off]:
+    ...     div, curl = SPH_div_curl_at(s, v_rot, r=r)
+    ...     if np.max(np.abs(div)) > 1e-8:
+    ...         print(np.max(np.abs(div)))
+    ...     if np.max(np.abs(curl - 2*Omega)) > 1e-8:
+    ...         print(np.max(np.abs(curl - 2*Omega)))
 
 '''
-__all__ = ['kernel_weighted', 'SPH_qty_at', 'scatter_gas_qty_to_stars']
+__all__ = ['kernel_weighted', 'SPH_qty_at', 'SPH_qtys_at',
+           'scatter_gas_qty_to_stars', 'SPH_gradient_at', 'SPH_div_curl_at']
 
 import numpy as np
 from ..units import *
@@ -133,7 +158,55 @@ def kernel_weighted(s, qty, units=None, kernel=None, parallel=None):
     return UnitArr(y, units)
 
 
-def SPH_qty_at(s, qty, r, units=None, kernel=None, dV='dV'):
+def _eval_sph_at(s, qtys, r, kernel, dV, periodic):
+    '''
+    Evaluate the (N,K) array of gas quantities `qtys` at the positions `r` (in
+    units of the positions) with a single tree walk in the C library.
+
+    Returns:
+        Q (np.ndarray):         The (M,K) array of the SPH quantities.
+        n_ngbs (np.ndarray):    The number of neighbours at each position.
+        norm (np.ndarray):      The sum of the kernel weights at each position.
+    '''
+    from .. import C
+    # C function expects contiguous doubles and cannot deal with views:
+    r = np.ascontiguousarray(r, dtype=np.float64).reshape((-1, 3))
+    qtys = np.ascontiguousarray(qtys, dtype=np.float64)
+    gas_pos = np.ascontiguousarray(s.gas['pos'].view(np.ndarray),
+                                   dtype=np.float64)
+    hsml = s.gas['hsml'].in_units_of(s['pos'].units, subs=s).view(np.ndarray)
+    hsml = np.ascontiguousarray(hsml, dtype=np.float64)
+    dV = s.gas.get(dV).in_units_of(s['pos'].units ** 3, subs=s).view(np.ndarray)
+    dV = np.ascontiguousarray(dV, dtype=np.float64)
+    if periodic:
+        periodic = float(s.boxsize.in_units_of(s['pos'].units, subs=s))
+    else:
+        periodic = np.inf
+
+    Q = np.empty((len(r), qtys.shape[1]), dtype=np.float64)
+    n_ngbs = np.empty(len(r), dtype=np.uintp)
+    norm = np.empty(len(r), dtype=np.float64)
+    C.cpygad.eval_sph_at_multi(
+        C.c_size_t(len(r)),
+        C.c_void_p(r.ctypes.data),
+        C.c_size_t(qtys.shape[1]),
+        C.c_void_p(Q.ctypes.data),
+        C.c_size_t(len(gas_pos)),
+        C.c_void_p(gas_pos.ctypes.data),
+        C.c_void_p(hsml.ctypes.data),
+        C.c_void_p(dV.ctypes.data),
+        C.c_void_p(qtys.ctypes.data),
+        C.c_double(periodic),
+        C.c_void_p(n_ngbs.ctypes.data),
+        C.c_void_p(norm.ctypes.data),
+        C.create_string_buffer(kernel.encode('ascii')),
+        None  # build new tree
+    )
+    return Q, n_ngbs, norm
+
+
+def SPH_qty_at(s, qty, r, units=None, kernel=None, dV='dV', periodic=False,
+               shepard=False):
     '''
     Calculate a SPH quantity with the scatter approach at a given position.
 
@@ -149,6 +222,10 @@ def SPH_qty_at(s, qty, r, units=None, kernel=None, dV='dV'):
         kernel (str):           The kernel to use. The default is to take the
                                 kernel given in the `gadget.cfg`.
         dV (str, array-like):   The volume measure of the SPH particles.
+        periodic (bool):        Whether to take the periodic box of the
+                                snapshot into account.
+        shepard (bool):         Whether to normalize the result by the sum of
+                                the kernel weights (Shepard correction).
 
     Returns:
         Q (UnitArr):            The SPH property at the given position.
@@ -169,13 +246,24 @@ def SPH_qty_at(s, qty, r, units=None, kernel=None, dV='dV'):
     qty = np.asarray(qty)
 
     r = r.view(np.ndarray)
+    if kernel is None:
+        from ..gadget import config
+        kernel = config.general['kernel']
+    if len(qty.shape) > 2:
+        raise ValueError('Cannot handle more than two dimension in qty!')
+
+    if len(r) >= 100 or periodic or shepard:
+        Q, n_ngbs, norm = _eval_sph_at(s, qty.reshape((len(qty), -1)), r,
+                                       kernel, dV, periodic)
+        if shepard:
+            Q /= np.where(norm > 0, norm, 1.0)[:, np.newaxis]
+        Q = Q.reshape(r.shape[:-1] + qty.shape[1:])
+        return UnitArr(Q, units)
+
     gas_pos = s.gas['pos'].view(np.ndarray)
     hsml = s.gas['hsml'].in_units_of(s['pos'].units, subs=s).view(np.ndarray)
     dV = s.gas.get(dV).in_units_of(s['pos'].units ** 3, subs=s).view(np.ndarray)
 
-    if kernel is None:
-        from ..gadget import config
-        kernel = config.general['kernel']
     from ..kernels import vector_kernels
     kernel_func = vector_kernels[kernel]
 
@@ -185,7 +273,7 @@ def SPH_qty_at(s, qty, r, units=None, kernel=None, dV='dV'):
         Q = np.sum((qty[mask].T * (kernel_func(d[mask]) * dV[mask] /
                                    hsml[mask] ** 3)).T,
                    axis=0)
-    elif len(r) < 100:
+    else:
         dV_hsml3 = dV / hsml ** 3
         Q = np.empty((len(r),) + qty.shape[1:], dtype=qty.dtype)
         for i, x in enumerate(r):
@@ -194,69 +282,252 @@ def SPH_qty_at(s, qty, r, units=None, kernel=None, dV='dV'):
             Q[i] = np.sum((qty[mask].T * (kernel_func(d[mask]) *
                                           dV_hsml3[mask])).T,
                           axis=0)
-    else:
-        from .. import C
-        # C function expects doubles and cannot deal with views:
-        r = r.astype(np.float64)
-        gas_pos = gas_pos.astype(np.float64)
-        hsml = hsml.astype(np.float64)
-        dV = dV.astype(np.float64)
-        qty = qty.astype(np.float64)
-        if r.base is not None:
-            r = r.copy()
-        if gas_pos.base is not None:
-            gas_pos = gas_pos.copy()
-            hsml = hsml.copy()
-            dV = dV.copy()
-        # TODO: handle different types than double
-        if len(qty.shape) == 1:
-            Q = np.empty(len(r), dtype=np.float64)
-            if qty.base is not None:
-                qty = qty.copy()
-            C.cpygad.eval_sph_at(
-                C.c_size_t(len(r)),
-                C.c_void_p(r.ctypes.data),
-                C.c_void_p(Q.ctypes.data),
-                C.c_size_t(len(gas_pos)),
-                C.c_void_p(gas_pos.ctypes.data),
-                C.c_void_p(hsml.ctypes.data),
-                C.c_void_p(dV.ctypes.data),
-                C.c_void_p(qty.ctypes.data),
-                C.create_string_buffer(kernel.encode('ascii')),
-                None  # build new tree
-            )
-        elif len(qty.shape) == 2:
-            # C function needs contiquous arrays and cannot deal with
-            # mutli-dimenensional ones...
-            Q = np.empty((qty.shape[1], len(r)), dtype=np.float64)
-            qty = qty.T
-            if qty.base is not None:
-                qty = qty.copy()
-            # avoid the reconstruction of the octree
-            from ..octree import cOctree
-            tree = cOctree(gas_pos, hsml)
-            for k in range(Q.shape[0]):
-                C.cpygad.eval_sph_at(
-                    C.c_size_t(len(r)),
-                    C.c_void_p(r.ctypes.data),
-                    C.c_void_p(Q[k].ctypes.data),
-                    C.c_size_t(len(gas_pos)),
-                    C.c_void_p(gas_pos.ctypes.data),
-                    C.c_void_p(hsml.ctypes.data),
-                    C.c_void_p(dV.ctypes.data),
-                    C.c_void_p(qty[k].ctypes.data),
-                    C.create_string_buffer(kernel.encode('ascii')),
-                    C.c_void_p(tree._cOctree__node_ptr),
-                )
-            del tree
-            Q = Q.T
-        else:
-            raise ValueError('Cannot handle more than two dimension in qty!')
 
     return UnitArr(Q, units)
 
 
-def scatter_gas_qty_to_stars(s, qty, name=None, units=None, kernel=None, dV='dV'):
+def SPH_qtys_at(s, qtys, r, units=None, kernel=None, dV='dV', periodic=False,
+                shepard=False, ngb_info=False):
+    '''
+    Calculate several SPH quantities at once with the scatter approach at given
+    positions, walking the tree only once per position.
+
+    Args:
+        s (Snap):               The (sub-)snapshot to take the gas (quantities)
+                                from.
+        qtys (list):            The names of the gas quantities (or array-like
+                                objects with the length of the gas); scalars
+                                as well as vectors.
+        r (UnitQty):            The position(s) to evaluate the SPH quantities
+                                at.
+        units (list):           The units to convert the quantities to (None
+                                for no conversion). If None, no conversion is
+                                done at all.
+        kernel (str):           The kernel to use. The default is to take the
+                                kernel given in the `gadget.cfg`.
+        dV (str, array-like):   The volume measure of the SPH particles.
+        periodic (bool):        Whether to take the periodic box of the
+                                snapshot into account.
+        shepard (bool):         Whether to normalize the results by the sum of
+                                the kernel weights (Shepard correction).
+        ngb_info (bool):        If True, also return the number of neighbours
+                                and the sum of the kernel weights.
+
+    Returns:
+        Qs (list):              The SPH quantities (UnitArr's) at the given
+                                position(s).
+      (if ngb_info:)
+        n_ngbs (np.ndarray):    The number of neighbours at the positions.
+        norm (np.ndarray):      The sum of the kernel weights at the positions.
+    '''
+    r = UnitQty(r, s['pos'].units, subs=s)
+    if not (r.shape == (3,) or (r.shape[1:] == (3,) and len(r.shape) == 2)):
+        raise ValueError('Position `r` needs to have shape (3,) or (N,3)!')
+    if units is None:
+        units = [None] * len(qtys)
+    if len(units) != len(qtys):
+        raise ValueError('Need as many units as quantities!')
+    if kernel is None:
+        from ..gadget import config
+        kernel = config.general['kernel']
+
+    # stack all the quantities into one (N,K) array
+    columns, shapes, qty_units = [], [], []
+    for qty, u in zip(qtys, units):
+        if isinstance(qty, str):
+            qty = s.gas.get(qty)
+        elif len(qty) != len(s.gas):
+            from ..utils import nice_big_num_str
+            raise RuntimeError('The length of the quantity ' + \
+                               '(%s) does not ' % nice_big_num_str(len(qty)) + \
+                               'match the number of gas ' + \
+                               '(%s)!' % nice_big_num_str(len(s.gas)))
+        qty_units.append(getattr(qty, 'units', None) if u is None else Unit(u))
+        if u is not None:
+            qty = qty.in_units_of(u, subs=s)
+        qty = np.asarray(qty)
+        if len(qty.shape) > 2:
+            raise ValueError('Cannot handle more than two dimension in qty!')
+        shapes.append(qty.shape[1:])
+        columns.append(qty.reshape((len(qty), -1)).astype(np.float64))
+    Q, n_ngbs, norm = _eval_sph_at(s, np.hstack(columns), r.view(np.ndarray),
+                                   kernel, dV, periodic)
+    if shepard:
+        Q /= np.where(norm > 0, norm, 1.0)[:, np.newaxis]
+
+    Qs, k = [], 0
+    for shape, u in zip(shapes, qty_units):
+        K = int(np.prod(shape))
+        Qk = Q[:, k:k + K].reshape(r.shape[:-1] + shape)
+        Qs.append(UnitArr(Qk, u))
+        k += K
+    if ngb_info:
+        return Qs, n_ngbs.reshape(r.shape[:-1]), norm.reshape(r.shape[:-1])
+    return Qs
+
+
+def _sph_derivative_args(s, qty, r, kernel, dV, periodic):
+    '''
+    Prepare the arguments for the C functions of the SPH derivatives: the
+    positions (and whether they are the gas positions), the gas quantity as
+    (N,K) array, its units, and the particle properties.
+    '''
+    if isinstance(qty, str):
+        qty = s.gas.get(qty)
+    elif len(qty) != len(s.gas):
+        from ..utils import nice_big_num_str
+        raise RuntimeError('The length of the quantity ' + \
+                           '(%s) does not ' % nice_big_num_str(len(qty)) + \
+                           'match the number of gas ' + \
+                           '(%s)!' % nice_big_num_str(len(s.gas)))
+    units = getattr(qty, 'units', None)
+    qty = np.ascontiguousarray(qty, dtype=np.float64)
+    if len(qty.shape) > 2:
+        raise ValueError('Cannot handle more than two dimension in qty!')
+
+    gas_pos = np.ascontiguousarray(s.gas['pos'].view(np.ndarray),
+                                   dtype=np.float64)
+    if r is None:
+        r = gas_pos
+    else:
+        r = UnitQty(r, s['pos'].units, subs=s)
+        if not (r.shape == (3,) or (r.shape[1:] == (3,) and len(r.shape) == 2)):
+            raise ValueError('Position `r` needs to have shape (3,) or (N,3)!')
+        r = np.ascontiguousarray(r.view(np.ndarray), dtype=np.float64)
+    hsml = s.gas['hsml'].in_units_of(s['pos'].units, subs=s).view(np.ndarray)
+    hsml = np.ascontiguousarray(hsml, dtype=np.float64)
+    dV = s.gas.get(dV).in_units_of(s['pos'].units ** 3, subs=s).view(np.ndarray)
+    dV = np.ascontiguousarray(dV, dtype=np.float64)
+    if periodic:
+        periodic = float(s.boxsize.in_units_of(s['pos'].units, subs=s))
+    else:
+        periodic = np.inf
+    if kernel is None:
+        from ..gadget import config
+        kernel = config.general['kernel']
+    return r, qty, units, gas_pos, hsml, dV, periodic, kernel
+
+
+def SPH_gradient_at(s, qty, r=None, kernel=None, dV='dV', periodic=False,
+                    corrected=True):
+    '''
+    Calculate the gradient of a SPH quantity (a scalar or each component of a
+    vector quantity).
+
+    The standard SPH estimate (in the scatter approach) is
+
+        grad A(r_i) = sum_j dV_j (A_j - A_i) grad_i W(r_i - r_j, h_j)
+
+    The matrix-corrected version (`corrected=True`) multiplies this with the
+    inverse of the matrix sum_j dV_j (r_j - r_i) x grad_i W(r_i - r_j, h_j),
+    which makes it exact for linear fields. At positions other than the ones of
+    the gas particles, A_i is estimated along with the gradient.
+
+    Args:
+        s (Snap):               The (sub-)snapshot to take the gas (quantity)
+                                from.
+        qty (str, array-like):  The name of the gas quantity or a array-like
+                                object with length of the gas.
+        r (UnitQty):            The position(s) to evaluate the gradient at.
+                                Defaults to the positions of the gas particles.
+        kernel (str):           The kernel to use. The default is to take the
+                                kernel given in the `gadget.cfg`.
+        dV (str, array-like):   The volume measure of the SPH particles.
+        periodic (bool):        Whether to take the periodic box of the
+                                snapshot into account.
+        corrected (bool):       Whether to use the matrix-corrected estimator.
+
+    Returns:
+        grad (UnitArr):         The gradient(s), of shape r.shape[:-1] +
+                                qty.shape[1:] + (3,).
+    '''
+    from .. import C
+    at_gas = r is None
+    r, qty, units, gas_pos, hsml, dV, periodic, kernel = \
+        _sph_derivative_args(s, qty, r, kernel, dV, periodic)
+    qty_shape = qty.shape[1:]
+    qty = qty.reshape((len(qty), -1))
+    M = len(r.reshape((-1, 3)))
+    grad = np.empty((M, qty.shape[1], 3), dtype=np.float64)
+    C.cpygad.sph_gradients(
+        C.c_size_t(M),
+        C.c_void_p(r.ctypes.data),
+        C.c_void_p(qty.ctypes.data) if at_gas else None,
+        C.c_size_t(qty.shape[1]),
+        C.c_void_p(grad.ctypes.data),
+        C.c_size_t(len(gas_pos)),
+        C.c_void_p(gas_pos.ctypes.data),
+        C.c_void_p(hsml.ctypes.data),
+        C.c_void_p(dV.ctypes.data),
+        C.c_void_p(qty.ctypes.data),
+        C.c_double(periodic),
+        C.c_int(int(corrected)),
+        C.create_string_buffer(kernel.encode('ascii')),
+        None  # build new tree
+    )
+    grad = grad.reshape(r.shape[:-1] + qty_shape + (3,))
+    if units is not None:
+        units = units / s['pos'].units
+    return UnitArr(grad, units)
+
+
+def SPH_div_curl_at(s, qty='vel', r=None, kernel=None, dV='dV', periodic=False,
+                    corrected=True):
+    '''
+    Calculate the divergence and the curl of a SPH vector quantity from its
+    gradients as estimated by `SPH_gradient_at`.
+
+    Args:
+        s (Snap):               The (sub-)snapshot to take the gas (quantity)
+                                from.
+        qty (str, array-like):  The name of the gas vector quantity or a
+                                array-like object of shape (N,3).
+        r (UnitQty):            The position(s) to evaluate at. Defaults to the
+                                positions of the gas particles.
+        kernel (str):           The kernel to use. The default is to take the
+                                kernel given in the `gadget.cfg`.
+        dV (str, array-like):   The volume measure of the SPH particles.
+        periodic (bool):        Whether to take the periodic box of the
+                                snapshot into account.
+        corrected (bool):       Whether to use the matrix-corrected estimator.
+
+    Returns:
+        div (UnitArr):          The divergence.
+        curl (UnitArr):         The curl.
+    '''
+    from .. import C
+    at_gas = r is None
+    r, qty, units, gas_pos, hsml, dV, periodic, kernel = \
+        _sph_derivative_args(s, qty, r, kernel, dV, periodic)
+    if qty.shape[1:] != (3,):
+        raise ValueError('Need a vector quantity of shape (N,3)!')
+    M = len(r.reshape((-1, 3)))
+    div = np.empty(M, dtype=np.float64)
+    curl = np.empty((M, 3), dtype=np.float64)
+    C.cpygad.sph_div_curl(
+        C.c_size_t(M),
+        C.c_void_p(r.ctypes.data),
+        C.c_void_p(qty.ctypes.data) if at_gas else None,
+        C.c_void_p(div.ctypes.data),
+        C.c_void_p(curl.ctypes.data),
+        C.c_size_t(len(gas_pos)),
+        C.c_void_p(gas_pos.ctypes.data),
+        C.c_void_p(hsml.ctypes.data),
+        C.c_void_p(dV.ctypes.data),
+        C.c_void_p(qty.ctypes.data),
+        C.c_double(periodic),
+        C.c_int(int(corrected)),
+        C.create_string_buffer(kernel.encode('ascii')),
+        None  # build new tree
+    )
+    if units is not None:
+        units = units / s['pos'].units
+    return (UnitArr(div.reshape(r.shape[:-1]), units),
+            UnitArr(curl.reshape(r.shape), units))
+
+
+def scatter_gas_qty_to_stars(s, qty, name=None, units=None, kernel=None, dV='dV',
+                             periodic=False):
     '''
     Calculate a gas property at the positions of the stars and store it as a
     stellar property.
@@ -268,6 +539,9 @@ def scatter_gas_qty_to_stars(s, qty, name=None, units=None, kernel=None, dV='dV'
     quantities are stored as a new block for the stars of the snapshot. (Make
     shure there is no such block yet.)
 
+    Several properties can be scattered at once (with a single tree walk) by
+    passing lists for `qty`, `name`, and `units`.
+
     Args:
         s (Snap):               The snapshot to spread the properties of.
         qty (array-like, str):  The name of the block or the block itself to
@@ -281,9 +555,12 @@ def scatter_gas_qty_to_stars(s, qty, name=None, units=None, kernel=None, dV='dV'
         kernel (str):           The kernel to use. The default is to take the
                                 kernel given in the `gadget.cfg`.
         dV (str, array-like):   The volume measure of the SPH particles.
+        periodic (bool):        Whether to take the periodic box of the
+                                snapshot into account.
 
     Returns:
-        Q (UnitArr):            The new SPH block.
+        Q (UnitArr):            The new SPH block (a list of them, if `qty` is
+                                a list).
 
     Raises:
         RuntimeError:       From this function directly:
@@ -296,12 +573,26 @@ def scatter_gas_qty_to_stars(s, qty, name=None, units=None, kernel=None, dV='dV'
                                 correct "host" of the new block.
         KeyError:           If there already exists a block of that name.
     '''
+    if isinstance(qty, list):
+        if name is None:
+            name = [None] * len(qty)
+        name = [q if n is None and isinstance(q, str) else n
+                for q, n in zip(qty, name)]
+        if None in name:
+            raise RuntimeError('No name for some quantity is given!')
+        Qs = SPH_qtys_at(s, qty, r=s.stars['pos'], units=units, kernel=kernel,
+                         dV=dV, periodic=periodic)
+        for n, Q in zip(name, Qs):
+            s.stars[n] = Q
+        return [s.stars[n] for n in name]
+
     if name is None:
         if isinstance(qty, str):
             name = qty
         else:
             raise RuntimeError('No name for the quantity is given!')
 
-    s.stars[name] = SPH_qty_at(s, qty=qty, r=s.stars['pos'], units=units, kernel=kernel)
+    s.stars[name] = SPH_qty_at(s, qty=qty, r=s.stars['pos'], units=units,
+                               kernel=kernel, dV=dV, periodic=periodic)
     return s.stars[name]
 
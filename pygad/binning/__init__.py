@@ -4,9 +4,9 @@ Some (convenience) functions for binning.
 Also doctest other parts of this sub-module:
     >>> import doctest
     >>> doctest.testmod(core)
-    TestResults(failed=0, attempted=32)
+    TestResults(failed=0, attempted=37)
     >>> doctest.testmod(cbinning)
-    TestResults(failed=0, attempted=34)
+    TestResults(failed=0, attempted=50)
     >>> doctest.testmod(mapping)
     TestResults(failed=0, attempted=13)
     >>> doctest.testmod(oneDbinning)
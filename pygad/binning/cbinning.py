@@ -70,9 +70,74 @@ Testing:
     ...     print(np.mean(np.abs(px_rel_err)))
     >>> if np.percentile(np.abs(px_rel_err), 99) > 0.05:
     ...     print(np.percentile(np.abs(px_rel_err), 99))
+
+    Many lines at once:
+    >>> lines = SPH_3D_to_lines(sub.gas, qty='rho', los=[[0,0],[0.05,-0.02]],
+    ...                         extent=extent[2], Npx=Npx[2])
+    create 2 SPH-lines with 1100 bins (length 200 [kpc])...
+    done with SPH lines
+    >>> if np.max(np.abs(lines[0]-line)) > 1e-6 * np.max(line):
+    ...     print(np.max(np.abs(lines[0]-line)))
+    >>> lines = SPH_3D_to_lines(sub.gas, qty='rho', los=[[0,0],[0.05,-0.02]],
+    ...                         extent=extent[2], Npx=Npx[2], xaxis=2, yaxis=0)
+    create 2 SPH-lines with 1100 bins (length 200 [kpc])...
+    done with SPH lines
+    >>> line = SPH_3D_to_line(sub.gas, qty='rho', los=[0.05,-0.02],
+    ...                       extent=extent[2], Npx=Npx[2], xaxis=2, yaxis=0)
+    create a SPH-line with 1100 bins (length 200 [kpc])...
+    done with SPH line
+    >>> if np.max(np.abs(lines[1]-line)) > 1e-6 * np.max(line):
+    ...     print(np.max(np.abs(lines[1]-line)))
+
+    The slices sample the SPH field at their pixel centers (also for oblique
+    planes):
+    >>> from ..analysis import SPH_qty_at
+    >>> center = UnitArr([20.0, -30.0, 10.0], 'kpc')
+    >>> ext_sl, Npx_sl = UnitArr([[-200,300],[-100,400]], 'kpc'), [10,16]
+    >>> for directions in [None, [[1.0,2.0,0.5], [0.0,-1.0,4.0]]]:
+    ...     sl = SPH_to_slice(sub.gas, 'rho', ext_sl, Npx_sl, xaxis=2, yaxis=0,
+    ...                       center=center, directions=directions)
+    ...     e = (np.eye(3)[[2,0]] if directions is None else
+    ...          directions / np.linalg.norm(directions, axis=1)[:,np.newaxis])
+    ...     u, v = [ext_sl[k,0] + (np.arange(Npx_sl[k]) + 0.5) * sl.res()[k]
+    ...             for k in range(2)]
+    ...     r = (center + u[:,np.newaxis,np.newaxis] * e[0]
+    ...                 + v[np.newaxis,:,np.newaxis] * e[1])
+    ...     rho = SPH_qty_at(sub.gas, 'rho', r.reshape((-1,3)))
+    ...     err = np.max(np.abs(sl.ravel() - rho)) / np.max(rho)
+    ...     if not err < 1e-6:
+    ...         print(err)
+    create a 10 x 16 SPH-slice (500 x 500 [kpc])...
+    done with SPH slice
+    create a 10 x 16 SPH-slice (500 x 500 [kpc])...
+    done with SPH slice
+
+    The PPV cube summed over the velocity bins and its zeroth moment are the
+    column density map (if the velocity range covers all of the lines), and the
+    other moments are those of the cube:
+    >>> cube, mom0, mom1, mom2 = SPH_to_PPV(sub.gas, 'rho', map2D.extent,
+    ...                                     map2D.Npx, [-5000,5000], 500)
+    ... # doctest:+ELLIPSIS
+    create a 30 x 75 x 500 SPH-PPV-cube (1200 x 3000 [kpc] x 1e+04 [km s**-1])...
+    done with SPH PPV-cube
+    >>> for m in [cube.sum(axis=-1), mom0]:
+    ...     err = np.max(np.abs(m - map2D)) / np.max(map2D)
+    ...     if not err < 1e-6:
+    ...         print(err)
+    >>> v = -5000 + 20 * (np.arange(500) + 0.5)
+    >>> cube, M0 = cube.view(np.ndarray), mom0.view(np.ndarray)
+    >>> with np.errstate(divide='ignore', invalid='ignore'):
+    ...     mean_v = np.sum(cube * v, axis=-1) / M0
+    ...     disp = np.sqrt(np.sum(cube * v**2, axis=-1) / M0 - mean_v**2)
+    >>> assert np.all(np.isnan(mom1) == (M0 == 0))
+    >>> for m, m_cube in [(mom1, mean_v), (mom2, disp)]:
+    ...     err = np.nanmax(np.abs(m.view(np.ndarray) - m_cube))
+    ...     if not err < 1e-6:
+    ...         print(err)
 '''
 __all__ = ['SPH_to_3Dgrid', 'SPH_to_2Dgrid', 'SPH_3D_to_line',
-           'SPH_to_2Dgrid_by_particle']
+           'SPH_3D_to_lines', 'SPH_to_2Dgrid_by_particle', 'SPH_to_slice',
+           'SPH_to_PPV', 'mesh_assign', 'MASS_ASSIGNMENT_ORDER']
 
 import numpy as np
 from ..kernels import *
@@ -82,9 +147,19 @@ from ..utils import *
 from .. import environment
 from .. import gadget
 from .. import C
+from ..physics import kB, m_H
 from numbers import Number
 from ..snapshot import BoxMask
 
+# the orders of the mass assignment schemes of the particle-mesh functions
+MASS_ASSIGNMENT_ORDER = {'NGP': 1, 'CIC': 2, 'TSC': 3, 'PCS': 4}
+
+def _mass_assignment_order(scheme):
+    try:
+        return MASS_ASSIGNMENT_ORDER[scheme.upper()]
+    except KeyError:
+        raise ValueError("Unknown mass assignment scheme '%s'!" % scheme)
+
 def SPH_to_3Dgrid(s, qty, extent, Npx, kernel=None, dV='dV', hsml='hsml',
                   normed=True):
     '''
@@ -339,6 +414,85 @@ def SPH_to_2Dgrid(s, qty, extent, Npx, xaxis=0, yaxis=1, kernel=None, dV='dV',
 
     return Map(grid, extent)
 
+def _line_props(s, qty, extent, Npx, xaxis, yaxis, kernel):
+    '''
+    Prepare the common arguments of `SPH_3D_to_line` and `SPH_3D_to_lines`.
+
+    Returns:
+        zaxis (int):            The axis along the lines.
+        extent (UnitArr):       The extent along the lines (shape (1,2)).
+        Npx (int):              The number of pixels per line.
+        res (UnitArr):          The size of the pixels.
+        qty (UnitQty):          The quantity to bin.
+        qty_units (Unit):       The units of the binned (integrated) quantity.
+        kernel (str):           The name of the kernel.
+    '''
+    zaxis = (set([0,1,2]) - set([xaxis, yaxis])).pop()
+    if set([xaxis, yaxis, zaxis]) != set([0,1,2]):
+        raise ValueError('Illdefined axes (x=%s, y=%s)!' % (xaxis, yaxis))
+    extent = UnitQty(extent, s['pos'].units, subs=s).reshape([1,2])
+    extent, Npx, res = grid_props(extent=extent, Npx=Npx, dim=1)
+    extent = UnitQty(extent, s['pos'].units, subs=s)
+    Npx = int(Npx)
+    res = UnitScalar(res.reshape([]), s['pos'].units, subs=s)
+    if kernel is None:
+        kernel = gadget.general['kernel']
+
+    if isinstance(qty, str):
+        qty = s.get(qty)
+    qty_units = getattr(qty,'units',None)
+    if qty_units is None:
+        qty_units = s['pos'].units
+    else:
+        qty_units = (qty_units * s['pos'].units).gather()   # integrated!
+    if qty.shape!=(len(s),):
+        raise ValueError('Quantity has to have shape (N,)!')
+    if len(s) and len(s.gas) != len(s):
+        raise NotImplementedError()
+
+    return zaxis, extent, Npx, res, qty, qty_units, kernel
+
+def _line_particle_args(s, mask, qty, hsml, dV, axes):
+    '''
+    Prepare the particle arrays of `SPH_3D_to_line` and `SPH_3D_to_lines`.
+
+    Args:
+        s (Snap):               The gas-only snapshot.
+        mask (array-like):      The (boolean) mask of the particles to pass or
+                                None for all of them.
+        qty (UnitQty):          The quantity to bin (for all of `s`).
+        hsml, dV:               As for `SPH_3D_to_line`.
+        axes (tuple):           The axes of the positions in the order to pass.
+
+    Returns:
+        pos, hsml, dV, qty (np.ndarray):
+                                The contiguous float64 arrays of the masked
+                                particles in the units of the positions.
+    '''
+    sub = s.gas if mask is None else s.gas[mask]
+    if mask is None:
+        mask = slice(None)
+    units = s['pos'].units
+    # TODO: why always need a copy? C vs Fortran alignment...!?
+    pos = sub['pos'].view(np.ndarray)[:,axes]
+    if isinstance(hsml, str):
+        hsml = sub[hsml].in_units_of(units)
+    else:
+        hsml = UnitQty(hsml, units, subs=s)
+        hsml = hsml * np.ones(len(sub)) if hsml.shape == () else hsml[mask]
+    hsml = hsml.view(np.ndarray)
+    if isinstance(dV, str):
+        dV = sub[dV].in_units_of(units**3)
+    elif dV is None:
+        dV = (hsml/2.0)**3
+    else:
+        dV = UnitQty(dV, units**3, subs=s)
+        dV = dV * np.ones(len(sub)) if dV.shape == () else dV[mask]
+    dV = np.asarray(dV)
+    qty = qty[mask].view(np.ndarray)
+    return tuple(np.ascontiguousarray(a, dtype=np.float64)
+                 for a in (pos, hsml, dV, qty))
+
 def SPH_3D_to_line(s, qty, los, extent, Npx, xaxis=0, yaxis=1, kernel=None,
                    dV='dV', hsml='hsml'):
     '''
@@ -355,15 +509,15 @@ def SPH_3D_to_line(s, qty, los, extent, Npx, xaxis=0, yaxis=1, kernel=None,
                                 L=len(s) and dimension 1 (i.e. shape (L,)) or a
                                 string that can be passed to s.get and returns
                                 such an array.
-        los (UnitQty):          TODO
-        extent (UnitQty):       The extent of the map. It can be a scalar and then
-                                is taken to be the total side length of a square
-                                around the origin or a sequence of the minima and
-                                maxima of the directions:
-                                [[xmin,xmax],[ymin,ymax]].
-        Npx (int, sequence):    The number of pixel per side. Either an integer
-                                that is taken for both sides or a 2-tuple of such,
-                                each value for one direction.
+        los (UnitQty):          The position of the line in the plane of `xaxis`
+                                and `yaxis` (shape (2,)).
+        extent (UnitQty):       The extent of the line along the third axis:
+                                [zmin,zmax].
+        Npx (int):              The number of pixel of the line.
+        xaxis (int):            The coordinate for the first component of
+                                `los`.
+        yaxis (int):            The coordinate for the second component of
+                                `los`. The line is along the remaining one.
         kernel (str):           The kernel to use for smoothing. (By default use
                                 the kernel defined in `gadget.cfg`.)
         dV (str, UnitQty, Unit):The volume element to use. Can be a block name, a
@@ -377,69 +531,28 @@ def SPH_3D_to_line(s, qty, los, extent, Npx, xaxis=0, yaxis=1, kernel=None,
         line (Map):             The binned SPH quantity.
     '''
     # prepare arguments
-    zaxis = (set([0,1,2]) - set([xaxis, yaxis])).pop()
-    if set([xaxis, yaxis, zaxis]) != set([0,1,2]):
-        raise ValueError('Illdefined axes (x=%s, y=%s)!' % (xaxis, yaxis))
-    extent = UnitQty(extent, s['pos'].units, subs=s).reshape([1,2])
-    extent, Npx, res = grid_props(extent=extent, Npx=Npx, dim=1)
-    extent = UnitQty(extent, s['pos'].units, subs=s)
-    Npx = int(Npx)
-    res = UnitScalar(res.reshape([]), s['pos'].units, subs=s)
+    zaxis, extent, Npx, res, qty, qty_units, kernel = \
+            _line_props(s, qty, extent, Npx, xaxis, yaxis, kernel)
     los = UnitQty(los, s['pos'].units, dtype=np.float64, subs=s)
     if los.shape != (2,):
         raise ValueError("`los` must have shape (2,)!")
-    if kernel is None:
-        kernel = gadget.general['kernel']
 
     if environment.verbose >= environment.VERBOSE_NORMAL:
         print('create a SPH-line with %d bins' % Npx, end=' ')
         print('(length %.4g %s)...' % (extent[0,1]-extent[0,0], extent.units))
 
-    # prepare (sub-)snapshot
-    if isinstance(qty, str):
-        qty = s.get(qty)
-    qty_units = getattr(qty,'units',None)
-    if qty_units is None:
-        qty_units = s['pos'].units
-    else:
-        qty_units = (qty_units * s['pos'].units).gather()   # integrated!
-    if qty.shape!=(len(s),):
-        raise ValueError('Quantity has to have shape (N,)!')
     if len(s) == 0:
         return UnitArr(np.zeros(Npx), qty_units), res
 
-    if len(s.gas) != len(s):
-        raise NotImplementedError()
-    sub = s.gas[ periodic_distance_to(s.gas['pos'][:,(xaxis,yaxis)],
-                                      los, s.boxsize) < s.gas['hsml'] ]
-
-    # TODO: why always need a copy? C vs Fortran alignment...!?
-    pos = sub['pos'].view(np.ndarray)[:,(xaxis,yaxis,zaxis)].astype(np.float64).copy()
-    if isinstance(hsml, str):
-        hsml = sub[hsml].in_units_of(s['pos'].units)
-    elif isinstance(hsml, (Number,Unit)):
-        hsml = UnitScalar(hsml,s['pos'].units)*np.ones(len(sub), dtype=np.float64)
-    else:   # should be some array
-        hsml = UnitQty(hsml,s['pos'].units,subs=s)[sub._mask]
-    hsml = hsml.view(np.ndarray).astype(np.float64)
-    if isinstance(dV, str):
-        dV = sub[dV].in_units_of(s['pos'].units**3)
-    elif dV is None:
-        dV = (hsml/2.0)**3
-    else:
-        dV = UnitArr(dV[sub._mask], s['pos'].units**3)
-    dV = dV.view(np.ndarray).astype(np.float64)
-    qty = qty[sub._mask].view(np.ndarray).astype(np.float64)
-    if hsml.base is not None:
-        hsml.copy()
-    if dV.base is not None:
-        dV.copy()
-    if qty.base is not None:
-        qty.copy()
+    # prepare (sub-)snapshot
+    mask = periodic_distance_to(s.gas['pos'][:,(xaxis,yaxis)],
+                                los, s.boxsize) < s.gas['hsml']
+    pos, hsml, dV, qty = _line_particle_args(s, mask, qty, hsml, dV,
+                                             (xaxis,yaxis,zaxis))
 
     ext = extent.view(np.ndarray).reshape((2,)).astype(np.float64).copy()
     line = np.empty(Npx, dtype=np.float64)
-    C.cpygad.bin_sph_along_line(C.c_size_t(len(sub)),
+    C.cpygad.bin_sph_along_line(C.c_size_t(len(pos)),
                                 C.c_void_p(pos.ctypes.data),
                                 C.c_void_p(hsml.ctypes.data),
                                 C.c_void_p(dV.ctypes.data),
@@ -457,6 +570,81 @@ def SPH_3D_to_line(s, qty, los, extent, Npx, xaxis=0, yaxis=1, kernel=None,
 
     return Map(line, extent, Npx=Npx)
 
+def SPH_3D_to_lines(s, qty, los, extent, Npx, xaxis=0, yaxis=1, kernel=None,
+                    dV='dV', hsml='hsml'):
+    '''
+    Bin some (integrated) quantity along many lines along a coordinate axis.
+
+    Same as `SPH_3D_to_line`, but for many lines at once: the particles
+    intersecting a line are found with a 2D tree of the projected positions and
+    the lines are filled in parallel.
+
+    Args:
+        s (Snap):               The gas-only (sub-)snapshot to bin from.
+        qty (UnitQty, str):     The quantity to map. It can be a UnitArr of length
+                                L=len(s) and dimension 1 (i.e. shape (L,)) or a
+                                string that can be passed to s.get and returns
+                                such an array.
+        los (UnitQty):          The positions of the lines in the plane of
+                                `xaxis` and `yaxis` (shape (N_los,2)).
+        extent (UnitQty):       The extent of the lines along the third axis:
+                                [zmin,zmax].
+        Npx (int):              The number of pixel per line.
+        xaxis (int):            The coordinate for the first components of
+                                `los`.
+        yaxis (int):            The coordinate for the second components of
+                                `los`. The lines are along the remaining one.
+        kernel (str):           The kernel to use for smoothing. (By default use
+                                the kernel defined in `gadget.cfg`.)
+        dV (str, UnitQty, Unit):The volume element to use. Can be a block name, a
+                                block itself or a Unit that is taken as constant
+                                volume for all particles.
+        hsml (str, UnitQty, Unit):
+                                The smoothing lengths to use. Defined analoguous
+                                to dV.
+
+    Returns:
+        lines (UnitArr):        The binned SPH quantity (shape (N_los,Npx)).
+    '''
+    # prepare arguments
+    zaxis, extent, Npx, res, qty, qty_units, kernel = \
+            _line_props(s, qty, extent, Npx, xaxis, yaxis, kernel)
+    los = UnitQty(los, s['pos'].units, dtype=np.float64, subs=s)
+    if len(los.shape) != 2 or los.shape[1] != 2:
+        raise ValueError("`los` must have shape (N_los,2)!")
+    los = los.view(np.ndarray).astype(np.float64).copy()
+
+    if environment.verbose >= environment.VERBOSE_NORMAL:
+        print('create %d SPH-lines with %d bins' % (len(los), Npx), end=' ')
+        print('(length %.4g %s)...' % (extent[0,1]-extent[0,0], extent.units))
+
+    if len(s) == 0:
+        return UnitArr(np.zeros((len(los),Npx)), qty_units)
+
+    pos, hsml, dV, qty = _line_particle_args(s, None, qty, hsml, dV,
+                                             (xaxis,yaxis,zaxis))
+
+    ext = extent.view(np.ndarray).reshape((2,)).astype(np.float64).copy()
+    lines = np.empty((len(los),Npx), dtype=np.float64)
+    C.cpygad.bin_sph_along_lines(C.c_size_t(len(pos)),
+                                 C.c_void_p(pos.ctypes.data),
+                                 C.c_void_p(hsml.ctypes.data),
+                                 C.c_void_p(dV.ctypes.data),
+                                 C.c_void_p(qty.ctypes.data),
+                                 C.c_size_t(len(los)),
+                                 C.c_void_p(los.ctypes.data),
+                                 C.c_void_p(ext.ctypes.data),
+                                 C.c_size_t(Npx),
+                                 C.c_void_p(lines.ctypes.data),
+                                 C.create_string_buffer(kernel.encode('ascii')),
+                                 C.c_double(s.boxsize.in_units_of(s['pos'].units)))
+    lines = UnitArr(lines, qty_units)
+
+    if environment.verbose >= environment.VERBOSE_NORMAL:
+        print('done with SPH lines')
+
+    return lines
+
 def SPH_to_2Dgrid_by_particle(s, qty, extent, Npx, reduction, xaxis=0, yaxis=1,
                               kernel=None, av=None, dV='dV', hsml='hsml'):
     '''
@@ -602,3 +790,376 @@ def SPH_to_2Dgrid_by_particle(s, qty, extent, Npx, reduction, xaxis=0, yaxis=1,
 
     return Map(grid, extent)
 
+
+def SPH_to_slice(s, qty, extent, Npx, xaxis=0, yaxis=1, center=None,
+                 directions=None, kernel=None, dV='dV', shepard=False):
+    '''
+    Evaluate some SPH quantity on an infinitesimally thin slice.
+
+    The SPH field is evaluated at the pixel centers of a plane (of arbitrary
+    orientation) by one neighbour query per pixel, so that the cost does not
+    depend on the size of any 3D grid. Unlike the other binning functions,
+    this samples the field rather than integrating it over the pixels.
+
+    Args:
+        s (Snap):               The gas-only (sub-)snapshot to evaluate from.
+        qty (UnitQty, str):     The quantity to map. It can be a UnitArr of length
+                                L=len(s) and dimension 1 (i.e. shape (L,)) or a
+                                string that can be passed to s.get and returns
+                                such an array.
+        extent (UnitQty):       The extent of the slice (relative to `center`
+                                along the directions of the plane). It can be a
+                                scalar and then is taken to be the total side
+                                length of a square around the center or a
+                                sequence of the minima and maxima of the
+                                directions: [[xmin,xmax],[ymin,ymax]].
+        Npx (int, sequence):    The number of pixel per side. Either an integer
+                                that is taken for both sides or a 2-tuple of such,
+                                each value for one direction.
+        xaxis (int):            The coordinate axis along the x-direction of the
+                                slice (if `directions` is not given).
+        yaxis (int):            The coordinate axis along the y-direction of the
+                                slice (if `directions` is not given).
+        center (UnitQty):       A point on the plane of the slice, the origin of
+                                its coordinates. Default: the origin.
+        directions (array-like):
+                                The directions of the x- and y-axes of the slice
+                                as a (2,3)-array. They are normalized (and the
+                                second one is made orthogonal to the first).
+        kernel (str):           The kernel to use for smoothing. (By default use
+                                the kernel defined in `gadget.cfg`.)
+        dV (str, UnitQty, Unit):The volume element to use. Can be a block name, a
+                                block itself or a Unit that is taken as constant
+                                volume for all particles.
+        shepard (bool):         Whether to normalize the result by the sum of
+                                the kernel weights (Shepard correction).
+
+    Returns:
+        grid (Map):             The SPH quantity on the slice.
+    '''
+    # prepare arguments
+    extent, Npx, res = grid_props(extent=extent, Npx=Npx, dim=2)
+    extent = UnitQty(extent, s['pos'].units, subs=s)
+    if kernel is None:
+        kernel = gadget.general['kernel']
+    if center is None:
+        center = [0,0,0]
+    center = UnitQty(center, s['pos'].units, subs=s)
+    center = center.view(np.ndarray).astype(np.float64).copy()
+    if directions is None:
+        if xaxis == yaxis or set([xaxis, yaxis]) - set([0,1,2]):
+            raise ValueError('Illdefined axes (x=%s, y=%s)!' % (xaxis, yaxis))
+        directions = np.zeros((2,3))
+        directions[0,xaxis] = directions[1,yaxis] = 1.0
+    e_u, e_v = np.array(directions, dtype=np.float64).reshape((2,3))
+    e_u /= np.linalg.norm(e_u)
+    e_v -= np.dot(e_u, e_v) * e_u
+    if np.linalg.norm(e_v) < 1e-6:
+        raise ValueError('The directions of the slice are (nearly) parallel!')
+    e_v /= np.linalg.norm(e_v)
+    normal = np.cross(e_u, e_v)
+
+    if environment.verbose >= environment.VERBOSE_NORMAL:
+        print('create a %d x %d' % tuple(Npx), end=' ')
+        print('SPH-slice (%.4g x %.4g' % tuple(extent[:,1]-extent[:,0]), end=' ')
+        print('%s)...' % extent.units)
+
+    # prepare (sub-)snapshot
+    if isinstance(qty, str):
+        qty = s.get(qty)
+    qty_units = getattr(qty,'units',None)
+    if qty.shape!=(len(s),):
+        raise ValueError('Quantity has to have shape (N,)!')
+    if len(s) == 0:
+        return Map(UnitArr(np.zeros(tuple(Npx)), qty_units), extent)
+
+    if len(s.gas) != len(s):
+        raise NotImplementedError()
+    # only the particles with kernels cutting the plane contribute
+    boxsize = float(s.boxsize.in_units_of(s['pos'].units))
+    d = s['pos'].view(np.ndarray) - center
+    d -= boxsize * np.round(d / boxsize)
+    hsml = s['hsml'].in_units_of(s['pos'].units).view(np.ndarray)
+    mask = np.abs(np.dot(d, normal)) < hsml
+    sub = s[mask]
+
+    pos = sub['pos'].view(np.ndarray).astype(np.float64)
+    hsml = hsml[mask].astype(np.float64)
+    if isinstance(dV, str):
+        dV = sub[dV].in_units_of(s['pos'].units**3)
+    elif isinstance(dV, (Number,Unit)):
+        dV = UnitScalar(dV,s['pos'].units**3)*np.ones(len(sub), dtype=np.float64)
+    else:
+        dV = UnitArr(dV[mask], s['pos'].units**3)
+    dV = dV.view(np.ndarray).astype(np.float64)
+    qty = qty[mask].view(np.ndarray).astype(np.float64)
+    if pos.base is not None:
+        pos = pos.copy()
+    if dV.base is not None:
+        dV = dV.copy()
+    if qty.base is not None:
+        qty = qty.copy()
+
+    ext = extent.view(np.ndarray).astype(np.float64).copy()
+    Npx = Npx.astype(np.uintp)
+    grid = np.empty(np.prod(Npx), dtype=np.float64)
+    norm = np.empty(np.prod(Npx), dtype=np.float64)
+    C.cpygad.eval_sph_on_plane(C.c_void_p(center.ctypes.data),
+                               C.c_void_p(e_u.ctypes.data),
+                               C.c_void_p(e_v.ctypes.data),
+                               C.c_void_p(ext.ctypes.data),
+                               C.c_void_p(Npx.ctypes.data),
+                               C.c_size_t(1),
+                               C.c_void_p(grid.ctypes.data),
+                               C.c_size_t(len(sub)),
+                               C.c_void_p(pos.ctypes.data),
+                               C.c_void_p(hsml.ctypes.data),
+                               C.c_void_p(dV.ctypes.data),
+                               C.c_void_p(qty.ctypes.data),
+                               C.c_double(boxsize),
+                               C.c_void_p(norm.ctypes.data),
+                               C.create_string_buffer(kernel.encode('ascii')),
+                               None,    # build new tree
+    )
+    if shepard:
+        grid /= np.where(norm > 0, norm, 1.0)
+    grid = UnitArr(grid.reshape(tuple(Npx)), qty_units)
+
+    if environment.verbose >= environment.VERBOSE_NORMAL:
+        print('done with SPH slice')
+
+    return Map(grid, extent)
+
+
+def SPH_to_PPV(s, qty, extent, Npx, vel_extent, N_vel, xaxis=0, yaxis=1,
+               kernel=None, dV='dV', hsml='hsml', temp='temp', atomwt=m_H,
+               v_turb=None, cube=True):
+    '''
+    Bin some SPH quantity into a position-position-velocity cube and calculate
+    its moment maps along the velocity axis.
+
+    Spatially the particles are spread as in `SPH_to_2Dgrid`, along the
+    velocity axis (the line-of-sight component of the peculiar velocities) by
+    Gaussian line profiles of the Doppler parameters b = sqrt(2 kB T / m +
+    v_turb^2), as for the absorption spectra. The moments are accumulated in
+    the same pass as the cube, which is therefore not needed for them.
+
+    Args:
+        s (Snap):               The gas-only (sub-)snapshot to bin from.
+        qty (UnitQty, str):     The quantity to map. It can be a UnitArr of length
+                                L=len(s) and dimension 1 (i.e. shape (L,)) or a
+                                string that can be passed to s.get and returns
+                                such an array.
+        extent (UnitQty):       The extent of the map. It can be a scalar and then
+                                is taken to be the total side length of a square
+                                around the origin or a sequence of the minima and
+                                maxima of the directions:
+                                [[xmin,xmax],[ymin,ymax]].
+        Npx (int, sequence):    The number of pixel per side. Either an integer
+                                that is taken for both sides or a 2-tuple of such,
+                                each value for one direction.
+        vel_extent (UnitQty):   The velocity range of the cube (in km/s, if
+                                without units).
+        N_vel (int):            The number of (equally wide) velocity bins.
+        kernel (str):           The kernel to use for smoothing. (By default use
+                                the kernel defined in `gadget.cfg`.)
+        dV (str, UnitQty, Unit):The volume element to use. Can be a block name, a
+                                block itself or a Unit that is taken as constant
+                                volume for all particles.
+        hsml (str, UnitQty, Unit):
+                                The smoothing lengths to use. Defined analoguous
+                                to dV.
+        temp (str, UnitQty):    The temperatures for the thermal broadening. If
+                                None, there is none.
+        atomwt (UnitScalar):    The mass of the emitting atoms / molecules for
+                                the thermal broadening (default: hydrogen, m_H).
+        v_turb (str, UnitQty, UnitScalar):
+                                Additional (turbulent) broadening per particle.
+        cube (bool):            Whether to return the cube (or only the moment
+                                maps, which saves its memory).
+
+    Returns:
+        cube (UnitArr):         The binned SPH quantity of shape (*Npx, N_vel),
+                                integrated along the line of sight and over the
+                                velocity bins. None, if `cube` is False.
+        mom0 (Map):             The zeroth moment, i.e. the integrated quantity
+                                within the velocity range.
+        mom1 (Map):             The (`qty`-weighted) mean velocity along the line
+                                of sight (NaN for empty pixels).
+        mom2 (Map):             The velocity dispersion along the line of sight
+                                (NaN for empty pixels).
+    '''
+    # prepare arguments
+    zaxis = (set([0,1,2]) - set([xaxis, yaxis])).pop()
+    if set([xaxis, yaxis, zaxis]) != set([0,1,2]):
+        raise ValueError('Illdefined axes (x=%s, y=%s)!' % (xaxis, yaxis))
+    extent, Npx, res = grid_props(extent=extent, Npx=Npx, dim=2)
+    extent = UnitQty(extent, s['pos'].units, subs=s)
+    vel_extent = UnitQty(vel_extent, 'km/s', subs=s)
+    if vel_extent.shape != (2,) or not vel_extent[0] < vel_extent[1]:
+        raise ValueError('Illdefined velocity extent %s!' % vel_extent)
+    N_vel = int(N_vel)
+    if kernel is None:
+        kernel = gadget.general['kernel']
+
+    if environment.verbose >= environment.VERBOSE_NORMAL:
+        print('create a %d x %d x %d' % (Npx[0], Npx[1], N_vel), end=' ')
+        print('SPH-PPV-cube (%.4g x %.4g' % tuple(extent[:,1]-extent[:,0]), end=' ')
+        print('%s x %.4g %s)...' % (extent.units, vel_extent[1]-vel_extent[0],
+                                   vel_extent.units))
+
+    # prepare (sub-)snapshot
+    if isinstance(qty, str):
+        qty = s.get(qty)
+    qty_units = getattr(qty,'units',None)
+    if qty_units is None:
+        qty_units = s['pos'].units**-2
+    else:
+        qty_units = (qty_units * s['pos'].units).gather()   # integrated!
+    if qty.shape!=(len(s),):
+        raise ValueError('Quantity has to have shape (N,)!')
+
+    if len(s.gas) not in [0,len(s)]:
+        raise NotImplementedError()
+    ext3D = UnitArr(np.empty((3,2)), extent.units)
+    ext3D[xaxis] = extent[0]
+    ext3D[yaxis] = extent[1]
+    ext3D[zaxis] = [-np.inf, +np.inf]
+    sub = s[BoxMask(ext3D, sph_overlap=True)]
+
+    pos = sub['pos'].view(np.ndarray)[:,(xaxis,yaxis)].astype(np.float64).copy()
+    vel = sub['vel'][:,zaxis].in_units_of(vel_extent.units, subs=s)
+    vel = vel.view(np.ndarray).astype(np.float64).copy()
+    if isinstance(hsml, str):
+        hsml = sub[hsml].in_units_of(s['pos'].units)
+    elif isinstance(hsml, (Number,Unit)):
+        hsml = UnitScalar(hsml,s['pos'].units)*np.ones(len(sub), dtype=np.float64)
+    else:   # should be some array
+        hsml = UnitQty(hsml,s['pos'].units,subs=s)[sub._mask]
+    hsml = hsml.view(np.ndarray).astype(np.float64).copy()
+    if isinstance(dV, str):
+        dV = sub[dV].in_units_of(s['pos'].units**3)
+    elif dV is None:
+        dV = (hsml/2.0)**3
+    elif isinstance(dV, (Number,Unit)):
+        dV = UnitScalar(dV,s['pos'].units**3)*np.ones(len(sub), dtype=np.float64)
+    else:
+        dV = UnitArr(dV[sub._mask], s['pos'].units**3)
+    dV = dV.view(np.ndarray).astype(np.float64).copy()
+    qty = qty[sub._mask].view(np.ndarray).astype(np.float64).copy()
+
+    # the line broadening
+    b_0 = np.sqrt(2.0 * kB * UnitScalar('1 K') / UnitScalar(atomwt))
+    b_0 = float(b_0.in_units_of(vel_extent.units))
+    if temp is not None:
+        if isinstance(temp, str):
+            temp = sub[temp]
+        else:
+            temp = UnitQty(temp, 'K', subs=s)[sub._mask]
+        temp = temp.in_units_of('K').view(np.ndarray).astype(np.float64).copy()
+    if v_turb is not None:
+        if isinstance(v_turb, str):
+            v_turb = sub[v_turb]
+        else:
+            v_turb = UnitQty(v_turb, vel_extent.units, subs=s)
+            if v_turb.shape == tuple():
+                v_turb = v_turb * np.ones(len(s), dtype=np.float64)
+            v_turb = v_turb[sub._mask]
+        v_turb = v_turb.in_units_of(vel_extent.units, subs=s)
+        v_turb = v_turb.view(np.ndarray).astype(np.float64).copy()
+
+    ext = extent.view(np.ndarray).astype(np.float64).copy()
+    vext = vel_extent.view(np.ndarray).astype(np.float64).copy()
+    Npx = Npx.astype(np.uintp)
+    grid = np.empty(tuple(Npx)+(N_vel,), dtype=np.float64) if cube else None
+    moments = np.empty((3,)+tuple(Npx), dtype=np.float64)
+    C.cpygad.sph_ppv_cube(C.c_size_t(len(sub)),
+                          C.c_void_p(pos.ctypes.data),
+                          C.c_void_p(vel.ctypes.data),
+                          C.c_void_p(hsml.ctypes.data),
+                          C.c_void_p(dV.ctypes.data),
+                          C.c_void_p(qty.ctypes.data),
+                          None if temp is None else C.c_void_p(temp.ctypes.data),
+                          C.c_double(b_0),
+                          None if v_turb is None else C.c_void_p(v_turb.ctypes.data),
+                          C.c_void_p(ext.ctypes.data),
+                          C.c_void_p(Npx.ctypes.data),
+                          C.c_void_p(vext.ctypes.data),
+                          C.c_size_t(N_vel),
+                          None if grid is None else C.c_void_p(grid.ctypes.data),
+                          C.c_void_p(moments.ctypes.data),
+                          C.create_string_buffer(kernel.encode('ascii')),
+                          C.c_double(s.boxsize.in_units_of(s['pos'].units)),
+    )
+    if grid is not None:
+        grid = UnitArr(grid, qty_units)
+    mom0 = Map(UnitArr(moments[0], qty_units), extent)
+    mom1 = Map(UnitArr(moments[1], vel_extent.units), extent)
+    mom2 = Map(UnitArr(moments[2], vel_extent.units), extent)
+
+    if environment.verbose >= environment.VERBOSE_NORMAL:
+        print('done with SPH PPV-cube')
+
+    return grid, mom0, mom1, mom2
+
+
+def mesh_assign(s, qty='mass', Npx=256, scheme='CIC', shift=0.0, boxsize=None):
+    '''
+    Assign some particle quantity onto a periodic grid covering the entire
+    box, as for particle-mesh methods (no smoothing lengths needed).
+
+    Args:
+        s (Snap):               The (sub-)snapshot to bin from.
+        qty (UnitQty, str):     The quantity to assign (summed per cell). It can
+                                be a UnitArr of shape (len(s),) or a string that
+                                can be passed to s.get and returns such an
+                                array.
+        Npx (int):              The number of cells per side.
+        scheme (str):           The mass assignment scheme: 'NGP' (nearest grid
+                                point), 'CIC' (cloud in cell), 'TSC'
+                                (triangular shaped cloud), or 'PCS' (piecewise
+                                cubic spline).
+        shift (float):          Shift the particles by this many cells along
+                                all axes (e.g. 0.5 for an interlaced grid).
+        boxsize (UnitScalar):   The side length of the periodic box. Default:
+                                the one of the snapshot.
+
+    Returns:
+        grid (Map):             The assigned quantity over the box.
+    '''
+    order = _mass_assignment_order(scheme)
+    Npx = int(Npx)
+    if boxsize is None:
+        boxsize = s.boxsize
+    boxsize = float(UnitScalar(boxsize, s['pos'].units, subs=s))
+
+    if environment.verbose >= environment.VERBOSE_NORMAL:
+        print('assign onto a %d^3 mesh (%s)...' % (Npx, scheme.upper()))
+
+    if isinstance(qty, str):
+        qty = s.get(qty)
+    qty_units = getattr(qty,'units',None)
+    if qty.shape!=(len(s),):
+        raise ValueError('Quantity has to have shape (N,)!')
+
+    pos = s['pos'].view(np.ndarray).astype(np.float64)
+    qty = qty.view(np.ndarray).astype(np.float64)
+    if pos.base is not None:
+        pos = pos.copy()
+    if qty.base is not None:
+        qty = qty.copy()
+
+    grid = np.empty(Npx**3, dtype=np.float64)
+    C.cpygad.mesh_assign(C.c_size_t(len(s)),
+                         C.c_void_p(pos.ctypes.data),
+                         C.c_void_p(qty.ctypes.data),
+                         C.c_double(boxsize),
+                         C.c_size_t(Npx),
+                         C.c_int(order),
+                         C.c_double(shift),
+                         C.c_void_p(grid.ctypes.data),
+    )
+    grid = UnitArr(grid.reshape((Npx,)*3), qty_units)
+
+    extent = UnitArr([[0.0, boxsize]]*3, s['pos'].units)
+    return Map(grid, extent)
@@ -85,17 +85,52 @@ Examples:
     UnitArr(5.183263e+03)
     >>> m1 = scale01(m1, np.percentile(m1, [5,95]))
     >>> assert m1.min() >= 0 and m1.max() <= 1
+
+    The smoothing in C equals the convolutions by scipy with the same kernels
+    (for the small kernels done directly, for the larger ones by FFTs), as
+    does the fallback for the other boundary modes:
+    >>> from scipy.integrate import quad
+    >>> from scipy.ndimage import gaussian_filter
+    >>> from ..kernels import kernels, vector_kernels
+    >>> def kernel_stencil(sml, D):
+    ...     R = int(np.ceil(sml))
+    ...     x = np.arange(-R, R+1)
+    ...     q = np.sqrt(np.sum(np.square(np.meshgrid(*(x,)*D)), axis=0)) / sml
+    ...     if D == 3:
+    ...         w = vector_kernels['cubic'](np.minimum(q,1).ravel())
+    ...     else:   # the projected kernel
+    ...         w = [quad(lambda l: kernels['cubic'](np.sqrt(u**2 + l**2)),
+    ...                   0, np.sqrt(1 - min(u,1)**2))[0] for u in q.ravel()]
+    ...     w = np.where(q < 1, np.reshape(w, q.shape), 0.0)
+    ...     return w / w.sum()
+    >>> for shape, smls in [((64,48), [3.3, 9.2]), ((20,24,18), [2.2, 4.5])]:
+    ...     grid = np.random.random(shape)
+    ...     for sml in smls:
+    ...         stencil = kernel_stencil(sml, len(shape))
+    ...         for mode in ['constant', 'wrap', 'nearest']:
+    ...             diff = (smooth(grid, sml, 'cubic', mode, cval=0.3) -
+    ...                     convolve(grid, stencil, mode=mode, cval=0.3))
+    ...             if np.max(np.abs(diff)) > 1e-6:
+    ...                 print(shape, sml, mode, np.max(np.abs(diff)))
+    ...     for sml in [1.5, 2.3, 10.0]:
+    ...         for mode in ['constant', 'wrap', 'nearest']:
+    ...             diff = (smooth(grid, sml, 'gaussian', mode, cval=0.3) -
+    ...                     gaussian_filter(grid, sml, mode=mode, cval=0.3,
+    ...                                     truncate=4.0))
+    ...             if np.max(np.abs(diff)) > 1e-10:
+    ...                 print(shape, sml, mode, np.max(np.abs(diff)))
 '''
 __all__ = ['gridbin2d', 'gridbin1d', 'gridbin', 'grid_props', 'Map', 'scale01', 'smooth']
 
 import numpy as np
 from ..units import *
+from .. import C
 from scipy.stats import binned_statistic_dd
-from scipy.ndimage.filters import convolve
+from scipy.ndimage.filters import convolve, gaussian_filter
 
 
 def gridbin2d(x, y, qty=None, bins=50, extent=None, normed=False, stats=None,
-              nanval=None):
+              nanval=None, logaxes=False):
     '''
     Bin data on a 2-dim. grid.
 
@@ -103,37 +138,41 @@ def gridbin2d(x, y, qty=None, bins=50, extent=None, normed=False, stats=None,
     information!
     '''
     return gridbin(np.array([x, y]).T, qty=qty, bins=bins, extent=extent,
-                   normed=normed, stats=stats, nanval=nanval)
+                   normed=normed, stats=stats, nanval=nanval, logaxes=logaxes)
 
 
 def gridbin1d(x, qty=None, bins=50, extent=None, normed=False, stats=None,
-              nanval=None):
+              nanval=None, logaxes=False):
     '''
     Bin data 1-dimensional.
 
     This calls gridbin. See gridbin for more information!
     '''
-    extent = np.asarray(extent)
-    if extent.shape == (2,):
-        extent = extent.reshape((1, 2))
+    if extent is not None:
+        extent = np.asarray(extent)
+        if extent.shape == (2,):
+            extent = extent.reshape((1, 2))
     return gridbin(np.array(x).reshape((len(x), 1)), qty=qty, bins=bins, extent=extent,
-                   normed=normed, stats=stats, nanval=nanval)
+                   normed=normed, stats=stats, nanval=nanval, logaxes=logaxes)
 
 
 def gridbin(pnts, qty=None, bins=50, extent=None, normed=False, stats=None,
-            nanval=None):
+            nanval=None, logaxes=False):
     '''
     Bin data on a grid.
 
     It can used to speed-up scatter plots, for instance.
 
-    It basically is a wrapper for binned_statistic_dd for a little more
-    convenience and for adding units.
+    The predefined statistics (except 'median') are accumulated in a single
+    parallel pass in the C library (see `histogram_dd`), other statistics are
+    passed on to binned_statistic_dd.
 
     Args:
         pnts (array-like):  An (N,D)-array of the points to bin.
-        qty (UnitArr):      Values for the points to bin. If None, points are just
-                            counted per bin.
+        qty (UnitArr, list):
+                            Values for the points to bin. If None, points are just
+                            counted per bin. A list of such values is binned in
+                            the same pass and a list of grids is returned.
         bins (int, array-like):
                             Number of bins per dimension.
         extent (secquence): The range for the grid. A squence of pairs of the
@@ -141,62 +180,185 @@ def gridbin(pnts, qty=None, bins=50, extent=None, normed=False, stats=None,
                             If both this and pnts are UnitArr's, it is taken care
                             of the units.
         normed (True):      Whether to norm the gridded quantity to one.
-        stats (str, function):
+        stats (str, function, list):
                             A function to apply at the end. The predefined ones
-                            are: 'count', 'sum', 'mean', 'median'. For more
-                            information see binned_statistic_dd.
+                            are: 'count', 'sum', 'mean', 'median', 'var', 'std',
+                            'min', and 'max'. For more information see
+                            binned_statistic_dd. A list of predefined
+                            statistics is computed in a single pass and a list
+                            of grids is returned (per quantity, if there are
+                            several).
                             Default: 'count' if `qty` is None else 'sum'
         nanval (value):     All points where the grid is NaN are set to this
                             value.
+        logaxes (bool, sequence):
+                            Whether to space the bins logarithmically (for all
+                            or per dimension). The extent is still given in the
+                            coordinates, but the extent of the returned map is
+                            in log10 of them along these axes.
 
     Returns:
         gridded (Map):      The (N,...,N)-array of the binned data.
     '''
-    known_stats = ['count', 'sum', 'mean', 'median']
-    if isinstance(stats, str) and stats not in known_stats:
-        raise ValueError('Unknown statistic. Choose from: %s' % known_stats)
+    known_stats = ['count', 'sum', 'mean', 'median', 'var', 'std', 'min', 'max']
+    multi_stats = isinstance(stats, (list, tuple))
+    stats_list = list(stats) if multi_stats else [stats]
+    for st in stats_list:
+        if isinstance(st, str) and st not in known_stats:
+            raise ValueError('Unknown statistic. Choose from: %s' % known_stats)
     pnts = np.asanyarray(pnts)
     if len(pnts.shape) != 2:
         raise ValueError('The points array has to have shape (N,D)!')
+    D = pnts.shape[1]
 
+    multi_qty = isinstance(qty, (list, tuple)) and len(qty) > 0 \
+            and np.ndim(qty[0]) > 0
     if qty is None:
-        if stats is None or stats == 'count':
-            stats = 'count'
-            qty = np.ones(len(pnts), int)
+        qtys = []
+        stats_list = ['count' if st is None else st for st in stats_list]
     else:
-        if stats is None:
-            stats = 'sum'
-        qty = np.asanyarray(qty)
+        qtys = [np.asanyarray(q) for q in (qty if multi_qty else [qty])]
+        stats_list = ['sum' if st is None else st for st in stats_list]
 
     if isinstance(extent, UnitArr) and isinstance(pnts, UnitArr):
         extent = extent.in_units_of(pnts.units)
 
-    gridded, edges, binnum = binned_statistic_dd(pnts, qty, range=extent,
-                                                 statistic=stats, bins=bins)
-    if extent is None:
-        extent = np.array([[e[0], e[-1]] for e in edges])
+    if qty is None and any(st != 'count' for st in stats_list):
+        raise ValueError('Only counting is possible without a quantity!')
+
+    logaxes = np.broadcast_to(np.asarray(logaxes, dtype=bool), (D,))
+    in_C = all(isinstance(st, str) and st != 'median' for st in stats_list)
+    if in_C and not isinstance(bins, (int, np.integer)):
+        in_C = all(isinstance(b, (int, np.integer)) for b in bins)
+    if not in_C and np.any(logaxes):
+        raise ValueError('Logarithmic axes are only supported for the '
+                         'predefined statistics (except \'median\') with '
+                         'numbers of bins!')
+
+    if in_C:
+        grids, extent = _gridbin_C(pnts, qtys, bins, extent, stats_list,
+                                   logaxes)
+    else:
+        grids = []
+        for q in (qtys if qtys else [np.ones(len(pnts), int)]):
+            grids.append([])
+            for st in stats_list:
+                gridded, edges, binnum = binned_statistic_dd(
+                        pnts, q, range=extent, statistic=st, bins=bins)
+                grids[-1].append(gridded)
+        if extent is None:
+            extent = np.array([[e[0], e[-1]] for e in edges])
+
+    results = []
+    for q, grids_q in zip(qtys if qtys else [None], grids):
+        results.append([])
+        for st, gridded in zip(stats_list, grids_q):
+            gridded = UnitArr(gridded)
+            # if the values to bin have units, the result should as well
+            if isinstance(q, UnitArr) and not st == 'count':
+                if st == 'var':
+                    gridded.units = q.units**2
+                elif isinstance(st, str):
+                    gridded.units = q.units
+                else:
+                    if st in UnitArr._ufunc_registry:
+                        gridded.units = UnitArr._ufunc_registry[st](q)
+                    else:
+                        import warnings
+                        warnings.warn('Operation \'%s\' on units is ' % st.__name__ + \
+                                      '*not* defined! Return normal numpy array.')
+                        gridded = gridded.view(np.ndarray)
+
+            if normed:
+                gridded /= gridded.sum()
+
+            if nanval is not None:
+                gridded[np.isnan(gridded)] = nanval
+
+            results[-1].append(Map(gridded, extent=extent))
+
+    if not multi_stats:
+        results = [r[0] for r in results]
+    return results if multi_qty else results[0]
+
+
+def _gridbin_C(pnts, qtys, bins, extent, stats, logaxes):
+    '''
+    Bin the points with the C histogram for `gridbin` (which see).
 
-    gridded = UnitArr(gridded)
-    # if the values to bin have units, the result should as well
-    if isinstance(qty, UnitArr) and not stats == 'count':
-        if isinstance(stats, str):
-            gridded.units = qty.units
-        else:
-            if stats in UnitArr._ufunc_registry:
-                gridded.units = UnitArr._ufunc_registry[ufunc](qty)
+    Returns:
+        grids (list):       Per quantity (or a single one without), a list of
+                            the grids for the statistics.
+        extent (np.ndarray):The extent of the grids (log10 along the
+                            logarithmic axes).
+    '''
+    N, D = pnts.shape
+    pnts_C = np.ascontiguousarray(np.asarray(pnts), dtype=np.float64)
+    if extent is None:
+        extent = np.empty((D,2), dtype=np.float64)
+        for d in range(D):
+            x = pnts_C[:,d]
+            if logaxes[d]:
+                x = x[x > 0]
+            if len(x) == 0:
+                x = np.array([1.0])
+            extent[d] = x.min(), x.max()
+            if extent[d,0] == extent[d,1]:
+                if logaxes[d]:
+                    extent[d] *= [0.5, 2.0]
+                else:
+                    extent[d] += [-0.5, 0.5]
+    else:
+        extent = np.array(np.asarray(extent), dtype=np.float64).reshape((D,2))
+    Nbins = np.broadcast_to(np.asarray(bins, dtype=np.uintp), (D,))
+    Nbins = np.ascontiguousarray(Nbins)
+    log_axis = np.ascontiguousarray(logaxes, dtype=np.intc)
+
+    K = len(qtys)
+    Q = np.empty((N,K), dtype=np.float64) if K else None
+    for k, q in enumerate(qtys):
+        Q[:,k] = np.asarray(q).ravel()
+
+    shape = tuple(Nbins)
+    count = np.empty(shape, dtype=np.float64)
+    need = set(stats)
+    if 'std' in need:
+        need.add('var')
+    out = {}
+    for st in ['sum', 'mean', 'var', 'min', 'max']:
+        out[st] = np.empty(shape+(K,), dtype=np.float64) \
+                if (st in need and K) else None
+    def ptr(a):
+        return C.c_void_p(None if a is None else a.ctypes.data)
+    C.cpygad.histogram_dd(C.c_size_t(N),
+                          C.c_size_t(D),
+                          C.c_void_p(pnts_C.ctypes.data),
+                          C.c_void_p(Nbins.ctypes.data),
+                          C.c_void_p(extent.ctypes.data),
+                          C.c_void_p(log_axis.ctypes.data),
+                          C.c_size_t(K),
+                          ptr(Q),
+                          C.c_void_p(count.ctypes.data),
+                          ptr(out['sum']),
+                          ptr(out['mean']),
+                          ptr(out['var']),
+                          ptr(out['min']),
+                          ptr(out['max']),
+    )
+
+    grids = []
+    for k in range(max(K,1)):
+        grids.append([])
+        for st in stats:
+            if st == 'count':
+                grids[-1].append(count.copy())
+            elif st == 'std':
+                grids[-1].append(np.sqrt(out['var'][...,k]))
             else:
-                import warnings
-                warnings.warn('Operation \'%s\' on units is ' % stats.__name__ + \
-                              '*not* defined! Return normal numpy array.')
-                gridded = gridded.view(np.ndarray)
-
-    if normed:
-        gridded /= gridded.sum()
-
-    if nanval is not None:
-        gridded[np.isnan(gridded)] = nanval
+                grids[-1].append(out[st][...,k].copy())
 
-    return Map(gridded, extent=extent)
+    extent[logaxes] = np.log10(extent[logaxes])
+    return grids, extent
 
 
 def grid_props(extent, Npx=256, dim=None):
@@ -402,24 +564,48 @@ def scale01(arr, lims):
     return arr
 
 
-def smooth(grid, sml, kernel, bndrymode='constant'):
+def _proj_kernel_values(kernel, q):
+    '''
+    The projection of the (vector) kernel at the radii q, integrated along the
+    line of sight in four pieces by 8-point Gauss-Legendre quadratures (as
+    `_proj_kernel` in the C library).
+    '''
+    x, w = np.polynomial.legendre.leggauss(8)
+    q = np.asarray(q, dtype=float).reshape((-1, 1))
+    l_max = np.sqrt(np.maximum(1.0 - q ** 2, 0.0))
+    l = l_max / 4. * (np.arange(4)[:, np.newaxis] + 0.5 * (1. + x)).ravel()
+    W = kernel(np.sqrt(q ** 2 + l ** 2).ravel()).reshape(l.shape)
+    return 2. * l_max[:, 0] / 8. * np.dot(W, np.tile(w, 4))
+
+
+def smooth(grid, sml, kernel, bndrymode='constant', cval=0.0):
     '''
     Smooth a gridded quantity (e.g. an image).
 
+    2D and 3D grids are smoothed in the C library (see `smooth_grid`), if the
+    kernel is given by name and the boundary mode is 'constant' or 'wrap';
+    small kernels are convolved directly, large ones by FFTs.
+
     Args:
         grid (array-like):      The grid to smooth. Can be a UnitArr and stays
                                 one.
         sml (float):            The number of pixels to smooth over (a square
-                                array is used for convolution).
-        kernel (vector-function):
-                                The kernel to use for smoothing. It is a function
-                                of one argument (the radius in px/sml) and does
-                                not have to be normed (is gets normed in here).
+                                array is used for convolution). For the kernel
+                                'gaussian' it is its standard deviation in
+                                pixels.
+        kernel (str, vector-function):
+                                The kernel to use for smoothing. Either the name
+                                of one of the SPH kernels (which is projected for
+                                2D grids), 'gaussian', or a function of one
+                                argument (the radius in px/sml), which does not
+                                have to be normed (is gets normed in here).
                                 It has to be a vector function, i.e. be able to
                                 operate on entire arrays.
         bndrymode (str):        How to handle the boundaries. See e.g.
                                 scipy.ndimage.filters.convolve for more
                                 information.
+        cval (float):           The value beyond the boundaries for the mode
+                                'constant'.
 
     Returns:
         smooth (array-like):    The smoothed grid. It preserves units.
@@ -431,20 +617,43 @@ def smooth(grid, sml, kernel, bndrymode='constant'):
 
     sml = float(sml)
 
-    from ..kernels import kernels, vector_kernels
-
-    pxs = int(2 * np.ceil(sml) + 1)
-    x = np.linspace(float(-(pxs - 1) / 2.), float((pxs - 1) / 2.), pxs) / sml
     D = len(grid.shape)
-    x = np.meshgrid(*(x,) * D)
-    x = np.array(x)
-    dists = np.sqrt(np.sum(x ** 2, axis=0))
-    conv_grid = kernel(dists.ravel())
-    conv_grid = conv_grid.reshape((pxs, pxs))
-    conv_grid /= np.sum(conv_grid)
-    smooth = convolve(grid, conv_grid, mode=bndrymode)
+    if isinstance(kernel, str) and D in [2,3] \
+            and bndrymode in ['constant', 'wrap']:
+        smooth = np.array(np.asarray(grid), dtype=np.float64, order='C')
+        Npx = np.array(smooth.shape, dtype=np.uintp)
+        C.cpygad.smooth_grid(C.c_size_t(D),
+                             C.c_void_p(Npx.ctypes.data),
+                             C.c_void_p(smooth.ctypes.data),
+                             C.c_double(sml),
+                             C.create_string_buffer(kernel.encode('ascii')),
+                             C.c_int(bndrymode == 'wrap'),
+                             C.c_double(cval),
+        )
+    elif kernel == 'gaussian':
+        smooth = gaussian_filter(grid, sml, mode=bndrymode, cval=cval,
+                                 truncate=4.0)
+    else:
+        pxs = int(2 * np.ceil(sml) + 1)
+        x = np.linspace(float(-(pxs - 1) / 2.), float((pxs - 1) / 2.), pxs) / sml
+        x = np.meshgrid(*(x,) * D)
+        x = np.array(x)
+        dists = np.sqrt(np.sum(x ** 2, axis=0))
+        if isinstance(kernel, str):
+            # the same kernel values as in the C library
+            from ..kernels import vector_kernels
+            q = np.minimum(dists.ravel(), 1.0)
+            if D == 2:
+                conv_grid = _proj_kernel_values(vector_kernels[kernel], q)
+            else:
+                conv_grid = vector_kernels[kernel](q)
+            conv_grid[q >= 1.0] = 0.0
+        else:
+            conv_grid = kernel(dists.ravel())
+        conv_grid = conv_grid.reshape((pxs,) * D)
+        conv_grid /= np.sum(conv_grid)
+        smooth = convolve(grid, conv_grid, mode=bndrymode, cval=cval)
 
     if isinstance(grid, UnitArr):
         smooth = UnitArr(smooth, grid.units)
     return smooth
-
@@ -172,7 +172,6 @@ def map_qty(s, extent, field, qty, av=None, reduction=None, Npx=256,
         ptypes = list(set(range(6))-set(families['gas']))
     else:
         ptypes = list(range(6))
-    proj_kernel = project_kernel(kernel)
     for pt in ptypes:
         sub = s.SubSnap([pt])
         if len(sub) == 0:
@@ -188,7 +187,7 @@ def map_qty(s, extent, field, qty, av=None, reduction=None, Npx=256,
 
             tmp = gridbin(sub['pos'][:,(xaxis,yaxis)], qty[sub._mask], extent=extent_w,
                           bins=Npx_w, nanval=0.0)
-            tmp = smooth(tmp, softening[pt] / res.min(), kernel=proj_kernel)
+            tmp = smooth(tmp, softening[pt] / res.min(), kernel=kernel)
             tmp = tmp[border:-border,border:-border]
         else:
             Npx_w = Npx
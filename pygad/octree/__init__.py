@@ -4,11 +4,13 @@ A module for octrees on 3-dim. points in form of np.ndarrays.
 Also doctest other parts of this sub-module:
     >>> import doctest
     >>> doctest.testmod(coctree)
-    TestResults(failed=0, attempted=48)
+    TestResults(failed=0, attempted=74)
+    >>> doctest.testmod(cquadtree)
+    TestResults(failed=0, attempted=31)
     >>> doctest.testmod(octree)
     TestResults(failed=0, attempted=29)
 '''
 
 from .coctree import *
+from .cquadtree import *
 from .octree import *
-
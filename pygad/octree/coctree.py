@@ -5,7 +5,6 @@ TODO:
     * handle UnitArr's! (save units of stored max_H?!)
     * find a way *not* to restrict the numbers of neighbours returned in
       `find_ngbs_within` and `find_ngbs_SPH`
-    * implement 2D tree (quadtree)? -> e.g. speed-up for maps
 
 Doctests:
     Generate N random points in a box of [0,L]**3
@@ -84,6 +83,69 @@ Doctests:
     >>> assert np.all(periodic_dists<h)
     >>> assert np.any(normal_dists>h)
 
+    The region queries against brute force, periodic and with the smoothing
+    lengthes the tree was built with (the positions are taken as their images
+    closest to the reference point of the region)
+    >>> def rel(ref):
+    ...     d = pos - ref
+    ...     return d - L * np.round(d / L)
+    >>> def axial(d, axis):
+    ...     axis = np.array(axis) / np.linalg.norm(axis)
+    ...     z = np.dot(d, axis)
+    ...     return z, np.sqrt(np.maximum(np.sum(d**2, axis=1) - z**2, 0.0))
+    >>> def seg_dist(z, rho, a, b):
+    ...     ab, ap = np.subtract(b, a), np.transpose([z-a[0], rho-a[1]])
+    ...     t = np.clip(np.dot(ap, ab) / np.dot(ab, ab), 0.0, 1.0)
+    ...     return np.linalg.norm(ap - t[:,np.newaxis] * ab, axis=1)
+    >>> c, axis, lo, hi = [0.1, 1.2, 0.6], [1., -2., 0.5], [-0.1, 0.9, 0.4], [0.2, 1.4, 0.7]
+    >>> mid = np.mean([lo, hi], axis=0)
+    >>> d = rel(mid)
+    >>> sel = {'box': np.all((lo-mid-H[:,np.newaxis] <= d) &
+    ...                      (d <= hi-mid+H[:,np.newaxis]), axis=1)}
+    >>> d = rel(c)
+    >>> sel['ball'] = np.sum(d**2, axis=1) < (0.3 + H)**2
+    >>> z, rho = axial(d, axis)
+    >>> sel['cylinder'] = np.hypot(np.maximum(np.abs(z)-0.1, 0.0),
+    ...                            np.maximum(rho-0.3, 0.0)) <= H
+    >>> sel['slab'] = np.abs(z) <= 0.05 + H
+    >>> rim = [0.5, 0.5*np.tan(0.4)]
+    >>> sel['cone'] = (((0 <= z) & (z <= 0.5) & (rho <= z*np.tan(0.4))) |
+    ...                (np.minimum(seg_dist(z, rho, [0,0], rim),
+    ...                            seg_dist(z, rho, [0.5,0], rim)) <= H))
+    >>> found = {
+    ...     'box':      tree.find_in_box(lo, hi, pos, L, H),
+    ...     'ball':     tree.find_in_ball(c, 0.3, pos, L, H),
+    ...     'cylinder': tree.find_in_cylinder(c, axis, 0.3, 0.1, pos, L, H),
+    ...     'slab':     tree.find_in_slab(c, axis, 0.05, pos, L, H),
+    ...     'cone':     tree.find_in_cone(c, axis, 0.4, 0.5, pos, L, H)}
+    >>> for region in sorted(found):
+    ...     if set(found[region]) != set(np.where(sel[region])[0]):
+    ...         print(region, len(found[region]), np.sum(sel[region]))
+    >>> for region in sorted(found):
+    ...     assert 0 < len(found[region]) < N
+    >>> mask = tree.find_in_ball(c, 0.3, pos, L, H, mask=True)
+    >>> assert np.all(mask == sel['ball'])
+    >>> mask = tree.find_in_ball(c, 0.3, pos, mask=True)
+    >>> assert np.all(mask == (np.sum((pos-c)**2, axis=1) < 0.3**2))
+
+    Many coincident positions (more than fit into a leaf at the maximum depth)
+    >>> pos_c = np.concatenate([np.random.random((300,3))[
+    ...                             np.random.randint(300, size=5000)],
+    ...                         np.random.random((1000,3))])
+    >>> H_c = 0.05 + 0.1*np.random.random(len(pos_c))
+    >>> tree_c = cOctree(pos_c, H_c)
+    >>> for r in np.random.random((20,3)):
+    ...     d = np.linalg.norm(pos_c - r, axis=1)
+    ...     assert (set(tree_c.find_ngbs_within(r, 0.1, pos_c, max_ngbs=len(d))) ==
+    ...             set(np.where(d < 0.1)[0]))
+    ...     assert (set(tree_c.find_ngbs_SPH(r, H_c, pos_c, max_ngbs=len(d))) ==
+    ...             set(np.where(d < H_c)[0]))
+    ...     assert d[tree_c.find_next_ngb(r, pos_c)] == d.min()
+    >>> for r in pos_c[:20]:
+    ...     d = np.linalg.norm(pos_c - r, axis=1)
+    ...     assert (set(tree_c.find_ngbs_within(r, 1e-9, pos_c, max_ngbs=len(d))) ==
+    ...             set(np.where(d == 0)[0]))
+
     More neighbour finding
     >>> pos = np.array([[0.1,0.3,0.2], [0.9,0.3,0.2], [0.8,0.5,0.1],
     ...                 [0.1,0.6,0.8], [0.2,0.2,0.3], [0.6,0.6,0.7]])
@@ -109,6 +171,7 @@ import sys
 import numpy as np
 import warnings
 import weakref
+import zlib
 from .. import environment
 from .. import utils
 
@@ -152,6 +215,100 @@ cpygad.get_octree_ngbs_SPH.argtypes = [c_void_p,
                                        c_void_p, c_double, c_double]
 cpygad.get_octree_next_ngb.argtypes = [c_void_p, c_void_p, c_void_p, c_double,
                                        c_void_p]
+cpygad.get_octree_ngbs_within_batch.restype = c_size_t
+cpygad.get_octree_ngbs_within_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                                c_void_p, c_size_t, c_void_p,
+                                                c_void_p, c_void_p, c_double]
+cpygad.get_octree_ngbs_SPH_batch.restype = c_size_t
+cpygad.get_octree_ngbs_SPH_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                             c_void_p, c_size_t, c_void_p,
+                                             c_void_p, c_void_p, c_double,
+                                             c_double]
+cpygad.get_octree_next_ngb_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                             c_void_p, c_void_p, c_double]
+cpygad.update_octree_sum_w.argtypes = [c_void_p, c_void_p]
+cpygad.get_octree_count_within_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                                 c_void_p, c_void_p, c_void_p, c_double]
+cpygad.get_octree_sum_within_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                               c_void_p, c_void_p, c_void_p, c_void_p,
+                                               c_double]
+cpygad.update_octree_categories.argtypes = [c_void_p, c_void_p]
+cpygad.get_octree_ngbs_within_in_categories.argtypes = [c_void_p,
+                                                        c_void_p, c_double,
+                                                        c_size_t, c_void_p,
+                                                        POINTER(c_size_t),
+                                                        c_void_p, c_double,
+                                                        c_uint, c_void_p,
+                                                        c_void_p]
+cpygad.get_octree_next_ngb_in_categories.argtypes = [c_void_p, c_void_p,
+                                                     c_void_p, c_double,
+                                                     c_uint, c_void_p,
+                                                     c_void_p]
+cpygad.get_octree_next_ngb_in_categories_batch.argtypes = [c_void_p, c_size_t,
+                                                           c_void_p, c_void_p,
+                                                           c_void_p, c_double,
+                                                           c_uint, c_void_p]
+
+for _region in ['box', 'ball', 'cylinder', 'slab', 'cone']:
+    getattr(cpygad, 'get_octree_in_'+_region).restype = c_size_t
+cpygad.get_octree_in_box.argtypes = [c_void_p, c_void_p, c_void_p, c_void_p,
+                                     c_size_t, c_void_p, c_void_p, c_void_p,
+                                     c_double]
+cpygad.get_octree_in_ball.argtypes = [c_void_p, c_void_p, c_double, c_void_p,
+                                      c_size_t, c_void_p, c_void_p, c_void_p,
+                                      c_double]
+cpygad.get_octree_in_cylinder.argtypes = [c_void_p, c_void_p, c_void_p,
+                                          c_double, c_double, c_void_p,
+                                          c_size_t, c_void_p, c_void_p,
+                                          c_void_p, c_double]
+cpygad.get_octree_in_slab.argtypes = [c_void_p, c_void_p, c_void_p, c_double,
+                                      c_void_p, c_size_t, c_void_p, c_void_p,
+                                      c_void_p, c_double]
+cpygad.get_octree_in_cone.argtypes = [c_void_p, c_void_p, c_void_p,
+                                      c_double, c_double, c_void_p,
+                                      c_size_t, c_void_p, c_void_p,
+                                      c_void_p, c_double]
+
+
+def _batch_query(query, node_ptr, r, H, pos, *args):
+    '''
+    Run a batched neighbour query of the C library, which returns the total
+    number of neighbours and only fills the buffer, if it was large enough.
+
+    Returns:
+        ngbs (list):        The arrays of neighbour indices for all positions.
+    '''
+    M = len(r)
+    offsets = np.empty(M + 1, dtype=np.uintp)
+    max_tot = 64 * M
+    ngbs = np.empty(max_tot, dtype=np.uintp)
+    tot = query(node_ptr, M, r.ctypes.data, H.ctypes.data,
+                max_tot, ngbs.ctypes.data, offsets.ctypes.data,
+                pos.ctypes.data, *args)
+    if tot > max_tot:
+        ngbs = np.empty(tot, dtype=np.uintp)
+        query(node_ptr, M, r.ctypes.data, H.ctypes.data,
+              tot, ngbs.ctypes.data, offsets.ctypes.data,
+              pos.ctypes.data, *args)
+    return np.split(ngbs[:tot], offsets[1:-1].astype(np.intp))
+
+
+def _prepare_batch_args(r, H, pos, dim, per_query_H):
+    '''Prepare the arguments for the batched neighbour queries.'''
+    r = np.ascontiguousarray(r, dtype=np.float64)
+    if len(r.shape) != 2 or r.shape[1] != dim:
+        raise ValueError('Positions have to have shape (M,%d)!' % dim)
+    pos = np.ascontiguousarray(pos, dtype=np.float64)
+    if pos.shape[1:] != (dim,):
+        raise ValueError('Positions have to have shape (N,%d)!' % dim)
+    H = np.asarray(H, dtype=np.float64)
+    if per_query_H:
+        H = np.ascontiguousarray(H * np.ones(len(r)), dtype=np.float64)
+    elif H.shape != (len(pos),):
+        raise ValueError('Smoothing lengthes have to have shape (N,)!')
+    else:
+        H = np.ascontiguousarray(H)
+    return r, H, pos
 
 
 class _MAX_TREE_LEVEL_class(type):
@@ -182,11 +339,13 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
     def MAX_TREE_LEVEL(self):
         return cOctree.MAX_TREE_LEVEL
 
-    def __init__(self, pos, H=None):
+    def __init__(self, pos, H=None, categories=None):
         if environment.verbose >= environment.VERBOSE_TALKY:
             print('build a cOctree with %s positions' % (
                 utils.nice_big_num_str(len(s))))
             sys.stdout.flush()
+        # the token of a snapshot block (see `built_from`)
+        self.__pos_token = getattr(pos, 'token', None)
         pos = np.asarray(pos, dtype=np.float64)
         if pos.shape[1:] != (3,):
             raise ValueError('Positions have to have shape (N,3)!')
@@ -195,6 +354,8 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
 
         self.__parent = None
         self.__node_ptr = cpygad.new_octree_from_pos(len(pos), pos.ctypes.data)
+        self.__pos_checksum = zlib.crc32(pos)
+        self.__H = 0.0
         # If this object does not have any references anymore, and hence will get
         # garbage collected, the weakref will not reference any object anymore
         # and, hence, call its callback function, which in turn has the
@@ -211,6 +372,8 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
 
         if H is not None:
             self.update_max_H(H)
+        if categories is not None:
+            self.update_categories(categories)
 
         if environment.verbose >= environment.VERBOSE_TALKY:
             print('done.')
@@ -265,6 +428,14 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
         '''The maximum smoothing length (as support radius) in the tree.'''
         return float(cpygad.get_octree_max_H(self.__node_ptr))
 
+    @property
+    def H(self):
+        '''
+        The smoothing lengthes the maximum H of the tree were last updated with
+        (see `update_max_H`); zero for a new tree and None for child nodes.
+        '''
+        return self.__H
+
     @property
     def max_depth(self):
         '''The maximum depth of this particular tree. (Only node would be 0.)'''
@@ -278,6 +449,9 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
             child = cOctree.__new__(cOctree)
             child.__parent = self
             child.__node_ptr = cpygad.get_octree_child(self.__node_ptr, o)
+            child.__pos_checksum = None
+            child.__pos_token = None
+            child.__H = None
             return child
         else:
             return None
@@ -311,6 +485,25 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
             raise ValueError('Position has to have shape (3,)!')
         return bool(cpygad.get_octree_in_region(self.__node_ptr, r.ctypes.data))
 
+    def built_from(self, pos):
+        '''
+        Whether the tree was built from the positions `pos`. For a block of a
+        snapshot (a `SimArr`) this is the case, if the tree was built from the
+        same block and it did not change since (see `SimArr.token`), which is
+        checked in constant time. For other arrays a checksum of the positions
+        is compared. Positions that got translated or rotated since, or those of
+        another snapshot with as many particles, do not match.
+        (Always False for child nodes.)
+        '''
+        if self.__pos_checksum is None:
+            return False
+        token = getattr(pos, 'token', None)
+        if token is not None:
+            return token == self.__pos_token
+        pos = np.ascontiguousarray(pos, dtype=np.float64)
+        return pos.shape == (self.tot_num_part, 3) \
+            and zlib.crc32(pos) == self.__pos_checksum
+
     def update_max_H(self, H=None):
         '''
         Fill the tree with particles (without deleting former particles from
@@ -326,14 +519,40 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
             H = float(H)
             cpygad.update_octree_const_max_H(self.__node_ptr, H)
         else:
-            H = np.asarray(H, dtype=np.float64)
+            H = np.array(H, dtype=np.float64)
             if H.shape != (self.tot_num_part,):
                 raise ValueError('Smoothing lengthes have to have shape (N,)!')
-            if H.base is not None:
-                H = H.copy()
             cpygad.update_octree_max_H(self.__node_ptr, H.ctypes.data)
+        self.__H = H
 
-    def find_ngbs_within(self, r, H, pos, periodic=np.inf, cond=None, max_ngbs=100):
+    def update_categories(self, categories):
+        '''
+        Fill the categories of the particles into the nodes of the tree, such
+        that queries restricted to some categories (the `categories` arguments)
+        skip all nodes without any matching particle (e.g. gas-only nodes, when
+        searching for the nearest star).
+
+        Args:
+            categories (array-like):
+                                A bitmask of categories (up to 32) per particle,
+                                e.g. `1 << type`.
+        '''
+        cat = np.ascontiguousarray(categories, dtype=np.uint32)
+        if cat.shape != (self.tot_num_part,):
+            raise ValueError('Categories have to have shape (N,)!')
+        cpygad.update_octree_categories(self.__node_ptr, cat.ctypes.data)
+        self.__cat = cat
+
+    def _categories_args(self, categories):
+        '''The bitmask and the particle categories for the C queries.'''
+        cat = getattr(self, '_cOctree__cat', None)
+        if cat is None:
+            raise RuntimeError('The categories have not been set ' +
+                               '(`update_categories`)!')
+        return int(categories), cat.ctypes.data
+
+    def find_ngbs_within(self, r, H, pos, periodic=np.inf, cond=None, max_ngbs=100,
+                         categories=None):
         '''
         Find all particles in tree within distance `H` from position `r`.
 
@@ -350,6 +569,9 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
                                 False is excluded from the neighbours.
             max_ngbs (int):     Only return this number of neighbours at maximum.
                                 (Not necessarily the closest ones!)
+            categories (int):   If given, only consider particles whose categories
+                                (see `update_categories`) share a bit with this
+                                bitmask.
 
         Returns:
             ngbs (np.ndarray):  List if the indices of the neighbours (in random
@@ -357,6 +579,8 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
         '''
         r = np.asarray(r, dtype=np.float64).copy()
         H = float(H)
+        # the token of a snapshot block (see `built_from`)
+        self.__pos_token = getattr(pos, 'token', None)
         pos = np.asarray(pos, dtype=np.float64)
         if pos.shape[1:] != (3,):
             raise ValueError('Positions have to have shape (N,3)!')
@@ -374,12 +598,19 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
             if cond.base is not None:
                 cond = cond.copy()
             cond = cond.ctypes.data
-        cpygad.get_octree_ngbs_within(self.__node_ptr,
-                                      r.ctypes.data, H,
-                                      max_ngbs, ngbs.ctypes.data, byref(N_ngbs),
-                                      pos.ctypes.data, periodic,
-                                      cond,
-                                      )
+        if categories is not None:
+            cpygad.get_octree_ngbs_within_in_categories(
+                    self.__node_ptr, r.ctypes.data, H,
+                    max_ngbs, ngbs.ctypes.data, byref(N_ngbs),
+                    pos.ctypes.data, periodic,
+                    *self._categories_args(categories), cond)
+        else:
+            cpygad.get_octree_ngbs_within(self.__node_ptr,
+                                          r.ctypes.data, H,
+                                          max_ngbs, ngbs.ctypes.data, byref(N_ngbs),
+                                          pos.ctypes.data, periodic,
+                                          cond,
+                                          )
         #ngbs.resize(N_ngbs.value)
         erg = np.resize(ngbs, N_ngbs.value)
         return erg
@@ -404,6 +635,8 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
                                 order). At maximum, though, `max_ngbs` of them.
         '''
         r = np.asarray(r, dtype=np.float64).copy()
+        # the token of a snapshot block (see `built_from`)
+        self.__pos_token = getattr(pos, 'token', None)
         pos = np.asarray(pos, dtype=np.float64)
         if pos.shape[1:] != (3,):
             raise ValueError('Positions have to have shape (N,3)!')
@@ -430,7 +663,7 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
         erg = np.resize(ngbs, N_ngbs.value)
         return erg
 
-    def find_next_ngb(self, r, pos, periodic=np.inf, cond=None):
+    def find_next_ngb(self, r, pos, periodic=np.inf, cond=None, categories=None):
         '''
         Find all particles in tree within distance `H` from position `r`.
 
@@ -444,6 +677,9 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
                                 that a particle is registered as a neighbour. In
                                 other words, each particle i for which cond[i] is
                                 False is excluded from the neighbours.
+            categories (int):   If given, only consider particles whose categories
+                                (see `update_categories`) share a bit with this
+                                bitmask.
 
         Returns:
             ngb (int):          Index of the next neighbour to position r that
@@ -451,6 +687,8 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
                                 next neighbour.
         '''
         r = np.asarray(r, dtype=np.float64).copy()
+        # the token of a snapshot block (see `built_from`)
+        self.__pos_token = getattr(pos, 'token', None)
         pos = np.asarray(pos, dtype=np.float64)
         if pos.shape[1:] != (3,):
             raise ValueError('Positions have to have shape (N,3)!')
@@ -465,14 +703,294 @@ class cOctree(object, metaclass=_MAX_TREE_LEVEL_class):
             if cond.base is not None:
                 cond = cond.copy()
             cond = cond.ctypes.data
-        ngb = cpygad.get_octree_next_ngb(self.__node_ptr,
-                                         r.ctypes.data,
-                                         pos.ctypes.data,
-                                         periodic,
-                                         cond,
-                                         )
+        if categories is not None:
+            ngb = cpygad.get_octree_next_ngb_in_categories(
+                    self.__node_ptr, r.ctypes.data, pos.ctypes.data, periodic,
+                    *self._categories_args(categories), cond)
+        else:
+            ngb = cpygad.get_octree_next_ngb(self.__node_ptr,
+                                             r.ctypes.data,
+                                             pos.ctypes.data,
+                                             periodic,
+                                             cond,
+                                             )
         if ngb == -1:
             ngb = None
 
         return ngb
 
+    def find_ngbs_within_batch(self, r, H, pos, periodic=np.inf):
+        '''
+        Find the particles within distance `H` for many positions at once (in
+        parallel and without a limit on the number of neighbours).
+
+        Args:
+            r (array-like):     The reference positions (shape (M,3)).
+            H (array-like):     The maximum distance(s), one for all or one per
+                                reference position.
+            pos (array-like):   The positions corresponding to the indices of the
+                                tree.
+            periodic (float):   Assume the particles to sit in a periodic cube
+                                with this side length.
+
+        Returns:
+            ngbs (list):        The arrays of the neighbour indices for all the
+                                reference positions.
+        '''
+        r, H, pos = _prepare_batch_args(r, H, pos, 3, True)
+        return _batch_query(cpygad.get_octree_ngbs_within_batch,
+                            self.__node_ptr, r, H, pos, float(periodic))
+
+    def find_ngbs_SPH_batch(self, r, H, pos, periodic=np.inf):
+        '''
+        Find the particles whose smoothing lengthes `H` reach the positions `r`,
+        for many positions at once (in parallel and without a limit on the
+        number of neighbours).
+
+        Args:
+            r (array-like):     The reference positions (shape (M,3)).
+            H (array-like):     The smoothing lengthes (support radius)
+                                corresponding to the indices of the tree.
+            pos (array-like):   The positions corresponding to the indices of the
+                                tree.
+            periodic (float):   Assume the particles to sit in a periodic cube
+                                with this side length.
+
+        Returns:
+            ngbs (list):        The arrays of the neighbour indices for all the
+                                reference positions.
+        '''
+        r, H, pos = _prepare_batch_args(r, H, pos, 3, False)
+        return _batch_query(cpygad.get_octree_ngbs_SPH_batch,
+                            self.__node_ptr, r, H, pos, float(periodic), 0.0)
+
+    def find_next_ngbs(self, r, pos, periodic=np.inf, categories=None):
+        '''
+        Find the nearest neighbours of many positions at once (in parallel).
+
+        Args:
+            r (array-like):     The reference positions (shape (M,3)).
+            pos (array-like):   The positions corresponding to the indices of the
+                                tree.
+            periodic (float):   Assume the particles to sit in a periodic cube
+                                with this side length.
+            categories (int):   If given, only consider particles whose categories
+                                (see `update_categories`) share a bit with this
+                                bitmask.
+
+        Returns:
+            ngbs (np.ndarray):  The indices of the nearest neighbours.
+        '''
+        r, _, pos = _prepare_batch_args(r, 0.0, pos, 3, True)
+        ngbs = np.empty(len(r), dtype=np.uintp)
+        if categories is not None:
+            cpygad.get_octree_next_ngb_in_categories_batch(
+                    self.__node_ptr, len(r), r.ctypes.data, ngbs.ctypes.data,
+                    pos.ctypes.data, float(periodic),
+                    *self._categories_args(categories))
+        else:
+            cpygad.get_octree_next_ngb_batch(self.__node_ptr, len(r), r.ctypes.data,
+                                             ngbs.ctypes.data, pos.ctypes.data,
+                                             float(periodic))
+        return ngbs
+
+    def update_sum_w(self, w):
+        '''
+        Fill the sums of the particle weights (e.g. the masses) into the nodes of
+        the tree, as needed by `sum_within`.
+
+        Args:
+            w (array-like):     The weights of the particles (shape (N,)).
+        '''
+        w = np.ascontiguousarray(w, dtype=np.float64)
+        if w.shape != (self.tot_num_part,):
+            raise ValueError('Weights have to have shape (N,)!')
+        cpygad.update_octree_sum_w(self.__node_ptr, w.ctypes.data)
+        self.__sum_w = w
+
+    def count_within(self, r, H, pos, periodic=np.inf):
+        '''
+        Count the particles within distance `H` from the position(s) `r`.
+
+        Nodes that lie entirely within the search radius contribute their total
+        number of particles without being descended into.
+
+        Args:
+            r (array-like):     The reference position(s) (shape (3,) or
+                                (M,3)).
+            H (array-like):     The maximum distance(s), one for all or one per
+                                reference position.
+            pos (array-like):   The positions corresponding to the indices of the
+                                tree.
+            periodic (float):   Assume the particles to sit in a periodic box
+                                with this side length.
+
+        Returns:
+            N (int, np.ndarray):The number(s) of particles.
+        '''
+        single = np.shape(r) == (3,)
+        r, H, pos = _prepare_batch_args(np.reshape(r, (-1,3)), H, pos, 3, True)
+        counts = np.empty(len(r), dtype=np.uintp)
+        cpygad.get_octree_count_within_batch(self.__node_ptr, len(r), r.ctypes.data,
+                                             H.ctypes.data, counts.ctypes.data,
+                                             pos.ctypes.data, float(periodic))
+        return int(counts[0]) if single else counts
+
+    def sum_within(self, r, H, pos, periodic=np.inf):
+        '''
+        Sum the weights (as set by `update_sum_w`) of the particles within
+        distance `H` from the position(s) `r`, e.g. for aperture masses.
+
+        Nodes that lie entirely within the search radius contribute their sum
+        of weights without being descended into.
+
+        Args:
+            r (array-like):     The reference position(s) (shape (3,) or
+                                (M,3)).
+            H (array-like):     The maximum distance(s), one for all or one per
+                                reference position.
+            pos (array-like):   The positions corresponding to the indices of the
+                                tree.
+            periodic (float):   Assume the particles to sit in a periodic box
+                                with this side length.
+
+        Returns:
+            sum (float, np.ndarray):
+                                The sum(s) of the weights.
+        '''
+        w = getattr(self, '_cOctree__sum_w', None)
+        if w is None:
+            raise RuntimeError('The weights have not been set (`update_sum_w`)!')
+        single = np.shape(r) == (3,)
+        r, H, pos = _prepare_batch_args(np.reshape(r, (-1,3)), H, pos, 3, True)
+        sums = np.empty(len(r), dtype=np.float64)
+        cpygad.get_octree_sum_within_batch(self.__node_ptr, len(r), r.ctypes.data,
+                                           H.ctypes.data, sums.ctypes.data,
+                                           pos.ctypes.data, w.ctypes.data,
+                                           float(periodic))
+        return float(sums[0]) if single else sums
+
+    def _find_in_region(self, query, args, pos, periodic, H, mask):
+        '''
+        Run one of the region queries of the C library, see `find_in_box`.
+        '''
+        pos = np.ascontiguousarray(pos, dtype=np.float64)
+        if pos.shape != (self.tot_num_part, 3):
+            raise ValueError('Positions have to have shape (N,3)!')
+        if H is not None:
+            H = np.ascontiguousarray(H, dtype=np.float64)
+            if H.shape != (len(pos),):
+                raise ValueError('Smoothing lengthes have to have shape (N,)!')
+            H_ptr = H.ctypes.data
+        else:
+            H_ptr = None
+        # keep references to the arrays until the query is done
+        # (np.ascontiguousarray would turn the scalars into arrays of length one)
+        arrs = [np.ascontiguousarray(a, dtype=np.float64) if np.ndim(a) else
+                float(a) for a in args]
+        args = [a.ctypes.data if isinstance(a, np.ndarray) else a for a in arrs]
+        periodic = float(periodic)
+
+        if mask:
+            sel = np.zeros(len(pos), dtype=bool)
+            query(self.__node_ptr, *args, H_ptr, 0, None, sel.ctypes.data,
+                  pos.ctypes.data, periodic)
+            return sel
+        max_ngbs = 1024
+        ngbs = np.empty(max_ngbs, dtype=np.uintp)
+        N = query(self.__node_ptr, *args, H_ptr, max_ngbs, ngbs.ctypes.data,
+                  None, pos.ctypes.data, periodic)
+        if N > max_ngbs:
+            ngbs = np.empty(N, dtype=np.uintp)
+            query(self.__node_ptr, *args, H_ptr, N, ngbs.ctypes.data,
+                  None, pos.ctypes.data, periodic)
+        return ngbs[:N]
+
+    def find_in_box(self, lo, hi, pos, periodic=np.inf, H=None, mask=False):
+        '''
+        Find all particles within an axis-aligned box (boundaries included).
+
+        All `find_in_*` queries take nodes that lie entirely within the region
+        as a whole and skip those outside, such that the time needed scales with
+        the size of the selection rather than the number of particles.
+
+        Args:
+            lo, hi (array-like):The lower and upper corner of the box.
+            pos (array-like):   The positions corresponding to the indices of the
+                                tree.
+            periodic (float):   Assume the particles to sit in a periodic cube
+                                with this side length. The positions are then
+                                taken as their images closest to the center of
+                                the region.
+            H (array-like):     If given, also select the particles that are
+                                within their H of the region (along the axes for
+                                the box). The maximum H of the tree have to be
+                                updated with these values (`update_max_H`).
+            mask (bool):        Return a boolean mask for all particles rather
+                                than the indices of the selected ones.
+
+        Returns:
+            ngbs (np.ndarray):  The indices of the particles (in no particular
+                                order) or, if `mask` is set, the mask.
+        '''
+        return self._find_in_region(cpygad.get_octree_in_box, [lo, hi],
+                                    pos, periodic, H, mask)
+
+    def find_in_ball(self, center, R, pos, periodic=np.inf, H=None, mask=False):
+        '''
+        Find all particles closer than R to `center`.
+
+        For the other arguments and the return value see `find_in_box`.
+        '''
+        return self._find_in_region(cpygad.get_octree_in_ball, [center, R],
+                                    pos, periodic, H, mask)
+
+    def find_in_cylinder(self, center, axis, R, h, pos, periodic=np.inf,
+                         H=None, mask=False):
+        '''
+        Find all particles within an oriented cylinder (or disc).
+
+        Args:
+            center (array-like):The center of the cylinder.
+            axis (array-like):  The direction of its axis (needs not to be
+                                normalized).
+            R (float):          Its radius.
+            h (float):          Half of its height.
+
+        For the other arguments and the return value see `find_in_box`.
+        '''
+        return self._find_in_region(cpygad.get_octree_in_cylinder,
+                                    [center, axis, R, h],
+                                    pos, periodic, H, mask)
+
+    def find_in_slab(self, center, normal, h, pos, periodic=np.inf, H=None,
+                     mask=False):
+        '''
+        Find all particles within distance `h` of the plane through `center`
+        with the given normal (needs not to be normalized).
+
+        For the other arguments and the return value see `find_in_box`.
+        '''
+        return self._find_in_region(cpygad.get_octree_in_slab,
+                                    [center, normal, h],
+                                    pos, periodic, H, mask)
+
+    def find_in_cone(self, apex, axis, alpha, L, pos, periodic=np.inf, H=None,
+                     mask=False):
+        '''
+        Find all particles within a cone.
+
+        Args:
+            apex (array-like):  The tip of the cone.
+            axis (array-like):  The direction it opens into.
+            alpha (float):      The half opening angle (in radians, between 0
+                                and pi/2).
+            L (float):          The length of the cone along its axis.
+
+        For the other arguments and the return value see `find_in_box`.
+        '''
+        if not 0 < alpha < np.pi/2:
+            raise ValueError('The opening angle has to be in (0,pi/2)!')
+        return self._find_in_region(cpygad.get_octree_in_cone,
+                                    [apex, axis, alpha, L],
+                                    pos, periodic, H, mask)
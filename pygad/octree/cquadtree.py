@@ -0,0 +1,496 @@
+'''
+A fast quadtree class for 2-dim. points, e.g. for queries in projection
+(implemented in C, here is only the interface)
+
+Doctests:
+    Generate N random points in a square of [0,L]**2
+    Keep N small, since there is a comparison with brute force done!
+    >>> N, L = int(2e4), 1.0
+    >>> pos = L * np.random.random((N,2))
+    >>> H = 0.01 + 0.02*np.random.random(N)
+    >>> tree = cQuadtree(pos, H)
+    >>> assert tree.tot_num_part == N
+    >>> assert tree.max_H == np.max(H)
+    >>> assert tree.is_in_node(tree.center)
+
+    brute force neighbours
+    >>> r = np.array([0.3, 0.6])
+    >>> d = np.linalg.norm(pos - r, axis=-1)
+    >>> assert set(tree.find_ngbs_within(r, 0.02, pos, max_ngbs=1000)) == \\
+    ...         set(np.where(d < 0.02)[0])
+    >>> assert set(tree.find_ngbs_SPH(r, H, pos, max_ngbs=1000)) == \\
+    ...         set(np.where(d < H)[0])
+    >>> assert tree.find_next_ngb(r, pos) == np.argmin(d)
+    >>> tree.update_sum_w(np.ones(N))
+    >>> assert tree.count_within(r, 0.1, pos) == np.sum(d < 0.1) == \\
+    ...         tree.sum_within(r, 0.1, pos)
+
+    batched queries
+    >>> rs = L * np.random.random((50,2))
+    >>> ngbs = tree.find_ngbs_SPH_batch(rs, H, pos, periodic=L)
+    >>> for x, n in zip(rs, ngbs):
+    ...     dx = np.abs(pos - x)
+    ...     dx = np.minimum(dx, L - dx)
+    ...     assert set(n) == set(np.where(np.linalg.norm(dx, axis=-1) < H)[0])
+    >>> ngbs = tree.find_ngbs_within_batch(rs, 0.02, pos)
+    >>> assert all(len(n) == np.sum(np.linalg.norm(pos - x, axis=-1) < 0.02)
+    ...            for x, n in zip(rs, ngbs))
+    >>> assert np.all(tree.find_next_ngbs(rs, pos) ==
+    ...               [np.argmin(np.linalg.norm(pos - x, axis=-1)) for x in rs])
+
+    queries restricted to categories of particles
+    >>> cat = np.where(np.random.random(N) < 0.01, 2, 1)
+    >>> tree.update_categories(cat)
+    >>> rare = np.where(cat == 2)[0]
+    >>> assert tree.find_next_ngb(r, pos, categories=2) == rare[np.argmin(d[rare])]
+    >>> assert np.all(tree.find_next_ngbs(rs, pos, categories=2) ==
+    ...     [rare[np.argmin(np.linalg.norm(pos[rare] - x, axis=-1))] for x in rs])
+    >>> assert set(tree.find_ngbs_within(r, 0.2, pos, categories=2)) == \\
+    ...         set(rare[d[rare] < 0.2])
+
+    many coincident positions (more than fit into a leaf at the maximum depth)
+    >>> pos_c = np.concatenate([np.random.random((300,2))[
+    ...                             np.random.randint(300, size=5000)],
+    ...                         np.random.random((1000,2))])
+    >>> H_c = 0.02 + 0.05*np.random.random(len(pos_c))
+    >>> tree_c = cQuadtree(pos_c, H_c)
+    >>> for r in np.random.random((20,2)):
+    ...     d = np.linalg.norm(pos_c - r, axis=1)
+    ...     assert (set(tree_c.find_ngbs_within(r, 0.05, pos_c, max_ngbs=len(d))) ==
+    ...             set(np.where(d < 0.05)[0]))
+    ...     assert (set(tree_c.find_ngbs_SPH(r, H_c, pos_c, max_ngbs=len(d))) ==
+    ...             set(np.where(d < H_c)[0]))
+    ...     assert d[tree_c.find_next_ngb(r, pos_c)] == d.min()
+    >>> for r in pos_c[:20]:
+    ...     d = np.linalg.norm(pos_c - r, axis=1)
+    ...     assert (set(tree_c.find_ngbs_within(r, 1e-9, pos_c, max_ngbs=len(d))) ==
+    ...             set(np.where(d == 0)[0]))
+'''
+__all__ = ['cQuadtree']
+
+from ..C import *
+import sys
+import numpy as np
+import weakref
+from .. import environment
+from .. import utils
+from .coctree import _batch_query, _prepare_batch_args
+
+cpygad.new_quadtree_from_pos.restype = c_void_p
+cpygad.new_quadtree_from_pos.argtypes = [c_size_t, c_void_p]
+cpygad.free_quadtree.argtypes = [c_void_p]
+cpygad.get_quadtree_center.argtypes = [c_void_p, c_void_p]
+cpygad.get_quadtree_side_2.restype = c_double
+cpygad.get_quadtree_side_2.argtypes = [c_void_p]
+cpygad.get_quadtree_is_leaf.restype = c_int
+cpygad.get_quadtree_is_leaf.argtypes = [c_void_p]
+cpygad.get_quadtree_num_children.restype = c_uint
+cpygad.get_quadtree_num_children.argtypes = [c_void_p]
+cpygad.get_quadtree_tot_part.restype = c_size_t
+cpygad.get_quadtree_tot_part.argtypes = [c_void_p]
+cpygad.get_quadtree_max_H.restype = c_double
+cpygad.get_quadtree_max_H.argtypes = [c_void_p]
+cpygad.get_quadtree_max_depth.restype = c_int
+cpygad.get_quadtree_max_depth.argtypes = [c_void_p]
+cpygad.get_quadtree_node_count.restype = c_size_t
+cpygad.get_quadtree_node_count.argtypes = [c_void_p, c_int]
+cpygad.get_quadtree_in_region.restype = c_int
+cpygad.get_quadtree_in_region.argtypes = [c_void_p, c_void_p]
+cpygad.update_quadtree_max_H.argtypes = [c_void_p, c_void_p]
+cpygad.update_quadtree_const_max_H.argtypes = [c_void_p, c_double]
+cpygad.get_quadtree_ngbs_within.argtypes = [c_void_p,
+                                            c_void_p, c_double,
+                                            c_size_t, c_void_p, POINTER(c_size_t),
+                                            c_void_p, c_double,
+                                            c_void_p]
+cpygad.get_quadtree_ngbs_SPH.argtypes = [c_void_p,
+                                         c_void_p, c_void_p,
+                                         c_size_t, c_void_p, POINTER(c_size_t),
+                                         c_void_p, c_double, c_double]
+cpygad.get_quadtree_next_ngb.argtypes = [c_void_p, c_void_p, c_void_p, c_double,
+                                         c_void_p]
+cpygad.get_quadtree_ngbs_within_batch.restype = c_size_t
+cpygad.get_quadtree_ngbs_within_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                                  c_void_p, c_size_t, c_void_p,
+                                                  c_void_p, c_void_p, c_double]
+cpygad.get_quadtree_ngbs_SPH_batch.restype = c_size_t
+cpygad.get_quadtree_ngbs_SPH_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                               c_void_p, c_size_t, c_void_p,
+                                               c_void_p, c_void_p, c_double,
+                                               c_double]
+cpygad.get_quadtree_next_ngb_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                               c_void_p, c_void_p, c_double]
+cpygad.update_quadtree_sum_w.argtypes = [c_void_p, c_void_p]
+cpygad.update_quadtree_categories.argtypes = [c_void_p, c_void_p]
+cpygad.get_quadtree_ngbs_within_in_categories.argtypes = [c_void_p,
+                                                          c_void_p, c_double,
+                                                          c_size_t, c_void_p,
+                                                          POINTER(c_size_t),
+                                                          c_void_p, c_double,
+                                                          c_uint, c_void_p,
+                                                          c_void_p]
+cpygad.get_quadtree_next_ngb_in_categories.argtypes = [c_void_p, c_void_p,
+                                                       c_void_p, c_double,
+                                                       c_uint, c_void_p,
+                                                       c_void_p]
+cpygad.get_quadtree_next_ngb_in_categories_batch.argtypes = [c_void_p, c_size_t,
+                                                             c_void_p, c_void_p,
+                                                             c_void_p, c_double,
+                                                             c_uint, c_void_p]
+cpygad.get_quadtree_count_within_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                                   c_void_p, c_void_p, c_void_p, c_double]
+cpygad.get_quadtree_sum_within_batch.argtypes = [c_void_p, c_size_t, c_void_p,
+                                                 c_void_p, c_void_p, c_void_p, c_void_p,
+                                                 c_double]
+
+
+class cQuadtree(object):
+    '''
+    A quadtree implementation with the backend in written in C.
+
+    Actually this is a wrapper to the C++ template class Tree<2>. Internally only
+    indices are stored so that any property of a particle can be referenced.
+
+    Args:
+        pos (array-like):       The (projected) positions (shape (N,2)).
+        H (array-like, float):  The smoothing lengthes of the particles (if
+                                needed for SPH neighbour queries).
+    '''
+
+    def __init__(self, pos, H=None, categories=None):
+        if environment.verbose >= environment.VERBOSE_TALKY:
+            print('build a cQuadtree with %s positions' % (
+                utils.nice_big_num_str(len(pos))))
+            sys.stdout.flush()
+        pos = np.ascontiguousarray(pos, dtype=np.float64)
+        if pos.shape[1:] != (2,):
+            raise ValueError('Positions have to have shape (N,2)!')
+
+        self.__node_ptr = cpygad.new_quadtree_from_pos(len(pos), pos.ctypes.data)
+        # see `cOctree.__init__` for the freeing of the C memory
+        self.__weakref_for_freeing_C_memory = weakref.ref(
+            self,
+            lambda wr, ptr=self.__node_ptr: cpygad.free_quadtree(ptr),
+        )
+
+        if H is not None:
+            self.update_max_H(H)
+        if categories is not None:
+            self.update_categories(categories)
+
+        if environment.verbose >= environment.VERBOSE_TALKY:
+            print('done.')
+            sys.stdout.flush()
+
+    @property
+    def center(self):
+        center = np.empty((2,), dtype=np.float64)
+        cpygad.get_quadtree_center(self.__node_ptr, center.ctypes.data)
+        return center
+
+    @property
+    def side_2(self):
+        '''Half the side length of the tree square.'''
+        return float(cpygad.get_quadtree_side_2(self.__node_ptr))
+
+    @property
+    def full_side(self):
+        '''The total side length of the tree square.'''
+        return 2.0 * self.side_2
+
+    @property
+    def is_leaf(self):
+        '''Whether this is a leaf node.'''
+        return bool(cpygad.get_quadtree_is_leaf(self.__node_ptr))
+
+    @property
+    def num_children(self):
+        '''Number of child nodes.'''
+        return int(cpygad.get_quadtree_num_children(self.__node_ptr))
+
+    @property
+    def tot_num_part(self):
+        '''Get the total number of particles in the tree.'''
+        return int(cpygad.get_quadtree_tot_part(self.__node_ptr))
+
+    @property
+    def max_H(self):
+        '''The maximum smoothing length (as support radius) in the tree.'''
+        return float(cpygad.get_quadtree_max_H(self.__node_ptr))
+
+    @property
+    def max_depth(self):
+        '''The maximum depth of the tree. (Only node would be 0.)'''
+        return int(cpygad.get_quadtree_max_depth(self.__node_ptr))
+
+    def count_nodes(self, count_non_leaves=True):
+        '''
+        Count all nodes in the tree.
+
+        Args:
+            count_non_leaves (bool):    Whether to count all nodes (that is also
+                                        include nodes that are no leaves). If set
+                                        to False, only count leaf nodes.
+
+        Returns:
+            nodes (int):                The number of nodes.
+        '''
+        nol = int(bool(count_non_leaves))
+        return int(cpygad.get_quadtree_node_count(self.__node_ptr, nol))
+
+    def is_in_node(self, r):
+        '''Check whether position r lies within the tree.'''
+        r = np.asarray(r, dtype=np.float64).copy()
+        if r.shape != (2,):
+            raise ValueError('Position has to have shape (2,)!')
+        return bool(cpygad.get_quadtree_in_region(self.__node_ptr, r.ctypes.data))
+
+    def update_max_H(self, H):
+        '''
+        Update the maximum smoothing lengthes of the nodes.
+
+        Args:
+            H (array-like, float):  The smoothing lengthes of the particles. Has
+                                    to have shape (N,) or can be a float (all
+                                    smoothing lengthes then are the same).
+        '''
+        from numbers import Number
+        if isinstance(H, Number):
+            cpygad.update_quadtree_const_max_H(self.__node_ptr, float(H))
+        else:
+            H = np.ascontiguousarray(H, dtype=np.float64)
+            if H.shape != (self.tot_num_part,):
+                raise ValueError('Smoothing lengthes have to have shape (N,)!')
+            cpygad.update_quadtree_max_H(self.__node_ptr, H.ctypes.data)
+
+    def update_categories(self, categories):
+        '''
+        Fill the categories of the particles into the nodes of the tree.
+
+        See `cOctree.update_categories`.
+        '''
+        cat = np.ascontiguousarray(categories, dtype=np.uint32)
+        if cat.shape != (self.tot_num_part,):
+            raise ValueError('Categories have to have shape (N,)!')
+        cpygad.update_quadtree_categories(self.__node_ptr, cat.ctypes.data)
+        self.__cat = cat
+
+    def _categories_args(self, categories):
+        '''The bitmask and the particle categories for the C queries.'''
+        cat = getattr(self, '_cQuadtree__cat', None)
+        if cat is None:
+            raise RuntimeError('The categories have not been set ' +
+                               '(`update_categories`)!')
+        return int(categories), cat.ctypes.data
+
+    def find_ngbs_within(self, r, H, pos, periodic=np.inf, cond=None, max_ngbs=100,
+                         categories=None):
+        '''
+        Find all particles in tree within distance `H` from position `r`.
+
+        See `cOctree.find_ngbs_within` for the arguments (with 2-dim.
+        positions).
+        '''
+        r = np.asarray(r, dtype=np.float64).copy()
+        pos = np.ascontiguousarray(pos, dtype=np.float64)
+        if pos.shape[1:] != (2,):
+            raise ValueError('Positions have to have shape (N,2)!')
+        max_ngbs = int(max_ngbs)
+
+        ngbs = np.empty(max_ngbs, dtype=np.uintp)
+        N_ngbs = c_size_t()
+        if cond is not None:
+            cond = np.ascontiguousarray(cond, dtype=np.int32)
+            if cond.shape != (len(pos),):
+                raise ValueError('Unmatching shape of `cond`: %s!' % (cond.shape,))
+            cond = cond.ctypes.data
+        if categories is not None:
+            cpygad.get_quadtree_ngbs_within_in_categories(
+                    self.__node_ptr, r.ctypes.data, float(H),
+                    max_ngbs, ngbs.ctypes.data, byref(N_ngbs),
+                    pos.ctypes.data, float(periodic),
+                    *self._categories_args(categories), cond)
+        else:
+            cpygad.get_quadtree_ngbs_within(self.__node_ptr,
+                                            r.ctypes.data, float(H),
+                                            max_ngbs, ngbs.ctypes.data, byref(N_ngbs),
+                                            pos.ctypes.data, float(periodic),
+                                            cond,
+                                            )
+        return ngbs[:N_ngbs.value].copy()
+
+    def find_ngbs_SPH(self, r, H, pos, periodic=np.inf, max_ngbs=100):
+        '''
+        Find all particles in tree whose smoothing lengthes `H` reach position
+        `r`.
+
+        See `cOctree.find_ngbs_SPH` for the arguments (with 2-dim. positions).
+        '''
+        r = np.asarray(r, dtype=np.float64).copy()
+        pos = np.ascontiguousarray(pos, dtype=np.float64)
+        if pos.shape[1:] != (2,):
+            raise ValueError('Positions have to have shape (N,2)!')
+        H = np.ascontiguousarray(H, dtype=np.float64)
+        if H.shape != (len(pos),):
+            raise ValueError('Smoothing lengthes have to have shape (N,)!')
+        max_ngbs = int(max_ngbs)
+
+        ngbs = np.empty(max_ngbs, dtype=np.uintp)
+        N_ngbs = c_size_t()
+        cpygad.get_quadtree_ngbs_SPH(self.__node_ptr,
+                                     r.ctypes.data, H.ctypes.data,
+                                     max_ngbs, ngbs.ctypes.data, byref(N_ngbs),
+                                     pos.ctypes.data, float(periodic),
+                                     0.0,
+                                     )
+        return ngbs[:N_ngbs.value].copy()
+
+    def find_next_ngb(self, r, pos, periodic=np.inf, cond=None, categories=None):
+        '''
+        Find the nearest neighbour of position `r`.
+
+        See `cOctree.find_next_ngb` for the arguments (with 2-dim. positions).
+        '''
+        r = np.asarray(r, dtype=np.float64).copy()
+        pos = np.ascontiguousarray(pos, dtype=np.float64)
+        if pos.shape[1:] != (2,):
+            raise ValueError('Positions have to have shape (N,2)!')
+        if cond is not None:
+            cond = np.ascontiguousarray(cond, dtype=np.int32)
+            if cond.shape != (len(pos),):
+                raise ValueError('Unmatching shape of `cond`: %s!' % (cond.shape,))
+            cond = cond.ctypes.data
+        if categories is not None:
+            ngb = cpygad.get_quadtree_next_ngb_in_categories(
+                    self.__node_ptr, r.ctypes.data, pos.ctypes.data,
+                    float(periodic), *self._categories_args(categories), cond)
+        else:
+            ngb = cpygad.get_quadtree_next_ngb(self.__node_ptr,
+                                               r.ctypes.data,
+                                               pos.ctypes.data,
+                                               float(periodic),
+                                               cond,
+                                               )
+        if ngb == -1:
+            ngb = None
+        return ngb
+
+    def find_ngbs_within_batch(self, r, H, pos, periodic=np.inf):
+        '''
+        Find the particles within distance `H` for many positions at once (in
+        parallel and without a limit on the number of neighbours).
+
+        See `cOctree.find_ngbs_within_batch` for the arguments (with 2-dim.
+        positions).
+        '''
+        r, H, pos = _prepare_batch_args(r, H, pos, 2, True)
+        return _batch_query(cpygad.get_quadtree_ngbs_within_batch,
+                            self.__node_ptr, r, H, pos, float(periodic))
+
+    def find_ngbs_SPH_batch(self, r, H, pos, periodic=np.inf):
+        '''
+        Find the particles whose smoothing lengthes `H` reach the positions `r`,
+        for many positions at once (in parallel and without a limit on the
+        number of neighbours).
+
+        See `cOctree.find_ngbs_SPH_batch` for the arguments (with 2-dim.
+        positions).
+        '''
+        r, H, pos = _prepare_batch_args(r, H, pos, 2, False)
+        return _batch_query(cpygad.get_quadtree_ngbs_SPH_batch,
+                            self.__node_ptr, r, H, pos, float(periodic), 0.0)
+
+    def find_next_ngbs(self, r, pos, periodic=np.inf, categories=None):
+        '''
+        Find the nearest neighbours of many positions at once (in parallel).
+
+        See `cOctree.find_next_ngbs` for the arguments (with 2-dim. positions).
+        '''
+        r, _, pos = _prepare_batch_args(r, 0.0, pos, 2, True)
+        ngbs = np.empty(len(r), dtype=np.uintp)
+        if categories is not None:
+            cpygad.get_quadtree_next_ngb_in_categories_batch(
+                    self.__node_ptr, len(r), r.ctypes.data, ngbs.ctypes.data,
+                    pos.ctypes.data, float(periodic),
+                    *self._categories_args(categories))
+        else:
+            cpygad.get_quadtree_next_ngb_batch(self.__node_ptr, len(r), r.ctypes.data,
+                                               ngbs.ctypes.data, pos.ctypes.data,
+                                               float(periodic))
+        return ngbs
+
+    def update_sum_w(self, w):
+        '''
+        Fill the sums of the particle weights (e.g. the masses) into the nodes of
+        the tree, as needed by `sum_within`.
+
+        Args:
+            w (array-like):     The weights of the particles (shape (N,)).
+        '''
+        w = np.ascontiguousarray(w, dtype=np.float64)
+        if w.shape != (self.tot_num_part,):
+            raise ValueError('Weights have to have shape (N,)!')
+        cpygad.update_quadtree_sum_w(self.__node_ptr, w.ctypes.data)
+        self.__sum_w = w
+
+    def count_within(self, r, H, pos, periodic=np.inf):
+        '''
+        Count the particles within distance `H` from the position(s) `r`.
+
+        Nodes that lie entirely within the search radius contribute their total
+        number of particles without being descended into.
+
+        Args:
+            r (array-like):     The reference position(s) (shape (2,) or
+                                (M,2)).
+            H (array-like):     The maximum distance(s), one for all or one per
+                                reference position.
+            pos (array-like):   The positions corresponding to the indices of the
+                                tree.
+            periodic (float):   Assume the particles to sit in a periodic box
+                                with this side length.
+
+        Returns:
+            N (int, np.ndarray):The number(s) of particles.
+        '''
+        single = np.shape(r) == (2,)
+        r, H, pos = _prepare_batch_args(np.reshape(r, (-1,2)), H, pos, 2, True)
+        counts = np.empty(len(r), dtype=np.uintp)
+        cpygad.get_quadtree_count_within_batch(self.__node_ptr, len(r), r.ctypes.data,
+                                               H.ctypes.data, counts.ctypes.data,
+                                               pos.ctypes.data, float(periodic))
+        return int(counts[0]) if single else counts
+
+    def sum_within(self, r, H, pos, periodic=np.inf):
+        '''
+        Sum the weights (as set by `update_sum_w`) of the particles within
+        distance `H` from the position(s) `r`, e.g. for aperture masses.
+
+        Nodes that lie entirely within the search radius contribute their sum
+        of weights without being descended into.
+
+        Args:
+            r (array-like):     The reference position(s) (shape (2,) or
+                                (M,2)).
+            H (array-like):     The maximum distance(s), one for all or one per
+                                reference position.
+            pos (array-like):   The positions corresponding to the indices of the
+                                tree.
+            periodic (float):   Assume the particles to sit in a periodic box
+                                with this side length.
+
+        Returns:
+            sum (float, np.ndarray):
+                                The sum(s) of the weights.
+        '''
+        w = getattr(self, '_cQuadtree__sum_w', None)
+        if w is None:
+            raise RuntimeError('The weights have not been set (`update_sum_w`)!')
+        single = np.shape(r) == (2,)
+        r, H, pos = _prepare_batch_args(np.reshape(r, (-1,2)), H, pos, 2, True)
+        sums = np.empty(len(r), dtype=np.float64)
+        cpygad.get_quadtree_sum_within_batch(self.__node_ptr, len(r), r.ctypes.data,
+                                             H.ctypes.data, sums.ctypes.data,
+                                             pos.ctypes.data, w.ctypes.data,
+                                             float(periodic))
+        return float(sums[0]) if single else sums
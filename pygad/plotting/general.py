@@ -308,10 +308,9 @@ def scatter_map(x, y, s=None, qty=None, av=None, bins=150, extent=None,
         extent = np.asarray(extent)
 
     if av is not None:
-        grid = gridbin2d(x, y, av * qty, bins=bins, extent=extent,
-                         nanval=0.0)
-        grid /= gridbin2d(x, y, av, bins=bins, extent=extent,
-                          nanval=0.0)
+        grid, grid_av = gridbin2d(x, y, [av * qty, av], bins=bins,
+                                  extent=extent, nanval=0.0)
+        grid /= grid_av
         # grid[np.isnan(grid)] = 0.0
     else:
         grid = gridbin2d(x, y, qty, bins=bins, extent=extent, nanval=0.0)
@@ -329,10 +328,9 @@ def scatter_map(x, y, s=None, qty=None, av=None, bins=150, extent=None,
         clim = vlim
     else:
         if colors_av is not None:
-            col = gridbin2d(x, y, colors_av * colors, bins=bins, extent=extent,
-                            nanval=0.0)
-            col /= gridbin2d(x, y, colors_av, bins=bins, extent=extent,
-                             nanval=0.0)
+            col, col_av = gridbin2d(x, y, [colors_av * colors, colors_av],
+                                    bins=bins, extent=extent, nanval=0.0)
+            col /= col_av
             col[np.isnan(col)] = 0.0
         else:
             col = gridbin2d(x, y, colors, bins=bins, extent=extent, nanval=0.0)
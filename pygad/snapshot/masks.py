@@ -98,6 +98,39 @@ Examples:
     >>> np.round( np.percentile(
     ...     s[ BallMask('100 kpc') & ~BallMask('30 kpc') ]['r'], [0,100]) )
     array([ 30.,  100.])
+
+    Masks using an octree of the positions select the same particles (filling
+    the maximum H of the tree with the smoothing lengthes only once):
+    >>> from ..octree import cOctree
+    >>> tree = cOctree(s['pos'])
+    >>> Hs = []
+    >>> for sph_overlap in [False, True]:
+    ...     for R in ['30 kpc', '100 kpc']:
+    ...         for Mask in [BallMask, BoxMask]:
+    ...             mask = Mask(R, sph_overlap=sph_overlap, tree=tree)
+    ...             no_tree = Mask(R, sph_overlap=sph_overlap)
+    ...             if np.any(mask.get_mask_for(s) != no_tree.get_mask_for(s)):
+    ...                 print(mask)
+    ...             Hs.append(tree.H)
+    >>> Hs[0]
+    0.0
+    >>> all(H is Hs[4] for H in Hs[4:])
+    True
+    >>> for rmax, zmax in [('60 kpc', '5 kpc'), ('30 kpc', None), (None, '2 kpc')]:
+    ...     mask = DiscMask(0.85, rmax, zmax, tree=tree)
+    ...     no_tree = DiscMask(0.85, rmax, zmax)
+    ...     if np.any(mask.get_mask_for(s) != no_tree.get_mask_for(s)):
+    ...         print(mask)
+
+    Once the positions changed, the tree is not used anymore:
+    >>> tree.built_from(s['pos'])
+    True
+    >>> s['pos'] += UnitArr([10,0,0], 'kpc')
+    >>> tree.built_from(s['pos'])
+    False
+    >>> assert np.all(BallMask('30 kpc', tree=tree).get_mask_for(s)
+    ...               == BallMask('30 kpc').get_mask_for(s))
+    >>> s['pos'] -= UnitArr([10,0,0], 'kpc')
 '''
 __all__ = ['SnapMask', 'BallMask', 'BoxMask', 'DiscMask', 'IDMask', 'ExprMask']
 
@@ -108,6 +141,61 @@ from .. import gadget
 import operator
 
 
+def _use_tree(tree, s):
+    '''
+    Whether the octree `tree` can be used for masking the snapshot `s`, i.e.
+    whether it was built from its current positions.
+    '''
+    return tree is not None and len(s) == tree.tot_num_part \
+        and tree.built_from(s['pos'])
+
+
+def _sph_overlap_H(s):
+    '''
+    The smoothing lengthes of the gas (and zero for all other particles) of the
+    snapshot `s`.
+    '''
+    H = np.zeros(len(s), dtype=np.float64)
+    for pt in gadget.families['gas']:
+        if s.parts[pt]:
+            sub = s.SubSnap([pt])
+            H[sum(s.parts[:pt]):sum(s.parts[:pt + 1])] = \
+                sub['hsml'].in_units_of(s['pos'].units, subs=s)
+    return H
+
+
+def _sph_overlap_H_token(s):
+    '''
+    The tokens (see `SimArr.token`) of the smoothing lengthes of the gas of the
+    snapshot `s` together with the units of its positions, which `_sph_overlap_H`
+    depends on.
+    '''
+    tokens = [str(s['pos'].units)]
+    for pt in gadget.families['gas']:
+        if s.parts[pt]:
+            tokens.append(s.SubSnap([pt])['hsml'].token)
+    return tokens
+
+
+def _tree_mask(tree, query, s, sph_overlap, *args, **kwargs):
+    '''
+    The mask of the snapshot `s` by the region query `query` of the octree
+    `tree`. With `sph_overlap`, the maximum H of the tree are filled with the
+    smoothing lengthes -- only once, as long as neither they nor the H of the
+    tree changed since.
+    '''
+    if not sph_overlap:
+        return query(*args, pos=s['pos'].view(np.ndarray), mask=True, **kwargs)
+    H_token = _sph_overlap_H_token(s)
+    H_token_tree, H = getattr(tree, '_sph_overlap_H', (None, None))
+    if H is None or H is not tree.H or H_token != H_token_tree:
+        tree.update_max_H(_sph_overlap_H(s))
+        H = tree.H
+        tree._sph_overlap_H = (H_token, H)
+    return query(*args, pos=s['pos'].view(np.ndarray), H=H, mask=True,
+                 **kwargs)
+
+
 class SnapMask(object):
     '''The base class for more complicated masks.'''
 
@@ -171,17 +259,30 @@ class BallMask(SnapMask):
                                 smoothed into it.
         periodic_snap (bool):   Whether to consider the snapshot to be masked
                                 periodic with its boxside or not.
+        tree (cOctree):         An octree of the positions of the snapshot to
+                                mask (i.e. `cOctree(s['pos'])`). The mask is
+                                then found by a tree query in a time that scales
+                                with the size of the selection rather than with
+                                the size of the snapshot. If the positions
+                                changed since the tree was built (see
+                                `cOctree.built_from`), the mask is found without
+                                it. (With `sph_overlap`, the maximum H of the
+                                tree are filled with the smoothing lengthes,
+                                which is only redone, if they change.)
     '''
 
-    def __init__(self, R, center=None, sph_overlap=False, periodic_snap=True):
+    def __init__(self, R, center=None, sph_overlap=False, periodic_snap=True,
+                 tree=None):
         super(BallMask, self).__init__()
         self.R = R
         self.center = center
         self.sph_overlap = sph_overlap
         self.periodic_snap = periodic_snap
+        self.tree = tree
 
     def inverted(self):
-        inv = BallMask(self._R, self._center, sph_overlap=self.sph_overlap)
+        inv = BallMask(self._R, self._center, sph_overlap=self.sph_overlap,
+                       periodic_snap=self.periodic_snap, tree=self.tree)
         inv._inverse = not self._inverse
         return inv
 
@@ -216,6 +317,15 @@ class BallMask(SnapMask):
 
     def _get_mask_for(self, s):
         from ..utils import periodic_distance_to, dist
+        if _use_tree(self.tree, s):
+            R = float(self._R.in_units_of(s['pos'].units, subs=s))
+            center = self._center.in_units_of(s['pos'].units, subs=s)
+            periodic = float(s.boxsize.in_units_of(s['pos'].units, subs=s)) \
+                if self.periodic_snap else np.inf
+            return _tree_mask(self.tree, self.tree.find_in_ball, s,
+                              self.sph_overlap, center.view(np.ndarray), R,
+                              periodic=periodic)
+
         R = self._R.in_units_of(s['r'].units, subs=s)
         center = self._center.in_units_of(s['r'].units, subs=s)
 
@@ -252,9 +362,11 @@ class BoxMask(SnapMask):
         sph_overlap (bool):     If True, also include gas particles, that actually
                                 lie outside of the box, but they are smoothed
                                 into it.
+        tree (cOctree):         An octree of the positions of the snapshot(s) to
+                                mask, see `BallMask`.
     '''
 
-    def __init__(self, extent, center=None, sph_overlap=False):
+    def __init__(self, extent, center=None, sph_overlap=False, tree=None):
         super(BoxMask, self).__init__()
         # might be needed for calculation of self.center in setting self.extent:
         self._extent = UnitArr([[-1, 1]] * 3)
@@ -262,9 +374,10 @@ class BoxMask(SnapMask):
         if center is not None:
             self.center += center
         self.sph_overlap = sph_overlap
+        self.tree = tree
 
     def inverted(self):
-        inv = BoxMask(self._extent, sph_overlap=self.sph_overlap)
+        inv = BoxMask(self._extent, sph_overlap=self.sph_overlap, tree=self.tree)
         inv._inverse = not self._inverse
         return inv
 
@@ -312,6 +425,11 @@ class BoxMask(SnapMask):
     def _get_mask_for(self, s):
         ext = self._extent.in_units_of(s['pos'].units, subs=s)
 
+        if _use_tree(self.tree, s):
+            ext = ext.view(np.ndarray)
+            return _tree_mask(self.tree, self.tree.find_in_box, s,
+                              self.sph_overlap, ext[:, 0], ext[:, 1])
+
         mask = (ext[0, 0] <= s['pos'][:, 0]) & (s['pos'][:, 0] <= ext[0, 1]) & \
                (ext[1, 0] <= s['pos'][:, 1]) & (s['pos'][:, 1] <= ext[1, 1]) & \
                (ext[2, 0] <= s['pos'][:, 2]) & (s['pos'][:, 2] <= ext[2, 1])
@@ -350,16 +468,22 @@ class DiscMask(SnapMask):
                             radius. If None, this requirement is ignored.
         zmax (UnitScalar):  An additional requirement on the z-coordinate. If
                             None, this requirement is ignored.
+        tree (cOctree):     An octree of the positions of the snapshot to mask,
+                            see `BallMask`. It is used for the cylinder given by
+                            `rmax` and `zmax` (the jzjc criterion still needs
+                            the derived block for all particles).
     '''
 
-    def __init__(self, jzjc_min=0.85, rmax='50 kpc', zmax='5 kpc'):
+    def __init__(self, jzjc_min=0.85, rmax='50 kpc', zmax='5 kpc', tree=None):
         super(DiscMask, self).__init__()
         self.jzjc_min = jzjc_min
         self.rmax = rmax
         self.zmax = zmax
+        self.tree = tree
 
     def inverted(self):
-        inv = DiscMask(self.jzjc_min, self._rmax, zmax=self._zmax)
+        inv = DiscMask(self.jzjc_min, self._rmax, zmax=self._zmax,
+                       tree=self.tree)
         inv._inverse = not self._inverse
         return inv
 
@@ -395,7 +519,19 @@ class DiscMask(SnapMask):
         return s + ')'
 
     def _get_mask_for(self, s):
-        mask = s['jzjc'] > np.sign(np.mean(s['jzjc'])) * self.jzjc_min
+        jzjc = s['jzjc']
+        jzjc_min = np.sign(np.mean(jzjc)) * self.jzjc_min
+        if _use_tree(self.tree, s) and \
+                (self._rmax is not None or self._zmax is not None):
+            rmax, zmax = [np.inf if x is None else
+                          float(x.in_units_of(s['pos'].units, subs=s))
+                          for x in (self._rmax, self._zmax)]
+            mask = _tree_mask(self.tree, self.tree.find_in_cylinder, s, False,
+                              [0., 0., 0.], [0., 0., 1.], rmax, zmax)
+            mask[mask] = jzjc[mask] > jzjc_min
+            return mask
+
+        mask = jzjc > jzjc_min
         if self._rmax is not None:
             rmax = self._rmax.in_units_of(s['rcyl'].units, subs=s)
             mask &= s['rcyl'] < rmax
@@ -51,6 +51,17 @@ import functools
 import weakref
 
 
+class _Version(object):
+    '''
+    The number of times a block (and all its views) changed in place. Instances
+    compare by identity, such that a reloaded block does not match the old one.
+    '''
+    __slots__ = ('count',)
+
+    def __init__(self):
+        self.count = 0
+
+
 class SimArr(UnitArr):
     '''
     A UnitArr that belongs to a snapshot and can have derived arrays, which are
@@ -69,6 +80,7 @@ class SimArr(UnitArr):
         else:
             new._snap = getattr(data, '_snap', lambda: None)
         new._dependencies = getattr(data, '_dependencies', set())
+        new._version = getattr(data, '_version', None) or _Version()
 
         return new
 
@@ -76,6 +88,7 @@ class SimArr(UnitArr):
         UnitArr.__array_finalize__(self, obj)
         self._snap = getattr(obj, '_snap', lambda: None)
         self._dependencies = getattr(obj, '_dependencies', set())
+        self._version = getattr(obj, '_version', None) or _Version()
 
     def downgrade_to_UnitArr(self):
         '''
@@ -88,6 +101,7 @@ class SimArr(UnitArr):
                 a.__class__ = UnitArr  # to port to Python 3.x ?!
             if hasattr(a, '_snap'):         del a._snap
             if hasattr(a, '_dependencies'): del a._dependencies
+            if hasattr(a, '_version'):      del a._version
             a = a.base
 
     def __array_wrap__(self, array, context=None):
@@ -110,6 +124,17 @@ class SimArr(UnitArr):
         '''A set of the names of the derived blocks that depend on this one.'''
         return self._dependencies
 
+    @property
+    def token(self):
+        '''
+        A token of the current state of this array: it compares equal for the
+        same view of the same block as long as the block did not change in place
+        (as far as it is tracked for invalidating the derived blocks) or got
+        converted into other units.
+        '''
+        return (self._version, self._version.count, str(self.units),
+                self.__array_interface__['data'][0], self.shape, self.strides)
+
     def __repr__(self):
         r = super(SimArr, self).__repr__()
         r = r.replace('UnitArr', 'SimArr').replace('\n ', '\n')
@@ -133,12 +158,14 @@ class SimArr(UnitArr):
             duplicate = UnitArr.__copy__(self).view(SimArr)
         duplicate._snap = self._snap
         duplicate._dependencies = self._dependencies.copy()
+        duplicate._version = _Version()
         return duplicate
 
     def __deepcopy__(self, *a):
         duplicate = UnitArr.__deepcopy__(self).view(SimArr)
         duplicate._snap = self._snap
         duplicate._dependencies = self._dependencies.copy()
+        duplicate._version = _Version()
         return duplicate
 
     def convert_to(self, units, subs=None):
@@ -165,8 +192,9 @@ class SimArr(UnitArr):
         (They get rederived automatically, if needed, anyway.)
 
         There is no need to call this function directly. It gets called once the
-        array changes.
+        array changes (which is also counted for `token`).
         '''
+        self._version.count += 1
         for dep in self._dependencies:
             host = self.snap.get_host_subsnap(dep)
             if dep in host._blocks: